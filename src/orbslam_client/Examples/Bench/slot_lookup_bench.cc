@@ -0,0 +1,214 @@
+/*
+ * Compares the two ways a LightKeyFrame / LightMapPoint can get to its object:
+ *
+ *   slot    the handle keeps the id and looks the slot table up on every dereference, as getKeyFrameById does
+ *   cached  the handle keeps the pointer with the generation of the slot it was read from, a generation per slot
+ *           bumped on every release and set, and looks the slot table up again only when it changed
+ *
+ * The handles dereference the object and read a field of it, as UpdateLocalKeyFrames or SearchLocalPoints do.
+ * Two access patterns: a local map walked over and over (the handles of the covisible keyframes) and the whole
+ * table in random order. The eviction is a writer releasing and publishing again random slots.
+ *
+ * Usage: slot_lookup_bench [objects] [rounds] [evictions per second]
+ */
+
+#include "SlotTable.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace ORB_SLAM2;
+
+namespace {
+
+    // a keyframe is much larger, the field read is what matters
+    struct Object {
+        long unsigned int mnId;
+        double mPayload[15];
+    };
+
+    SlotTable<Object> gSlots;
+
+    // a generation per slot, what a cached handle would need next to the table
+    vector<std::atomic<unsigned int>> *gGenerations;
+
+    // out of line as Cache::getKeyFrameById, the handles call it through the library
+    __attribute__((noinline)) Object *getById(long unsigned int id) {
+        return gSlots.get(id);
+    }
+
+    struct SlotHandle {
+
+        long unsigned int mnId;
+
+        Object *get() const { return getById(mnId); }
+    };
+
+    struct CachedHandle {
+
+        long unsigned int mnId;
+        mutable Object *mpObject;
+        mutable const std::atomic<unsigned int> *mpGeneration;
+        mutable unsigned int mnGeneration;
+
+        Object *get() const {
+
+            if (mpGeneration && mpGeneration->load(std::memory_order_acquire) == mnGeneration)
+                return mpObject;
+
+            return refresh();
+        }
+
+        __attribute__((noinline)) Object *refresh() const {
+
+            mpGeneration = &(*gGenerations)[mnId];
+
+            // the generation first, a release after it makes the next get miss
+            mnGeneration = mpGeneration->load(std::memory_order_acquire);
+            mpObject = getById(mnId);
+
+            return mpObject;
+        }
+    };
+
+    template<class Handle>
+    double walk(const vector<Handle> &handles, const vector<size_t> &order, size_t rounds, long unsigned int &sum) {
+
+        auto start = chrono::steady_clock::now();
+
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t i : order) {
+                Object *p = handles[i].get();
+                if (p)
+                    sum += p->mnId;
+            }
+        }
+
+        auto stop = chrono::steady_clock::now();
+
+        return chrono::duration<double, std::nano>(stop - start).count() / (double) (rounds * order.size());
+    }
+
+    void evict(vector<Object> &objects, double rate, std::atomic<bool> &stop, std::atomic<unsigned long> &count) {
+
+        if (rate <= 0)
+            return;
+
+        mt19937 rng(7);
+        uniform_int_distribution<size_t> pick(1, objects.size() - 1);
+        const chrono::nanoseconds period((long long) (1e9 / rate));
+        auto next = chrono::steady_clock::now();
+
+        while (!stop.load(std::memory_order_relaxed)) {
+
+            Object *p = &objects[pick(rng)];
+            std::atomic<unsigned int> &gen = (*gGenerations)[p->mnId];
+
+            gen.fetch_add(1, std::memory_order_acq_rel);
+            gSlots.release(p->mnId, p, SLOT_RESIDENT);
+            gen.fetch_add(1, std::memory_order_acq_rel);
+            gSlots.set(p->mnId, p, SLOT_RESIDENT);
+
+            count.fetch_add(1, std::memory_order_relaxed);
+
+            next += period;
+            this_thread::sleep_until(next);
+        }
+    }
+
+    template<class Handle>
+    vector<Handle> makeHandles(size_t n) {
+
+        vector<Handle> handles(n);
+
+        for (size_t i = 0; i < n; i++) {
+            handles[i] = Handle();
+            handles[i].mnId = i + 1;
+        }
+
+        return handles;
+    }
+
+}
+
+int main(int argc, char **argv) {
+
+    const size_t nObjects = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+    const size_t nRounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 20;
+    const double dRate = argc > 3 ? atof(argv[3]) : 1000;
+
+    // id 0 is never published, as in the cache
+    vector<Object> objects(nObjects + 1);
+    vector<std::atomic<unsigned int>> generations(nObjects + 1);
+    gGenerations = &generations;
+
+    for (size_t i = 0; i <= nObjects; i++) {
+        objects[i].mnId = i;
+        generations[i].store(0, std::memory_order_relaxed);
+        if (i)
+            gSlots.set(i, &objects[i], SLOT_RESIDENT);
+    }
+
+    vector<SlotHandle> slotHandles = makeHandles<SlotHandle>(nObjects);
+    vector<CachedHandle> cachedHandles = makeHandles<CachedHandle>(nObjects);
+
+    mt19937 rng(11);
+
+    // a local map of a couple of thousand objects, near each other in id
+    const size_t nLocal = std::min<size_t>(2000, nObjects);
+    vector<size_t> local(nLocal);
+    const size_t base = (nObjects - nLocal) / 2;
+    for (size_t i = 0; i < nLocal; i++)
+        local[i] = base + i;
+    shuffle(local.begin(), local.end(), rng);
+
+    vector<size_t> all(nObjects);
+    for (size_t i = 0; i < nObjects; i++)
+        all[i] = i;
+    shuffle(all.begin(), all.end(), rng);
+
+    cout << "objects " << nObjects << ", handle " << sizeof(SlotHandle) << " / " << sizeof(CachedHandle)
+         << " bytes, evictions " << dRate << "/s" << endl;
+
+    long unsigned int sum = 0;
+
+    for (int e = 0; e < 2; e++) {
+
+        const double rate = e ? dRate : 0;
+        std::atomic<bool> stop(false);
+        std::atomic<unsigned long> evicted(0);
+        thread writer(evict, std::ref(objects), rate, std::ref(stop), std::ref(evicted));
+
+        // warm both once so the cached handles start filled
+        walk(slotHandles, all, 1, sum);
+        walk(cachedHandles, all, 1, sum);
+
+        const size_t localRounds = nRounds * std::max<size_t>(1, nObjects / nLocal);
+
+        double slotLocal = walk(slotHandles, local, localRounds, sum);
+        double cachedLocal = walk(cachedHandles, local, localRounds, sum);
+        double slotAll = walk(slotHandles, all, nRounds, sum);
+        double cachedAll = walk(cachedHandles, all, nRounds, sum);
+
+        stop.store(true);
+        writer.join();
+
+        cout << fixed << setprecision(2)
+             << (e ? "with eviction " : "no eviction   ")
+             << " local map: slot " << slotLocal << " ns, cached " << cachedLocal << " ns"
+             << " | whole table: slot " << slotAll << " ns, cached " << cachedAll << " ns"
+             << " (" << evicted.load() << " evicted)" << endl;
+    }
+
+    // keep the reads from being optimized away
+    return sum == 0 ? 1 : 0;
+
+}
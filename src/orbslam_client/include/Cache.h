@@ -14,8 +14,17 @@
 #include "ORBVocabulary.h"
 #include "KeyFrameDatabase.h"
 #include "Map.h"
+#include "MapMemory.h"
+#include "SlotTable.h"
 #include "SerializeObject.h"
 
+#include <deque>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
 
 /*
  * Cache class is the data layer which organize all the persistent data, such as keyframe, mappoint, all kinds of map.
@@ -34,6 +43,16 @@ namespace ORB_SLAM2 {
 
     class TopoMap;
 
+    class TileStore;
+
+    class ServiceConnections;
+
+    class DataDriver;
+
+    class MapJournal;
+
+    struct JournalRecord;
+
     typedef long unsigned int TopoId;
 
     class LoopKeyPoint{
@@ -55,6 +74,41 @@ namespace ORB_SLAM2 {
     enum KF_status { KF_IN_CACHE, KF_IN_SERVER, KF_UNEXIST };
     enum TopoId_status { UN_USE , IN_USE, IN_SERVER };
     enum MP_status { MP_IN_CACHE, MP_IN_SERVER, MP_UNEXIST };
+    // payload format of the tiles sent to the server, loading detects the format by itself
+    enum TileFormat { TILE_FORMAT_ARCHIVE = 0, TILE_FORMAT_BINARY = 1 };
+
+    // a tile detached from the local map and waiting for (or in) its upload on an I/O worker.
+    // the objects stay alive and reachable by id until the upload is done, so a tile that is
+    // needed again before that is put back into the map instead of being fetched from the server
+    struct EvictedTile {
+        TopoId tId;
+        std::vector<KeyFrame *> vKFs;
+        // all the mappoints of the tile are uploaded, only the ones not shared with a cached tile are detached
+        std::set<MapPoint *> sMPs;
+        std::vector<MapPoint *> vDetachedMPs;
+        bool bUploading;
+        bool bRestored;
+        // its sMPs are counted in the in-flight references of the cache
+        bool bReferenced;
+    };
+
+    // a tile fetched ahead of time from the predicted camera motion, kept out of the map until it is needed
+    struct PrefetchedTile {
+        std::set<KeyFrame *> sKFs;
+        std::set<MapPoint *> sMPs;
+        double stamp;
+    };
+
+    struct PrefetchStats {
+        // tiles fetched ahead of time
+        long unsigned int nIssued;
+        // demand loads served by a prefetched tile
+        long unsigned int nHits;
+        // demand loads which still had to go to the server
+        long unsigned int nMisses;
+        // prefetched tiles dropped without being used
+        long unsigned int nWasted;
+    };
 
     class Cache {
 
@@ -147,6 +201,9 @@ namespace ORB_SLAM2 {
 
         void getAllKeyFramePose();
 
+        // the pose read by getAllKeyFramePose, empty when the keyframe has none
+        cv::Mat getStoredKeyFramePose(long unsigned int pId);
+
         void getAllMapPointPose();
 
         void updateAllPoseToServer();
@@ -175,8 +232,15 @@ namespace ORB_SLAM2 {
 
         void setTopoIdSetUnUse( std::set<TopoId> tps );
 
+        // bring the stored tiles within radius of center into the cache with one spatial query, e.g. to
+        // relocalize after a kidnapping. falls back to the tile window around center when the store has no
+        // spatial index. returns the number of tiles brought in
+        int LoadNeighbourhood( const cv::Mat &center, float radius );
+
+        // binary snapshot of the TopoMap index and of every tile, see MapSnapshot
         void SaveMap(const string &filename);
 
+        // reads the index, the tiles stay in the snapshot until the camera gets close to them
         void LoadMap(const string &filename);
 
         void RequestFinish();
@@ -199,6 +263,24 @@ namespace ORB_SLAM2 {
 
         void outputKeyframePose();
 
+        // block until every queued eviction has reached the server
+        void waitForEvictions();
+
+        // camera pose and motion model of the tracker, used to predict the tiles needed next
+        void updateMotion( const cv::Mat &Tcw, const cv::Mat &Velocity, const double &timestamp );
+
+        // of the last pose tracked, empty before the first one
+        cv::Mat getCameraCenter();
+
+        PrefetchStats getPrefetchStats();
+
+        // the byte accounts of the map, current to the last measure
+        MemoryStats getMemoryStats();
+
+        // put back the map of a previous run: the TopoMap index of the stored tiles, and the journal records
+        // after its last checkpoint applied to the tile store. called before the threads are started
+        bool RecoverMap();
+
     private:
         /*  cache organize function   */
 
@@ -206,22 +288,91 @@ namespace ORB_SLAM2 {
 
         void transTopoMapKeyFrames();
 
+        // the tiles to keep within mnMemoryBudget: the guaranteed ones, then the others by value (close to the
+        // camera, used lately, covisible with the current keyframe) while they fit
+        std::set<TopoId> selectTopoMapsInBudget( const std::set<TopoId> &tpWindow );
+
+        // resident bytes of the objects of a tile in cache, from their accounts in MapMemory
+        size_t estimateTileBytes( TopoId tId );
+
+        // measure the objects in the map and the side structures again, and log the accounts
+        void measureMemory();
+
+        // split the resident tiles over mnTileSplitKeyFrames or mnTileSplitSize, merge back the children
+        // holding less than a quarter of that
+        void adaptTileSizes();
+
+        // move the objects of the tiles from to the tiles to, which take their place in cache
+        void retileTopoMaps( const std::set<TopoId> &from, const std::set<TopoId> &to );
+
         bool checkInCache( LightKeyFrame tLKF );
 
 
         bool CheckFinish();
         void SetFinish();
 
-        //transfer the keyframes to server and
-        //get the keyframe from server using ros service
-        void transKeyFrameToServer( std::set<long unsigned int>  pkfs );
+        //detach the tiles from the map and queue their upload, the serialization and the ros
+        //service call are done by the I/O workers
+        void evictTopoMaps( const std::set<TopoId> &tIds );
 
-        void transKeyFrameFromServer( long unsigned int tid, std::set<long unsigned int> pkfs );
+        std::shared_ptr<EvictedTile> detachTopoMap( TopoId tId );
+
+        bool restoreInFlightTopoMap( TopoId tId );
+
+        // one batch request for all the tiles
+        void uploadEvictedTiles( const std::vector<std::shared_ptr<EvictedTile> > &tiles );
+
+        // with mMutexEvictQueue held, once the tile leaves mInFlightTiles
+        void releaseInFlightMapPoints( EvictedTile &tile );
+
+        // write the dirty tiles to the store, false when the store failed
+        bool writeBackTiles( const std::vector<std::shared_ptr<EvictedTile> > &tiles );
+
+        // whether the copy in the tile store is out of date, a clean tile is dropped without being written
+        bool isTileDirty( const EvictedTile &tile );
+
+        uint8_t tileCodecFor( const EvictedTile &tile, const cv::Mat &Ow );
+
+        void ioWorkerRun();
+
+        // motion predictive prefetching
+        std::vector<TopoId> predictTopoIds();
+
+        void schedulePrefetch();
+
+        bool takePrefetchedTile( TopoId tId );
+
+        void dropPrefetchedTiles();
+
+        void prefetchRun();
+
+        // write-ahead journal: the objects changed since the last call go to the journal, a checkpoint
+        // writes the tiles in cache to the store and drops the journal segments it covers
+        void journalChanges();
 
-        void transMapPointToServer( TopoId tId, std::set<MapPoint*> vMP);
+        bool checkpointJournal();
+
+        // every tile in cache with its keyframes and mappoints, nothing is detached
+        void collectCachedTiles(std::vector<std::shared_ptr<EvictedTile> > &tiles);
+
+        // the tiles touched by the journal records during the recovery, read from the store when first touched
+        struct RecoveredTile {
+            std::map<long unsigned int, KeyFrame *> mKFs;
+            std::map<long unsigned int, MapPoint *> mMPs;
+        };
+
+        RecoveredTile &loadRecoveredTile( TopoId tId, std::map<TopoId, RecoveredTile> &tiles );
+
+        bool replayJournalRecord( const JournalRecord &record, std::map<TopoId, RecoveredTile> &tiles );
+
+        //get the keyframe from server using ros service
+        void transKeyFrameFromServer( long unsigned int tid, std::set<long unsigned int> pkfs );
 
         void transMapPointFromServer( TopoId tId );
 
+        // the keyframes and mappoints of several tiles in one request
+        void transTopoMapsFromServer( const std::vector<TopoId> &tIds );
+
     public:
 
         TopoMap * mTopoMap;
@@ -232,6 +383,84 @@ namespace ORB_SLAM2 {
 
         float mbf;
 
+        TileFormat mTileFormat;
+
+        // where evicted tiles are stored, the orbslam_server by default
+        TileStore *mpTileStore;
+
+        // persistent service clients, shared by the tile store and the data driver
+        ServiceConnections *mpConnections;
+
+        // shared by the cache thread, the I/O workers and the prefetcher
+        DataDriver *mpDataDriver;
+
+        // number of I/O worker threads and the bound of the eviction queue
+        int mnIOWorkers;
+
+        int mnMaxEvictQueue;
+
+        // tiles uploaded together by one I/O worker
+        int mnEvictBatch;
+
+        // seconds of predicted motion covered by the prefetcher (0 disables it) and the number of tiles staged at most
+        float mfPrefetchHorizon;
+
+        int mnMaxPrefetchTiles;
+
+        // TileCompression of the binary tiles: evicted tiles closer than mfHotTileRange to the camera are likely
+        // swapped back in soon and use the hot codec, the others the cold one
+        uint8_t mHotTileCodec;
+
+        uint8_t mColdTileCodec;
+
+        float mfHotTileRange;
+
+        // a stored pose is written back after a correction when it moved more than this (meters / radians),
+        // the pose blocks go to the store mnPoseBatch tiles per request
+        float mfPoseDeltaTranslation;
+
+        float mfPoseDeltaRotation;
+
+        int mnPoseBatch;
+
+        // write-ahead journal of the map, nullptr when it is disabled. the changes are journaled every
+        // mfJournalInterval seconds and a checkpoint is taken once a segment reaches mnJournalCheckpointSize MB
+        MapJournal *mpJournal;
+
+        float mfJournalInterval;
+
+        int mnJournalCheckpointSize;
+
+        // byte budget of the tiles in cache (MB), 0 keeps every tile of the window of getTopoMapsNeedInCache
+        // and nothing else. the tiles within mnGuaranteedTiles of the current tile are never evicted
+        int mnMemoryBudget;
+
+        int mnGuaranteedTiles;
+
+        // a resident tile with more keyframes or more MB than this is split in 8, down to the Lmin
+        // tiles, 0 disables the test
+        int mnTileSplitKeyFrames;
+
+        int mnTileSplitSize;
+
+        // the time series of the byte accounts, one line every mfMemoryLogInterval seconds, 0 disables the
+        // measures and the log
+        std::string mMemoryLogPath;
+
+        float mfMemoryLogInterval;
+
+        // bytes, the payloads from this size on are mapped apart by malloc and given back once freed, the
+        // keyframes and the mappoints themselves are in the TileArena. 0 leaves malloc as it is
+        int mnMmapThreshold;
+
+        // free the keyframes and the mappoints of the written back tiles, see EpochManager. off by default: the
+        // tracking and the local mapping still keep raw pointers (mpReferenceKF, mpLastKeyFrame,
+        // mlpRecentAddedMapPoints) across their sections, only safe with the tiles around the camera guaranteed
+        bool mbReclaimEvicted;
+
+        // the tiles within this radius of the last pose tracked are brought in once the tracking is lost, 0 disables it
+        float mfRelocRadius;
+
     private:
 
         // ORB vocabulary used for place recognition and feature matching.
@@ -255,6 +484,12 @@ namespace ORB_SLAM2 {
         std::mutex mMutexMPToMPmap;
         std::map<long unsigned int, MapPoint *> lMPToMPmap;
 
+        // the lookups by id of getKeyFrameById / getMapPointById, the maps above are kept for the walks over
+        // the objects in cache. every change of tmpKFMap, lKFToKFmap, lMPToMPmap and of the in-flight objects
+        // is published here
+        SlotTable<KeyFrame> mKFSlots;
+        SlotTable<MapPoint> mMPSlots;
+
         //cache orgnize data
 
         bool mbFinished;
@@ -280,6 +515,67 @@ namespace ORB_SLAM2 {
 
         std::mutex mCorrectLoopMutex;
 
+        // write-behind eviction
+        std::vector<std::thread *> mvptIOWorkers;
+
+        std::mutex mMutexEvictQueue;
+        std::condition_variable mCondEvictQueue;
+        std::condition_variable mCondEvictDone;
+        std::deque<TopoId> mEvictQueue;
+        bool mbStopIOWorkers;
+
+        // guarded by mMutexEvictQueue as well, their objects are SLOT_IN_FLIGHT in the slot tables
+        std::map<TopoId, std::shared_ptr<EvictedTile> > mInFlightTiles;
+
+        // the in-flight tiles listing a mappoint in their sMPs, it is not retired before they are all done
+        std::map<MapPoint *, int> mInFlightMPRefs;
+        // detached by a tile written back, retired once no in-flight tile lists them
+        std::set<MapPoint *> mRetiringMPs;
+
+        // prefetcher
+        float mfTileSize;
+
+        std::mutex mMutexMotion;
+        cv::Mat mCameraCenter;
+        cv::Mat mCameraVelocity;
+        double mMotionStamp;
+        double mScheduledStamp;
+        std::deque< pair<double, cv::Mat> > mRecentKFCenters;
+
+        std::thread * mptPrefetcher;
+        std::mutex mMutexPrefetch;
+        std::condition_variable mCondPrefetch;
+        std::deque<TopoId> mPrefetchQueue;
+        TopoId mPrefetching;
+        unsigned int mnPrefetchGeneration;
+        bool mbStopPrefetcher;
+        std::map<TopoId, PrefetchedTile> mPrefetchedTiles;
+        PrefetchStats mPrefetchStats;
+
+        // demand loads in progress, the prefetcher backs off meanwhile
+        std::atomic<bool> mbDemandIO;
+
+        // evicted tiles dropped because the stored copy was up to date, and the ones written back
+        std::atomic<long unsigned int> mnCleanTilesSkipped;
+        std::atomic<long unsigned int> mnDirtyTilesWritten;
+
+        // version of each object when it was last journaled, cache thread only
+        std::map<long unsigned int, unsigned int> mJournaledKFs;
+        std::map<long unsigned int, unsigned int> mJournaledMPs;
+        std::chrono::steady_clock::time_point mJournalTime;
+
+        // budget driven residency, cache thread only. the size of a tile is kept after it is evicted, to
+        // tell whether it fits when it is needed again
+        std::map<TopoId, size_t> mTileBytes;
+        std::map<TopoId, std::chrono::steady_clock::time_point> mTileLastUsed;
+        TopoId mWindowTopoId;
+        std::chrono::steady_clock::time_point mWindowTime;
+        std::atomic<long unsigned int> mnCurrentKFId;
+        std::chrono::steady_clock::time_point mTileAdaptTime;
+        bool mbMemoryLogOpen;
+        std::chrono::steady_clock::time_point mMemoryLogTime;
+        std::chrono::steady_clock::time_point mMemoryLogStart;
+
 
     };
 
@@ -12,7 +12,10 @@
 #include "LightKeyFrame.h"
 #include "LightMapPoint.h"
 #include "SerializeObject.h"
+#include "TileCodec.h"
 #include <cstdlib>
+#include <map>
+#include <mutex>
 #include "ros/ros.h"
 #include "boost/serialization/vector.hpp"
 #include "boost/serialization/map.hpp"
@@ -58,6 +61,21 @@ namespace ORB_SLAM2{
 
         std::set<KeyFrame *> TransTopoKeyFramesFromServer( TopoId tId ) ;
 
+        // several tiles in one round trip, pKFs[i] and pMPs[i] belong to tIds[i] and are compressed with codecs[i]
+        bool TransTopoTilesToServer( const std::vector<TopoId> &tIds, const std::vector<std::vector<KeyFrame *> > &pKFs,
+                                     const std::vector<std::set<MapPoint *> > &pMPs, const std::vector<uint8_t> &codecs );
+
+        void TransTopoTilesFromServer( const std::vector<TopoId> &tIds, std::set<KeyFrame *> &kfs, std::set<MapPoint *> &mps );
+
+        // the same with the objects of each tile apart, kfs[i] and mps[i] come from tIds[i]
+        bool TransTopoTilesFromServer( const std::vector<TopoId> &tIds, std::vector<std::set<KeyFrame *> > &kfs,
+                                       std::vector<std::set<MapPoint *> > &mps );
+
+        // the tiles found by a spatial query, nearest first, with their objects apart. tiles of query.exclude
+        // come back with empty sets. false when the store has no spatial index
+        bool QueryTopoTilesFromServer( const TileQuery &query, std::vector<TopoId> &tIds, std::vector<std::set<KeyFrame *> > &kfs,
+                                       std::vector<std::set<MapPoint *> > &mps );
+
         void TransKeyFramesToServerOneByOne( std::vector<KeyFrame *> pKFs);
 
         // trans the KeyFrames from ORBSlam server
@@ -82,17 +100,63 @@ namespace ORB_SLAM2{
 
         void updateAllMapPointPose();
 
+        // write back the pose blocks of the stored tiles holding a pose moved beyond the Cache thresholds
+        void updateChangedPoses();
+
+        // the tiles compressed and expanded by each codec, their bytes and time
+        void reportCodecs();
+
     private:
 
-        Cache * pCacher;
+        // one tile of keyframes / mappoints to and from its DATA and POSE blocks
+        std::vector<long unsigned int> encodeTopoKeyFrames( TopoId tId, const std::vector<KeyFrame *> &pKFs, std::string &data, std::string &pose, uint8_t codec );
+
+        // the decoded objects are marked as stored with tile tId
+        std::set<KeyFrame *> decodeTopoKeyFrames( TopoId tId, const std::string &data, const std::string &pose );
+
+        std::vector<long unsigned int> encodeTopoMapPoints( TopoId tId, const std::set<MapPoint *> &pMPs, std::string &data, std::string &pose, uint8_t codec );
+
+        std::set<MapPoint *> decodeTopoMapPoints( TopoId tId, const std::string &data, const std::string &pose );
+
+        // bounding box of the keyframe centres and mappoint positions, left empty for an empty tile
+        void tileExtent( const std::vector<KeyFrame *> &pKFs, const std::set<MapPoint *> &pMPs, std::vector<double> &extent );
 
-        ofstream f1;
-        ofstream f2;
-        ofstream f3;
-        ofstream f4;
+        // per tile pose blocks, written in the configured tile format and read in either format
+        void encodeKeyFramePoses( TopoId tId, const KeyFramePoseMap &poses, std::string &out );
+
+        bool decodeKeyFramePoses( const std::string &in, KeyFramePoseMap &poses );
+
+        void encodeMapPointPoses( TopoId tId, const MapPointPoseMap &poses, std::string &out );
+
+        bool decodeMapPointPoses( const std::string &in, MapPointPoseMap &poses );
+
+        bool keyFramePoseChanged( const cv::Mat &Tcw, const cv::Mat &storedTcw );
+
+        bool mapPointPoseChanged( const cv::Mat &Pos, const cv::Mat &storedPos );
+
+        // compress / decompress one binary tile, counted in the codec stats
+        void compressTile( std::string &tile, uint8_t codec );
+
+        // returns in itself when it is not a compressed tile, raw otherwise
+        const std::string &expandTile( const std::string &in, std::string &raw );
+
+        Cache * pCacher;
 
         std::mutex mMutexGetKeyFrame;
         std::mutex mMutexPushKeyFrame;
+
+        struct CodecStats {
+            CodecStats() : nTiles(0), rawBytes(0), packedBytes(0), seconds(0) {}
+            long unsigned int nTiles;
+            size_t rawBytes;
+            size_t packedBytes;
+            double seconds;
+        };
+
+        // by codec, a tile which did not shrink is counted with TILE_CODEC_NONE
+        std::mutex mMutexCodecStats;
+        std::map<uint8_t, CodecStats> mCompressStats;
+        std::map<uint8_t, CodecStats> mExpandStats;
     };
 
 } //namespace ORB_SLAM
@@ -0,0 +1,67 @@
+#ifndef ORB_SLAM2_EPOCHMANAGER_H
+#define ORB_SLAM2_EPOCHMANAGER_H
+
+#include <cstddef>
+
+/*
+ * EpochManager frees the keyframes and the mappoints of the evicted tiles once no thread can still use them.
+ * The threads using the objects got from the cache, by pointer or through a LightKeyFrame / LightMapPoint,
+ * do it inside an EpochGuard, one iteration of their loop. An object is retired once it can not be reached
+ * any more from the cache and it is deleted two epochs later: the epoch only advances when every thread in a
+ * section entered it in the current epoch, so the sections which could have got the object are all over.
+ *
+ * A raw pointer kept by a thread beyond its section is not covered, such a pointer must be to an object of a
+ * tile the cache keeps, or be held as a LightKeyFrame / LightMapPoint.
+ */
+
+namespace ORB_SLAM2 {
+
+    class KeyFrame;
+    class MapPoint;
+
+    struct EpochStats {
+        long unsigned int epoch;
+        // retired and not yet freed
+        long unsigned int nRetired;
+        long unsigned int nFreed;
+    };
+
+    class EpochManager {
+
+    public:
+
+        // sections nest, only the outermost one counts
+        static void enter();
+
+        static void exit();
+
+        static void retire(KeyFrame *pKF);
+
+        static void retire(MapPoint *pMP);
+
+        // advance the epoch if it can and free what is old enough, outside of a section. the number freed
+        static size_t collect();
+
+        static EpochStats stats();
+
+    };
+
+    class EpochGuard {
+
+    public:
+
+        EpochGuard() { EpochManager::enter(); }
+
+        ~EpochGuard() { EpochManager::exit(); }
+
+    private:
+
+        EpochGuard(const EpochGuard &);
+
+        EpochGuard &operator=(const EpochGuard &);
+
+    };
+
+} //namespace ORB_SLAM
+
+#endif //ORB_SLAM2_EPOCHMANAGER_H
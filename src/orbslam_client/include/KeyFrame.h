@@ -36,6 +36,7 @@
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/serialization/set.hpp>
 #include <mutex>
+#include <atomic>
 #include <malloc.h>
 
 namespace ORB_SLAM2 {
@@ -54,10 +55,13 @@ namespace ORB_SLAM2 {
 
     class LightMapPoint;
 
+    class TileCodec;
+
     class KeyFrame {
 
     private:
         friend class boost::serialization::access;
+        friend class TileCodec;
         //serialize LightKeyFrame class
         template<class Archive>
         void serialize(Archive & ar, const unsigned int version){
@@ -90,7 +94,7 @@ namespace ORB_SLAM2 {
         };
 
     public:
-        KeyFrame() {}
+        KeyFrame() : mnVersion(1), mnStoredVersion(0) {}
 
         KeyFrame(Frame &F, Cache *pCacher);
 
@@ -131,6 +135,27 @@ namespace ORB_SLAM2 {
 
         void setCache(Cache * pCache);
 
+        // change tracking for the write-back of evicted tiles, every change to a serialized member bumps the version
+        void SetDirty();
+
+        unsigned int GetVersion();
+
+        // whether the keyframe changed since the copy in the tile store was written
+        bool IsDirty();
+
+        void SetStored(unsigned int nVersion);
+
+        // register a keyframe read back by the map recovery with the resident TopoMap index
+        void RestoreTopoMap();
+
+        // heap bytes of the keyframe and of what it owns, see MapMemory
+        size_t MemoryBytes();
+
+        // in the arena of its tile, see TileArena
+        static void *operator new(size_t size);
+
+        static void operator delete(void *p);
+
         // Bag of Words Representation
         void ComputeBoW();
 
@@ -166,6 +191,9 @@ namespace ORB_SLAM2 {
 
         KeyFrame *GetParent();
 
+        // also when the parent is out of the cache, 0 for none
+        long unsigned int GetParentId();
+
         bool hasChild(KeyFrame *pKF);
 
         // Loop Edges
@@ -338,6 +366,9 @@ namespace ORB_SLAM2 {
         std::mutex mMutexPose;
         std::mutex mMutexConnections;
         std::mutex mMutexFeatures;
+
+        std::atomic<unsigned int> mnVersion;
+        std::atomic<unsigned int> mnStoredVersion;
     };
 
 } //namespace ORB_SLAM
@@ -46,6 +46,9 @@ namespace ORB_SLAM2 {
 
         void add(KeyFrame *pKF);
 
+        // a keyframe which is not in memory, from the BoW vector kept in the TopoMap
+        void add(long unsigned int nId, const DBoW2::BowVector &vBow, Cache *pCache);
+
         void erase(KeyFrame *pKF);
 
         void clear();
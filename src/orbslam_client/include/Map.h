@@ -26,6 +26,7 @@
 #include <set>
 #include "LightMapPoint.h"
 #include "SerializeObject.h"
+#include "MapMemory.h"
 #include <mutex>
 
 
@@ -55,6 +56,7 @@ namespace ORB_SLAM2 {
     public:
         Map();
 
+        // measure again the keyframes and mappoints in the map, the caller holds mMutexMapUpdate
         void anlyzMapsize();
 
         void AddKeyFrame(KeyFrame *pKF);
@@ -93,6 +95,9 @@ namespace ORB_SLAM2 {
         // This avoid that two points are created simultaneously in separate threads (id conflict)
         std::mutex mMutexPointCreation;
 
+        // byte accounting of the objects in the map
+        MapMemory mMemory;
+
     protected:
         std::set<MapPoint *> mspMapPoints;
         std::set<KeyFrame *> mspKeyFrames;
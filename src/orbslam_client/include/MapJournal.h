@@ -0,0 +1,128 @@
+#ifndef ORB_SLAM2_MAPJOURNAL_H
+#define ORB_SLAM2_MAPJOURNAL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "TileCodec.h"
+
+/*
+ * MapJournal is the client side write-ahead log of the map. Each record is one TileCodec payload: the
+ * keyframes or mappoints of a tile changed since they were last journaled, or the pose blocks written
+ * back after a loop correction.
+ *
+ *   uint32 magic ("M2WL") | uint32 kind | uint64 seq | uint32 size | uint32 check | payload
+ *
+ * The records are appended by a writer thread, every batch is one write and one fdatasync, so the
+ * caller only pays for the encoding. The log is split into segments (path/journal.N). A checkpoint
+ * starts a new segment, writes the tiles in cache to the tile store and then drops the older segments,
+ * path/checkpoint names the first segment which is not covered by the tile store.
+ */
+
+namespace ORB_SLAM2 {
+
+    struct JournalRecord {
+        uint32_t kind;
+        uint64_t seq;
+        std::string payload;
+    };
+
+    class MapJournal {
+
+    public:
+
+        MapJournal( const std::string &path );
+
+        ~MapJournal();
+
+        // creates the directory and a new segment, the segments left by a previous run are kept for replay
+        bool open();
+
+        bool isOpen() const { return mFd >= 0; }
+
+        // queue one record, the payload is moved out
+        uint64_t append( TileKind kind, std::string &payload );
+
+        // block until every record appended so far is on disk
+        bool flush();
+
+        // close the current segment and start a new one, returns the new segment
+        uint32_t rotate();
+
+        // the tile store holds everything journaled before segment, the older segments are removed
+        bool checkpoint( uint32_t segment );
+
+        // the records left by a previous run after its last checkpoint, in order. a torn record at the end of a
+        // segment ends that segment only. false when a record in the middle of a segment is damaged, the replay
+        // stops there
+        bool replay( std::vector<JournalRecord> &records );
+
+        // bytes appended to the current segment
+        uint64_t segmentBytes();
+
+        void report();
+
+        void close();
+
+    private:
+
+        struct RecordHeader {
+            uint32_t magic;
+            uint32_t kind;
+            uint64_t seq;
+            uint32_t size;
+            uint32_t check;
+        };
+
+        void writerRun();
+
+        bool openSegment( uint32_t segment );
+
+        std::string segmentPath( uint32_t segment ) const;
+
+        static uint32_t checkOf( const RecordHeader &header, const char *payload );
+
+        // the bad record at offset is the last one of its segment: its payload runs past the end or ends there,
+        // or nothing but the zeros of a file extended by the crash follows
+        static bool tornTail( const std::string &data, size_t offset, const RecordHeader &header, bool bFits );
+
+        std::string mPath;
+
+        int mFd;
+
+        uint32_t mnSegment;
+
+        // segments of the previous run, replayed by the recovery
+        std::vector<uint32_t> mvOldSegments;
+
+        std::thread *mptWriter;
+
+        std::mutex mMutexJournal;
+        std::condition_variable mCondPending;
+        std::condition_variable mCondDurable;
+
+        std::vector<std::string> mPending;
+        bool mbWriting;
+        bool mbStop;
+        bool mbFailed;
+
+        uint64_t mnNextSeq;
+        uint64_t mnDurableSeq;
+        uint64_t mnSegmentBytes;
+
+        // statistics
+        long unsigned int mnRecords;
+        long unsigned int mnFlushes;
+        long unsigned int mnCheckpoints;
+        uint64_t mnBytes;
+        double mFlushTime;
+
+    };
+
+} //namespace ORB_SLAM
+
+#endif //ORB_SLAM2_MAPJOURNAL_H
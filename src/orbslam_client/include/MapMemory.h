@@ -0,0 +1,146 @@
+#ifndef ORB_SLAM2_MAPMEMORY_H
+#define ORB_SLAM2_MAPMEMORY_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+/*
+ * MapMemory accounts the heap bytes of the resident keyframes and mappoints, by object and by tile, and the
+ * bytes of the side structures of the TopoMap and of the cache indexes. An object is measured when it enters
+ * the map and again by Map::anlyzMapsize, its account is dropped when it leaves, the totals only move by the
+ * difference so they are current without walking the map.
+ *
+ * The sizes are those glibc malloc hands out: each allocation with its header rounded up to 16 bytes, each
+ * tree node with its links. A mappoint is charged to the first tile listing it, so the tiles add up to the
+ * total.
+ */
+
+namespace ORB_SLAM2 {
+
+    typedef long unsigned int TopoId;
+
+    // bytes taken from the heap by one allocation of n bytes
+    inline size_t mallocBytes( size_t n ) {
+        return n == 0 ? 0 : std::max<size_t>( 32, ( n + 8 + 15 ) & ~( size_t ) 15 );
+    }
+
+    // color, parent, left and right of a red-black tree node
+    static const size_t TREE_NODE_BYTES = 32;
+
+    template<class T, class A>
+    size_t heapBytes( const std::vector<T, A> &v ) {
+        return mallocBytes( v.capacity() * sizeof( T ) );
+    }
+
+    template<class K, class V, class C, class A>
+    size_t heapBytes( const std::map<K, V, C, A> &m ) {
+        return m.size() * mallocBytes( TREE_NODE_BYTES + sizeof( std::pair<const K, V> ) );
+    }
+
+    template<class K, class C, class A>
+    size_t heapBytes( const std::set<K, C, A> &s ) {
+        return s.size() * mallocBytes( TREE_NODE_BYTES + sizeof( K ) );
+    }
+
+    // the data of a matrix owning it, with the reference count and the alignment of cv::fastMalloc
+    inline size_t heapBytes( const cv::Mat &m ) {
+        if( m.empty() || !m.refcount )
+            return 0;
+        return mallocBytes( cv::alignSize( m.total() * m.elemSize(), sizeof( int ) ) + sizeof( int ) + sizeof( void * ) + 16 );
+    }
+
+    struct MemoryStats {
+        long unsigned int nKeyFrames;
+        long unsigned int nMapPoints;
+        size_t keyFrameBytes;
+        size_t mapPointBytes;
+        long unsigned int nTiles;
+        size_t largestTileBytes;
+        // TopoMap and cache structures by name
+        std::map<std::string, size_t> structures;
+        // of the whole process
+        size_t residentBytes;
+    };
+
+    class MapMemory {
+
+    public:
+
+        MapMemory();
+
+        // an object entered the map, or was measured again
+        void setKeyFrame( long unsigned int id, TopoId tId, size_t bytes );
+
+        void setMapPoint( long unsigned int id, TopoId tId, size_t bytes );
+
+        // measured again, ignored when the object left the map meanwhile
+        void updateKeyFrame( long unsigned int id, TopoId tId, size_t bytes );
+
+        void updateMapPoint( long unsigned int id, TopoId tId, size_t bytes );
+
+        void eraseKeyFrame( long unsigned int id );
+
+        void eraseMapPoint( long unsigned int id );
+
+        // 0 when the object is not in the map
+        size_t keyFrameBytes( long unsigned int id );
+
+        size_t mapPointBytes( long unsigned int id );
+
+        size_t tileBytes( TopoId tId );
+
+        void getTileBytes( std::map<TopoId, size_t> &tiles );
+
+        void setStructure( const std::string &name, size_t bytes );
+
+        MemoryStats stats();
+
+        void clear();
+
+        // the time series, one line per call
+        bool openLog( const std::string &path );
+
+        void log( double t );
+
+        static size_t processResidentBytes();
+
+    private:
+
+        struct Account {
+            TopoId tId;
+            size_t bytes;
+        };
+
+        // mMutexMemory is held
+        void set( std::map<long unsigned int, Account> &accounts, size_t &total, long unsigned int id, TopoId tId,
+                  size_t bytes, bool bInsert );
+
+        void erase( std::map<long unsigned int, Account> &accounts, size_t &total, long unsigned int id );
+
+        std::mutex mMutexMemory;
+
+        std::map<long unsigned int, Account> mKeyFrames;
+        std::map<long unsigned int, Account> mMapPoints;
+
+        size_t mnKeyFrameBytes;
+        size_t mnMapPointBytes;
+
+        std::map<TopoId, size_t> mTiles;
+
+        std::map<std::string, size_t> mStructures;
+
+        std::ofstream mLog;
+        bool mbLogHeader;
+
+    };
+
+} //namespace ORB_SLAM
+
+#endif //ORB_SLAM2_MAPMEMORY_H
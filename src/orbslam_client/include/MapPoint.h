@@ -32,6 +32,7 @@
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/serialization/set.hpp>
 #include <mutex>
+#include <atomic>
 #include <malloc.h>
 
 
@@ -49,10 +50,13 @@ namespace ORB_SLAM2 {
 
     class LoopKeyPoint;
 
+    class TileCodec;
+
     typedef long unsigned int TopoId;
 
     class MapPoint {
         friend class boost::serialization::access;
+        friend class TileCodec;
 
         //serialize LightKeyFrame class
         template<class Archive>
@@ -80,7 +84,7 @@ namespace ORB_SLAM2 {
         }
 
     public:
-        MapPoint() {}
+        MapPoint() : mnVersion(1) {}
 
         MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Cache *pCacher);
 
@@ -158,6 +162,28 @@ namespace ORB_SLAM2 {
 
         void setCache( Cache * pCache );
 
+        // change tracking for the write-back of evicted tiles, every change to a serialized member bumps the version.
+        // the visible / found counters are left out, they change every frame
+        void SetDirty();
+
+        unsigned int GetVersion();
+
+        // a mappoint can be stored with several tiles, each copy is tracked on its own
+        bool IsDirty( TopoId tId );
+
+        void SetStored( TopoId tId, unsigned int nVersion );
+
+        // register a mappoint read back by the map recovery as stored with tile tId
+        void RestoreTopoMap( TopoId tId );
+
+        // heap bytes of the mappoint and of what it owns, see MapMemory
+        size_t MemoryBytes();
+
+        // in the arena of its tile, see TileArena
+        static void *operator new(size_t size);
+
+        static void operator delete(void *p);
+
     public:
         long unsigned int mnId;
         static long unsigned int nNextId;
@@ -230,6 +256,10 @@ namespace ORB_SLAM2 {
         std::mutex mMutexFound;
         std::mutex mMutexObservations;
 
+        std::atomic<unsigned int> mnVersion;
+        std::map<TopoId, unsigned int> mStoredVersions;
+        std::mutex mMutexVersion;
+
     };
 
 } //namespace ORB_SLAM
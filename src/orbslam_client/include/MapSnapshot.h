@@ -0,0 +1,124 @@
+#ifndef ORB_SLAM2_MAPSNAPSHOT_H
+#define ORB_SLAM2_MAPSNAPSHOT_H
+
+#include <string>
+#include <map>
+#include <set>
+#include <stdint.h>
+
+#include "TileStore.h"
+
+/*
+ * MapSnapshot is the file written by SaveMap. The header is followed by the tile sections, copied from
+ * the tile store as they are stored (DATA then POSE block), the TopoMap index and the tile directory.
+ *
+ *   uint32 magic ("M2SN") | uint16 version | uint8 format | uint8 pad | uint32 tiles | uint32 check |
+ *   uint64 kfNextId | uint64 mpNextId | uint64 topoId | uint64 indexOffset | uint64 indexSize | uint64 directoryOffset
+ *
+ * The file is written as path.tmp and renamed when it is complete. On open only the header, the index
+ * and the directory are read, the tile sections stay mapped and are faulted in when a tile is read.
+ */
+
+namespace ORB_SLAM2 {
+
+    struct SnapshotInfo {
+        uint8_t format;
+        long unsigned int nKFNextId;
+        long unsigned int nMPNextId;
+        // the tile of the last keyframe, the load starts around it
+        TopoId currentTopoId;
+    };
+
+    class MapSnapshot {
+
+    public:
+
+        MapSnapshot();
+
+        ~MapSnapshot();
+
+        // writing
+        bool create( const std::string &path );
+
+        // empty payloads are not written
+        bool addTile( const TileBlocks &tile );
+
+        bool finish( const SnapshotInfo &info, const std::string &index );
+
+        // reading
+        bool open( const std::string &path );
+
+        bool isOpen() const { return mpMapped != nullptr; }
+
+        const SnapshotInfo &info() const { return mInfo; }
+
+        const char *indexData() const;
+
+        size_t indexSize() const;
+
+        bool hasTile( TopoId tId ) const;
+
+        bool getTile( TileKind kind, TopoId tId, std::string &data, std::string &pose ) const;
+
+        bool getAllPoses( TileKind kind, std::map<TopoId, std::string> &poses ) const;
+
+        void getTileIds( std::set<TopoId> &tIds ) const;
+
+        const std::string &path() const { return mPath; }
+
+        void close();
+
+    private:
+
+        struct SnapshotHeader {
+            uint32_t magic;
+            uint16_t version;
+            uint8_t format;
+            uint8_t pad;
+            uint32_t tiles;
+            uint32_t check;
+            uint64_t kfNextId;
+            uint64_t mpNextId;
+            uint64_t topoId;
+            uint64_t indexOffset;
+            uint64_t indexSize;
+            uint64_t directoryOffset;
+        };
+
+        struct SnapshotEntry {
+            uint64_t topoId;
+            uint64_t dataOffset;
+            uint64_t poseOffset;
+            uint32_t dataSize;
+            uint32_t poseSize;
+            uint32_t kind;
+            uint32_t pad;
+        };
+
+        typedef std::pair<uint32_t, TopoId> TileKey;
+
+        bool writeBlock( const std::string &block, uint64_t &offset );
+
+        static uint32_t checkOf( const SnapshotHeader &header, const char *directory, size_t size );
+
+        std::string mPath;
+
+        SnapshotInfo mInfo;
+
+        // writing
+        int mFd;
+        uint64_t mEnd;
+        std::vector<SnapshotEntry> mvEntries;
+
+        // reading
+        char *mpMapped;
+        uint64_t mSize;
+        uint64_t mIndexOffset;
+        uint64_t mIndexSize;
+        std::map<TileKey, SnapshotEntry> mDirectory;
+
+    };
+
+} //namespace ORB_SLAM
+
+#endif //ORB_SLAM2_MAPSNAPSHOT_H
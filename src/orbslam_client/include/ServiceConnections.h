@@ -0,0 +1,148 @@
+#ifndef ORB_SLAM2_SERVICECONNECTIONS_H
+#define ORB_SLAM2_SERVICECONNECTIONS_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+
+#include "ros/ros.h"
+
+/*
+ * ServiceConnections keeps persistent service clients to orbslam_server, so a tile swap does not pay for
+ * the master lookup and the TCP connection setup on every call.
+ *
+ * A persistent client carries one call at a time, the I/O workers, the prefetcher and the cache thread each
+ * lease their own client of a service and hand it back after the call. A client whose connection is gone
+ * (server restarted, network error) is dropped, the call is retried once on a new connection.
+ */
+
+namespace ORB_SLAM2 {
+
+    struct ServiceConnectionStats {
+        // persistent connections opened, and the ones opened again after a broken one
+        long unsigned int nConnects;
+        long unsigned int nReconnects;
+        // calls made on a connection opened by an earlier call
+        long unsigned int nReused;
+        long unsigned int nCalls;
+        long unsigned int nFailures;
+        // wall time of the first call of each connection (lookup + connect + transfer) and of the reused calls
+        double setupTime;
+        double reusedTime;
+    };
+
+    class ServiceConnections {
+
+    public:
+
+        // seconds a new connection waits for the service to be advertised
+        ServiceConnections( double waitTimeout = 1.0 );
+
+        ~ServiceConnections();
+
+        template<class Service>
+        bool call( const std::string &name, Service &srv );
+
+        ServiceConnectionStats getStats( const std::string &name );
+
+        // one line per service
+        void report();
+
+        // close every idle connection, the next calls connect again
+        void shutdown();
+
+    private:
+
+        struct Lease {
+            ros::ServiceClient client;
+            // no call made on it yet
+            bool bFresh;
+        };
+
+        template<class Service>
+        Lease acquire( const std::string &name );
+
+        void release( const std::string &name, Lease &lease );
+
+        void record( const std::string &name, const Lease &lease, bool bOK, double seconds );
+
+        void recordReconnect( const std::string &name );
+
+        double mWaitTimeout;
+
+        ros::NodeHandle mNodeHandle;
+
+        std::map<std::string, std::vector<ros::ServiceClient> > mIdle;
+
+        std::map<std::string, ServiceConnectionStats> mStats;
+
+        std::mutex mMutexConnections;
+
+    };
+
+    template<class Service>
+    ServiceConnections::Lease ServiceConnections::acquire(const std::string &name) {
+
+        {
+            std::unique_lock<std::mutex> lock(mMutexConnections);
+
+            std::vector<ros::ServiceClient> &idle = mIdle[name];
+
+            // health check, connections found broken by an earlier call are not handed out again
+            while (!idle.empty()) {
+                Lease lease;
+                lease.client = idle.back();
+                lease.bFresh = false;
+                idle.pop_back();
+                if (lease.client.isValid())
+                    return lease;
+                lease.client.shutdown();
+            }
+        }
+
+        Lease lease;
+        lease.client = mNodeHandle.serviceClient<Service>(name, true);
+        lease.bFresh = true;
+
+        if (mWaitTimeout > 0 && !lease.client.waitForExistence(ros::Duration(mWaitTimeout)))
+            ROS_INFO("service %s is not advertised", name.c_str());
+
+        return lease;
+
+    }
+
+    template<class Service>
+    bool ServiceConnections::call(const std::string &name, Service &srv) {
+
+        Lease lease = acquire<Service>(name);
+
+        ros::WallTime start = ros::WallTime::now();
+        bool bOK = lease.client.call(srv);
+        record(name, lease, bOK, (ros::WallTime::now() - start).toSec());
+
+        if (!bOK) {
+            // the persistent link may have been closed by the other side, retry on a new one
+            lease.client.shutdown();
+            recordReconnect(name);
+
+            lease.client = mNodeHandle.serviceClient<Service>(name, true);
+            lease.bFresh = true;
+
+            start = ros::WallTime::now();
+            bOK = lease.client.call(srv);
+            record(name, lease, bOK, (ros::WallTime::now() - start).toSec());
+        }
+
+        if (bOK)
+            release(name, lease);
+        else
+            lease.client.shutdown();
+
+        return bOK;
+
+    }
+
+} //namespace ORB_SLAM
+
+#endif //ORB_SLAM2_SERVICECONNECTIONS_H
@@ -0,0 +1,152 @@
+#ifndef ORB_SLAM2_SLOTTABLE_H
+#define ORB_SLAM2_SLOTTABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cassert>
+#include <iostream>
+#include <stdint.h>
+
+/*
+ * SlotTable maps the ids of the keyframes or of the mappoints, dense since they come from nNextId, to the
+ * object and its residency. A slot is one atomic word holding the pointer and the state in its low bits, so a
+ * reader sees a pointer together with the state it was published with, never one of another object.
+ *
+ * The slots are in chunks of 2^CHUNK_BITS allocated on the first write to them and kept to the end, a lookup
+ * reads the chunk pointer and the slot, without a lock. The writers are serialized by the cache for an id,
+ * release only clears a slot still holding what the caller published.
+ */
+
+namespace ORB_SLAM2 {
+
+    enum SlotState {
+        SLOT_EMPTY = 0,
+        // created by the tracking, not in the map yet
+        SLOT_TEMPORARY = 1,
+        SLOT_RESIDENT = 2,
+        // detached from the map, its tile is being written back
+        SLOT_IN_FLIGHT = 3
+    };
+
+    template<class T>
+    class SlotTable {
+
+    public:
+
+        SlotTable() {
+            for (size_t i = 0; i < MAX_CHUNKS; i++)
+                mChunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+        ~SlotTable() {
+            for (size_t i = 0; i < MAX_CHUNKS; i++)
+                delete[] mChunks[i].load(std::memory_order_relaxed);
+        }
+
+        // wait-free, nullptr for an id never published or released
+        T *get(long unsigned int id, SlotState *pState = nullptr) const {
+
+            const std::atomic<uintptr_t> *slot = find(id);
+            const uintptr_t word = slot ? slot->load(std::memory_order_acquire) : 0;
+
+            if (pState)
+                *pState = (SlotState) (word & STATE_MASK);
+
+            return (T *) (word & ~STATE_MASK);
+
+        }
+
+        void set(long unsigned int id, T *p, SlotState state) {
+
+            std::atomic<uintptr_t> *slot = create(id);
+
+            // the object could never be found by its id
+            if (!slot) {
+                std::cerr << "slot table: id " << id << " is past the last slot, the object is not published" << std::endl;
+                assert(slot && "id past the last slot");
+                return;
+            }
+
+            slot->store(p ? (uintptr_t) p | state : 0, std::memory_order_release);
+
+        }
+
+        // clear the slot if it still holds p in this state
+        bool release(long unsigned int id, T *p, SlotState state) {
+
+            std::atomic<uintptr_t> *slot = find(id);
+
+            if (!slot)
+                return false;
+
+            uintptr_t expected = (uintptr_t) p | state;
+            return slot->compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+
+        }
+
+        void clear() {
+
+            for (size_t i = 0; i < MAX_CHUNKS; i++) {
+                std::atomic<uintptr_t> *chunk = mChunks[i].load(std::memory_order_acquire);
+                for (size_t j = 0; chunk && j < CHUNK_SIZE; j++)
+                    chunk[j].store(0, std::memory_order_release);
+            }
+
+        }
+
+    private:
+
+        // 16384 slots of 8 bytes a chunk, 16384 chunks, the ids up to 2^28
+        static const int CHUNK_BITS = 14;
+        static const size_t CHUNK_SIZE = (size_t) 1 << CHUNK_BITS;
+        static const size_t MAX_CHUNKS = (size_t) 1 << 14;
+
+        // the objects are at least 4 bytes aligned
+        static const uintptr_t STATE_MASK = 3;
+
+        std::atomic<uintptr_t> *find(long unsigned int id) const {
+
+            const size_t c = id >> CHUNK_BITS;
+
+            if (c >= MAX_CHUNKS)
+                return nullptr;
+
+            std::atomic<uintptr_t> *chunk = mChunks[c].load(std::memory_order_acquire);
+
+            return chunk ? &chunk[id & (CHUNK_SIZE - 1)] : nullptr;
+
+        }
+
+        std::atomic<uintptr_t> *create(long unsigned int id) {
+
+            const size_t c = id >> CHUNK_BITS;
+
+            if (c >= MAX_CHUNKS)
+                return nullptr;
+
+            std::atomic<uintptr_t> *chunk = mChunks[c].load(std::memory_order_acquire);
+
+            if (!chunk) {
+
+                std::atomic<uintptr_t> *fresh = new std::atomic<uintptr_t>[CHUNK_SIZE];
+                for (size_t j = 0; j < CHUNK_SIZE; j++)
+                    fresh[j].store(0, std::memory_order_relaxed);
+
+                // another writer may have put its chunk first
+                if (mChunks[c].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel))
+                    chunk = fresh;
+                else
+                    delete[] fresh;
+            }
+
+            return &chunk[id & (CHUNK_SIZE - 1)];
+
+        }
+
+        std::atomic<std::atomic<uintptr_t> *> mChunks[MAX_CHUNKS];
+
+    };
+
+} //namespace ORB_SLAM
+
+#endif //ORB_SLAM2_SLOTTABLE_H
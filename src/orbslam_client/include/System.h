@@ -119,6 +119,10 @@ public:
 
 private:
 
+    // Trw of the reference keyframe of a frame, through the culled keyframes to their parents. a keyframe out
+    // of memory gives its stored pose, the stored poses are read on the first one. empty when none is known
+    cv::Mat ReferencePose(const LightKeyFrame &ref, bool &bStoredPoses);
+
     // Input sensor
     eSensor mSensor;
 
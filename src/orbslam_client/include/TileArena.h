@@ -0,0 +1,66 @@
+#ifndef ORB_SLAM2_TILEARENA_H
+#define ORB_SLAM2_TILEARENA_H
+
+#include <cstddef>
+
+/*
+ * TileArena allocates the keyframes and the mappoints (the objects themselves, not their payloads) in chunks
+ * mapped for one tile and one object size. The objects of a tile are decoded together and leave the cache
+ * together, so the chunks of an evicted tile empty out as a whole and are unmapped at once, giving the pages
+ * back without trimming the heap.
+ *
+ * The tile of an allocation is that of the innermost TileArenaScope of the thread, the tile decoded by
+ * TileCodec or DataDriver, else the default tile, the current tile of the cache, for the objects created by
+ * the tracking and the local mapping.
+ *
+ * The chunks of a tile and an object size have their own lock, so the threads decoding or creating objects of
+ * different tiles do not wait on each other. Each object is preceded by a header holding its chunk, a release
+ * goes straight to it.
+ */
+
+namespace ORB_SLAM2 {
+
+    typedef long unsigned int TopoId;
+
+    struct TileArenaStats {
+        long unsigned int nChunks;
+        // mapped, and taken by the live objects
+        size_t mappedBytes;
+        size_t liveBytes;
+    };
+
+    class TileArena {
+
+    public:
+
+        static void *allocate(size_t size);
+
+        static void release(void *p);
+
+        // the bytes an object of this size takes in a chunk, with its header
+        static size_t objectBytes(size_t size);
+
+        static void setDefaultTile(TopoId tId);
+
+        static TileArenaStats stats();
+
+    };
+
+    class TileArenaScope {
+
+    public:
+
+        explicit TileArenaScope(TopoId tId);
+
+        ~TileArenaScope();
+
+    private:
+
+        TopoId mPrevious;
+        bool mbPrevious;
+
+    };
+
+} //namespace ORB_SLAM
+
+#endif //ORB_SLAM2_TILEARENA_H
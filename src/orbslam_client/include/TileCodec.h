@@ -0,0 +1,136 @@
+#ifndef ORB_SLAM2_TILECODEC_H
+#define ORB_SLAM2_TILECODEC_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+
+#include "Cache.h"
+
+/*
+ * TileCodec is the binary wire format of the tile payloads exchanged with orbslam_server.
+ *
+ * A tile is a fixed little-endian header followed by one record per object. Poses, descriptors,
+ * keypoints and the other dense members are written as raw contiguous blocks, and decoding fills
+ * the KeyFrame / MapPoint members straight from the received buffer.
+ *
+ *   uint32 magic ("M2TL") | uint16 version | uint8 kind | uint8 codec | uint32 count | uint64 topoId | uint32 size
+ *
+ * The boost text archive format is still supported next to it, a payload is recognised by its magic.
+ *
+ * The codec byte tells how the body after the header is stored. A compressed body starts with the
+ * uint32 size of the raw body, size is then the compressed size. The header itself is never compressed.
+ */
+
+namespace ORB_SLAM2 {
+
+    class KeyFrame;
+
+    class MapPoint;
+
+    class Cache;
+
+    class LoopKeyPoint;
+
+    class TopoMap;
+
+    class TileWriter;
+
+    class TileReader;
+
+    typedef long unsigned int TopoId;
+
+    typedef std::map<long unsigned int, cv::Mat> KeyFramePoseMap;
+
+    typedef std::map<long unsigned int, std::pair<cv::Mat, std::vector<std::pair<long unsigned int, LoopKeyPoint> > > > MapPointPoseMap;
+
+    enum TileKind { TILE_KEYFRAMES = 1, TILE_MAPPOINTS = 2, TILE_KEYFRAME_POSES = 3, TILE_MAPPOINT_POSES = 4, TILE_TOPO_INDEX = 5 };
+
+    // zlib at its fastest level for the swap path, bzip2 for tiles which are not expected back soon
+    enum TileCompression { TILE_CODEC_NONE = 0, TILE_CODEC_ZLIB = 1, TILE_CODEC_BZIP2 = 2 };
+
+    struct TileHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint8_t kind;
+        uint8_t codec;
+        uint32_t count;
+        uint64_t topoId;
+        uint32_t size;
+    };
+
+    class TileCodec {
+
+    public:
+
+        static const uint32_t MAGIC = 0x4c54324d; // "M2TL"
+
+        static const uint16_t VERSION = 1;
+
+        static const size_t HEADER_SIZE = 24;
+
+        // check whether the buffer holds a binary tile (otherwise it is a text archive)
+        static bool isTile(const char *data, size_t size);
+
+        static bool isTile(const std::string &buf) {
+            return isTile(buf.data(), buf.size());
+        }
+
+        static bool readHeader(const char *data, size_t size, TileHeader &header);
+
+        // codec of a binary tile, TILE_CODEC_NONE for anything else
+        static uint8_t codecOf(const std::string &buf);
+
+        // compress the body of an encoded tile in place, the tile is left as it is (and false returned)
+        // when the codec is unknown or the body does not shrink
+        static bool compress(std::string &tile, uint8_t codec);
+
+        // the tile with its body decompressed, a tile which is not compressed is copied
+        static bool decompress(const char *data, size_t size, std::string &out);
+
+        // keyframe tiles
+        static void encodeKeyFrames(TopoId tId, const std::vector<KeyFrame *> &pKFs, std::string &out);
+
+        // appends the objects of the tile, pKFs is left as it was when the tile is broken
+        static bool decodeKeyFrames(const char *data, size_t size, Cache *pCacher, std::vector<KeyFrame *> &pKFs);
+
+        // mappoint tiles
+        static void encodeMapPoints(TopoId tId, const std::vector<MapPoint *> &pMPs, std::string &out);
+
+        // the same, pMPs is left as it was when the tile is broken
+        static bool decodeMapPoints(const char *data, size_t size, Cache *pCacher, std::vector<MapPoint *> &pMPs);
+
+        // pose blocks stored next to the tiles
+        static void encodeKeyFramePoses(TopoId tId, const KeyFramePoseMap &poses, std::string &out);
+
+        static bool decodeKeyFramePoses(const char *data, size_t size, KeyFramePoseMap &poses);
+
+        static void encodeMapPointPoses(TopoId tId, const MapPointPoseMap &poses, std::string &out);
+
+        static bool decodeMapPointPoses(const char *data, size_t size, MapPointPoseMap &poses);
+
+        // the TopoMap index (tiles, covisibility graph, spanning tree, loop edges, BoW vectors), count is 0
+        static void encodeTopoIndex(TopoMap *pTopo, std::string &out);
+
+        // pTopo is replaced by the decoded index, it is left as it was when the index is damaged
+        static bool decodeTopoIndex(const char *data, size_t size, TopoMap *pTopo);
+
+    private:
+
+        // KeyFrame and MapPoint declare TileCodec as friend, the records are (de)serialized member by member
+        static void writeKeyFrame(TileWriter &w, KeyFrame *pKF);
+
+        static void readKeyFrame(TileReader &r, KeyFrame *pKF, Cache *pCacher);
+
+        static void writeMapPoint(TileWriter &w, MapPoint *pMP);
+
+        static void readMapPoint(TileReader &r, MapPoint *pMP, Cache *pCacher);
+
+    };
+
+} //namespace ORB_SLAM
+
+#endif //ORB_SLAM2_TILECODEC_H
@@ -0,0 +1,291 @@
+#ifndef ORB_SLAM2_TILESTORE_H
+#define ORB_SLAM2_TILESTORE_H
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <stdint.h>
+
+#include "TileCodec.h"
+
+/*
+ * TileStore is the storage backend behind DataDriver. A tile is stored as two opaque blocks, the
+ * serialized objects (DATA) and the pose block (POSE), keyed by its kind and TopoId.
+ *
+ * RosTileStore forwards to the orbslam_server services (ODB / PostgreSQL), MappedTileStore keeps the
+ * tiles in a local append-only file mapped into memory, with an index file replayed on open.
+ * SnapshotTileStore serves the tiles of a loaded map snapshot until they are saved again.
+ * ShardedTileStore spreads the tiles over several stores by TopoId, one orbslam_server process each.
+ */
+
+namespace ORB_SLAM2 {
+
+    // both payloads of one tile, as moved by the batch calls
+    struct TileBlocks {
+        TopoId tId;
+        std::string kfPose;
+        std::string kfData;
+        std::string mpPose;
+        std::string mpData;
+        // bounding box of the objects of the tile, min x y z then max x y z, empty when unknown
+        std::vector<double> extent;
+        // to the query center, only set by queryTiles
+        double distance;
+    };
+
+    // the tiles intersecting box (or the cube of side 2 radius around center when box is empty) and within
+    // radius of center (radius <= 0: any distance), nearest first
+    struct TileQuery {
+        std::vector<double> box;
+        double center[3];
+        double radius;
+        // 0 for no limit
+        unsigned int maxTiles;
+        // tiles the caller holds already, they come back with empty payloads
+        std::vector<TopoId> exclude;
+    };
+
+    class TileStore {
+
+    public:
+
+        virtual ~TileStore() {}
+
+        // kind is TILE_KEYFRAMES or TILE_MAPPOINTS
+        virtual bool saveTile( TileKind kind, TopoId tId, const std::string &data, const std::string &pose ) = 0;
+
+        // false when the tile is unknown or the backend failed, data is left empty then
+        virtual bool getTile( TileKind kind, TopoId tId, std::string &data, std::string &pose ) = 0;
+
+        // the pose blocks of every stored tile of one kind
+        virtual bool getAllPoses( TileKind kind, std::map<TopoId, std::string> &poses ) = 0;
+
+        virtual bool updateAllPoses( TileKind kind, const std::map<TopoId, std::string> &poses ) = 0;
+
+        // the pose blocks of some tiles of both kinds, the default goes kind by kind
+        virtual bool updatePoses( const std::map<TopoId, std::string> &kfPoses, const std::map<TopoId, std::string> &mpPoses );
+
+        // several tiles at once, the default goes tile by tile; empty payloads are not stored
+        virtual bool saveTiles( const std::vector<TileBlocks> &tiles );
+
+        // tiles[i].tId selects the tile, unknown tiles come back with empty payloads
+        virtual bool getTiles( std::vector<TileBlocks> &tiles );
+
+        // spatial query on the extents of the stored tiles, false when the backend has no spatial index
+        virtual bool queryTiles( const TileQuery &query, std::vector<TileBlocks> &tiles ) { return false; }
+
+        virtual std::string name() const = 0;
+
+    };
+
+    class ServiceConnections;
+
+    class RosTileStore : public TileStore {
+
+    public:
+
+        // the service clients are owned by the caller and shared with DataDriver. ns prefixes the service
+        // names, for a server started in its own namespace ("shard0/")
+        RosTileStore( ServiceConnections *pConnections, const std::string &ns = "" ) :
+                mpConnections(pConnections), mNamespace(ns) {}
+
+        bool saveTile( TileKind kind, TopoId tId, const std::string &data, const std::string &pose );
+
+        bool getTile( TileKind kind, TopoId tId, std::string &data, std::string &pose );
+
+        bool getAllPoses( TileKind kind, std::map<TopoId, std::string> &poses );
+
+        bool updateAllPoses( TileKind kind, const std::map<TopoId, std::string> &poses );
+
+        // binary blocks in one service call and one database transaction
+        bool updatePoses( const std::map<TopoId, std::string> &kfPoses, const std::map<TopoId, std::string> &mpPoses );
+
+        // one service call and one database transaction per batch
+        bool saveTiles( const std::vector<TileBlocks> &tiles );
+
+        bool getTiles( std::vector<TileBlocks> &tiles );
+
+        // queryTopoTiles, served from the PostGIS extents of the tile tables
+        bool queryTiles( const TileQuery &query, std::vector<TileBlocks> &tiles );
+
+        std::string name() const { return mNamespace.empty() ? "ros" : "ros " + mNamespace; }
+
+    private:
+
+        ServiceConnections *mpConnections;
+
+        std::string mNamespace;
+
+    };
+
+    class MappedTileStore : public TileStore {
+
+    public:
+
+        // bReset drops the tiles left by a previous run
+        MappedTileStore( const std::string &path, bool bReset = true );
+
+        ~MappedTileStore();
+
+        bool isOpen() const { return mDataFd >= 0 && mIndexFd >= 0; }
+
+        bool saveTile( TileKind kind, TopoId tId, const std::string &data, const std::string &pose );
+
+        bool getTile( TileKind kind, TopoId tId, std::string &data, std::string &pose );
+
+        bool getAllPoses( TileKind kind, std::map<TopoId, std::string> &poses );
+
+        bool updateAllPoses( TileKind kind, const std::map<TopoId, std::string> &poses );
+
+        std::string name() const { return "mapped " + mPath; }
+
+    private:
+
+        // one record of the index file, the last record of a tile wins
+        struct IndexEntry {
+            uint64_t topoId;
+            uint64_t dataOffset;
+            uint64_t poseOffset;
+            uint32_t dataSize;
+            uint32_t poseSize;
+            uint32_t kind;
+            // of the two blocks, a record whose blocks did not reach the disk is told apart on replay
+            uint32_t dataCheck;
+            uint32_t poseCheck;
+            uint32_t check;
+        };
+
+        typedef std::pair<uint32_t, TopoId> TileKey;
+
+        bool replayIndex();
+
+        // append a block to the data file, growing the mapping when needed
+        bool append( const std::string &block, uint64_t &offset );
+
+        // the blocks appended are on disk before the index record pointing to them is written
+        bool sync( uint64_t offset, uint64_t size );
+
+        bool appendIndex( const IndexEntry &entry );
+
+        bool reserve( uint64_t size );
+
+        static uint32_t checkOf( const IndexEntry &entry );
+
+        static uint32_t checkOf( const char *block, size_t size );
+
+        std::string mPath;
+
+        int mDataFd;
+        int mIndexFd;
+
+        char *mpMapped;
+        uint64_t mCapacity;
+        uint64_t mEnd;
+
+        std::map<TileKey, IndexEntry> mIndex;
+
+        std::mutex mMutexStore;
+
+    };
+
+    class MapSnapshot;
+
+    class SnapshotTileStore : public TileStore {
+
+    public:
+
+        // takes the ownership of both, the tiles written from now on go to pStore
+        SnapshotTileStore( TileStore *pStore, MapSnapshot *pSnapshot );
+
+        ~SnapshotTileStore();
+
+        bool saveTile( TileKind kind, TopoId tId, const std::string &data, const std::string &pose );
+
+        bool getTile( TileKind kind, TopoId tId, std::string &data, std::string &pose );
+
+        bool getAllPoses( TileKind kind, std::map<TopoId, std::string> &poses );
+
+        bool updateAllPoses( TileKind kind, const std::map<TopoId, std::string> &poses );
+
+        bool updatePoses( const std::map<TopoId, std::string> &kfPoses, const std::map<TopoId, std::string> &mpPoses );
+
+        bool saveTiles( const std::vector<TileBlocks> &tiles );
+
+        bool getTiles( std::vector<TileBlocks> &tiles );
+
+        // the snapshot has no extents, the query goes to the store
+        bool queryTiles( const TileQuery &query, std::vector<TileBlocks> &tiles );
+
+        std::string name() const;
+
+    private:
+
+        typedef std::pair<uint32_t, TopoId> TileKey;
+
+        // the snapshot still holds the latest copy of the tile
+        bool inSnapshot( TileKind kind, TopoId tId );
+
+        void supersede( TileKind kind, TopoId tId );
+
+        // the poses of the tiles which are only in the snapshot, the tile is moved to the store with them
+        bool movePoses( TileKind kind, const std::map<TopoId, std::string> &poses, std::map<TopoId, std::string> &rest );
+
+        TileStore *mpStore;
+
+        MapSnapshot *mpSnapshot;
+
+        std::set<TileKey> mSuperseded;
+
+        std::mutex mMutexSuperseded;
+
+    };
+
+    class ShardedTileStore : public TileStore {
+
+    public:
+
+        // takes the ownership of the shards. range 0 hashes the TopoId, otherwise the ids are dealt to the
+        // shards in runs of range consecutive ids, a power of 8 run is a cube of neighbouring tiles
+        ShardedTileStore( const std::vector<TileStore *> &vpShards, TopoId range = 0 );
+
+        ~ShardedTileStore();
+
+        size_t shardOf( TopoId tId ) const;
+
+        bool saveTile( TileKind kind, TopoId tId, const std::string &data, const std::string &pose );
+
+        bool getTile( TileKind kind, TopoId tId, std::string &data, std::string &pose );
+
+        // the batch calls are split by shard, the shards are called in parallel
+        bool getAllPoses( TileKind kind, std::map<TopoId, std::string> &poses );
+
+        bool updateAllPoses( TileKind kind, const std::map<TopoId, std::string> &poses );
+
+        bool updatePoses( const std::map<TopoId, std::string> &kfPoses, const std::map<TopoId, std::string> &mpPoses );
+
+        bool saveTiles( const std::vector<TileBlocks> &tiles );
+
+        bool getTiles( std::vector<TileBlocks> &tiles );
+
+        // every shard is asked, the answers are merged nearest first
+        bool queryTiles( const TileQuery &query, std::vector<TileBlocks> &tiles );
+
+        std::string name() const;
+
+    private:
+
+        // job(s) for every shard with bUsed[s], on its own thread when there are several, true when all succeed
+        bool forShards( const std::vector<char> &bUsed, const std::function<bool( size_t )> &job );
+
+        std::vector<TileStore *> mvpShards;
+
+        TopoId mRange;
+
+    };
+
+} //namespace ORB_SLAM
+
+#endif //ORB_SLAM2_TILESTORE_H
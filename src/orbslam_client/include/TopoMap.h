@@ -7,6 +7,9 @@
 
 #include <string>
 #include <thread>
+#include <mutex>
+#include <set>
+#include <vector>
 
 #include "Cache.h"
 #include "KeyFrame.h"
@@ -28,27 +31,63 @@ namespace ORB_SLAM2{
 
     typedef long unsigned int TopoId;
 
+    /*
+     * A TopoId is the Morton (Z-order) code of the cell of the tile, 20 bits per axis interleaved as
+     * x0 y0 z0 x1 y1 z1 ..., so the tiles close in space have close ids in the tile store. The cell
+     * indices start at 1, 0 is never a tile.
+     *
+     * The cells of the first level are Lmax wide. A cell holding too much is split into its 8 children
+     * of the next level, down to Lmin, the level of the cell is kept in the bits above the code. A point
+     * belongs to the leaf cell containing it, the first level ids are those of unsplit maps.
+     */
     class ToPoIdGenetator{
 
     public:
 
-        ToPoIdGenetator() {}
+        ToPoIdGenetator() : mVerticalRadius( 1 ), mnMaxLevel( 0 ) {}
         ToPoIdGenetator(int MaxArea, int Lmin, int Lmax );
         TopoId generateId( cv::Point3d p3d);
         TopoId generateId( long unsigned int x, long unsigned int y, long unsigned int z );
-        std::set< TopoId > generateOctIds( TopoId tId );
+        TopoId generateId( int level, long unsigned int x, long unsigned int y, long unsigned int z );
+        void decodeId( TopoId tId, long unsigned int &x, long unsigned int &y, long unsigned int &z );
+        // the leaf tiles within radius first level cells of tId horizontally, and within mVerticalRadius
+        // along y (the vertical axis of the camera frame of the first keyframe)
+        std::set< TopoId > generateOctIds( TopoId tId, int radius = 5 );
+        // in first level cells along the widest axis
+        int tileDistance( TopoId a, TopoId b );
+
+        // the cell tree
+        int maxLevel() const { return mnMaxLevel; }
+        int levelOf( TopoId tId );
+        TopoId parentOf( TopoId tId );
+        std::vector<TopoId> childrenOf( TopoId tId );
+        void setSplit( TopoId tId, bool bSplit );
+        bool isSplit( TopoId tId );
+        // the ancestors of a restored tile are split
+        void noteTile( TopoId tId );
+
+        int mVerticalRadius;
 
     private:
+        // mMutexSplit is held
+        void addLeaves( TopoId tId, std::set<TopoId> &leaves );
+
         int mMaxArea;
         int mLmin;
         int mLmax;
-        int codebits;
+        int mnMaxLevel;
+
+        std::set<TopoId> mSplit;
+        std::mutex mMutexSplit;
 
     };
 
 
     class TopoMap{
 
+        // the map snapshot writes and reads the index member by member
+        friend class TileCodec;
+
     public:
 
         TopoMap() {}
@@ -73,9 +112,45 @@ namespace ORB_SLAM2{
 
         std::set<long unsigned int > getMapPoints( TopoId tpId );
 
+        // the map recovery puts back the objects of the stored tiles, no tile is marked dirty
+        void restoreKeyFrame( long unsigned int kf, TopoId tpId );
+
+        void restoreMapPoint( long unsigned int mpid, TopoId tpId );
+
+        // the cell tree of the adaptive tiles
+        int getTileLevel( TopoId tpId );
+
+        int getMaxTileLevel();
+
+        TopoId getParentTile( TopoId tpId );
+
+        std::vector<TopoId> getChildTiles( TopoId tpId );
+
+        bool isTileSplit( TopoId tpId );
+
+        void setTileSplit( TopoId tpId, bool bSplit );
+
+        void noteTileId( TopoId tpId );
+
+        // a mappoint moved to another tile, it may stay in some others
+        void eraseMapPointFromTile( long unsigned int mpid, TopoId tpId );
+
+        // tiles whose set of keyframes or mappoints changed since they were stored
+        void markTopoIdDirty( TopoId tpId );
+
+        // clears the mark, returns whether it was set
+        bool takeTopoIdDirty( TopoId tpId );
+
         // the strategy that keep the local topomap in the cache
         std::set<TopoId> getTopoMapsNeedInCache( TopoId tpId);
 
+        std::set<TopoId> getTopoMapsInRange( TopoId tpId, int radius );
+
+        int getTileDistance( TopoId a, TopoId b );
+
+        // levels of tiles above and below the current one kept in cache
+        void setVerticalRadius( int radius );
+
         // functions about the keyFrame observation graph
         void addKeyFrameObservations( long unsigned int kf1, long unsigned int kf2, const int weight );
 
@@ -116,6 +191,9 @@ namespace ORB_SLAM2{
 
         void updateAllPose();
 
+        // heap bytes of the structures by name, see MapMemory
+        void memoryBytes( std::map<std::string, size_t> &structures );
+
     public:
         std::map<long unsigned int, cv::Mat > mpKfPose;
 
@@ -123,6 +201,11 @@ namespace ORB_SLAM2{
 
         std::map<long unsigned int, std::vector< pair < long unsigned int, LoopKeyPoint > > > mpMpObservations;
 
+        // the poses as they are in the tile store, the write-back after a correction only sends the tiles which moved
+        std::map<long unsigned int, cv::Mat > mpKfPoseStored;
+
+        std::map<long unsigned int, cv::Mat > mpMpPoseStored;
+
         std::map<long unsigned int, cv::Mat > mpKfTcwGBA;
 
         std::map<long unsigned int, long unsigned int > mpKfBAGlobalForKF;
@@ -159,7 +242,10 @@ namespace ORB_SLAM2{
 
         ToPoIdGenetator* mTopoIdGen;
 
+        std::set<TopoId> mDirtyTopoIds;
+
         std::mutex mpTopoMpsMutex;
+        std::mutex mDirtyTopoIdsMutex;
         std::mutex mKFgraphMutex;
         std::mutex mpTopoKFsMutex;
 
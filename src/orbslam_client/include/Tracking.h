@@ -106,7 +106,8 @@ public:
     // Lists used to recover the full camera trajectory at the end of the execution.
     // Basically we store the reference keyframe for each frame and its relative transformation
     list<cv::Mat> mlRelativeFramePoses;
-    list<KeyFrame*> mlpReferences;
+    // by id, the reference keyframes of the old frames may have left the memory
+    list<LightKeyFrame> mlpReferences;
     list<double> mlFrameTimes;
     list<bool> mlbLost;
 
@@ -214,6 +215,8 @@ protected:
     Frame mLastFrame;
     unsigned int mnLastKeyFrameId;
     unsigned int mnLastRelocFrameId;
+    // the tiles around the last pose were brought in for this loss of the tracking
+    bool mbNeighbourhoodLoaded;
 
     //Motion Model
     cv::Mat mVelocity;
@@ -6,10 +6,18 @@
 #include "Cache.h"
 #include "Converter.h"
 #include "DataDriver.h"
+#include "TileStore.h"
+#include "ServiceConnections.h"
+#include "MapJournal.h"
+#include "MapSnapshot.h"
+#include "TileArena.h"
+#include "EpochManager.h"
 #include <thread>
 #include <pangolin/pangolin.h>
 #include <iomanip>
 #include <time.h>
+#include <algorithm>
+#include <limits>
 
 namespace ORB_SLAM2 {
 
@@ -26,11 +34,58 @@ namespace ORB_SLAM2 {
         mbNotStop = true;
         mbStopped = false;
         mbFinishRequested = false;
+        mTileFormat = TILE_FORMAT_ARCHIVE;
+        mpConnections = new ServiceConnections();
+        mpTileStore = new RosTileStore(mpConnections);
+        mpDataDriver = new DataDriver(this);
+        mnIOWorkers = 2;
+        mnMaxEvictQueue = 8;
+        mbStopIOWorkers = false;
+        mnEvictBatch = 11;
+        mfPrefetchHorizon = 2.0;
+        mnMaxPrefetchTiles = 16;
+        mHotTileCodec = TILE_CODEC_NONE;
+        mColdTileCodec = TILE_CODEC_NONE;
+        mfHotTileRange = 2 * Lmax;
+        mfPoseDeltaTranslation = 0.001;
+        mfPoseDeltaRotation = 0.001;
+        mnPoseBatch = 64;
+        mpJournal = nullptr;
+        mfJournalInterval = 1.0;
+        mnJournalCheckpointSize = 64;
+        mJournalTime = std::chrono::steady_clock::now();
+        mnMemoryBudget = 0;
+        mnGuaranteedTiles = 1;
+        mnTileSplitKeyFrames = 0;
+        mnTileSplitSize = 0;
+        mTileAdaptTime = mJournalTime;
+        mMemoryLogPath = "mymapsize.txt";
+        mfMemoryLogInterval = 1.0;
+        mnMmapThreshold = 16384;
+        mbReclaimEvicted = false;
+        mbMemoryLogOpen = false;
+        mMemoryLogTime = mJournalTime;
+        mMemoryLogStart = mJournalTime;
+        mWindowTopoId = 0;
+        mWindowTime = mJournalTime;
+        mnCurrentKFId = 0;
+        mfTileSize = Lmax;
+        mfRelocRadius = 2 * Lmax;
+        mMotionStamp = 0;
+        mScheduledStamp = 0;
+        mptPrefetcher = nullptr;
+        mPrefetching = 0;
+        mnPrefetchGeneration = 0;
+        mbStopPrefetcher = false;
+        mPrefetchStats.nIssued = mPrefetchStats.nHits = mPrefetchStats.nMisses = mPrefetchStats.nWasted = 0;
+        mbDemandIO = false;
+        mnCleanTilesSkipped = 0;
+        mnDirtyTilesWritten = 0;
         kfStatus.clear();
 
         //init topomap
         {
-            mTopoMap = new TopoMap(this, maxArea, Lmax, Lmin);
+            mTopoMap = new TopoMap(this, maxArea, Lmin, Lmax);
 
             mCurrentTopoId = mTopoMap->generateId(cv::Point3d(0, 0, 0));
 
@@ -84,6 +139,7 @@ namespace ORB_SLAM2 {
         unique_lock<mutex> lock(mMutexlKFToKFmap);
         mpMap->AddKeyFrame(pKF);
         lKFToKFmap[pKF->mnId] = pKF;
+        mKFSlots.set(pKF->mnId, pKF, SLOT_RESIDENT);
         kfStatus[pKF->mnId] = KF_IN_CACHE;
         tmpKFMap.erase(pKF->mnId);
         kfTimstamp[ pKF->mnId ] = pKF->mTimeStamp;
@@ -96,6 +152,15 @@ namespace ORB_SLAM2 {
 
         this->mCurrentTopoId = pKF->mTopoId;
 
+        mnCurrentKFId = pKF->mnId;
+
+        {
+            unique_lock<mutex> lock(mMutexMotion);
+            mRecentKFCenters.push_back(make_pair(pKF->mTimeStamp, pKF->GetCameraCenter()));
+            while (mRecentKFCenters.size() > 5)
+                mRecentKFCenters.pop_front();
+        }
+
     }
 
     void Cache::EraseKeyFrameFromTopoMap(KeyFrame *pKF) {
@@ -111,6 +176,7 @@ namespace ORB_SLAM2 {
             //unique_lock<mutex> lock2(mpMap->mMutexMapUpdate);
             unique_lock<mutex> lock(mMutexlKFToKFmap);
             lKFToKFmap.erase(pKF->mnId);
+            mKFSlots.release(pKF->mnId, pKF, SLOT_RESIDENT);
             kfStatus.erase(pKF->mnId);
         }
 
@@ -124,6 +190,7 @@ namespace ORB_SLAM2 {
 
         unique_lock<mutex> lock(mMutexMPToMPmap);
         lMPToMPmap[pMP->mnId] = pMP;
+        mMPSlots.set(pMP->mnId, pMP, SLOT_RESIDENT);
         mpStatus[pMP->mnId] = MP_IN_CACHE;
 
     }
@@ -140,6 +207,7 @@ namespace ORB_SLAM2 {
         {
             unique_lock<mutex> lock(mMutexMPToMPmap);
             lMPToMPmap.erase(pMP->mnId);
+            mMPSlots.release(pMP->mnId, pMP, SLOT_RESIDENT);
             EraseMapPointFromTopoMap(pMP->mnId);
         }
 
@@ -158,14 +226,8 @@ namespace ORB_SLAM2 {
 
         if (pId <= 0) return nullptr;
 
-        KeyFrame *pKF = nullptr;
-
-        if (tmpKFMap.find(pId) != tmpKFMap.end()) {
-            pKF = tmpKFMap[pId];
-        } else if (lKFToKFmap.find(pId) != lKFToKFmap.end())
-            pKF = lKFToKFmap[pId];
-
-        return pKF;
+        // temporary, in cache, or in a tile which is still being written back to the server
+        return mKFSlots.get(pId);
     }
 
     bool Cache::KeyFrameInCache(long unsigned int pID) {
@@ -183,17 +245,7 @@ namespace ORB_SLAM2 {
 
         if (pId <= 0) return nullptr;
 
-        MapPoint *pMP = nullptr;
-        {
-            //unique_lock<mutex> lock(mMutexMPToMPmap);
-            if (lMPToMPmap.find(pId) != lMPToMPmap.end()) {
-                unique_lock<mutex> lock(mMutexMPToMPmap);
-                pMP = lMPToMPmap[pId];
-            }
-
-        }
-
-        return pMP;
+        return mMPSlots.get(pId);
 
     }
 
@@ -203,11 +255,9 @@ namespace ORB_SLAM2 {
 
         KeyFrame *pKF = nullptr;
 
-        DataDriver DB(this);
-
         LightKeyFrame tlkf(pId, this);
         {
-            pKF = DB.transOneKeyFrameFromServer(tlkf);
+            pKF = mpDataDriver->transOneKeyFrameFromServer(tlkf);
         }
 
         if (pKF) {
@@ -222,6 +272,7 @@ namespace ORB_SLAM2 {
                 unique_lock<mutex> lock(mMutexlKFToKFmap);
                 // add KeyFrame to the LinghtKeyFrame to KeyFrame map
                 lKFToKFmap[pKF->mnId] = pKF;
+                mKFSlots.set(pKF->mnId, pKF, SLOT_RESIDENT);
             }
 
         }
@@ -280,6 +331,8 @@ namespace ORB_SLAM2 {
         }
         lMPToMPmap.clear();
         tmpKFMap.clear();
+        mKFSlots.clear();
+        mMPSlots.clear();
         kfStatus.clear();
         mTpInCache.clear();
         mCurrentTopoId = 0;
@@ -312,36 +365,271 @@ namespace ORB_SLAM2 {
 
     }
 
+    int Cache::LoadNeighbourhood(const cv::Mat &center, float radius) {
+
+        if (center.empty() || radius <= 0)
+            return 0;
+
+        time_t start_t, end_t;
+        start_t = clock();
+
+        // the same locks as transTopoMapKeyFrames, the cache thread and the loop correction stay out of the maps
+        unique_lock<mutex> lock(mMutexStop);
+
+        if (mbStopped)
+            return 0;
+
+        const cv::Point3d p(center.at<float>(0), center.at<float>(1), center.at<float>(2));
+
+        TileQuery query;
+        query.center[0] = p.x;
+        query.center[1] = p.y;
+        query.center[2] = p.z;
+        query.radius = radius;
+        query.maxTiles = 0;
+
+        // the tiles in cache are only listed
+        query.exclude.assign(mTpInCache.begin(), mTpInCache.end());
+
+        std::vector<TopoId> tIds;
+        std::vector<std::set<KeyFrame *> > kfs;
+        std::vector<std::set<MapPoint *> > mps;
+
+        mCurrentTopoId = mTopoMap->generateId(p);
+
+        if (!mpDataDriver->QueryTopoTilesFromServer(query, tIds, kfs, mps)) {
+            const size_t nCached = mTpInCache.size();
+            transTopoMapKeyFrames();
+            return (int) (mTpInCache.size() - std::min(nCached, mTpInCache.size()));
+        }
+
+        unique_lock<mutex> lock1(mCorrectLoopMutex);
+
+        int nLoaded = 0;
+
+        for (size_t i = 0; i < tIds.size(); i++) {
+
+            if (mTpInCache.find(tIds[i]) != mTpInCache.end())
+                continue;
+
+            mTpInCache.insert(tIds[i]);
+            TopoIdStatus[tIds[i]] = UN_USE;
+            nLoaded++;
+
+            // the tile has not left the process yet or was prefetched meanwhile, the fetched copy is dropped
+            if (restoreInFlightTopoMap(tIds[i]) || takePrefetchedTile(tIds[i])) {
+                for (std::set<KeyFrame *>::iterator mit = kfs[i].begin(); mit != kfs[i].end(); mit++)
+                    delete *mit;
+                for (std::set<MapPoint *>::iterator mit = mps[i].begin(); mit != mps[i].end(); mit++)
+                    delete *mit;
+                continue;
+            }
+
+            unique_lock<mutex> lock2(mpMap->mMutexMapUpdate);
+
+            for (std::set<KeyFrame *>::iterator mit = kfs[i].begin(); mit != kfs[i].end(); mit++) {
+                if (*mit) {
+                    (*mit)->setCache(this);
+                    AddKeyFrameToMap(*mit);
+                }
+            }
+
+            for (std::set<MapPoint *>::iterator mit = mps[i].begin(); mit != mps[i].end(); mit++) {
+
+                if (lMPToMPmap.find((*mit)->mnId) == lMPToMPmap.end()) {
+                    mpMap->AddMapPoint(*mit);
+                    {
+                        unique_lock<mutex> lock3(mMutexMPToMPmap);
+                        lMPToMPmap[(*mit)->mnId] = *mit;
+                        mMPSlots.set((*mit)->mnId, *mit, SLOT_RESIDENT);
+                    }
+                } else {
+                    // shared with a tile already in cache
+                    delete *mit;
+                }
+            }
+        }
+
+        end_t = clock();
+
+        cout << "load neighbourhood of " << radius << " : " << tIds.size() << " tiles found, " << nLoaded
+             << " loaded use time " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+
+        return nLoaded;
+
+    }
+
     void Cache::SaveMap(const string &filename) {
-        // save Map to files
-        std::ofstream ofs("savetest.txt");
-        boost::archive::text_oarchive oa(ofs);
-        oa << mpMap;
-        ofs.close();
+
+        time_t start_t, end_t;
+        start_t = clock();
+
+        // the cache thread stays out of the map while it is copied
+        unique_lock<mutex> lock(mMutexStop);
+
+        waitForEvictions();
+
+        // the tiles in cache are written back, then every tile is copied from the store as it is stored
+        std::vector<std::shared_ptr<EvictedTile> > cached;
+        collectCachedTiles(cached);
+
+        if (!writeBackTiles(cached)) {
+            cerr << "can not write back the tiles in cache, the map is not saved" << endl;
+            return;
+        }
+
+        cached.clear();
+
+        SnapshotInfo info;
+        info.format = mTileFormat;
+        info.currentTopoId = mCurrentTopoId;
+        std::string index;
+        std::set<TopoId> tIds;
+
+        {
+            unique_lock<mutex> lock2(mpMap->mMutexMapUpdate);
+
+            info.nKFNextId = KeyFrame::nNextId;
+            info.nMPNextId = MapPoint::nNextId;
+
+            TileCodec::encodeTopoIndex(mTopoMap, index);
+
+            for (std::map<TopoId, std::set<long unsigned int> >::iterator mit = mTopoMap->mpTopoKFs.begin(); mit != mTopoMap->mpTopoKFs.end(); mit++)
+                if (!mit->second.empty())
+                    tIds.insert(mit->first);
+
+            for (std::map<TopoId, std::set<long unsigned int> >::iterator mit = mTopoMap->mpTopoMps.begin(); mit != mTopoMap->mpTopoMps.end(); mit++)
+                if (!mit->second.empty())
+                    tIds.insert(mit->first);
+        }
+
+        TileCodec::compress(index, mColdTileCodec);
+
+        MapSnapshot snapshot;
+
+        if (!snapshot.create(filename))
+            return;
+
+        std::vector<TopoId> vtIds(tIds.begin(), tIds.end());
+        const size_t nBatch = std::max(mnEvictBatch, 1);
+        bool bOK = true;
+
+        for (size_t i = 0; i < vtIds.size() && bOK; i += nBatch) {
+
+            std::vector<TileBlocks> tiles(std::min(nBatch, vtIds.size() - i));
+
+            for (size_t j = 0; j < tiles.size(); j++)
+                tiles[j].tId = vtIds[i + j];
+
+            bOK = mpTileStore->getTiles(tiles);
+
+            for (size_t j = 0; j < tiles.size() && bOK; j++)
+                bOK = snapshot.addTile(tiles[j]);
+        }
+
+        bOK = bOK && snapshot.finish(info, index);
+
+        end_t = clock();
+
+        if (bOK)
+            cout << "save map " << filename << " with " << vtIds.size() << " tiles use time "
+                 << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+        else
+            cerr << "save map " << filename << " failed" << endl;
 
     }
 
     void Cache::LoadMap(const string &filename) {
-        // loadMap to files
 
-        std::ifstream ifs("savetest.txt");
-        boost::archive::text_iarchive ia(ifs);
-        ia >> mpMap;
-        ifs.close();
+        time_t start_t, end_t;
+        start_t = clock();
+
+        if (mpMap->KeyFramesInMap() > 0) {
+            cerr << "the map is not empty, " << filename << " is not loaded" << endl;
+            return;
+        }
+
+        MapSnapshot *pSnapshot = new MapSnapshot();
+
+        if (!pSnapshot->open(filename)) {
+            delete pSnapshot;
+            return;
+        }
+
+        const SnapshotInfo &info = pSnapshot->info();
+
+        if (info.format != mTileFormat) {
+            cerr << "the map " << filename << " was saved with another tile format" << endl;
+            delete pSnapshot;
+            return;
+        }
+
+        unique_lock<mutex> lock(mMutexStop);
+
+        // only the index is read here, the tiles are read when the camera gets close to them
+        if (!TileCodec::decodeTopoIndex(pSnapshot->indexData(), pSnapshot->indexSize(), mTopoMap)) {
+            cerr << "the index of the map " << filename << " is damaged" << endl;
+            delete pSnapshot;
+            return;
+        }
+
+        size_t nKFs = 0;
+
+        for (std::map<TopoId, std::set<long unsigned int> >::iterator mit = mTopoMap->mpTopoKFs.begin(); mit != mTopoMap->mpTopoKFs.end(); mit++) {
+            for (std::set<long unsigned int>::iterator kit = mit->second.begin(); kit != mit->second.end(); kit++) {
+                if (mTopoMap->searchKeyFrameBowVector(*kit))
+                    mpKeyFrameDatabase->add(*kit, mTopoMap->getKeyFrameBowVector(*kit), this);
+                nKFs++;
+            }
+        }
+
+        KeyFrame::nNextId = std::max(KeyFrame::nNextId, info.nKFNextId);
+        MapPoint::nNextId = std::max(MapPoint::nNextId, info.nMPNextId);
+
+        std::set<TopoId> tIds;
+        pSnapshot->getTileIds(tIds);
+
+        for (std::set<TopoId>::iterator mit = tIds.begin(); mit != tIds.end(); mit++) {
+            TopoIdStatus[*mit] = IN_SERVER;
+            mTpInCache.erase(*mit);
+        }
+
+        mpTileStore = new SnapshotTileStore(mpTileStore, pSnapshot);
+
+        // the tiles around the pose the map was saved at
+        mCurrentTopoId = info.currentTopoId;
+
+        if (mCurrentTopoId != 0)
+            transTopoMapKeyFrames();
+
+        end_t = clock();
+
+        cout << "load map " << filename << " with " << tIds.size() << " tiles, " << nKFs << " keyframes, "
+             << mTpInCache.size() << " tiles in cache use time " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
 
     }
 
     void Cache::getAllKeyFramePose() {
 
-        DataDriver DB(this);
-        DB.getAllKeyFramePose();
+        waitForEvictions();
+
+        mpDataDriver->getAllKeyFramePose();
+
+    }
+
+    cv::Mat Cache::getStoredKeyFramePose(long unsigned int pId) {
+
+        std::map<long unsigned int, cv::Mat>::iterator mit = mTopoMap->mpKfPose.find(pId);
+
+        return mit != mTopoMap->mpKfPose.end() ? mit->second.clone() : cv::Mat();
 
     }
 
     void Cache::getAllMapPointPose() {
 
-        DataDriver DB(this);
-        DB.getAllMapPointPose();
+        waitForEvictions();
+
+        mpDataDriver->getAllMapPointPose();
 
     }
 
@@ -365,13 +653,14 @@ namespace ORB_SLAM2 {
 
     void Cache::updateAllPoseToServer(){
 
-        updatePoseInCache();
+        waitForEvictions();
 
-        DataDriver DB(this);
+        // the prefetched copies are older than the corrected poses
+        dropPrefetchedTiles();
 
-        DB.updateAllKeyFramePose();
+        updatePoseInCache();
 
-        DB.updateAllMapPointPose();
+        mpDataDriver->updateChangedPoses();
 
     }
 
@@ -446,11 +735,30 @@ namespace ORB_SLAM2 {
 
     void Cache::run() {
 
+        // fixed thresholds, else malloc raises them as the descriptors are freed and keeps the freed pages
+        if (mnMmapThreshold > 0) {
+            mallopt(M_MMAP_THRESHOLD, mnMmapThreshold);
+            mallopt(M_TRIM_THRESHOLD, 4 * mnMmapThreshold);
+        }
+
+        for (int i = 0; i < mnIOWorkers; i++)
+            mvptIOWorkers.push_back(new thread(&Cache::ioWorkerRun, this));
+
+        if (mfPrefetchHorizon > 0)
+            mptPrefetcher = new thread(&Cache::prefetchRun, this);
+
         while (1) {
 
+            // the objects of the written back tiles no thread can still see
+            EpochManager::collect();
+
+            TileArena::setDefaultTile(mCurrentTopoId);
+
+            // the sections only cover the branches reading the objects, the wait of a stop does not pin the epoch
             if (CheckTopoMapUnSatisfied()) {
 
                 try {
+                    EpochGuard guard;
                     unique_lock<mutex> lock(mMutexStop);
                     transTopoMapKeyFrames();
                 } catch( ... ) {
@@ -464,16 +772,119 @@ namespace ORB_SLAM2 {
                 }
                 if (CheckFinish())
                     break;
+            } else if (mptPrefetcher) {
+
+                EpochGuard guard;
+                schedulePrefetch();
+
+            }
+
+            if (mpJournal && std::chrono::duration<float>(std::chrono::steady_clock::now() - mJournalTime).count() >= mfJournalInterval) {
+
+                try {
+                    EpochGuard guard;
+                    unique_lock<mutex> lock(mMutexStop);
+                    if (!mbStopped) {
+                        journalChanges();
+                        if (mpJournal->segmentBytes() >= ((uint64_t) mnJournalCheckpointSize << 20))
+                            checkpointJournal();
+                    }
+                } catch( ... ) {
+                    cout << "error at journal\n";
+                }
+
+            }
+
+            if ((mnTileSplitKeyFrames > 0 || mnTileSplitSize > 0) && mTopoMap->getMaxTileLevel() > 0 &&
+                std::chrono::duration<float>(std::chrono::steady_clock::now() - mTileAdaptTime).count() >= 1.0) {
+
+                try {
+                    EpochGuard guard;
+                    unique_lock<mutex> lock(mMutexStop);
+                    if (!mbStopped)
+                        adaptTileSizes();
+                } catch( ... ) {
+                    cout << "error at tile sizes\n";
+                }
+
+                mTileAdaptTime = std::chrono::steady_clock::now();
+            }
+
+            if (mfMemoryLogInterval > 0 &&
+                std::chrono::duration<float>(std::chrono::steady_clock::now() - mMemoryLogTime).count() >= mfMemoryLogInterval) {
+
+                try {
+                    EpochGuard guard;
+                    unique_lock<mutex> lock(mMutexStop);
+                    if (!mbStopped)
+                        measureMemory();
+                } catch( ... ) {
+                    cout << "error at memory accounting\n";
+                }
+
+                mMemoryLogTime = std::chrono::steady_clock::now();
             }
 
             if (CheckFinish())
                 break;
 
-            malloc_trim(0);
             usleep(3000);
 
         }
 
+        // the workers drain the eviction queue before leaving
+        {
+            unique_lock<mutex> lock(mMutexEvictQueue);
+            mbStopIOWorkers = true;
+        }
+        mCondEvictQueue.notify_all();
+
+        for (size_t i = 0; i < mvptIOWorkers.size(); i++) {
+            mvptIOWorkers[i]->join();
+            delete mvptIOWorkers[i];
+        }
+        mvptIOWorkers.clear();
+
+        if (mptPrefetcher) {
+            {
+                unique_lock<mutex> lock(mMutexPrefetch);
+                mbStopPrefetcher = true;
+            }
+            mCondPrefetch.notify_all();
+            mptPrefetcher->join();
+            delete mptPrefetcher;
+            mptPrefetcher = nullptr;
+        }
+
+        // what is left in cache goes to the store, the next run has nothing to replay
+        if (mpJournal) {
+            try {
+                unique_lock<mutex> lock(mMutexStop);
+                journalChanges();
+                checkpointJournal();
+            } catch( ... ) {
+                cout << "error at journal\n";
+            }
+            mpJournal->report();
+        }
+
+        PrefetchStats stats = getPrefetchStats();
+        cout << "prefetch issued " << stats.nIssued << " hits " << stats.nHits << " misses " << stats.nMisses
+             << " wasted " << stats.nWasted << endl;
+        cout << "evicted tiles written " << mnDirtyTilesWritten << " skipped clean " << mnCleanTilesSkipped << endl;
+
+        MemoryStats memory = getMemoryStats();
+        cout << "memory: " << memory.nKeyFrames << " keyframes " << (memory.keyFrameBytes >> 20) << " MB, "
+             << memory.nMapPoints << " mappoints " << (memory.mapPointBytes >> 20) << " MB, "
+             << memory.nTiles << " tiles, resident " << (memory.residentBytes >> 20) << " MB" << endl;
+
+        EpochManager::collect();
+        EpochStats epochs = EpochManager::stats();
+        cout << "reclaimed " << epochs.nFreed << " evicted objects, " << epochs.nRetired << " waiting" << endl;
+
+        mpDataDriver->reportCodecs();
+        mpConnections->report();
+
         SetFinish();
     }
 
@@ -483,6 +894,12 @@ namespace ORB_SLAM2 {
 
         if (mCurrentTopoId == 0) return false;
 
+        // the budget is checked again when the camera enters another tile, and every second for the growth
+        // of the map in place
+        if (mnMemoryBudget > 0)
+            return mCurrentTopoId != mWindowTopoId ||
+                   std::chrono::duration<float>(std::chrono::steady_clock::now() - mWindowTime).count() >= 1.0;
+
         std::set<TopoId> tpNeedInCache;
 
         tpNeedInCache = mTopoMap->getTopoMapsNeedInCache(mCurrentTopoId);
@@ -509,6 +926,12 @@ namespace ORB_SLAM2 {
 
         tpNeedInCache = mTopoMap->getTopoMapsNeedInCache(mCurrentTopoId);
 
+        if (mnMemoryBudget > 0)
+            tpNeedInCache = selectTopoMapsInBudget(tpNeedInCache);
+
+        mWindowTopoId = mCurrentTopoId;
+        mWindowTime = std::chrono::steady_clock::now();
+
         std::set<TopoId> tpNeedOutCache;
 
         for (std::set<TopoId>::iterator mit = mTpInCache.begin(); mit != mTpInCache.end(); mit++) {
@@ -541,37 +964,29 @@ namespace ORB_SLAM2 {
 
         cout << endl;
 
-        for (std::set<TopoId>::iterator mit = tpNeedOutCache.begin(); mit != tpNeedOutCache.end(); mit++) {
-
-            std::set<long unsigned int> tKFs = mTopoMap->getKFsbyTopoId((*mit));
+        evictTopoMaps(tpNeedOutCache);
 
-            transKeyFrameToServer(tKFs);
-
-            std::set<long unsigned int> tmps = mTopoMap->getMapPoints(*mit);
+        for (std::set<TopoId>::iterator mit = tpNeedOutCache.begin(); mit != tpNeedOutCache.end(); mit++)
+            TopoIdStatus[*mit] = IN_SERVER;
 
-            std::set<MapPoint *> mps;
+        mbDemandIO = true;
 
-            mps.clear();
+        std::vector<TopoId> tpFetch;
 
-            for (std::set<long unsigned int>::iterator mpid = tmps.begin(); mpid != tmps.end(); mpid++)
-                if (lMPToMPmap.find(*mpid) != lMPToMPmap.end())
-                    mps.insert(lMPToMPmap[*mpid]);
+        for (std::set<TopoId>::iterator mit = tpNeedInCache.begin(); mit != tpNeedInCache.end(); mit++) {
 
-            if (mps.size() > 0)
-                transMapPointToServer(*mit, mps);
+            // the tile has not left the process yet, put it back instead of fetching it
+            if (restoreInFlightTopoMap(*mit)) {
 
-            TopoIdStatus[*mit] = IN_SERVER;
-        }
+                TopoIdStatus[*mit] = UN_USE;
 
-        for (std::set<TopoId>::iterator mit = tpNeedInCache.begin(); mit != tpNeedInCache.end(); mit++) {
+                continue;
+            }
 
             if (TopoIdStatus.find(*mit) != TopoIdStatus.end() && TopoIdStatus[*mit] == IN_SERVER) {
 
-                std::set<long unsigned int> tKFs = mTopoMap->getKFsbyTopoId((*mit));
-
-                transKeyFrameFromServer(*mit, tKFs);
-
-                transMapPointFromServer(*mit);
+                if (!takePrefetchedTile(*mit))
+                    tpFetch.push_back(*mit);
 
                 TopoIdStatus[*mit] = UN_USE;
 
@@ -579,167 +994,1672 @@ namespace ORB_SLAM2 {
 
         }
 
+        transTopoMapsFromServer(tpFetch);
+
+        mbDemandIO = false;
+
     }
 
-    void Cache::transKeyFrameToServer(std::set<long unsigned int> pkfs) {
+    size_t Cache::estimateTileBytes(TopoId tId) {
 
-        DataDriver DB(this);
+        std::set<long unsigned int> tKFs = mTopoMap->getKFsbyTopoId(tId);
 
-        vector<KeyFrame *> tpkfs;
-        tpkfs.clear();
+        std::set<long unsigned int> tMPs = mTopoMap->getMapPoints(tId);
 
-        long unsigned int tid = 0;
-        {
-            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+        // a mappoint shared with another tile counts in both, it stays while one of them is in cache
+        size_t bytes = 0;
 
-            for (std::set<long unsigned int>::iterator mit = pkfs.begin(); mit != pkfs.end(); mit++) {
+        for (std::set<long unsigned int>::iterator mit = tKFs.begin(); mit != tKFs.end(); mit++)
+            bytes += mpMap->mMemory.keyFrameBytes(*mit);
 
-                KeyFrame *tKF = getKeyFrameById(*mit);
+        for (std::set<long unsigned int>::iterator mit = tMPs.begin(); mit != tMPs.end(); mit++)
+            bytes += mpMap->mMemory.mapPointBytes(*mit);
 
-                if (tKF) {
+        return bytes;
 
-                    tpkfs.push_back(tKF);
+    }
 
-                    tid = tKF->mTopoId;
+    void Cache::measureMemory() {
 
-                    mpMap->transKeyframeToBack(tKF);
+        std::map<std::string, size_t> structures;
 
-                    {
-                        unique_lock<mutex> lock(mMutexlKFToKFmap);
-                        lKFToKFmap.erase(*mit);
-                        kfStatus[*mit] = KF_IN_SERVER;
-                    }
+        {
+            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+            mpMap->anlyzMapsize();
+            mTopoMap->memoryBytes(structures);
+        }
 
-                }
+        size_t index = 0;
 
-            }
+        {
+            unique_lock<mutex> lock(mMutexlKFToKFmap);
+            index += heapBytes(lKFToKFmap) + heapBytes(kfStatus) + heapBytes(kfTimstamp);
         }
 
         {
-            DB.TransTopoKeyFramesToServer(tid, tpkfs);
+            unique_lock<mutex> lock(mMutexMPToMPmap);
+            index += heapBytes(lMPToMPmap);
+        }
 
+        {
+            unique_lock<mutex> lock(mMutexTmpKFMap);
+            index += heapBytes(tmpKFMap);
         }
-//        {
-//
-//            for (int i = 0; i < (int) tpkfs.size(); i++) {
-//                if (tpkfs[i])
-//                    delete tpkfs[i];
-//            }
-//        }
 
+        structures["cache index"] = index;
 
-    }
+        // the room of the arena chunks not taken by an object
+        TileArenaStats arena = TileArena::stats();
+        structures["tile arenas"] = arena.mappedBytes - arena.liveBytes;
 
-    void Cache::keepTopoIdSetInCache(std::set<TopoId> tps) {
+        for (std::map<std::string, size_t>::iterator mit = structures.begin(); mit != structures.end(); mit++)
+            mpMap->mMemory.setStructure(mit->first, mit->second);
 
-        for (std::set<TopoId>::iterator mit = tps.begin(); mit != tps.end(); mit++) {
+        if (!mbMemoryLogOpen && !mMemoryLogPath.empty()) {
+            mpMap->mMemory.openLog(mMemoryLogPath);
+            mbMemoryLogOpen = true;
+        }
 
-            cout << *mit << endl;
+        mpMap->mMemory.log(std::chrono::duration<double>(std::chrono::steady_clock::now() - mMemoryLogStart).count());
 
-            if (mTpInCache.find(*mit) == mTpInCache.end()) {
+    }
 
-                std::set<long unsigned int> tKFs = mTopoMap->getKFsbyTopoId((*mit));
+    MemoryStats Cache::getMemoryStats() {
 
-//                transKeyFrameFromServer(tKFs);
+        return mpMap->mMemory.stats();
 
-                transMapPointFromServer(*mit);
+    }
 
-                mTpInCache.insert(*mit);
+    void Cache::adaptTileSizes() {
 
-            }
+        unique_lock<mutex> lock(mCorrectLoopMutex);
 
-            TopoIdStatus[*mit] = IN_USE;
+        const size_t splitBytes = (size_t) mnTileSplitSize << 20;
 
-        }
+        std::set<TopoId> tpSplit;
 
-    }
+        std::map<TopoId, size_t> nKFs, nBytes;
 
-    void Cache::setTopoIdSetUnUse(std::set<TopoId> tps) {
+        for (std::set<TopoId>::iterator mit = mTpInCache.begin(); mit != mTpInCache.end(); mit++) {
 
-        for (std::set<TopoId>::iterator mit = tps.begin(); mit != tps.end(); mit++) {
-            TopoIdStatus[*mit] = UN_USE;
-        }
-    }
+            nKFs[*mit] = mTopoMap->getKFsbyTopoId(*mit).size();
+            nBytes[*mit] = mnTileSplitSize > 0 ? estimateTileBytes(*mit) : 0;
 
-    void Cache::transKeyFrameFromServer(long unsigned int tid, std::set<long unsigned int> pkfs) {
+            // the tiles held by the loop closing keep their id
+            if (TopoIdStatus[*mit] != UN_USE || mTopoMap->getTileLevel(*mit) >= mTopoMap->getMaxTileLevel())
+                continue;
 
-        DataDriver DB(this);
+            if ((mnTileSplitKeyFrames > 0 && nKFs[*mit] > (size_t) mnTileSplitKeyFrames) ||
+                (mnTileSplitSize > 0 && nBytes[*mit] > splitBytes))
+                tpSplit.insert(*mit);
+        }
 
-        std::set<KeyFrame *> kfs;
+        // the parents whose 8 children are leaves in cache, or empty
+        std::set<TopoId> tpParents;
+        for (std::set<TopoId>::iterator mit = mTpInCache.begin(); mit != mTpInCache.end(); mit++)
+            if (mTopoMap->getTileLevel(*mit) > 0 && !tpSplit.count(*mit))
+                tpParents.insert(mTopoMap->getParentTile(*mit));
 
-        if (pkfs.size() <= 0) return;
+        std::map<TopoId, std::set<TopoId> > tpMerge;
 
-        kfs = DB.TransTopoKeyFramesFromServer(tid);
-        {
-            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
-            for (std::set<KeyFrame *>::iterator mit = kfs.begin(); mit != kfs.end(); mit++) {
+        for (std::set<TopoId>::iterator mit = tpParents.begin(); mit != tpParents.end(); mit++) {
 
-                if (*mit) {
+            std::vector<TopoId> children = mTopoMap->getChildTiles(*mit);
 
-                    (*mit)->setCache(this);
+            size_t nParentKFs = 0, nParentBytes = 0;
+            bool bMerge = true;
 
-                    AddKeyFrameToMap(*mit);
+            std::set<TopoId> tpResident;
 
+            for (size_t i = 0; i < children.size() && bMerge; i++) {
+
+                if (mTopoMap->isTileSplit(children[i]) || tpSplit.count(children[i])) {
+                    bMerge = false;
+                } else if (mTpInCache.count(children[i])) {
+                    bMerge = TopoIdStatus[children[i]] == UN_USE;
+                    nParentKFs += nKFs[children[i]];
+                    nParentBytes += nBytes[children[i]];
+                    tpResident.insert(children[i]);
+                } else {
+                    // a stored child would have to be fetched first
+                    bMerge = mTopoMap->getKFsbyTopoId(children[i]).empty() && mTopoMap->getMapPoints(children[i]).empty();
                 }
             }
+
+            {
+                unique_lock<mutex> lock2(mMutexEvictQueue);
+                for (size_t i = 0; i < children.size() && bMerge; i++)
+                    bMerge = mInFlightTiles.find(children[i]) == mInFlightTiles.end();
+                bMerge = bMerge && mInFlightTiles.find(*mit) == mInFlightTiles.end();
+            }
+
+            // far below the split thresholds, so a tile does not split and merge in turn
+            if (bMerge && (mnTileSplitKeyFrames <= 0 || 4 * nParentKFs < (size_t) mnTileSplitKeyFrames) &&
+                (mnTileSplitSize <= 0 || 4 * nParentBytes < splitBytes))
+                tpMerge[*mit] = tpResident;
         }
-    }
 
+        if (tpSplit.empty() && tpMerge.empty())
+            return;
 
-    void Cache::transMapPointToServer(TopoId tId, std::set<MapPoint *> vMP) {
+        for (std::set<TopoId>::iterator mit = tpSplit.begin(); mit != tpSplit.end(); mit++) {
 
-        DataDriver DB(this);
+            std::vector<TopoId> children = mTopoMap->getChildTiles(*mit);
 
-        vector<long unsigned int> finishedTransMps = DB.TransTopoMapPointsToServer(tId, vMP);
+            cout << "split tile " << *mit << " (" << nKFs[*mit] << " keyframes, " << (nBytes[*mit] >> 20) << " MB)" << endl;
 
-        {
-            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+            mTopoMap->setTileSplit(*mit, true);
 
-            for (int mit = 0; mit < (int) finishedTransMps.size(); mit++) {
+            std::set<TopoId> from;
+            from.insert(*mit);
 
-                long unsigned int tId = finishedTransMps[mit];
+            retileTopoMaps(from, std::set<TopoId>(children.begin(), children.end()));
+        }
 
-                MapPoint *tMP = getMapPointById(tId);
+        for (std::map<TopoId, std::set<TopoId> >::iterator mit = tpMerge.begin(); mit != tpMerge.end(); mit++) {
 
-                if (tMP) {
+            cout << "merge the children of tile " << mit->first << endl;
 
-                    std::set<TopoId> topoSet = tMP->mpTopoIds;
+            mTopoMap->setTileSplit(mit->first, false);
 
-                    bool flag = false;
+            std::set<TopoId> to;
+            to.insert(mit->first);
 
-                    for (std::set<TopoId>::iterator ptId = topoSet.begin(); ptId != topoSet.end(); ptId++) {
-                        if (mTpInCache.find(*ptId) != mTpInCache.end()) {
-                            flag = true;
-                            break;
-                        }
-                    }
+            retileTopoMaps(mit->second, to);
+        }
 
-                    if (!flag) {
+        // the window follows the new tile of the last keyframe
+        TopoId tCurrent = mTopoMap->getKeyFrameTopoId(mnCurrentKFId);
+        if (tCurrent != 0)
+            mCurrentTopoId = tCurrent;
 
-                        mpMap->EraseMapPoint(tMP);
-                        {
-                            unique_lock<mutex> lock(mMutexMPToMPmap);
-                            lMPToMPmap.erase(tId);
+        // the prefetched copies may be of the tiles which were just emptied
+        dropPrefetchedTiles();
+
+    }
+
+    void Cache::retileTopoMaps(const std::set<TopoId> &from, const std::set<TopoId> &to) {
+
+        {
+            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+            // the keyframes go to the leaf containing them
+            for (std::set<TopoId>::const_iterator mit = from.begin(); mit != from.end(); mit++) {
+
+                std::set<long unsigned int> tKFs = mTopoMap->getKFsbyTopoId(*mit);
+
+                for (std::set<long unsigned int>::iterator kit = tKFs.begin(); kit != tKFs.end(); kit++) {
+                    KeyFrame *pKF = getKeyFrameById(*kit);
+                    if (!pKF)
+                        continue;
+                    mTopoMap->addKeyFrame(pKF);
+                    pKF->SetDirty();
+                }
+            }
+
+            // the mappoints go to the tiles of the keyframes observing them
+            for (std::set<TopoId>::const_iterator mit = from.begin(); mit != from.end(); mit++) {
+
+                std::set<long unsigned int> tMPs = mTopoMap->getMapPoints(*mit);
+
+                for (std::set<long unsigned int>::iterator pit = tMPs.begin(); pit != tMPs.end(); pit++) {
+
+                    mTopoMap->eraseMapPointFromTile(*pit, *mit);
+
+                    MapPoint *pMP = getMapPointById(*pit);
+                    if (!pMP)
+                        continue;
+
+                    std::set<TopoId> tNew;
+
+                    std::vector<pair<long unsigned int, LoopKeyPoint> > obs = pMP->getObeservationIds();
+                    for (size_t i = 0; i < obs.size(); i++) {
+                        TopoId tId = mTopoMap->getKeyFrameTopoId(obs[i].first);
+                        if (to.count(tId))
+                            tNew.insert(tId);
+                    }
+
+                    if (tNew.empty()) {
+                        cv::Mat pos = pMP->GetWorldPos();
+                        TopoId tId = mTopoMap->generateId(cv::Point3d(pos.at<float>(0), pos.at<float>(1), pos.at<float>(2)));
+                        tNew.insert(to.count(tId) ? tId : *to.begin());
+                    }
+
+                    pMP->mpTopoIds.erase(*mit);
+
+                    for (std::set<TopoId>::iterator tit = tNew.begin(); tit != tNew.end(); tit++) {
+                        pMP->mpTopoIds.insert(*tit);
+                        mTopoMap->addMapPoint(pMP, *tit);
+                    }
+
+                    pMP->SetDirty();
+                }
+            }
+        }
+
+        for (std::set<TopoId>::const_iterator mit = from.begin(); mit != from.end(); mit++) {
+            mTpInCache.erase(*mit);
+            mTileBytes.erase(*mit);
+        }
+
+        for (std::set<TopoId>::const_iterator mit = to.begin(); mit != to.end(); mit++) {
+            mTpInCache.insert(*mit);
+            TopoIdStatus[*mit] = UN_USE;
+        }
+
+        // the emptied tiles are written once, their stored copies must not bring the objects back
+        evictTopoMaps(from);
+
+        for (std::set<TopoId>::const_iterator mit = from.begin(); mit != from.end(); mit++)
+            TopoIdStatus[*mit] = IN_SERVER;
+
+    }
+
+    std::set<TopoId> Cache::selectTopoMapsInBudget(const std::set<TopoId> &tpWindow) {
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        const size_t budget = (size_t) mnMemoryBudget << 20;
+
+        std::set<TopoId> tpGuaranteed = mTopoMap->getTopoMapsInRange(mCurrentTopoId, mnGuaranteedTiles);
+
+        for (std::set<TopoId>::iterator mit = tpGuaranteed.begin(); mit != tpGuaranteed.end(); mit++)
+            mTileLastUsed[*mit] = now;
+
+        // keyframes of the current local map, by tile
+        std::map<TopoId, int> covisibles;
+        std::vector<long unsigned int> vCovKFs = mTopoMap->GetVectorCovisibleKeyFrames(mnCurrentKFId);
+        for (size_t i = 0; i < vCovKFs.size(); i++) {
+            const TopoId tId = mTopoMap->getKeyFrameTopoId(vCovKFs[i]);
+            covisibles[tId]++;
+            mTileLastUsed[tId] = now;
+        }
+
+        // the tiles in cache are measured again, the others keep the size they had when they left
+        for (std::set<TopoId>::iterator mit = mTpInCache.begin(); mit != mTpInCache.end(); mit++)
+            mTileBytes[*mit] = estimateTileBytes(*mit);
+
+        size_t nKnown = 0, knownBytes = 0;
+        for (std::map<TopoId, size_t>::iterator mit = mTileBytes.begin(); mit != mTileBytes.end(); mit++) {
+            if (mit->second > 0) {
+                nKnown++;
+                knownBytes += mit->second;
+            }
+        }
+
+        // a stored tile never seen by this run, e.g. from a snapshot, is taken for an average one
+        const size_t averageBytes = nKnown ? knownBytes / nKnown : 0;
+
+        std::set<TopoId> tpCandidates(mTpInCache);
+        tpCandidates.insert(tpWindow.begin(), tpWindow.end());
+
+        std::set<TopoId> tpKeep;
+        size_t bytes = 0;
+
+        std::vector<pair<double, TopoId> > vRanked;
+
+        for (std::set<TopoId>::iterator mit = tpCandidates.begin(); mit != tpCandidates.end(); mit++) {
+
+            std::map<TopoId, TopoId_status>::iterator sit = TopoIdStatus.find(*mit);
+            const bool bStored = sit != TopoIdStatus.end() && sit->second == IN_SERVER;
+
+            std::map<TopoId, size_t>::iterator bit = mTileBytes.find(*mit);
+            const size_t size = bit != mTileBytes.end() ? bit->second : (bStored ? averageBytes : 0);
+
+            // the guaranteed tiles and the tiles held by the loop closing are always kept
+            if (tpGuaranteed.count(*mit) || (sit != TopoIdStatus.end() && sit->second == IN_USE)) {
+                tpKeep.insert(*mit);
+                bytes += size;
+                continue;
+            }
+
+            // empty tiles cost nothing, they are kept within the window as before
+            if (size == 0 && !bStored) {
+                if (tpWindow.count(*mit))
+                    tpKeep.insert(*mit);
+                continue;
+            }
+
+            const double distance = mTopoMap->getTileDistance(*mit, mCurrentTopoId);
+
+            // a tile never used counts as an hour old
+            double age = 3600;
+            std::map<TopoId, std::chrono::steady_clock::time_point>::iterator uit = mTileLastUsed.find(*mit);
+            if (uit != mTileLastUsed.end())
+                age = std::chrono::duration<double>(now - uit->second).count();
+
+            const double value = (1.0 + covisibles[*mit]) / ((1.0 + distance) * (1.0 + age / 30.0));
+
+            vRanked.push_back(make_pair(value, *mit));
+        }
+
+        // the most valuable first, while they fit
+        std::sort(vRanked.rbegin(), vRanked.rend());
+
+        int nLeftOut = 0;
+
+        for (size_t i = 0; i < vRanked.size(); i++) {
+
+            std::map<TopoId, size_t>::iterator bit = mTileBytes.find(vRanked[i].second);
+            const size_t size = bit != mTileBytes.end() ? bit->second : averageBytes;
+
+            if (bytes + size > budget) {
+                nLeftOut++;
+                continue;
+            }
+
+            tpKeep.insert(vRanked[i].second);
+            bytes += size;
+        }
+
+        cout << "tile budget: " << tpKeep.size() << " tiles, " << (bytes >> 20) << " of " << mnMemoryBudget
+             << " MB, " << nLeftOut << " left out" << endl;
+
+        return tpKeep;
+
+    }
+
+    void Cache::evictTopoMaps(const std::set<TopoId> &tIds) {
+
+        std::vector<std::shared_ptr<EvictedTile> > tiles;
+
+        for (std::set<TopoId>::const_iterator mit = tIds.begin(); mit != tIds.end(); mit++) {
+
+            // bounded queue, the cache thread waits here when the workers fall behind
+            {
+                unique_lock<mutex> lock(mMutexEvictQueue);
+                while ((int) mEvictQueue.size() >= mnMaxEvictQueue && !mvptIOWorkers.empty() && !mbStopIOWorkers)
+                    mCondEvictDone.wait(lock);
+            }
+
+            std::shared_ptr<EvictedTile> tile = detachTopoMap(*mit);
+
+            if (mvptIOWorkers.empty()) {
+                tiles.push_back(tile);
+                continue;
+            }
+
+            {
+                unique_lock<mutex> lock(mMutexEvictQueue);
+                mEvictQueue.push_back(*mit);
+            }
+            mCondEvictQueue.notify_one();
+        }
+
+        if (!tiles.empty())
+            uploadEvictedTiles(tiles);
+
+    }
+
+    std::shared_ptr<EvictedTile> Cache::detachTopoMap(TopoId tId) {
+
+        std::shared_ptr<EvictedTile> tile(new EvictedTile());
+        tile->tId = tId;
+        tile->bUploading = false;
+        tile->bRestored = false;
+        tile->bReferenced = false;
+
+        std::set<long unsigned int> tKFs = mTopoMap->getKFsbyTopoId(tId);
+
+        std::set<long unsigned int> tmps = mTopoMap->getMapPoints(tId);
+
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+        for (std::set<long unsigned int>::iterator mit = tKFs.begin(); mit != tKFs.end(); mit++) {
+
+            KeyFrame *tKF = getKeyFrameById(*mit);
+
+            if (tKF)
+                tile->vKFs.push_back(tKF);
+        }
+
+        for (std::set<long unsigned int>::iterator mpid = tmps.begin(); mpid != tmps.end(); mpid++) {
+
+            SlotState state;
+            MapPoint *tMP = mMPSlots.get(*mpid, &state);
+
+            if (tMP == nullptr)
+                continue;
+
+            tile->sMPs.insert(tMP);
+
+            // detached by another tile still in flight, it is that tile's to restore or to free
+            if (state == SLOT_IN_FLIGHT)
+                continue;
+
+            // mappoints also seen from a tile in cache stay in the map
+            bool flag = false;
+
+            for (std::set<TopoId>::iterator ptId = tMP->mpTopoIds.begin(); ptId != tMP->mpTopoIds.end(); ptId++) {
+                if (mTpInCache.find(*ptId) != mTpInCache.end()) {
+                    flag = true;
+                    break;
+                }
+            }
+
+            if (!flag)
+                tile->vDetachedMPs.push_back(tMP);
+        }
+
+        // publish the in-flight objects before they leave the maps so lookups never miss them
+        {
+            unique_lock<mutex> lock2(mMutexEvictQueue);
+
+            for (size_t i = 0; i < tile->vKFs.size(); i++)
+                mKFSlots.set(tile->vKFs[i]->mnId, tile->vKFs[i], SLOT_IN_FLIGHT);
+
+            for (size_t i = 0; i < tile->vDetachedMPs.size(); i++)
+                mMPSlots.set(tile->vDetachedMPs[i]->mnId, tile->vDetachedMPs[i], SLOT_IN_FLIGHT);
+
+            // the shared mappoints may be detached and written back by another tile before this one
+            for (std::set<MapPoint *>::iterator mit = tile->sMPs.begin(); mit != tile->sMPs.end(); mit++)
+                mInFlightMPRefs[*mit]++;
+            tile->bReferenced = true;
+
+            mInFlightTiles[tId] = tile;
+        }
+
+        for (size_t i = 0; i < tile->vKFs.size(); i++) {
+
+            KeyFrame *tKF = tile->vKFs[i];
+
+            mpMap->transKeyframeToBack(tKF);
+
+            {
+                unique_lock<mutex> lock3(mMutexlKFToKFmap);
+                lKFToKFmap.erase(tKF->mnId);
+                kfStatus[tKF->mnId] = KF_IN_SERVER;
+            }
+        }
+
+        for (size_t i = 0; i < tile->vDetachedMPs.size(); i++) {
+
+            MapPoint *tMP = tile->vDetachedMPs[i];
+
+            mpMap->EraseMapPoint(tMP);
+            {
+                unique_lock<mutex> lock3(mMutexMPToMPmap);
+                lMPToMPmap.erase(tMP->mnId);
+            }
+        }
+
+        return tile;
+
+    }
+
+    bool Cache::restoreInFlightTopoMap(TopoId tId) {
+
+        std::shared_ptr<EvictedTile> tile;
+
+        {
+            unique_lock<mutex> lock(mMutexEvictQueue);
+
+            std::map<TopoId, std::shared_ptr<EvictedTile> >::iterator mit = mInFlightTiles.find(tId);
+
+            if (mit == mInFlightTiles.end())
+                return false;
+
+            tile = mit->second;
+
+            // an upload which already started is let to finish, then the tile is read back from the server
+            while (tile->bUploading)
+                mCondEvictDone.wait(lock);
+
+            mit = mInFlightTiles.find(tId);
+            if (mit == mInFlightTiles.end() || mit->second != tile)
+                return false;
+
+            tile->bRestored = true;
+            mEvictQueue.erase(std::remove(mEvictQueue.begin(), mEvictQueue.end(), tId), mEvictQueue.end());
+        }
+
+        {
+            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+            for (size_t i = 0; i < tile->vKFs.size(); i++)
+                AddKeyFrameToMap(tile->vKFs[i]);
+
+            for (size_t i = 0; i < tile->vDetachedMPs.size(); i++) {
+
+                MapPoint *tMP = tile->vDetachedMPs[i];
+
+                mpMap->AddMapPoint(tMP);
+                {
+                    unique_lock<mutex> lock2(mMutexMPToMPmap);
+                    lMPToMPmap[tMP->mnId] = tMP;
+                    mMPSlots.set(tMP->mnId, tMP, SLOT_RESIDENT);
+                }
+            }
+
+            // the objects were published in cache again above
+            unique_lock<mutex> lock2(mMutexEvictQueue);
+
+            releaseInFlightMapPoints(*tile);
+            mInFlightTiles.erase(tId);
+        }
+
+        mCondEvictDone.notify_all();
+
+        cout << "restore in-flight tile " << tId << endl;
+
+        return true;
+
+    }
+
+    bool Cache::writeBackTiles(const std::vector<std::shared_ptr<EvictedTile> > &tiles) {
+
+        bool bOK = true;
+
+        try {
+            std::vector<TopoId> tIds;
+            std::vector<std::vector<KeyFrame *> > vKFs;
+            std::vector<std::set<MapPoint *> > vMPs;
+            std::vector<uint8_t> codecs;
+
+            cv::Mat Ow;
+            {
+                unique_lock<mutex> lock(mMutexMotion);
+                if (!mCameraCenter.empty())
+                    Ow = mCameraCenter.clone();
+            }
+
+            // versions taken before encoding, a change made while the tile is written keeps the object dirty
+            std::vector<std::vector<unsigned int> > vKFVersions;
+            std::vector<std::vector<unsigned int> > vMPVersions;
+
+            int nClean = 0;
+
+            for (size_t i = 0; i < tiles.size(); i++) {
+                // an emptied tile is written once, so the objects which moved out are not loaded again from it
+                if (!isTileDirty(*tiles[i])) {
+                    if (!tiles[i]->vKFs.empty() || !tiles[i]->sMPs.empty())
+                        nClean++;
+                    continue;
+                }
+
+                tIds.push_back(tiles[i]->tId);
+                vKFs.push_back(tiles[i]->vKFs);
+                vMPs.push_back(tiles[i]->sMPs);
+                codecs.push_back(tileCodecFor(*tiles[i], Ow));
+
+                vKFVersions.push_back(std::vector<unsigned int>());
+                for (size_t j = 0; j < tiles[i]->vKFs.size(); j++)
+                    vKFVersions.back().push_back(tiles[i]->vKFs[j]->GetVersion());
+
+                vMPVersions.push_back(std::vector<unsigned int>());
+                for (std::set<MapPoint *>::iterator mit = tiles[i]->sMPs.begin(); mit != tiles[i]->sMPs.end(); mit++)
+                    vMPVersions.back().push_back((*mit)->GetVersion());
+            }
+
+            mnCleanTilesSkipped += nClean;
+
+            if (!tIds.empty()) {
+
+                if (mpDataDriver->TransTopoTilesToServer(tIds, vKFs, vMPs, codecs)) {
+
+                    for (size_t i = 0; i < tIds.size(); i++) {
+
+                        for (size_t j = 0; j < vKFs[i].size(); j++)
+                            vKFs[i][j]->SetStored(vKFVersions[i][j]);
+
+                        size_t j = 0;
+                        for (std::set<MapPoint *>::iterator mit = vMPs[i].begin(); mit != vMPs[i].end(); mit++, j++)
+                            (*mit)->SetStored(tIds[i], vMPVersions[i][j]);
+                    }
+
+                    mnDirtyTilesWritten += tIds.size();
+
+                } else {
+
+                    // written again on the next eviction
+                    for (size_t i = 0; i < tIds.size(); i++)
+                        mTopoMap->markTopoIdDirty(tIds[i]);
+
+                    bOK = false;
+                }
+            }
+
+            if (nClean > 0)
+                cout << "skipped " << nClean << " clean tiles of " << tiles.size() << endl;
+
+        } catch( ... ) {
+            cout << "error at uploading " << tiles.size() << " tiles" << endl;
+            for (size_t i = 0; i < tiles.size(); i++)
+                mTopoMap->markTopoIdDirty(tiles[i]->tId);
+            bOK = false;
+        }
+
+        return bOK;
+
+    }
+
+    void Cache::uploadEvictedTiles(const std::vector<std::shared_ptr<EvictedTile> > &tiles) {
+
+        bool bWritten;
+
+        {
+            // the mappoints shared with a tile in cache may be detached by another tile meanwhile
+            EpochGuard guard;
+            bWritten = writeBackTiles(tiles);
+        }
+
+        bool bRetry = false;
+
+        {
+            unique_lock<mutex> lock(mMutexEvictQueue);
+
+            for (size_t t = 0; t < tiles.size(); t++) {
+
+                const std::shared_ptr<EvictedTile> &tile = tiles[t];
+
+                tile->bUploading = false;
+
+                // the objects are the only up-to-date copy, they stay in flight and the tile is queued again
+                if (!bWritten) {
+
+                    std::map<TopoId, std::shared_ptr<EvictedTile> >::iterator mit = mInFlightTiles.find(tile->tId);
+
+                    if (mit == mInFlightTiles.end() || mit->second != tile)
+                        continue;
+
+                    if (!mbStopIOWorkers) {
+                        mEvictQueue.push_back(tile->tId);
+                        bRetry = true;
+                        continue;
+                    }
+
+                    // the process is ending, the objects are kept instead of being retired
+                    cerr << "evicted tile " << tile->tId << " could not be written back" << endl;
+                    releaseInFlightMapPoints(*tile);
+                    mInFlightTiles.erase(mit);
+                    continue;
+                }
+
+                // its sMPs are not read any more
+                releaseInFlightMapPoints(*tile);
+
+                std::map<TopoId, std::shared_ptr<EvictedTile> >::iterator mit = mInFlightTiles.find(tile->tId);
+
+                if (mit != mInFlightTiles.end() && mit->second == tile) {
+
+                    // unless the object was fetched again meanwhile
+                    for (size_t i = 0; i < tile->vKFs.size(); i++)
+                        mKFSlots.release(tile->vKFs[i]->mnId, tile->vKFs[i], SLOT_IN_FLIGHT);
+
+                    for (size_t i = 0; i < tile->vDetachedMPs.size(); i++)
+                        mMPSlots.release(tile->vDetachedMPs[i]->mnId, tile->vDetachedMPs[i], SLOT_IN_FLIGHT);
+
+                    // not restored, the objects are only reachable by the threads which got them before
+                    if (mbReclaimEvicted) {
+                        for (size_t i = 0; i < tile->vKFs.size(); i++)
+                            EpochManager::retire(tile->vKFs[i]);
+
+                        // another tile in flight may still write it
+                        for (size_t i = 0; i < tile->vDetachedMPs.size(); i++) {
+                            if (mInFlightMPRefs.count(tile->vDetachedMPs[i]))
+                                mRetiringMPs.insert(tile->vDetachedMPs[i]);
+                            else
+                                EpochManager::retire(tile->vDetachedMPs[i]);
+                        }
+                    }
+
+                    mInFlightTiles.erase(mit);
+                }
+            }
+        }
+
+        mCondEvictDone.notify_all();
+
+        // the store is given some time before the retry
+        if (bRetry) {
+            mCondEvictQueue.notify_one();
+            usleep(100000);
+        }
+
+    }
+
+    void Cache::releaseInFlightMapPoints(EvictedTile &tile) {
+
+        if (!tile.bReferenced)
+            return;
+
+        tile.bReferenced = false;
+
+        for (std::set<MapPoint *>::iterator mit = tile.sMPs.begin(); mit != tile.sMPs.end(); mit++) {
+
+            std::map<MapPoint *, int>::iterator rit = mInFlightMPRefs.find(*mit);
+
+            if (rit == mInFlightMPRefs.end() || --rit->second > 0)
+                continue;
+
+            mInFlightMPRefs.erase(rit);
+
+            // the last tile which could write it is done
+            if (mRetiringMPs.erase(*mit))
+                EpochManager::retire(*mit);
+        }
+
+    }
+
+    void Cache::ioWorkerRun() {
+
+        while (1) {
+
+            std::vector<std::shared_ptr<EvictedTile> > tiles;
+
+            {
+                unique_lock<mutex> lock(mMutexEvictQueue);
+
+                while (mEvictQueue.empty() && !mbStopIOWorkers)
+                    mCondEvictQueue.wait(lock);
+
+                if (mEvictQueue.empty())
+                    break;
+
+                // take whatever is queued, up to one batch
+                while (!mEvictQueue.empty() && (int) tiles.size() < std::max(mnEvictBatch, 1)) {
+
+                    TopoId tId = mEvictQueue.front();
+                    mEvictQueue.pop_front();
+
+                    std::map<TopoId, std::shared_ptr<EvictedTile> >::iterator mit = mInFlightTiles.find(tId);
+
+                    if (mit != mInFlightTiles.end() && !mit->second->bRestored && !mit->second->bUploading) {
+                        mit->second->bUploading = true;
+                        tiles.push_back(mit->second);
+                    }
+                }
+            }
+
+            // slots of the bounded queue are free
+            mCondEvictDone.notify_all();
+
+            if (!tiles.empty())
+                uploadEvictedTiles(tiles);
+
+        }
+
+    }
+
+    cv::Mat Cache::getCameraCenter() {
+
+        unique_lock<mutex> lock(mMutexMotion);
+
+        return mCameraCenter.clone();
+
+    }
+
+    void Cache::updateMotion(const cv::Mat &Tcw, const cv::Mat &Velocity, const double &timestamp) {
+
+        if (Tcw.empty())
+            return;
+
+        cv::Mat Rcw = Tcw.rowRange(0, 3).colRange(0, 3);
+        cv::Mat tcw = Tcw.rowRange(0, 3).col(3);
+        cv::Mat Ow = -Rcw.t() * tcw;
+
+        unique_lock<mutex> lock(mMutexMotion);
+
+        // velocity of the camera center from the constant velocity model of the tracker
+        cv::Mat vFrame;
+        if (!Velocity.empty() && !mCameraCenter.empty() && timestamp > mMotionStamp) {
+            cv::Mat LastTwc = Tcw.inv() * Velocity;
+            vFrame = (Ow - LastTwc.rowRange(0, 3).col(3)) / (timestamp - mMotionStamp);
+        }
+
+        // and over the last keyframes, which is less noisy
+        cv::Mat vKF;
+        if (mRecentKFCenters.size() >= 2 && mRecentKFCenters.back().first > mRecentKFCenters.front().first)
+            vKF = (mRecentKFCenters.back().second - mRecentKFCenters.front().second) /
+                  (mRecentKFCenters.back().first - mRecentKFCenters.front().first);
+
+        if (!vFrame.empty() && !vKF.empty())
+            mCameraVelocity = 0.5 * (vFrame + vKF);
+        else if (!vFrame.empty())
+            mCameraVelocity = vFrame;
+        else if (!vKF.empty())
+            mCameraVelocity = vKF;
+        else
+            mCameraVelocity = cv::Mat();
+
+        mCameraCenter = Ow;
+        mMotionStamp = timestamp;
+
+    }
+
+    bool Cache::isTileDirty(const EvictedTile &tile) {
+
+        // always clears the mark, the tile is either skipped or written now
+        bool bDirty = mTopoMap->takeTopoIdDirty(tile.tId);
+
+        for (size_t i = 0; i < tile.vKFs.size() && !bDirty; i++)
+            bDirty = tile.vKFs[i]->IsDirty();
+
+        for (std::set<MapPoint *>::const_iterator mit = tile.sMPs.begin(); mit != tile.sMPs.end() && !bDirty; mit++)
+            bDirty = (*mit)->IsDirty(tile.tId);
+
+        return bDirty;
+
+    }
+
+    uint8_t Cache::tileCodecFor(const EvictedTile &tile, const cv::Mat &Ow) {
+
+        if (mHotTileCodec == mColdTileCodec || Ow.empty())
+            return mHotTileCodec;
+
+        // the closest keyframe decides, a tile without keyframes is placed by its mappoints
+        for (size_t i = 0; i < tile.vKFs.size(); i++)
+            if (cv::norm(tile.vKFs[i]->GetCameraCenter() - Ow) <= mfHotTileRange)
+                return mHotTileCodec;
+
+        if (tile.vKFs.empty()) {
+            for (std::set<MapPoint *>::const_iterator mit = tile.sMPs.begin(); mit != tile.sMPs.end(); mit++)
+                if (cv::norm((*mit)->GetWorldPos() - Ow) <= mfHotTileRange)
+                    return mHotTileCodec;
+        }
+
+        return mColdTileCodec;
+
+    }
+
+    std::vector<TopoId> Cache::predictTopoIds() {
+
+        std::vector<TopoId> predicted;
+
+        cv::Mat Ow, V;
+        {
+            unique_lock<mutex> lock(mMutexMotion);
+            if (mCameraCenter.empty() || mCameraVelocity.empty())
+                return predicted;
+            Ow = mCameraCenter.clone();
+            V = mCameraVelocity.clone();
+        }
+
+        const float distance = cv::norm(V) * mfPrefetchHorizon;
+
+        // not moving far enough to leave the current tile
+        if (distance < 0.25 * mfTileSize)
+            return predicted;
+
+        // sample the predicted trajectory at half a tile, the tiles are ordered by when they are reached
+        const int nSteps = min((int) ceil(distance / (0.5 * mfTileSize)), 32);
+
+        std::set<TopoId> seen;
+
+        for (int k = 1; k <= nSteps; k++) {
+
+            cv::Mat p = Ow + V * (mfPrefetchHorizon * k / nSteps);
+
+            TopoId tId = mTopoMap->generateId(cv::Point3d(p.at<float>(0), p.at<float>(1), p.at<float>(2)));
+
+            std::set<TopoId> window = mTopoMap->getTopoMapsNeedInCache(tId);
+
+            for (std::set<TopoId>::iterator mit = window.begin(); mit != window.end(); mit++) {
+                if (mTpInCache.find(*mit) == mTpInCache.end() && seen.insert(*mit).second)
+                    predicted.push_back(*mit);
+            }
+        }
+
+        return predicted;
+
+    }
+
+    void Cache::schedulePrefetch() {
+
+        {
+            unique_lock<mutex> lock(mMutexMotion);
+            if (mMotionStamp == mScheduledStamp)
+                return;
+            mScheduledStamp = mMotionStamp;
+        }
+
+        std::vector<TopoId> predicted = predictTopoIds();
+
+        std::vector<TopoId> candidates;
+
+        for (size_t i = 0; i < predicted.size() && (int) candidates.size() < mnMaxPrefetchTiles; i++) {
+
+            // only tiles stored on the server, tiles still in flight are restored for free
+            if (TopoIdStatus.find(predicted[i]) == TopoIdStatus.end() || TopoIdStatus[predicted[i]] != IN_SERVER)
+                continue;
+
+            {
+                unique_lock<mutex> lock(mMutexEvictQueue);
+                if (mInFlightTiles.find(predicted[i]) != mInFlightTiles.end())
+                    continue;
+            }
+
+            candidates.push_back(predicted[i]);
+        }
+
+        std::set<TopoId> sCandidates(candidates.begin(), candidates.end());
+
+        std::vector<PrefetchedTile> dropped;
+
+        {
+            unique_lock<mutex> lock(mMutexPrefetch);
+
+            mPrefetchQueue.clear();
+
+            for (size_t i = 0; i < candidates.size(); i++) {
+                if (candidates[i] != mPrefetching && mPrefetchedTiles.find(candidates[i]) == mPrefetchedTiles.end())
+                    mPrefetchQueue.push_back(candidates[i]);
+            }
+
+            // staged tiles which left the prediction for longer than the horizon are given up
+            for (std::map<TopoId, PrefetchedTile>::iterator mit = mPrefetchedTiles.begin(); mit != mPrefetchedTiles.end();) {
+                if (sCandidates.find(mit->first) == sCandidates.end() &&
+                    mScheduledStamp - mit->second.stamp > mfPrefetchHorizon) {
+                    dropped.push_back(mit->second);
+                    mPrefetchedTiles.erase(mit++);
+                    mPrefetchStats.nWasted++;
+                } else {
+                    mit++;
+                }
+            }
+        }
+
+        mCondPrefetch.notify_one();
+
+        // never published, nothing else can reference them
+        for (size_t i = 0; i < dropped.size(); i++) {
+            for (std::set<KeyFrame *>::iterator mit = dropped[i].sKFs.begin(); mit != dropped[i].sKFs.end(); mit++)
+                delete *mit;
+            for (std::set<MapPoint *>::iterator mit = dropped[i].sMPs.begin(); mit != dropped[i].sMPs.end(); mit++)
+                delete *mit;
+        }
+
+    }
+
+    bool Cache::takePrefetchedTile(TopoId tId) {
+
+        PrefetchedTile tile;
+
+        {
+            unique_lock<mutex> lock(mMutexPrefetch);
+
+            mPrefetchQueue.erase(std::remove(mPrefetchQueue.begin(), mPrefetchQueue.end(), tId), mPrefetchQueue.end());
+
+            // a fetch of this tile is already on the wire, waiting for it is cheaper than a second one
+            while (mPrefetching == tId)
+                mCondPrefetch.wait(lock);
+
+            std::map<TopoId, PrefetchedTile>::iterator mit = mPrefetchedTiles.find(tId);
+
+            if (mit == mPrefetchedTiles.end()) {
+                mPrefetchStats.nMisses++;
+                return false;
+            }
+
+            tile = mit->second;
+            mPrefetchedTiles.erase(mit);
+            mPrefetchStats.nHits++;
+        }
+
+        {
+            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+            for (std::set<KeyFrame *>::iterator mit = tile.sKFs.begin(); mit != tile.sKFs.end(); mit++) {
+                if (*mit) {
+                    (*mit)->setCache(this);
+                    AddKeyFrameToMap(*mit);
+                }
+            }
+
+            for (std::set<MapPoint *>::iterator mit = tile.sMPs.begin(); mit != tile.sMPs.end(); mit++) {
+
+                if (lMPToMPmap.find((*mit)->mnId) == lMPToMPmap.end()) {
+                    mpMap->AddMapPoint(*mit);
+                    {
+                        unique_lock<mutex> lock2(mMutexMPToMPmap);
+                        lMPToMPmap[(*mit)->mnId] = *mit;
+                        mMPSlots.set((*mit)->mnId, *mit, SLOT_RESIDENT);
+                    }
+                } else {
+                    // the shared mappoint is already in the map and the prefetched copy was never published
+                    delete *mit;
+                }
+            }
+        }
+
+        cout << "prefetched tile " << tId << " used" << endl;
+
+        return true;
+
+    }
+
+    void Cache::dropPrefetchedTiles() {
+
+        std::map<TopoId, PrefetchedTile> dropped;
+
+        {
+            unique_lock<mutex> lock(mMutexPrefetch);
+            dropped.swap(mPrefetchedTiles);
+            mPrefetchQueue.clear();
+            mPrefetchStats.nWasted += dropped.size();
+            // a fetch in progress is discarded when it completes
+            mnPrefetchGeneration++;
+        }
+
+        for (std::map<TopoId, PrefetchedTile>::iterator mit = dropped.begin(); mit != dropped.end(); mit++) {
+            for (std::set<KeyFrame *>::iterator kit = mit->second.sKFs.begin(); kit != mit->second.sKFs.end(); kit++)
+                delete *kit;
+            for (std::set<MapPoint *>::iterator pit = mit->second.sMPs.begin(); pit != mit->second.sMPs.end(); pit++)
+                delete *pit;
+        }
+
+    }
+
+    void Cache::prefetchRun() {
+
+        while (1) {
+
+            TopoId tId;
+            unsigned int generation;
+
+            {
+                unique_lock<mutex> lock(mMutexPrefetch);
+
+                while (mPrefetchQueue.empty() && !mbStopPrefetcher)
+                    mCondPrefetch.wait(lock);
+
+                if (mbStopPrefetcher)
+                    break;
+
+                tId = mPrefetchQueue.front();
+                mPrefetchQueue.pop_front();
+                mPrefetching = tId;
+                generation = mnPrefetchGeneration;
+            }
+
+            // demand loads go first
+            while (mbDemandIO)
+                usleep(1000);
+
+            PrefetchedTile tile;
+
+            {
+                mpDataDriver->TransTopoTilesFromServer(std::vector<TopoId>(1, tId), tile.sKFs, tile.sMPs);
+            }
+
+            {
+                unique_lock<mutex> lock(mMutexMotion);
+                tile.stamp = mMotionStamp;
+            }
+
+            bool bKeep = false;
+
+            {
+                unique_lock<mutex> lock(mMutexPrefetch);
+
+                mPrefetching = 0;
+
+                if (generation == mnPrefetchGeneration && (tile.sKFs.size() > 0 || tile.sMPs.size() > 0)) {
+                    mPrefetchedTiles[tId] = tile;
+                    mPrefetchStats.nIssued++;
+                    bKeep = true;
+                }
+            }
+
+            mCondPrefetch.notify_all();
+
+            if (!bKeep) {
+                for (std::set<KeyFrame *>::iterator mit = tile.sKFs.begin(); mit != tile.sKFs.end(); mit++)
+                    delete *mit;
+                for (std::set<MapPoint *>::iterator mit = tile.sMPs.begin(); mit != tile.sMPs.end(); mit++)
+                    delete *mit;
+            }
+
+        }
+
+    }
+
+    PrefetchStats Cache::getPrefetchStats() {
+
+        unique_lock<mutex> lock(mMutexPrefetch);
+
+        return mPrefetchStats;
+
+    }
+
+    void Cache::journalChanges() {
+
+        mJournalTime = std::chrono::steady_clock::now();
+
+        std::vector<pair<TileKind, std::string> > records;
+
+        size_t nKFs = 0, nMPs = 0;
+
+        {
+            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+            std::map<TopoId, std::vector<KeyFrame *> > kfs;
+            std::map<TopoId, std::vector<MapPoint *> > mps;
+
+            // versions taken before encoding, a change made meanwhile is journaled the next time
+            {
+                unique_lock<mutex> lock2(mMutexlKFToKFmap);
+
+                for (std::map<long unsigned int, KeyFrame *>::iterator mit = lKFToKFmap.begin(); mit != lKFToKFmap.end(); mit++) {
+
+                    if (mit->second == nullptr)
+                        continue;
+
+                    unsigned int nVersion = mit->second->GetVersion();
+                    unsigned int &nJournaled = mJournaledKFs[mit->first];
+
+                    if (nJournaled == nVersion)
+                        continue;
+
+                    nJournaled = nVersion;
+                    kfs[mit->second->mTopoId].push_back(mit->second);
+                    nKFs++;
+                }
+            }
+
+            {
+                unique_lock<mutex> lock2(mMutexMPToMPmap);
+
+                for (std::map<long unsigned int, MapPoint *>::iterator mit = lMPToMPmap.begin(); mit != lMPToMPmap.end(); mit++) {
+
+                    if (mit->second == nullptr)
+                        continue;
+
+                    unsigned int nVersion = mit->second->GetVersion();
+                    unsigned int &nJournaled = mJournaledMPs[mit->first];
+
+                    if (nJournaled == nVersion)
+                        continue;
+
+                    nJournaled = nVersion;
+
+                    // a mappoint is journaled once, the replay puts it in the tiles of its observations
+                    TopoId tId = mit->second->mpTopoIds.empty() ? 0 : *mit->second->mpTopoIds.begin();
+                    mps[tId].push_back(mit->second);
+                    nMPs++;
+                }
+            }
+
+            for (std::map<TopoId, std::vector<KeyFrame *> >::iterator mit = kfs.begin(); mit != kfs.end(); mit++) {
+                records.push_back(make_pair(TILE_KEYFRAMES, std::string()));
+                TileCodec::encodeKeyFrames(mit->first, mit->second, records.back().second);
+            }
+
+            for (std::map<TopoId, std::vector<MapPoint *> >::iterator mit = mps.begin(); mit != mps.end(); mit++) {
+                records.push_back(make_pair(TILE_MAPPOINTS, std::string()));
+                TileCodec::encodeMapPoints(mit->first, mit->second, records.back().second);
+            }
+        }
+
+        // compressed and queued out of the map lock, the writer thread does the I/O
+        for (size_t i = 0; i < records.size(); i++) {
+            TileCodec::compress(records[i].second, mHotTileCodec);
+            mpJournal->append(records[i].first, records[i].second);
+        }
+
+        if (!records.empty())
+            cout << "journal " << nKFs << " keyframes and " << nMPs << " mappoints in " << records.size() << " records" << endl;
+
+    }
+
+    void Cache::collectCachedTiles(std::vector<std::shared_ptr<EvictedTile> > &tiles) {
+
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+        for (std::set<TopoId>::iterator mit = mTpInCache.begin(); mit != mTpInCache.end(); mit++) {
+
+            std::shared_ptr<EvictedTile> tile(new EvictedTile());
+            tile->tId = *mit;
+            tile->bUploading = false;
+            tile->bRestored = false;
+            tile->bReferenced = false;
+
+            std::set<long unsigned int> tKFs = mTopoMap->getKFsbyTopoId(*mit);
+
+            for (std::set<long unsigned int>::iterator kit = tKFs.begin(); kit != tKFs.end(); kit++) {
+                KeyFrame *tKF = getKeyFrameById(*kit);
+                if (tKF)
+                    tile->vKFs.push_back(tKF);
+            }
+
+            std::set<long unsigned int> tMPs = mTopoMap->getMapPoints(*mit);
+
+            for (std::set<long unsigned int>::iterator pit = tMPs.begin(); pit != tMPs.end(); pit++) {
+                MapPoint *tMP = getMapPointById(*pit);
+                if (tMP)
+                    tile->sMPs.insert(tMP);
+            }
+
+            if (!tile->vKFs.empty() || !tile->sMPs.empty())
+                tiles.push_back(tile);
+        }
+
+    }
+
+    bool Cache::checkpointJournal() {
+
+        time_t start_t, end_t;
+        start_t = clock();
+
+        // what is journaled from now on is newer than what the checkpoint writes
+        uint32_t segment = mpJournal->rotate();
+
+        // the evicted tiles are written by the I/O workers
+        waitForEvictions();
+
+        std::vector<std::shared_ptr<EvictedTile> > tiles;
+        collectCachedTiles(tiles);
+
+        // the tiles stay in cache, only the dirty ones are written
+        bool bOK = writeBackTiles(tiles) && mpJournal->checkpoint(segment);
+
+        end_t = clock();
+
+        cout << "journal checkpoint of " << tiles.size() << " tiles at segment " << segment << (bOK ? "" : " failed")
+             << " use time " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+
+        return bOK;
+
+    }
+
+    Cache::RecoveredTile &Cache::loadRecoveredTile(TopoId tId, std::map<TopoId, RecoveredTile> &tiles) {
+
+        std::map<TopoId, RecoveredTile>::iterator mit = tiles.find(tId);
+
+        if (mit != tiles.end())
+            return mit->second;
+
+        RecoveredTile &tile = tiles[tId];
+
+        std::vector<std::set<KeyFrame *> > vKFs;
+        std::vector<std::set<MapPoint *> > vMPs;
+
+        // a tile which is not in the store comes back empty
+        if (mpDataDriver->TransTopoTilesFromServer(std::vector<TopoId>(1, tId), vKFs, vMPs)) {
+
+            for (std::set<KeyFrame *>::iterator kit = vKFs[0].begin(); kit != vKFs[0].end(); kit++)
+                tile.mKFs[(*kit)->mnId] = *kit;
+
+            for (std::set<MapPoint *>::iterator pit = vMPs[0].begin(); pit != vMPs[0].end(); pit++)
+                tile.mMPs[(*pit)->mnId] = *pit;
+        }
+
+        return tile;
+
+    }
+
+    bool Cache::replayJournalRecord(const JournalRecord &record, std::map<TopoId, RecoveredTile> &tiles) {
+
+        TileHeader header;
+
+        if (!TileCodec::readHeader(record.payload.data(), record.payload.size(), header))
+            return false;
+
+        const TopoId tId = header.topoId;
+        const char *data = record.payload.data();
+        const size_t size = record.payload.size();
+
+        if (record.kind == TILE_KEYFRAMES) {
+
+            std::vector<KeyFrame *> vKFs;
+
+            if (!TileCodec::decodeKeyFrames(data, size, this, vKFs)) {
+                for (size_t i = 0; i < vKFs.size(); i++)
+                    delete vKFs[i];
+                return false;
+            }
+
+            for (size_t i = 0; i < vKFs.size(); i++) {
+
+                KeyFrame *pKF = vKFs[i];
+
+                // the stored copy, in another tile when the keyframe has moved since
+                TopoId tStored = mTopoMap->getKeyFrameTopoId(pKF->mnId);
+                if (tStored != 0)
+                    loadRecoveredTile(tStored, tiles);
+
+                loadRecoveredTile(tId, tiles);
+
+                for (std::map<TopoId, RecoveredTile>::iterator mit = tiles.begin(); mit != tiles.end(); mit++) {
+                    std::map<long unsigned int, KeyFrame *>::iterator kit = mit->second.mKFs.find(pKF->mnId);
+                    if (kit != mit->second.mKFs.end()) {
+                        delete kit->second;
+                        mit->second.mKFs.erase(kit);
+                    }
+                }
+
+                tiles[tId].mKFs[pKF->mnId] = pKF;
+            }
+
+        } else if (record.kind == TILE_MAPPOINTS) {
+
+            std::vector<MapPoint *> vMPs;
+
+            if (!TileCodec::decodeMapPoints(data, size, this, vMPs)) {
+                for (size_t i = 0; i < vMPs.size(); i++)
+                    delete vMPs[i];
+                return false;
+            }
+
+            for (size_t i = 0; i < vMPs.size(); i++) {
+
+                MapPoint *pMP = vMPs[i];
+
+                // a mappoint is stored with the tiles of the keyframes observing it
+                std::set<TopoId> targets;
+                targets.insert(tId);
+
+                std::vector<pair<long unsigned int, LoopKeyPoint> > obs = pMP->getObeservationIds();
+
+                for (size_t k = 0; k < obs.size(); k++) {
+
+                    TopoId tObs = mTopoMap->getKeyFrameTopoId(obs[k].first);
+
+                    for (std::map<TopoId, RecoveredTile>::iterator mit = tiles.begin(); mit != tiles.end(); mit++) {
+                        if (mit->second.mKFs.count(obs[k].first)) {
+                            tObs = mit->first;
+                            break;
                         }
+                    }
+
+                    if (tObs != 0)
+                        targets.insert(tObs);
+                }
 
-//                        delete tMP;
+                for (std::set<TopoId>::iterator tit = targets.begin(); tit != targets.end(); tit++)
+                    loadRecoveredTile(*tit, tiles);
 
+                // every copy is replaced, a copy can be shared by several tiles
+                std::set<MapPoint *> replaced;
+
+                for (std::map<TopoId, RecoveredTile>::iterator mit = tiles.begin(); mit != tiles.end(); mit++) {
+                    std::map<long unsigned int, MapPoint *>::iterator pit = mit->second.mMPs.find(pMP->mnId);
+                    if (pit != mit->second.mMPs.end()) {
+                        replaced.insert(pit->second);
+                        pit->second = pMP;
                     }
                 }
 
+                for (std::set<TopoId>::iterator tit = targets.begin(); tit != targets.end(); tit++)
+                    tiles[*tit].mMPs[pMP->mnId] = pMP;
+
+                for (std::set<MapPoint *>::iterator rit = replaced.begin(); rit != replaced.end(); rit++)
+                    if (*rit != pMP)
+                        delete *rit;
+            }
+
+        } else if (record.kind == TILE_KEYFRAME_POSES) {
+
+            KeyFramePoseMap poses;
+
+            if (!TileCodec::decodeKeyFramePoses(data, size, poses))
+                return false;
+
+            loadRecoveredTile(tId, tiles);
+
+            for (KeyFramePoseMap::iterator pit = poses.begin(); pit != poses.end(); pit++) {
+                for (std::map<TopoId, RecoveredTile>::iterator mit = tiles.begin(); mit != tiles.end(); mit++) {
+                    std::map<long unsigned int, KeyFrame *>::iterator kit = mit->second.mKFs.find(pit->first);
+                    if (kit != mit->second.mKFs.end() && !pit->second.empty())
+                        kit->second->SetPose(pit->second);
+                }
+            }
+
+        } else if (record.kind == TILE_MAPPOINT_POSES) {
+
+            MapPointPoseMap poses;
+
+            if (!TileCodec::decodeMapPointPoses(data, size, poses))
+                return false;
+
+            loadRecoveredTile(tId, tiles);
+
+            for (MapPointPoseMap::iterator pit = poses.begin(); pit != poses.end(); pit++) {
+                for (std::map<TopoId, RecoveredTile>::iterator mit = tiles.begin(); mit != tiles.end(); mit++) {
+                    std::map<long unsigned int, MapPoint *>::iterator mpit = mit->second.mMPs.find(pit->first);
+                    if (mpit != mit->second.mMPs.end() && !pit->second.first.empty())
+                        mpit->second->SetWorldPos(pit->second.first);
+                }
+            }
+
+        } else {
+
+            return false;
+        }
+
+        return true;
+
+    }
+
+    bool Cache::RecoverMap() {
+
+        if (!mpJournal)
+            return false;
+
+        time_t start_t, end_t;
+        start_t = clock();
+
+        std::vector<JournalRecord> records;
+
+        if (!mpJournal->replay(records))
+            cout << "the map journal is damaged, the records after the damage are lost" << endl;
+
+        // the decoders drop the ids beyond nNextId, the stored ids are only known once they are read
+        const long unsigned int nKFNextId = KeyFrame::nNextId;
+        const long unsigned int nMPNextId = MapPoint::nNextId;
+        KeyFrame::nNextId = std::numeric_limits<long unsigned int>::max();
+        MapPoint::nNextId = std::numeric_limits<long unsigned int>::max();
+
+        long unsigned int nMaxKFId = 0, nMaxMPId = 0, nKFs = 0, nMPs = 0;
+
+        // the pose blocks list the stored tiles
+        std::set<TopoId> tIds;
+        {
+            std::map<TopoId, std::string> poses;
+
+            if (mpTileStore->getAllPoses(TILE_KEYFRAMES, poses))
+                for (std::map<TopoId, std::string>::iterator mit = poses.begin(); mit != poses.end(); mit++)
+                    tIds.insert(mit->first);
+
+            poses.clear();
+
+            if (mpTileStore->getAllPoses(TILE_MAPPOINTS, poses))
+                for (std::map<TopoId, std::string>::iterator mit = poses.begin(); mit != poses.end(); mit++)
+                    tIds.insert(mit->first);
+        }
+
+        // the TopoMap index and the keyframe database of the store, the objects are not kept
+        std::vector<TopoId> vtIds(tIds.begin(), tIds.end());
+        const size_t nBatch = std::max(mnEvictBatch, 1);
+
+        for (size_t i = 0; i < vtIds.size(); i += nBatch) {
+
+            std::vector<TopoId> batch(vtIds.begin() + i, vtIds.begin() + std::min(i + nBatch, vtIds.size()));
+            std::vector<std::set<KeyFrame *> > vKFs;
+            std::vector<std::set<MapPoint *> > vMPs;
+
+            if (!mpDataDriver->TransTopoTilesFromServer(batch, vKFs, vMPs))
+                continue;
+
+            for (size_t j = 0; j < batch.size(); j++) {
+
+                for (std::set<KeyFrame *>::iterator kit = vKFs[j].begin(); kit != vKFs[j].end(); kit++) {
+                    (*kit)->RestoreTopoMap();
+                    mpKeyFrameDatabase->add(*kit);
+                    nMaxKFId = std::max(nMaxKFId, (*kit)->mnId);
+                    nKFs++;
+                    delete *kit;
+                }
+
+                for (std::set<MapPoint *>::iterator pit = vMPs[j].begin(); pit != vMPs[j].end(); pit++) {
+                    (*pit)->RestoreTopoMap(batch[j]);
+                    nMaxMPId = std::max(nMaxMPId, (*pit)->mnId);
+                    nMPs++;
+                    delete *pit;
+                }
+            }
+        }
+
+        // the journal records in order, on the tiles they touch
+        std::map<TopoId, RecoveredTile> tiles;
+        size_t nApplied = 0;
+
+        for (size_t i = 0; i < records.size(); i++) {
+            if (replayJournalRecord(records[i], tiles))
+                nApplied++;
+            else
+                cout << "journal record " << records[i].seq << " can not be replayed" << endl;
+        }
+
+        records.clear();
+
+        // the replayed tiles go back to the store and into the index
+        bool bOK = true;
+
+        std::vector<TopoId> rtIds;
+        std::vector<std::vector<KeyFrame *> > rKFs;
+        std::vector<std::set<MapPoint *> > rMPs;
+        std::set<MapPoint *> sMPs;
+
+        for (std::map<TopoId, RecoveredTile>::iterator mit = tiles.begin(); mit != tiles.end(); mit++) {
+
+            rtIds.push_back(mit->first);
+            rKFs.push_back(std::vector<KeyFrame *>());
+            rMPs.push_back(std::set<MapPoint *>());
+
+            for (std::map<long unsigned int, KeyFrame *>::iterator kit = mit->second.mKFs.begin(); kit != mit->second.mKFs.end(); kit++)
+                rKFs.back().push_back(kit->second);
+
+            for (std::map<long unsigned int, MapPoint *>::iterator pit = mit->second.mMPs.begin(); pit != mit->second.mMPs.end(); pit++)
+                rMPs.back().insert(pit->second);
+
+            tIds.insert(mit->first);
+        }
+
+        for (size_t i = 0; i < rtIds.size(); i += nBatch) {
+
+            const size_t end = std::min(i + nBatch, rtIds.size());
+
+            std::vector<TopoId> batch(rtIds.begin() + i, rtIds.begin() + end);
+            std::vector<std::vector<KeyFrame *> > bKFs(rKFs.begin() + i, rKFs.begin() + end);
+            std::vector<std::set<MapPoint *> > bMPs(rMPs.begin() + i, rMPs.begin() + end);
+
+            bOK = mpDataDriver->TransTopoTilesToServer(batch, bKFs, bMPs, std::vector<uint8_t>(batch.size(), mColdTileCodec)) && bOK;
+        }
+
+        for (size_t i = 0; i < rtIds.size(); i++) {
+
+            for (size_t j = 0; j < rKFs[i].size(); j++) {
+                KeyFrame *pKF = rKFs[i][j];
+                pKF->RestoreTopoMap();
+                // the stored copy was added above, with the same words
+                mpKeyFrameDatabase->erase(pKF);
+                mpKeyFrameDatabase->add(pKF);
+                nMaxKFId = std::max(nMaxKFId, pKF->mnId);
+                delete pKF;
+            }
+
+            for (std::set<MapPoint *>::iterator pit = rMPs[i].begin(); pit != rMPs[i].end(); pit++) {
+                (*pit)->RestoreTopoMap(rtIds[i]);
+                nMaxMPId = std::max(nMaxMPId, (*pit)->mnId);
+                sMPs.insert(*pit);
+            }
+        }
+
+        for (std::set<MapPoint *>::iterator pit = sMPs.begin(); pit != sMPs.end(); pit++)
+            delete *pit;
+
+        KeyFrame::nNextId = std::max(nKFNextId, nMaxKFId + 1);
+        MapPoint::nNextId = std::max(nMPNextId, nMaxMPId + 1);
+
+        // the recovered tiles are read back when the camera gets close to them
+        for (std::set<TopoId>::iterator mit = tIds.begin(); mit != tIds.end(); mit++) {
+            TopoIdStatus[*mit] = IN_SERVER;
+            mTpInCache.erase(*mit);
+        }
+
+        // the store holds everything now, the replayed segments are dropped
+        if (bOK)
+            bOK = mpJournal->checkpoint(mpJournal->rotate());
+
+        end_t = clock();
+
+        cout << "recovered " << tIds.size() << " tiles, " << nKFs << " keyframes and " << nMPs << " mappoints from the store, "
+             << nApplied << " journal records replayed on " << rtIds.size() << " tiles use time "
+             << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+
+        return bOK;
+
+    }
+
+    void Cache::waitForEvictions() {
+
+        unique_lock<mutex> lock(mMutexEvictQueue);
+
+        while (!mInFlightTiles.empty() && !mvptIOWorkers.empty())
+            mCondEvictDone.wait(lock);
+
+    }
+
+    void Cache::keepTopoIdSetInCache(std::set<TopoId> tps) {
+
+        for (std::set<TopoId>::iterator mit = tps.begin(); mit != tps.end(); mit++) {
+
+            cout << *mit << endl;
+
+            if (mTpInCache.find(*mit) == mTpInCache.end()) {
+
+                std::set<long unsigned int> tKFs = mTopoMap->getKFsbyTopoId((*mit));
+
+//                transKeyFrameFromServer(tKFs);
+
+                transMapPointFromServer(*mit);
+
+                mTpInCache.insert(*mit);
+
             }
+
+            TopoIdStatus[*mit] = IN_USE;
+
+        }
+
+    }
+
+    void Cache::setTopoIdSetUnUse(std::set<TopoId> tps) {
+
+        for (std::set<TopoId>::iterator mit = tps.begin(); mit != tps.end(); mit++) {
+            TopoIdStatus[*mit] = UN_USE;
         }
+    }
+
+    void Cache::transKeyFrameFromServer(long unsigned int tid, std::set<long unsigned int> pkfs) {
+
+        std::set<KeyFrame *> kfs;
+
+        if (pkfs.size() <= 0) return;
+
+        kfs = mpDataDriver->TransTopoKeyFramesFromServer(tid);
+        {
+            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+            for (std::set<KeyFrame *>::iterator mit = kfs.begin(); mit != kfs.end(); mit++) {
 
+                if (*mit) {
+
+                    (*mit)->setCache(this);
+
+                    AddKeyFrameToMap(*mit);
 
+                }
+            }
+        }
     }
 
+
     void Cache::transMapPointFromServer(TopoId tId) {
 
         std::set<MapPoint *> vMPs;
 
-        DataDriver DB(this);
-
-        vMPs = DB.TransTopoMapPointsFromServer(tId);
+        vMPs = mpDataDriver->TransTopoMapPointsFromServer(tId);
 
         {
             unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
@@ -753,6 +2673,7 @@ namespace ORB_SLAM2 {
                     {
                         unique_lock<mutex> lock(mMutexMPToMPmap);
                         lMPToMPmap[tId] = *mit;
+                        mMPSlots.set(tId, *mit, SLOT_RESIDENT);
                     }
                 } else {
 //                    delete (*mit);
@@ -763,6 +2684,50 @@ namespace ORB_SLAM2 {
     }
 
 
+    void Cache::transTopoMapsFromServer(const std::vector<TopoId> &tIds) {
+
+        if (tIds.empty()) return;
+
+        std::set<KeyFrame *> kfs;
+
+        std::set<MapPoint *> vMPs;
+
+        mpDataDriver->TransTopoTilesFromServer(tIds, kfs, vMPs);
+
+        {
+            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+            for (std::set<KeyFrame *>::iterator mit = kfs.begin(); mit != kfs.end(); mit++) {
+
+                if (*mit) {
+
+                    (*mit)->setCache(this);
+
+                    AddKeyFrameToMap(*mit);
+
+                }
+            }
+
+            for (std::set<MapPoint *>::iterator mit = vMPs.begin(); mit != vMPs.end(); mit++) {
+
+                long unsigned int tId = (*mit)->mnId;
+
+                if (lMPToMPmap.find(tId) == lMPToMPmap.end()) {
+                    mpMap->AddMapPoint(*mit);
+                    {
+                        unique_lock<mutex> lock2(mMutexMPToMPmap);
+                        lMPToMPmap[tId] = *mit;
+                        mMPSlots.set(tId, *mit, SLOT_RESIDENT);
+                    }
+                } else {
+                    // shared with a tile already in cache
+                    delete *mit;
+                }
+            }
+        }
+
+    }
+
     bool Cache::checkInCache(LightKeyFrame tLKF) {
 
         unique_lock<mutex> lock(mMutexKFStatus);
@@ -780,6 +2745,7 @@ namespace ORB_SLAM2 {
 
             unique_lock<mutex> lock(mMutexTmpKFMap);
             tmpKFMap[pKF->mnId] = pKF;
+            mKFSlots.set(pKF->mnId, pKF, SLOT_TEMPORARY);
             kfStatus[pKF->mnId] = KF_IN_CACHE;
 
         }
@@ -792,6 +2758,8 @@ namespace ORB_SLAM2 {
 
         if (tmpKFMap.find(pID) != tmpKFMap.end()) {
 
+            mKFSlots.release(pID, tmpKFMap[pID], SLOT_TEMPORARY);
+
             tmpKFMap.erase(pID);
 
         }
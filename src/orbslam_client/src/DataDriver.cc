@@ -3,6 +3,10 @@
 //
 
 #include "DataDriver.h"
+#include "TileStore.h"
+#include "ServiceConnections.h"
+#include "MapJournal.h"
+#include "TileArena.h"
 #include "sstream"
 #include "ros/ros.h"
 #include "orbslam_server/orbslam_save.h"
@@ -10,9 +14,8 @@
 #include "orbslam_server/orbslam_get.h"
 #include "orbslam_server/orbslam_muilt_get.h"
 #include "orbslam_server/orbslam_muilt_save.h"
-#include "orbslam_server/orbslam_pose_save.h"
-#include "orbslam_server/orbslam_pose_get.h"
 #include <map>
+#include <chrono>
 #include <malloc.h>
 
 using namespace std;
@@ -25,8 +28,6 @@ namespace ORB_SLAM2 {
         time_t start_t, end_t;
         start_t = clock();
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_save>("saveOneKeyFrame");
         orbslam_server::orbslam_save srv;
 
         std::ostringstream os;
@@ -36,9 +37,9 @@ namespace ORB_SLAM2 {
 
         srv.request.ID = pKF->mnId;
 
-        srv.request.DATA = ss;
+        srv.request.DATA.assign(ss.begin(), ss.end());
 
-        if (client.call(srv)) {
+        if (pCacher->mpConnections->call("saveOneKeyFrame", srv)) {
 
             end_t = clock();
 
@@ -59,17 +60,15 @@ namespace ORB_SLAM2 {
 
         time_t start_t, end_t;
         start_t = clock();
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_get>("getOneKeyFrame");
         orbslam_server::orbslam_get srv;
 
         KeyFrame *tKF = new KeyFrame();
 
         srv.request.ID = pLKF.mnId;
 
-        if (client.call(srv)) {
+        if (pCacher->mpConnections->call("getOneKeyFrame", srv)) {
 
-            std::string ss = srv.response.DATA;
+            std::string ss(srv.response.DATA.begin(), srv.response.DATA.end());
             if (ss == "") {
                 return nullptr;
             } else {
@@ -127,8 +126,6 @@ namespace ORB_SLAM2 {
         time_t start_t, end_t;
         start_t = clock();
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_muilt_save>("saveKeyFrames");
         orbslam_server::orbslam_muilt_save srv;
 
         std::ostringstream os;
@@ -138,7 +135,7 @@ namespace ORB_SLAM2 {
 
         srv.request.DATA = ss;
 
-        if (client.call(srv)) {
+        if (pCacher->mpConnections->call("saveKeyFrames", srv)) {
 
             end_t = clock();
 
@@ -168,8 +165,6 @@ namespace ORB_SLAM2 {
         time_t start_t, end_t;
         start_t = clock();
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_muilt_get>("getKeyFrames");
         orbslam_server::orbslam_muilt_get srv;
 
         std::string ids;
@@ -182,7 +177,7 @@ namespace ORB_SLAM2 {
 
         srv.request.IDS = ids;
 
-        if (client.call(srv)) {
+        if (pCacher->mpConnections->call("getKeyFrames", srv)) {
 
             std::string totleData = srv.response.DATA;
 
@@ -256,8 +251,6 @@ namespace ORB_SLAM2 {
             time_t start_t, end_t;
             start_t = clock();
 
-            ros::NodeHandle n;
-            ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_muilt_save>("saveMapPoints");
             orbslam_server::orbslam_muilt_save srv;
 
             std::ostringstream os;
@@ -267,7 +260,7 @@ namespace ORB_SLAM2 {
 
             srv.request.DATA = ss;
 
-            if (client.call(srv)) {
+            if (pCacher->mpConnections->call("saveMapPoints", srv)) {
 
                 end_t = clock();
 
@@ -300,8 +293,6 @@ namespace ORB_SLAM2 {
         time_t start_t, end_t;
         start_t = clock();
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_muilt_get>("getMapPoints");
         orbslam_server::orbslam_muilt_get srv;
 
         std::string ids;
@@ -314,7 +305,7 @@ namespace ORB_SLAM2 {
 
         srv.request.IDS = ids;
 
-        if (client.call(srv)) {
+        if (pCacher->mpConnections->call("getMapPoints", srv)) {
 
             std::string totleData = srv.response.DATA;
 
@@ -353,244 +344,350 @@ namespace ORB_SLAM2 {
 
     }
 
-    std::vector<long unsigned int>  DataDriver::TransTopoMapPointsToServer(TopoId tId, std::set<MapPoint *> pMPs) {
-
-        time_t start_t, end_t;
-        start_t = clock();
-        f1.open( "STTmps.txt", ios::app );
+    std::vector<long unsigned int> DataDriver::encodeTopoMapPoints(TopoId tId, const std::set<MapPoint *> &pMPs,
+                                                                   std::string &data, std::string &pose, uint8_t codec) {
 
-        f1 << start_t / CLOCKS_PER_SEC << " ";
         std::vector<long unsigned int> mpTrulyTrans;
-        mpTrulyTrans.clear();
 
-        if (pMPs.size() > 0) {
+        std::vector<pair<unsigned long int, std::string> > tpmps;
+        std::vector<MapPoint *> binmps;
+        MapPointPoseMap tpposes;
 
-            std::vector<pair<unsigned long int, std::string> > tpmps;
-            std::map<unsigned long int, pair<cv::Mat,  std::vector< pair < long unsigned int, LoopKeyPoint > > > > tpposes;
-            tpmps.clear();
-            tpposes.clear();
+        const bool bBinary = pCacher->mTileFormat == TILE_FORMAT_BINARY;
 
-            for (std::set<MapPoint *>::iterator mit = pMPs.begin(); mit != pMPs.end(); mit++) {
+        for (std::set<MapPoint *>::const_iterator mit = pMPs.begin(); mit != pMPs.end(); mit++) {
 
-                if (*mit) {
+            if (*mit) {
 
-                    unsigned long int ttId = (*mit)->mnId;
+                unsigned long int ttId = (*mit)->mnId;
 
+                if (bBinary) {
+                    binmps.push_back(*mit);
+                } else {
                     std::ostringstream tos;
                     boost::archive::text_oarchive toa(tos);
 
                     toa << (*mit);
 
-                    std::string tss = tos.str();
-
-                    tpmps.push_back(pair<unsigned long int, std::string>(ttId, tss));
-
-                    tpposes[ttId] = make_pair((*mit)->GetWorldPos(), (*mit)->getObeservationIds() ) ;
-
-                    mpTrulyTrans.push_back(ttId);
-                    tos.clear();
+                    tpmps.push_back(pair<unsigned long int, std::string>(ttId, tos.str()));
                 }
 
+                tpposes[ttId] = make_pair((*mit)->GetWorldPos(), (*mit)->getObeservationIds() ) ;
+
+                mpTrulyTrans.push_back(ttId);
             }
 
-            ros::NodeHandle n;
-            ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_save>("saveTopoMapPoint");
-            orbslam_server::orbslam_save srv;
+        }
 
+        if (bBinary) {
+            TileCodec::encodeMapPoints(tId, binmps, data);
+            compressTile(data, codec);
+        } else {
             std::ostringstream os;
             boost::archive::text_oarchive oa(os);
             oa << tpmps;
 
-            srv.request.DATA = os.str();;
+            data = os.str();
+        }
 
-            f1 << srv.request.DATA.size() << " ";
-            std::ostringstream ps;
-            boost::archive::text_oarchive pa(ps);
-            pa << tpposes;
+        encodeMapPointPoses(tId, tpposes, pose);
 
-            srv.request.POSE = ps.str();
+        if (bBinary)
+            compressTile(pose, codec);
 
-            srv.request.ID = tId;
+        return mpTrulyTrans;
 
-            if (client.call(srv)) {
+    }
 
-                cout <<"tid " << tId <<  " Data size " << srv.request.DATA.size() << " POSE size " << srv.request.POSE.size() << endl;
+    std::set<MapPoint *> DataDriver::decodeTopoMapPoints(TopoId tId, const std::string &data, const std::string &pose) {
 
+        std::set<MapPoint *> mps_ans;
 
-            }
-            else {
-                cout << "Failed to call service save KeyFrames" << endl;
-            }
-            tpmps.clear();
-            tpposes.clear();
-            srv.request.POSE.clear();
-            srv.request.DATA.clear();
-            os.clear();
-            ps.clear();
+        TileArenaScope scope(tId);
+
+        std::vector<pair<long unsigned int, std::string> > tmps;
+
+        MapPointPoseMap tpposes;
+
+        std::vector<MapPoint *> tdecoded;
+
+        if (TileCodec::isTile(data)) {
+
+            std::string raw;
+            const std::string &tile = expandTile(data, raw);
+
+            if (!TileCodec::decodeMapPoints(tile.data(), tile.size(), pCacher, tdecoded))
+                ROS_INFO("error in the trans point from server");
+
+        } else {
+
+            std::stringstream tis(data);
+
+            boost::archive::text_iarchive tia(tis);
+
+            tia >> tmps;
+
+            for (int mit = 0; mit < (int)tmps.size(); mit++) {
+                try {
+                    std::stringstream sis(tmps[mit].second);
+
+                    boost::archive::text_iarchive sia(sis);
+
+                    MapPoint *tMP = new MapPoint();
+
+                    sia >> tMP;
+
+                    tMP->setCache(pCacher);
+
+                    tdecoded.push_back(tMP);
+
+                    sis.clear();
+                } catch(...) {
+                    ROS_INFO("error in the trans point from server");
+                }
 
+            }
         }
 
-        end_t = clock();
+        decodeMapPointPoses(pose, tpposes);
 
-        cout << "Trans TopoMapPoints to server size " << mpTrulyTrans.size() << " use time : " <<
-        (double) (end_t - start_t) / (double) CLOCKS_PER_SEC  << endl;
+        for (int mit = 0; mit < (int)tdecoded.size(); mit++) {
 
-        f1 << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC  << endl;
+            MapPoint *tMP = tdecoded[mit];
 
-        f1.close();
+            if (tpposes.find(tMP->mnId) != tpposes.end())
+                tMP->SetWorldPos(tpposes[tMP->mnId].first);
 
-        return mpTrulyTrans;
+            tMP->SetStored(tId, tMP->GetVersion());
+
+            if (tMP->mnId <= MapPoint::nNextId && tMP->mnId >= 0)
+                mps_ans.insert(tMP);
+
+        }
+
+        return mps_ans;
 
     }
 
-    std::set<MapPoint *> DataDriver::TransTopoMapPointsFromServer( TopoId tId ) {
+    std::vector<long unsigned int> DataDriver::encodeTopoKeyFrames(TopoId tId, const std::vector<KeyFrame *> &pKFs,
+                                                                   std::string &data, std::string &pose, uint8_t codec) {
+
+        std::vector<long unsigned int> mpTrulyTrans;
 
+        std::vector<pair<unsigned long int, std::string> > tpkfs;
+        std::vector<KeyFrame *> binkfs;
+        KeyFramePoseMap tpposes;
 
-        std::set<MapPoint *> mps_ans;
+        const bool bBinary = pCacher->mTileFormat == TILE_FORMAT_BINARY;
 
-        time_t start_t, end_t;
-        start_t = clock();
+        for (std::vector<KeyFrame *>::const_iterator mit = pKFs.begin(); mit != pKFs.end(); mit++) {
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_get>("getTopoMapPoint");
-        orbslam_server::orbslam_get srv;
+            if (*mit) {
+
+                unsigned long int ttId = (*mit)->mnId;
 
-        srv.request.ID = tId;
+                if (bBinary) {
+                    binkfs.push_back(*mit);
+                } else {
+                    std::ostringstream tos;
+                    boost::archive::text_oarchive toa(tos);
 
-        if (client.call(srv)) {
+                    toa << (*mit);
 
-            if( srv.response.DATA.size() <= 0 )
-                return mps_ans;
+                    tpkfs.push_back(pair<unsigned long int, std::string>(ttId, tos.str()));
+                }
 
-            f2.open( "TTSmps.txt", ios::app );
+                tpposes[ttId] = (*mit)->GetPose() ;
 
-            f2 << start_t / CLOCKS_PER_SEC << " " << srv.response.DATA.size() + srv.response.POSE.size() << " ";
+                mpTrulyTrans.push_back(ttId);
+            }
 
-            end_t = clock();
+        }
 
-            f2 << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
-            f2.close();
+        if (bBinary) {
+            TileCodec::encodeKeyFrames(tId, binkfs, data);
+            compressTile(data, codec);
+        } else {
+            std::ostringstream os;
+            boost::archive::text_oarchive oa(os);
+            oa << tpkfs;
 
-            std::vector<pair<long unsigned int, std::string> > tmps;
+            data = os.str();
+        }
 
-            std::map<unsigned long int, pair<cv::Mat, std::vector< pair < long unsigned int, LoopKeyPoint > > > > tpposes;
+        encodeKeyFramePoses(tId, tpposes, pose);
 
-            std::stringstream tis(srv.response.DATA);
+        if (bBinary)
+            compressTile(pose, codec);
 
-            boost::archive::text_iarchive tia(tis);
+        return mpTrulyTrans;
 
+    }
 
-            tia >> tmps;
+    std::set<KeyFrame *> DataDriver::decodeTopoKeyFrames(TopoId tId, const std::string &data, const std::string &pose) {
 
-            std::stringstream tps( srv.response.POSE );
-            boost::archive::text_iarchive tpa(tps);
+        std::set<KeyFrame *> kfs_ans;
 
-            tpa >> tpposes;
+        TileArenaScope scope(tId);
 
+        std::vector<pair<long unsigned int, std::string> > tkfs;
 
-            for (int mit = 0; mit < (int)tmps.size(); mit++) {
+        KeyFramePoseMap tpposes;
+
+        std::vector<KeyFrame *> tdecoded;
+
+        if (TileCodec::isTile(data)) {
+
+            std::string raw;
+            const std::string &tile = expandTile(data, raw);
+
+            if (!TileCodec::decodeKeyFrames(tile.data(), tile.size(), pCacher, tdecoded))
+                ROS_INFO("error in the trans keyframe from server");
+
+        } else {
+
+            std::stringstream tis(data);
+
+            boost::archive::text_iarchive tia(tis);
+
+            tia >> tkfs;
+
+            for (int mit = 0; mit < (int)tkfs.size(); mit++) {
                 try {
-                    std::stringstream sis(tmps[mit].second);
+                    std::stringstream sis(tkfs[mit].second);
 
                     boost::archive::text_iarchive sia(sis);
 
-                    MapPoint *tMP = new MapPoint();
-
-                    sia >> tMP;
+                    KeyFrame *tKF = new KeyFrame();
 
-                    if (tpposes.find(tMP->mnId) != tpposes.end())
-                        tMP->SetWorldPos(tpposes[tMP->mnId].first);
+                    sia >> tKF;
 
-                    tMP->setCache(pCacher);
+                    tKF->setCache(pCacher);
 
-                    if (tMP->mnId <= MapPoint::nNextId && tMP->mnId >= 0)
-                        mps_ans.insert(tMP);
+                    tdecoded.push_back(tKF);
 
                     sis.clear();
+
                 } catch(...) {
-                    ROS_INFO("error in the trans point from server");
+                    ROS_INFO("error in the trans keyframe from server");
                 }
 
             }
-            tmps.clear();
-            tpposes.clear();
-            tis.clear();
-            tps.clear();
-
         }
-        srv.response.DATA.clear();
-        srv.response.POSE.clear();
 
-        end_t = clock();
+        decodeKeyFramePoses(pose, tpposes);
 
-        cout << "Trans MP size " << mps_ans.size()  << " use time : " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+        for (int mit = 0; mit < (int)tdecoded.size(); mit++) {
 
-        return mps_ans;
+            KeyFrame *tKF = tdecoded[mit];
+
+            if (tpposes.find(tKF->mnId) != tpposes.end())
+                tKF->SetPose(tpposes[tKF->mnId]);
+
+            // what was just read is what the store holds
+            tKF->SetStored(tKF->GetVersion());
+
+            if (tKF->mnId <= KeyFrame::nNextId && tKF->mnId >= 0)
+                kfs_ans.insert(tKF);
+
+        }
+
+        return kfs_ans;
 
     }
 
-    std::vector<long unsigned int>  DataDriver::TransTopoKeyFramesToServer(TopoId tId, std::vector<KeyFrame *> pKFs) {
+    std::vector<long unsigned int>  DataDriver::TransTopoMapPointsToServer(TopoId tId, std::set<MapPoint *> pMPs) {
 
         time_t start_t, end_t;
         start_t = clock();
+        ofstream f1( "STTmps.txt", ios::app );
 
+        f1 << start_t / CLOCKS_PER_SEC << " ";
         std::vector<long unsigned int> mpTrulyTrans;
 
-        mpTrulyTrans.clear();
+        if (pMPs.size() > 0) {
 
-        if (pKFs.size() > 0) {
+            std::string data;
+            std::string pose;
 
-            std::vector<pair<unsigned long int, std::string> > tpkfs;
-            std::map<unsigned long int, cv::Mat > tpposes;
-            tpkfs.clear();
-            tpposes.clear();
+            mpTrulyTrans = encodeTopoMapPoints(tId, pMPs, data, pose, pCacher->mHotTileCodec);
 
-            for (std::vector<KeyFrame *>::iterator mit = pKFs.begin(); mit != pKFs.end(); mit++) {
+            f1 << data.size() << " ";
 
-                if (*mit) {
+            if (pCacher->mpTileStore->saveTile(TILE_MAPPOINTS, tId, data, pose)) {
 
-                    unsigned long int ttId = (*mit)->mnId;
+                cout <<"tid " << tId <<  " Data size " << data.size() << " POSE size " << pose.size() << endl;
 
-                    std::ostringstream tos;
-                    boost::archive::text_oarchive toa(tos);
+            }
+            else {
+                cout << "Failed to save MapPoints tile" << endl;
+            }
 
-                    toa << (*mit);
+        }
 
-                    std::string tss = tos.str();
+        end_t = clock();
 
-                    tpkfs.push_back(pair<unsigned long int, std::string>(ttId, tss));
+        cout << "Trans TopoMapPoints to server size " << mpTrulyTrans.size() << " use time : " <<
+        (double) (end_t - start_t) / (double) CLOCKS_PER_SEC  << endl;
 
-                    tpposes[ttId] = (*mit)->GetPose() ;
+        f1 << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC  << endl;
 
-                    mpTrulyTrans.push_back(ttId);
-                    tos.clear();
-                }
+        f1.close();
 
-            }
+        return mpTrulyTrans;
 
-            ros::NodeHandle n;
-            ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_save>("saveTopoKeyFrame");
-            orbslam_server::orbslam_save srv;
+    }
 
-            std::ostringstream os;
-            boost::archive::text_oarchive oa(os);
-            oa << tpkfs;
+    std::set<MapPoint *> DataDriver::TransTopoMapPointsFromServer( TopoId tId ) {
 
-            srv.request.DATA = os.str();;
 
-            std::ostringstream ps;
-            boost::archive::text_oarchive pa(ps);
-            pa << tpposes;
+        std::set<MapPoint *> mps_ans;
 
-            srv.request.POSE = ps.str();
+        time_t start_t, end_t;
+        start_t = clock();
 
-            srv.request.ID = tId;
+        std::string data;
+        std::string pose;
 
-            if (client.call(srv)) {
-                ;
-            }
-            else {
-                cout << "Failed to call service save KeyFrames" << endl;
+        if (pCacher->mpTileStore->getTile(TILE_MAPPOINTS, tId, data, pose)) {
+
+            ofstream f2( "TTSmps.txt", ios::app );
+
+            f2 << start_t / CLOCKS_PER_SEC << " " << data.size() + pose.size() << " ";
+
+            end_t = clock();
+
+            f2 << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+            f2.close();
+
+            mps_ans = decodeTopoMapPoints(tId, data, pose);
+
+        }
+
+        end_t = clock();
+
+        cout << "Trans MP size " << mps_ans.size()  << " use time : " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+
+        return mps_ans;
+
+    }
+
+    std::vector<long unsigned int>  DataDriver::TransTopoKeyFramesToServer(TopoId tId, std::vector<KeyFrame *> pKFs) {
+
+        time_t start_t, end_t;
+        start_t = clock();
+
+        std::vector<long unsigned int> mpTrulyTrans;
+
+        if (pKFs.size() > 0) {
+
+            std::string data;
+            std::string pose;
+
+            mpTrulyTrans = encodeTopoKeyFrames(tId, pKFs, data, pose, pCacher->mHotTileCodec);
+
+            if (!pCacher->mpTileStore->saveTile(TILE_KEYFRAMES, tId, data, pose)) {
+                cout << "Failed to save KeyFrames tile" << endl;
             }
 
             end_t = clock();
@@ -598,12 +695,6 @@ namespace ORB_SLAM2 {
             cout << "Trans Topokeyframes to server size " << mpTrulyTrans.size() << " use time : " <<
             (double) (end_t - start_t) / (double) CLOCKS_PER_SEC  << endl;
 
-            tpkfs.clear();
-            tpposes.clear();
-            os.clear();
-            ps.clear();
-            srv.request.POSE.clear();
-
         }
 
         return mpTrulyTrans;
@@ -618,73 +709,188 @@ namespace ORB_SLAM2 {
         time_t start_t, end_t;
         start_t = clock();
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_get>("getTopoKeyFrame");
-        orbslam_server::orbslam_get srv;
+        std::string data;
+        std::string pose;
 
-        srv.request.ID = tId;
+        if (pCacher->mpTileStore->getTile(TILE_KEYFRAMES, tId, data, pose)) {
 
-        if (client.call(srv)) {
+            kfs_ans = decodeTopoKeyFrames(tId, data, pose);
 
-            if( srv.response.DATA.size() <= 0 )
-                return kfs_ans;
+        }
 
-            end_t = clock();
+        end_t = clock();
 
-            std::vector<pair<long unsigned int, std::string> > tkfs;
+        cout << "Trans TopoKF size " << kfs_ans.size()  << " use time : " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+        return kfs_ans;
 
-            std::map<unsigned long int, cv::Mat > tpposes;
+    }
 
-            std::stringstream tis(srv.response.DATA);
+    bool DataDriver::TransTopoTilesToServer(const std::vector<TopoId> &tIds, const std::vector<std::vector<KeyFrame *> > &pKFs,
+                                            const std::vector<std::set<MapPoint *> > &pMPs, const std::vector<uint8_t> &codecs) {
 
-            boost::archive::text_iarchive tia(tis);
+        time_t start_t, end_t;
+        start_t = clock();
 
-            tia >> tkfs;
+        std::vector<TileBlocks> tiles(tIds.size());
 
-            std::stringstream tps( srv.response.POSE );
-            boost::archive::text_iarchive tpa(tps);
+        size_t bytes = 0;
 
-            tpa >> tpposes;
+        for (size_t i = 0; i < tIds.size(); i++) {
 
-            for (int mit = 0; mit < (int)tkfs.size(); mit++) {
-                try {
-                    std::stringstream sis(tkfs[mit].second);
+            tiles[i].tId = tIds[i];
 
-                    boost::archive::text_iarchive sia(sis);
+            // both payloads are replaced, an empty list included, so the objects which moved to another
+            // tile are not loaded again from this one
+            encodeTopoKeyFrames(tIds[i], pKFs[i], tiles[i].kfData, tiles[i].kfPose, codecs[i]);
 
-                    KeyFrame *tKF = new KeyFrame();
+            encodeTopoMapPoints(tIds[i], pMPs[i], tiles[i].mpData, tiles[i].mpPose, codecs[i]);
 
-                    sia >> tKF;
+            tileExtent(pKFs[i], pMPs[i], tiles[i].extent);
 
-                    if (tpposes.find(tKF->mnId) != tpposes.end())
-                        tKF->SetPose(tpposes[tKF->mnId]);
+            bytes += tiles[i].kfData.size() + tiles[i].kfPose.size() + tiles[i].mpData.size() + tiles[i].mpPose.size();
+        }
 
-                    tKF->setCache(pCacher);
+        bool bSaved = pCacher->mpTileStore->saveTiles(tiles);
+        if (!bSaved)
+            cout << "Failed to save tiles" << endl;
 
-                    if (tKF->mnId <= KeyFrame::nNextId && tKF->mnId >= 0)
-                        kfs_ans.insert(tKF);
+        end_t = clock();
 
-                    sis.clear();
+        cout << "Trans " << tIds.size() << " tiles to server size " << bytes << " use time : " <<
+        (double) (end_t - start_t) / (double) CLOCKS_PER_SEC  << endl;
 
-                } catch(...) {
-                    ROS_INFO("error in the trans keyframe from server");
-                }
+        return bSaved;
+
+    }
+
+    void DataDriver::tileExtent(const std::vector<KeyFrame *> &pKFs, const std::set<MapPoint *> &pMPs, std::vector<double> &extent) {
+
+        extent.clear();
+
+        std::vector<cv::Mat> points;
 
+        for (size_t i = 0; i < pKFs.size(); i++)
+            if (pKFs[i])
+                points.push_back(pKFs[i]->GetCameraCenter());
+
+        for (std::set<MapPoint *>::const_iterator mit = pMPs.begin(); mit != pMPs.end(); mit++)
+            if (*mit)
+                points.push_back((*mit)->GetWorldPos());
+
+        for (size_t i = 0; i < points.size(); i++) {
+
+            if (points[i].empty())
+                continue;
+
+            if (extent.empty()) {
+                for (int k = 0; k < 6; k++)
+                    extent.push_back(points[i].at<float>(k % 3));
+                continue;
             }
 
-            tkfs.clear();
-            tpposes.clear();
-            tis.clear();
-            tps.clear();
+            for (int k = 0; k < 3; k++) {
+                extent[k] = std::min(extent[k], (double) points[i].at<float>(k));
+                extent[k + 3] = std::max(extent[k + 3], (double) points[i].at<float>(k));
+            }
         }
 
-        srv.response.POSE.clear();
-        srv.response.DATA.clear();
+    }
+
+    bool DataDriver::QueryTopoTilesFromServer(const TileQuery &query, std::vector<TopoId> &tIds, std::vector<std::set<KeyFrame *> > &kfs,
+                                              std::vector<std::set<MapPoint *> > &mps) {
+
+        time_t start_t, end_t;
+        start_t = clock();
+
+        std::vector<TileBlocks> tiles;
+
+        if (!pCacher->mpTileStore->queryTiles(query, tiles))
+            return false;
+
+        tIds.assign(tiles.size(), 0);
+        kfs.assign(tiles.size(), std::set<KeyFrame *>());
+        mps.assign(tiles.size(), std::set<MapPoint *>());
+
+        size_t nKFs = 0, nMPs = 0;
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+
+            tIds[i] = tiles[i].tId;
+
+            if (tiles[i].kfData.size() > 0)
+                kfs[i] = decodeTopoKeyFrames(tiles[i].tId, tiles[i].kfData, tiles[i].kfPose);
+
+            if (tiles[i].mpData.size() > 0)
+                mps[i] = decodeTopoMapPoints(tiles[i].tId, tiles[i].mpData, tiles[i].mpPose);
+
+            nKFs += kfs[i].size();
+            nMPs += mps[i].size();
+        }
 
         end_t = clock();
 
-        cout << "Trans TopoKF size " << kfs_ans.size()  << " use time : " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
-        return kfs_ans;
+        cout << "Query " << tiles.size() << " tiles from server KF size " << nKFs << " MP size " << nMPs
+             << " use time : " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+
+        return true;
+
+    }
+
+    void DataDriver::TransTopoTilesFromServer(const std::vector<TopoId> &tIds, std::set<KeyFrame *> &kfs,
+                                              std::set<MapPoint *> &mps) {
+
+        std::vector<std::set<KeyFrame *> > tkfs;
+        std::vector<std::set<MapPoint *> > tmps;
+
+        if (!TransTopoTilesFromServer(tIds, tkfs, tmps))
+            return;
+
+        for (size_t i = 0; i < tIds.size(); i++) {
+            kfs.insert(tkfs[i].begin(), tkfs[i].end());
+            mps.insert(tmps[i].begin(), tmps[i].end());
+        }
+
+    }
+
+    bool DataDriver::TransTopoTilesFromServer(const std::vector<TopoId> &tIds, std::vector<std::set<KeyFrame *> > &kfs,
+                                              std::vector<std::set<MapPoint *> > &mps) {
+
+        time_t start_t, end_t;
+        start_t = clock();
+
+        std::vector<TileBlocks> tiles(tIds.size());
+
+        kfs.assign(tIds.size(), std::set<KeyFrame *>());
+        mps.assign(tIds.size(), std::set<MapPoint *>());
+
+        for (size_t i = 0; i < tIds.size(); i++)
+            tiles[i].tId = tIds[i];
+
+        if (!pCacher->mpTileStore->getTiles(tiles)) {
+            cout << "Failed to get tiles" << endl;
+            return false;
+        }
+
+        size_t nKFs = 0, nMPs = 0;
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+
+            if (tiles[i].kfData.size() > 0)
+                kfs[i] = decodeTopoKeyFrames(tiles[i].tId, tiles[i].kfData, tiles[i].kfPose);
+
+            if (tiles[i].mpData.size() > 0)
+                mps[i] = decodeTopoMapPoints(tiles[i].tId, tiles[i].mpData, tiles[i].mpPose);
+
+            nKFs += kfs[i].size();
+            nMPs += mps[i].size();
+        }
+
+        end_t = clock();
+
+        cout << "Trans " << tIds.size() << " tiles from server KF size " << nKFs << " MP size " << nMPs
+             << " use time : " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+
+        return true;
 
     }
 
@@ -695,12 +901,10 @@ namespace ORB_SLAM2 {
         time_t start_t, end_t;
         start_t = clock();
 
-        f3.open( "STTkfs.txt", ios::app );
+        ofstream f3( "STTkfs.txt", ios::app );
         f3 << start_t / CLOCKS_PER_SEC << " ";
         int size = 0;
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_save>("saveOneKeyFrame");
         orbslam_server::orbslam_save srv;
 
         for (int mit = 0; mit < (int) pKFs.size(); mit++) {
@@ -721,11 +925,11 @@ namespace ORB_SLAM2 {
 
             srv.request.ID = pKFs[mit]->mnId;
 
-            srv.request.DATA = ss;
+            srv.request.DATA.assign(ss.begin(), ss.end());
             size += ss.size();
-            srv.request.POSE = pose;
+            srv.request.POSE.assign(pose.begin(), pose.end());
             size += pose.size();
-            if (client.call(srv)) { ;
+            if (pCacher->mpConnections->call("saveOneKeyFrame", srv)) { ;
             }
             else {
                 ROS_ERROR("Failed to call service save");
@@ -751,7 +955,7 @@ namespace ORB_SLAM2 {
 
         time_t start_t, end_t;
         start_t = clock();
-        f4.open( "TTSkfs.txt", ios::app );
+        ofstream f4( "TTSkfs.txt", ios::app );
 
         f4 << start_t / CLOCKS_PER_SEC << " ";
         std::set<KeyFrame *> ans_kfs;
@@ -759,8 +963,6 @@ namespace ORB_SLAM2 {
 
         int size = 0;
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_get>("getOneKeyFrame");
         orbslam_server::orbslam_get srv;
 
         for (std::set<long unsigned int>::iterator mit = pKFs.begin(); mit != pKFs.end(); mit++) {
@@ -770,11 +972,11 @@ namespace ORB_SLAM2 {
             srv.request.ID = (*mit);
 
             try {
-                if (client.call(srv)) {
+                if (pCacher->mpConnections->call("getOneKeyFrame", srv)) {
 
-                    std::string ss = srv.response.DATA;
+                    std::string ss(srv.response.DATA.begin(), srv.response.DATA.end());
 
-                    std::string pose = srv.response.POSE;
+                    std::string pose(srv.response.POSE.begin(), srv.response.POSE.end());
 
                     size = size + ss.size() + pose.size();
 
@@ -836,8 +1038,6 @@ namespace ORB_SLAM2 {
         time_t start_t, end_t;
         start_t = clock();
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_save>("saveOneMapPoint");
         orbslam_server::orbslam_save srv;
 
         for (std::set<MapPoint *>::iterator mit = pMPs.begin(); mit != pMPs.end(); mit++) {
@@ -851,9 +1051,9 @@ namespace ORB_SLAM2 {
 
                 srv.request.ID = (*mit)->mnId;
 
-                srv.request.DATA = ss;
+                srv.request.DATA.assign(ss.begin(), ss.end());
 
-                if (client.call(srv)) {
+                if (pCacher->mpConnections->call("saveOneMapPoint", srv)) {
                     ans_mps.push_back((*mit)->mnId);
                 }
                 else {
@@ -882,8 +1082,6 @@ namespace ORB_SLAM2 {
         std::set<MapPoint *> ans_mps;
         ans_mps.clear();
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_get>("getOneMapPoint");
         orbslam_server::orbslam_get srv;
 
         for (std::set<long unsigned int>::iterator mit = pLMPs.begin(); mit != pLMPs.end(); mit++) {
@@ -893,9 +1091,9 @@ namespace ORB_SLAM2 {
             srv.request.ID = (*mit);
 
             try {
-                if (client.call(srv)) {
+                if (pCacher->mpConnections->call("getOneMapPoint", srv)) {
 
-                    std::string ss = srv.response.DATA;
+                    std::string ss(srv.response.DATA.begin(), srv.response.DATA.end());
                     if (ss == "") { ;
                     } else {
 
@@ -935,30 +1133,20 @@ namespace ORB_SLAM2 {
         start_t = clock();
 
         pCacher->mTopoMap->mpKfPose.clear();
+        pCacher->mTopoMap->mpKfPoseStored.clear();
 
         std::map<long unsigned int, std::string > kf_pose;
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_pose_get>("getAllKeyFramePose");
-        orbslam_server::orbslam_pose_get srv;
-
-        if (client.call(srv)) {
-
-            std::stringstream sPose(srv.response.POSE);
-            boost::archive::text_iarchive iPose( sPose );
-
-            iPose >> kf_pose;
-
-        }
+        if (!pCacher->mpTileStore->getAllPoses(TILE_KEYFRAMES, kf_pose))
+            ROS_INFO( "get all kf pose error");
 
         for( std::map<long unsigned int, std::string>::iterator mit = kf_pose.begin(); mit != kf_pose.end(); mit ++ ) {
 
-            std::map<long unsigned int, cv::Mat> subkf_pose;
-            stringstream tss( (*mit).second );
-            boost::archive::text_iarchive tis( tss );
-            tis >> subkf_pose;
+            KeyFramePoseMap subkf_pose;
+            decodeKeyFramePoses( (*mit).second, subkf_pose );
             for( std::map<long unsigned int, cv::Mat>::iterator mmit = subkf_pose.begin(); mmit != subkf_pose.end(); mmit ++ ) {
                 pCacher->mTopoMap->mpKfPose[ (*mmit).first ] = (*mmit).second;
+                pCacher->mTopoMap->mpKfPoseStored[ (*mmit).first ] = (*mmit).second.clone();
             }
             subkf_pose.clear();
         }
@@ -982,32 +1170,22 @@ namespace ORB_SLAM2 {
         start_t = clock();
 
         pCacher->mTopoMap->mpMpPose.clear();
+        pCacher->mTopoMap->mpMpPoseStored.clear();
         pCacher->mTopoMap->mpMpObservations.clear();
 
-        vector< pair<long unsigned int, std::string > > kf_pose;
-
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_pose_get>("getAllTopoMapPointPose");
-        orbslam_server::orbslam_pose_get srv;
-
-        if (client.call(srv)) {
-
-            std::stringstream sPose(srv.response.POSE);
-            boost::archive::text_iarchive iPose( sPose );
-
-            iPose >> kf_pose;
+        std::map<long unsigned int, std::string > kf_pose;
 
-        }
+        if (!pCacher->mpTileStore->getAllPoses(TILE_MAPPOINTS, kf_pose))
+            ROS_INFO( "get all mp pose error");
 
-        for( int i = 0 ; i <kf_pose.size(); i++ ) {
+        for( std::map<long unsigned int, std::string>::iterator tit = kf_pose.begin(); tit != kf_pose.end(); tit ++ ) {
 
-            stringstream tss( kf_pose[i].second );
-            boost::archive::text_iarchive tis( tss );
-            std::map<unsigned long int, pair<cv::Mat,  std::vector< pair < long unsigned int, LoopKeyPoint > > > > tpposes;
-            tis >> tpposes;
-            for( std::map<unsigned long int, pair<cv::Mat, std::vector< pair < long unsigned int, LoopKeyPoint > > > >::iterator mit = tpposes.begin();
+            MapPointPoseMap tpposes;
+            decodeMapPointPoses( (*tit).second, tpposes );
+            for( MapPointPoseMap::iterator mit = tpposes.begin();
                     mit != tpposes.end(); mit ++ ) {
                 pCacher->mTopoMap->mpMpPose[ (*mit).first ] = (*mit).second.first;
+                pCacher->mTopoMap->mpMpPoseStored[ (*mit).first ] = (*mit).second.first.clone();
                 pCacher->mTopoMap->mpMpObservations[ (*mit).first ] = (*mit).second.second;
             }
             tpposes.clear();
@@ -1036,38 +1214,20 @@ namespace ORB_SLAM2 {
         for( std::map< TopoId, std::set<long unsigned int > >::iterator topoKfIter = pCacher->mTopoMap->mpTopoKFs.begin();
              topoKfIter != pCacher->mTopoMap->mpTopoKFs.end(); topoKfIter++) {
 
-            std::map<unsigned long int, cv::Mat > tpposes;
+            KeyFramePoseMap tpposes;
             for( std::set<long unsigned int>::iterator mit = (*topoKfIter).second.begin(); mit != (*topoKfIter).second.end() ; mit++ ) {
                 tpposes[ *mit ] = pCacher->mTopoMap->mpKfPose[ *mit ];
             }
-            std::ostringstream os;
-            boost::archive::text_oarchive oa(os);
-
-            oa << tpposes;
-            vecKfPose[ (*topoKfIter).first ] = os.str();
-            os.clear();
+            encodeKeyFramePoses( (*topoKfIter).first, tpposes, vecKfPose[ (*topoKfIter).first ] );
+            compressTile( vecKfPose[ (*topoKfIter).first ], pCacher->mHotTileCodec );
             tpposes.clear();
         }
 
-        std::ostringstream os;
-        boost::archive::text_oarchive oa(os);
-
-        oa << vecKfPose;
-
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_pose_save>("updateAllKeyFramePose");
-        orbslam_server::orbslam_pose_save srv;
-
-        srv.request.POSE = os.str();
-
-        if (client.call(srv)) {
-            ;
-        } else {
+        if (!pCacher->mpTileStore->updateAllPoses(TILE_KEYFRAMES, vecKfPose)) {
             ROS_INFO( "update all kf pose error");
         }
 
         vecKfPose.clear();
-        os.clear();
         //pCacher->mTopoMap->mpKfPose.clear();
 
         end_t = clock();
@@ -1082,12 +1242,12 @@ namespace ORB_SLAM2 {
         time_t start_t, end_t;
         start_t = clock();
 
-        std::vector< pair<long unsigned int, std::string> >  vecMPPose;
+        std::map< long unsigned int, std::string >  vecMPPose;
 
         for( std::map<TopoId, set<long unsigned int> >::iterator mit = pCacher->mTopoMap->mpTopoMps.begin();
                 mit != pCacher->mTopoMap->mpTopoMps.end(); mit++ ) {
 
-            std::map<unsigned long int, pair<cv::Mat,  std::vector< pair < long unsigned int, LoopKeyPoint > > > > tpposes;
+            MapPointPoseMap tpposes;
 
             for( std::set<long unsigned int>::iterator mpsit = (*mit).second.begin(); mpsit!= (*mit).second.end(); mpsit ++ ) {
 
@@ -1100,41 +1260,313 @@ namespace ORB_SLAM2 {
 
             }
 
+            encodeMapPointPoses( (*mit).first, tpposes, vecMPPose[ (*mit).first ] );
+            compressTile( vecMPPose[ (*mit).first ], pCacher->mHotTileCodec );
+
+            tpposes.clear();
+
+        }
+
+        if (!pCacher->mpTileStore->updateAllPoses(TILE_MAPPOINTS, vecMPPose)) {
+            ROS_INFO( "update all mp pose error");
+        }
+
+        vecMPPose.clear();
+        end_t = clock();
+        cout << "updateAllMapPointPose use time " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+
+    }
+
+    bool DataDriver::keyFramePoseChanged( const cv::Mat &Tcw, const cv::Mat &storedTcw ) {
+
+        if (Tcw.empty() || storedTcw.empty())
+            return !(Tcw.empty() && storedTcw.empty());
+
+        cv::Mat dt = Tcw.rowRange(0, 3).col(3) - storedTcw.rowRange(0, 3).col(3);
+        if (cv::norm(dt) > pCacher->mfPoseDeltaTranslation)
+            return true;
+
+        // angle of the relative rotation
+        cv::Mat dR = Tcw.rowRange(0, 3).colRange(0, 3) * storedTcw.rowRange(0, 3).colRange(0, 3).t();
+        double c = (cv::trace(dR)[0] - 1.0) / 2.0;
+        return acos(std::max(-1.0, std::min(1.0, c))) > pCacher->mfPoseDeltaRotation;
+
+    }
+
+    bool DataDriver::mapPointPoseChanged( const cv::Mat &Pos, const cv::Mat &storedPos ) {
+
+        if (Pos.empty() || storedPos.empty())
+            return !(Pos.empty() && storedPos.empty());
+
+        return cv::norm(Pos - storedPos) > pCacher->mfPoseDeltaTranslation;
+
+    }
+
+    void DataDriver::updateChangedPoses(){
+
+        cout << "-- begin updateChangedPoses\n";
+        time_t start_t, end_t;
+        start_t = clock();
+
+        TopoMap *pTopo = pCacher->mTopoMap;
+
+        std::map< TopoId, std::string > kfPoses;
+        std::map< TopoId, std::string > mpPoses;
+
+        int nKFs = 0, nMPs = 0;
+
+        // objects without a stored pose are not in the store yet, their tile is written on eviction
+        for( std::map< TopoId, std::set<long unsigned int > >::iterator tit = pTopo->mpTopoKFs.begin();
+             tit != pTopo->mpTopoKFs.end(); tit++) {
+
+            bool bChanged = false;
+
+            for( std::set<long unsigned int>::iterator mit = (*tit).second.begin(); mit != (*tit).second.end() ; mit++ ) {
+                std::map<long unsigned int, cv::Mat>::iterator sit = pTopo->mpKfPoseStored.find( *mit );
+                if( sit != pTopo->mpKfPoseStored.end() && keyFramePoseChanged( pTopo->mpKfPose[ *mit ], (*sit).second ) ) {
+                    bChanged = true;
+                    nKFs++;
+                }
+            }
+
+            if( !bChanged )
+                continue;
+
+            KeyFramePoseMap tpposes;
+            for( std::set<long unsigned int>::iterator mit = (*tit).second.begin(); mit != (*tit).second.end() ; mit++ ) {
+                tpposes[ *mit ] = pTopo->mpKfPose[ *mit ];
+                pTopo->mpKfPoseStored[ *mit ] = tpposes[ *mit ].clone();
+            }
+            encodeKeyFramePoses( (*tit).first, tpposes, kfPoses[ (*tit).first ] );
+            compressTile( kfPoses[ (*tit).first ], pCacher->mHotTileCodec );
+
+            if( pCacher->mpJournal ) {
+                std::string record;
+                TileCodec::encodeKeyFramePoses( (*tit).first, tpposes, record );
+                pCacher->mpJournal->append( TILE_KEYFRAME_POSES, record );
+            }
+        }
+
+        for( std::map<TopoId, set<long unsigned int> >::iterator tit = pTopo->mpTopoMps.begin();
+                tit != pTopo->mpTopoMps.end(); tit++ ) {
+
+            bool bChanged = false;
+
+            for( std::set<long unsigned int>::iterator mit = (*tit).second.begin(); mit != (*tit).second.end(); mit ++ ) {
+                std::map<long unsigned int, cv::Mat>::iterator sit = pTopo->mpMpPoseStored.find( *mit );
+                if( sit != pTopo->mpMpPoseStored.end() && pTopo->mpMpPose.count( *mit ) &&
+                        mapPointPoseChanged( pTopo->mpMpPose[ *mit ], (*sit).second ) ) {
+                    bChanged = true;
+                    nMPs++;
+                }
+            }
+
+            if( !bChanged )
+                continue;
+
+            MapPointPoseMap tpposes;
+            for( std::set<long unsigned int>::iterator mit = (*tit).second.begin(); mit != (*tit).second.end(); mit ++ ) {
+                if( pTopo->mpMpPose.count( *mit ) && pTopo->mpMpObservations.count( *mit ) ) {
+                    tpposes[ *mit ] = make_pair( pTopo->mpMpPose[ *mit ], pTopo->mpMpObservations[ *mit ] );
+                    pTopo->mpMpPoseStored[ *mit ] = pTopo->mpMpPose[ *mit ].clone();
+                }
+            }
+            encodeMapPointPoses( (*tit).first, tpposes, mpPoses[ (*tit).first ] );
+            compressTile( mpPoses[ (*tit).first ], pCacher->mHotTileCodec );
+
+            if( pCacher->mpJournal ) {
+                std::string record;
+                TileCodec::encodeMapPointPoses( (*tit).first, tpposes, record );
+                pCacher->mpJournal->append( TILE_MAPPOINT_POSES, record );
+            }
+        }
+
+        // write-ahead, the corrected poses are on disk before the store is changed
+        if( pCacher->mpJournal && !pCacher->mpJournal->flush() )
+            ROS_INFO( "journal the changed poses error" );
+
+        // bounded requests, each one is a transaction on the server
+        const size_t nBatch = std::max(pCacher->mnPoseBatch, 1);
+
+        std::map< TopoId, std::string >::iterator kit = kfPoses.begin();
+        std::map< TopoId, std::string >::iterator pit = mpPoses.begin();
+
+        size_t bytes = 0;
+
+        while( kit != kfPoses.end() || pit != mpPoses.end() ) {
+
+            std::map< TopoId, std::string > kfBatch, mpBatch;
+
+            while( kit != kfPoses.end() && kfBatch.size() + mpBatch.size() < nBatch ) {
+                bytes += (*kit).second.size();
+                kfBatch.insert( *kit++ );
+            }
+
+            while( pit != mpPoses.end() && kfBatch.size() + mpBatch.size() < nBatch ) {
+                bytes += (*pit).second.size();
+                mpBatch.insert( *pit++ );
+            }
+
+            if( !pCacher->mpTileStore->updatePoses( kfBatch, mpBatch ) )
+                ROS_INFO( "update changed poses error" );
+        }
+
+        end_t = clock();
+        cout << "updateChangedPoses kf " << nKFs << " in " << kfPoses.size() << " tiles, mp " << nMPs << " in "
+             << mpPoses.size() << " tiles, size " << bytes << " use time " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+
+    }
+
+    void DataDriver::encodeKeyFramePoses( TopoId tId, const KeyFramePoseMap &poses, std::string &out ) {
+
+        if (pCacher->mTileFormat == TILE_FORMAT_BINARY) {
+            TileCodec::encodeKeyFramePoses(tId, poses, out);
+        } else {
             std::ostringstream os;
             boost::archive::text_oarchive oa(os);
+            oa << poses;
+            out = os.str();
+        }
 
-            oa << tpposes;
+    }
 
-            vecMPPose.push_back( make_pair( (*mit).first, os.str() ));
-
-            tpposes.clear();
-            os.clear();
+    bool DataDriver::decodeKeyFramePoses( const std::string &in, KeyFramePoseMap &poses ) {
 
+        if (TileCodec::isTile(in)) {
+            std::string raw;
+            const std::string &tile = expandTile(in, raw);
+            return TileCodec::decodeKeyFramePoses(tile.data(), tile.size(), poses);
         }
 
-        std::ostringstream os;
-        boost::archive::text_oarchive oa(os);
+        if (in.empty())
+            return false;
+
+        try {
+            std::stringstream is(in);
+            boost::archive::text_iarchive ia(is);
+            ia >> poses;
+        } catch(...) {
+            ROS_INFO("error in decoding keyframe poses");
+            return false;
+        }
 
-        oa << vecMPPose;
+        return true;
 
-        ros::NodeHandle n;
-        ros::ServiceClient client = n.serviceClient<orbslam_server::orbslam_pose_save>("updateAllTopoMapPointPose");
-        orbslam_server::orbslam_pose_save srv;
+    }
 
-        srv.request.POSE = os.str();
+    void DataDriver::encodeMapPointPoses( TopoId tId, const MapPointPoseMap &poses, std::string &out ) {
 
-        if (client.call(srv)) {
-            ;
+        if (pCacher->mTileFormat == TILE_FORMAT_BINARY) {
+            TileCodec::encodeMapPointPoses(tId, poses, out);
         } else {
-            ROS_INFO( "update all mp pose error");
+            std::ostringstream os;
+            boost::archive::text_oarchive oa(os);
+            oa << poses;
+            out = os.str();
         }
 
-        os.clear();
-        vecMPPose.clear();
-        end_t = clock();
-        cout << "updateAllMapPointPose use time " << (double) (end_t - start_t) / (double) CLOCKS_PER_SEC << endl;
+    }
+
+    bool DataDriver::decodeMapPointPoses( const std::string &in, MapPointPoseMap &poses ) {
+
+        if (TileCodec::isTile(in)) {
+            std::string raw;
+            const std::string &tile = expandTile(in, raw);
+            return TileCodec::decodeMapPointPoses(tile.data(), tile.size(), poses);
+        }
+
+        if (in.empty())
+            return false;
+
+        try {
+            std::stringstream is(in);
+            boost::archive::text_iarchive ia(is);
+            ia >> poses;
+        } catch(...) {
+            ROS_INFO("error in decoding mappoint poses");
+            return false;
+        }
+
+        return true;
 
     }
 
-}
+    void DataDriver::compressTile( std::string &tile, uint8_t codec ) {
+
+        if (codec == TILE_CODEC_NONE || !TileCodec::isTile(tile))
+            return;
+
+        const size_t rawSize = tile.size();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        bool bPacked = TileCodec::compress(tile, codec);
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
+        unique_lock<mutex> lock(mMutexCodecStats);
+
+        // kept uncompressed when it did not shrink
+        CodecStats &stats = mCompressStats[bPacked ? codec : (uint8_t) TILE_CODEC_NONE];
+        stats.nTiles++;
+        stats.rawBytes += rawSize;
+        stats.packedBytes += tile.size();
+        stats.seconds += seconds;
+
+    }
+
+    const std::string &DataDriver::expandTile( const std::string &in, std::string &raw ) {
+
+        TileHeader header;
+        if (!TileCodec::readHeader(in.data(), in.size(), header) || header.codec == TILE_CODEC_NONE)
+            return in;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // on failure the decoders report the tile which is still compressed
+        if (!TileCodec::decompress(in.data(), in.size(), raw))
+            return in;
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        unique_lock<mutex> lock(mMutexCodecStats);
+
+        CodecStats &stats = mExpandStats[header.codec];
+        stats.nTiles++;
+        stats.rawBytes += raw.size();
+        stats.packedBytes += in.size();
+        stats.seconds += seconds;
+
+        return raw;
+
+    }
+
+    void DataDriver::reportCodecs() {
+
+        std::map<uint8_t, CodecStats> compressed, expanded;
+
+        {
+            unique_lock<mutex> lock(mMutexCodecStats);
+            compressed = mCompressStats;
+            expanded = mExpandStats;
+        }
+
+        for (std::map<uint8_t, CodecStats>::iterator mit = compressed.begin(); mit != compressed.end(); mit++) {
+
+            const CodecStats &s = mit->second;
+
+            cout << "tile codec " << (int) mit->first << ": " << s.nTiles << " compressed, " << (s.rawBytes >> 10)
+                 << " KB to " << (s.packedBytes >> 10) << " KB, avg " << 1000.0 * s.seconds / s.nTiles << " ms" << endl;
+        }
+
+        for (std::map<uint8_t, CodecStats>::iterator mit = expanded.begin(); mit != expanded.end(); mit++) {
+
+            const CodecStats &s = mit->second;
+
+            cout << "tile codec " << (int) mit->first << ": " << s.nTiles << " expanded, " << (s.packedBytes >> 10)
+                 << " KB to " << (s.rawBytes >> 10) << " KB, avg " << 1000.0 * s.seconds / s.nTiles << " ms" << endl;
+        }
+
+    }
+
+}
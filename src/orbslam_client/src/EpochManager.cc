@@ -0,0 +1,199 @@
+#include "EpochManager.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+namespace ORB_SLAM2 {
+
+    namespace {
+
+        struct Record {
+            // the epoch the thread entered its section in, 0 out of a section
+            std::atomic<long unsigned int> epoch;
+            int depth;
+            std::atomic<bool> bUsed;
+        };
+
+        struct Retired {
+            long unsigned int epoch;
+            KeyFrame *pKF;
+            MapPoint *pMP;
+        };
+
+        struct Epochs {
+            Epochs() : nFreed(0) {}
+            std::mutex mutex;
+            // of the threads, reused once a thread is over
+            std::vector<Record *> records;
+            // in the order of their epochs
+            std::deque<Retired> retired;
+            long unsigned int nFreed;
+        };
+
+        Epochs &epochs() {
+            static Epochs *pEpochs = new Epochs();
+            return *pEpochs;
+        }
+
+        std::atomic<long unsigned int> gEpoch(1);
+
+        struct RecordHolder {
+            RecordHolder() : pRecord(nullptr) {}
+            ~RecordHolder() {
+                if (pRecord) {
+                    pRecord->depth = 0;
+                    pRecord->epoch.store(0, std::memory_order_release);
+                    pRecord->bUsed.store(false, std::memory_order_release);
+                }
+            }
+            Record *pRecord;
+        };
+
+        thread_local RecordHolder tlRecord;
+
+        Record *record() {
+
+            if (tlRecord.pRecord)
+                return tlRecord.pRecord;
+
+            Epochs &e = epochs();
+            unique_lock<mutex> lock(e.mutex);
+
+            for (size_t i = 0; i < e.records.size() && !tlRecord.pRecord; i++) {
+                bool bUsed = false;
+                if (e.records[i]->bUsed.compare_exchange_strong(bUsed, true))
+                    tlRecord.pRecord = e.records[i];
+            }
+
+            if (!tlRecord.pRecord) {
+                Record *pRecord = new Record();
+                pRecord->epoch.store(0);
+                pRecord->bUsed.store(true);
+                e.records.push_back(pRecord);
+                tlRecord.pRecord = pRecord;
+            }
+
+            tlRecord.pRecord->depth = 0;
+
+            return tlRecord.pRecord;
+
+        }
+
+        void retire(KeyFrame *pKF, MapPoint *pMP) {
+
+            Epochs &e = epochs();
+            unique_lock<mutex> lock(e.mutex);
+
+            Retired r;
+            r.epoch = gEpoch.load();
+            r.pKF = pKF;
+            r.pMP = pMP;
+
+            e.retired.push_back(r);
+
+        }
+
+    }
+
+    void EpochManager::enter() {
+
+        Record *pRecord = record();
+
+        if (pRecord->depth++ > 0)
+            return;
+
+        pRecord->epoch.store(gEpoch.load());
+
+        // published before any object is read
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    }
+
+    void EpochManager::exit() {
+
+        Record *pRecord = record();
+
+        if (pRecord->depth > 0 && --pRecord->depth == 0)
+            pRecord->epoch.store(0, std::memory_order_release);
+
+    }
+
+    void EpochManager::retire(KeyFrame *pKF) {
+
+        if (pKF)
+            ORB_SLAM2::retire(pKF, nullptr);
+
+    }
+
+    void EpochManager::retire(MapPoint *pMP) {
+
+        if (pMP)
+            ORB_SLAM2::retire(nullptr, pMP);
+
+    }
+
+    size_t EpochManager::collect() {
+
+        std::vector<Retired> freed;
+
+        {
+            Epochs &e = epochs();
+            unique_lock<mutex> lock(e.mutex);
+
+            if (e.retired.empty())
+                return 0;
+
+            // only advanced here, under the mutex
+            long unsigned int epoch = gEpoch.load();
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            bool bAdvance = true;
+            for (size_t i = 0; i < e.records.size() && bAdvance; i++) {
+                long unsigned int entered = e.records[i]->epoch.load();
+                if (entered != 0 && entered != epoch)
+                    bAdvance = false;
+            }
+
+            if (bAdvance)
+                gEpoch.store(++epoch);
+
+            while (!e.retired.empty() && e.retired.front().epoch + 2 <= epoch) {
+                freed.push_back(e.retired.front());
+                e.retired.pop_front();
+            }
+
+            e.nFreed += freed.size();
+        }
+
+        // the destructors run out of the mutex
+        for (size_t i = 0; i < freed.size(); i++) {
+            delete freed[i].pKF;
+            delete freed[i].pMP;
+        }
+
+        return freed.size();
+
+    }
+
+    EpochStats EpochManager::stats() {
+
+        Epochs &e = epochs();
+        unique_lock<mutex> lock(e.mutex);
+
+        EpochStats stats;
+        stats.epoch = gEpoch.load();
+        stats.nRetired = e.retired.size();
+        stats.nFreed = e.nFreed;
+
+        return stats;
+
+    }
+
+} //namespace ORB_SLAM
@@ -21,6 +21,8 @@
 #include "KeyFrame.h"
 #include "Converter.h"
 #include "ORBmatcher.h"
+#include "MapMemory.h"
+#include "TileArena.h"
 #include<mutex>
 
 namespace ORB_SLAM2 {
@@ -42,7 +44,7 @@ namespace ORB_SLAM2 {
             mnMaxY(F.mnMaxY), mK(F.mK), mvpMapPoints(F.mvpMapPoints), mpCacher(pCacher), mbFirstConnection(true),
             mpParent(nullptr),
             mbNotErase(false),
-            mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb / 2) {
+            mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb / 2), mnVersion(1), mnStoredVersion(0) {
         {
             std::unique_lock<mutex> lock( mMutexNextId );
 
@@ -67,6 +69,7 @@ namespace ORB_SLAM2 {
 
     void KeyFrame::ComputeBoW() {
         if (mBowVec.empty() || mFeatVec.empty()) {
+            SetDirty();
             vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
             // Feature vector associate features with nodes in the 4th level (from leaves up)
             // We assume the vocabulary tree has 6 levels, change the 4 otherwise
@@ -78,6 +81,7 @@ namespace ORB_SLAM2 {
     }
 
     void KeyFrame::SetPose(const cv::Mat &Tcw_) {
+        SetDirty();
         unique_lock<mutex> lock(mMutexPose);
         Tcw_.copyTo(Tcw);
         cv::Mat Rcw = Tcw.rowRange(0, 3).colRange(0, 3);
@@ -144,6 +148,7 @@ namespace ORB_SLAM2 {
     }
 
     void KeyFrame::UpdateBestCovisibles() {
+        SetDirty();
         unique_lock<mutex> lock(mMutexConnections);
         vector<pair<int, LightKeyFrame> > vPairs;
         vPairs.reserve(mConnectedKeyFrameWeights.size());
@@ -305,7 +310,86 @@ namespace ORB_SLAM2 {
 
     }
 
+    void KeyFrame::SetDirty() {
+        mnVersion++;
+    }
+
+    unsigned int KeyFrame::GetVersion() {
+        return mnVersion;
+    }
+
+    bool KeyFrame::IsDirty() {
+        return mnVersion != mnStoredVersion;
+    }
+
+    void KeyFrame::SetStored(unsigned int nVersion) {
+        mnStoredVersion = nVersion;
+    }
+
+    void KeyFrame::RestoreTopoMap() {
+        TopoMap *pTopo = mpCacher->mTopoMap;
+        pTopo->restoreKeyFrame(mnId, mTopoId);
+        pTopo->addKeyFrameBowVector(mnId, mBowVec);
+
+        unique_lock<mutex> lock(mMutexConnections);
+        pTopo->setKeyFrameObservation(mnId, mConnectedKeyFrameWeights);
+        if (mpParent.mnId > 0)
+            pTopo->ChangeParent(mnId, mpParent.mnId);
+        for (std::set<LightKeyFrame>::iterator sit = mspLoopEdges.begin(); sit != mspLoopEdges.end(); sit++)
+            pTopo->AddLoopEdge(mnId, sit->mnId);
+    }
+
+    void *KeyFrame::operator new(size_t size) {
+        return TileArena::allocate(size);
+    }
+
+    void KeyFrame::operator delete(void *p) {
+        TileArena::release(p);
+    }
+
+    size_t KeyFrame::MemoryBytes() {
+
+        size_t bytes = TileArena::objectBytes(sizeof(KeyFrame));
+
+        bytes += heapBytes(mvKeys) + heapBytes(mvKeysUn) + heapBytes(mvuRight) + heapBytes(mvDepth);
+        bytes += heapBytes(mDescriptors);
+        bytes += heapBytes(mvScaleFactors) + heapBytes(mvLevelSigma2) + heapBytes(mvInvLevelSigma2);
+        bytes += heapBytes(mTcwGBA) + heapBytes(mTcwBefGBA) + heapBytes(mTcp) + heapBytes(mK);
+
+        // BoW
+        bytes += heapBytes(mBowVec) + heapBytes(mFeatVec);
+        for (DBoW2::FeatureVector::const_iterator fit = mFeatVec.begin(); fit != mFeatVec.end(); fit++)
+            bytes += heapBytes(fit->second);
+
+        bytes += heapBytes(mGrid);
+        for (size_t i = 0; i < mGrid.size(); i++) {
+            bytes += heapBytes(mGrid[i]);
+            for (size_t j = 0; j < mGrid[i].size(); j++)
+                bytes += heapBytes(mGrid[i][j]);
+        }
+
+        {
+            unique_lock<mutex> lock(mMutexPose);
+            bytes += heapBytes(Tcw) + heapBytes(Twc) + heapBytes(Ow) + heapBytes(Cw);
+        }
+
+        {
+            unique_lock<mutex> lock(mMutexFeatures);
+            bytes += heapBytes(mvpMapPoints);
+        }
+
+        {
+            unique_lock<mutex> lock(mMutexConnections);
+            bytes += heapBytes(mConnectedKeyFrameWeights) + heapBytes(mvpOrderedConnectedKeyFrames) +
+                     heapBytes(mvOrderedWeights) + heapBytes(mspChildrens) + heapBytes(mspLoopEdges);
+        }
+
+        return bytes;
+
+    }
+
     void KeyFrame::AddMapPoint(MapPoint *pMP, const size_t &idx) {
+        SetDirty();
         unique_lock<mutex> lock(mMutexFeatures);
         LightMapPoint tLMP(pMP);
         mvpMapPoints[idx] = tLMP;
@@ -316,12 +400,14 @@ namespace ORB_SLAM2 {
     }
 
     void KeyFrame::EraseMapPointMatch(const size_t &idx) {
+        SetDirty();
         unique_lock<mutex> lock(mMutexFeatures);
         mvpMapPoints[idx] = static_cast<LightMapPoint>(NULL);
 
     }
 
     void KeyFrame::EraseMapPointMatch(MapPoint *pMP) {
+        SetDirty();
         int idx = pMP->GetIndexInKeyFrame(this);
         if (idx >= 0)
             mvpMapPoints[idx] = static_cast<LightMapPoint>(NULL);
@@ -339,6 +425,7 @@ namespace ORB_SLAM2 {
 
 
     void KeyFrame::ReplaceMapPointMatch(const size_t &idx, MapPoint *pMP) {
+        SetDirty();
         if (pMP) {
             LightMapPoint tLMP(pMP);
             mvpMapPoints[idx] = tLMP;
@@ -483,6 +570,8 @@ namespace ORB_SLAM2 {
 
             // mspConnectedKeyFrames = spConnectedKeyFrames;
 
+            SetDirty();
+
             mConnectedKeyFrameWeights = KFcounter;
 
             mpCacher->mTopoMap->setKeyFrameObservation( this->mnId, KFcounter );
@@ -503,18 +592,21 @@ namespace ORB_SLAM2 {
     }
 
     void KeyFrame::AddChild(KeyFrame *pKF) {
+        SetDirty();
         //unique_lock<mutex> lockCon(mMutexConnections);
         LightKeyFrame tLKF(pKF);
         mspChildrens.insert(tLKF);
     }
 
     void KeyFrame::EraseChild(KeyFrame *pKF) {
+        SetDirty();
         //unique_lock<mutex> lockCon(mMutexConnections);
         LightKeyFrame tLKF(pKF);
         mspChildrens.erase(tLKF);
     }
 
     void KeyFrame::ChangeParent(KeyFrame *pKF) {
+        SetDirty();
         //unique_lock<mutex> lockCon(mMutexConnections);
         LightKeyFrame tLKF(pKF);
         mpParent = tLKF;
@@ -538,6 +630,11 @@ namespace ORB_SLAM2 {
         return mpParent.getKeyFrameInCache();
     }
 
+    long unsigned int KeyFrame::GetParentId() {
+        unique_lock<mutex> lockCon(mMutexConnections);
+        return mpParent.mnId;
+    }
+
     bool KeyFrame::hasChild(KeyFrame *pKF) {
         unique_lock<mutex> lockCon(mMutexConnections);
         LightKeyFrame tLKF(pKF);
@@ -545,6 +642,7 @@ namespace ORB_SLAM2 {
     }
 
     void KeyFrame::AddLoopEdge(KeyFrame *pKF) {
+        SetDirty();
         unique_lock<mutex> lockCon(mMutexConnections);
         mbNotErase = true;
         LightKeyFrame tLKF(pKF);
@@ -564,11 +662,13 @@ namespace ORB_SLAM2 {
     }
 
     void KeyFrame::SetNotErase() {
+        SetDirty();
         unique_lock<mutex> lock(mMutexConnections);
         mbNotErase = true;
     }
 
     void KeyFrame::SetErase() {
+        SetDirty();
         {
             unique_lock<mutex> lock(mMutexConnections);
             if (mspLoopEdges.empty()) {
@@ -582,6 +682,7 @@ namespace ORB_SLAM2 {
     }
 
     void KeyFrame::SetBadFlag() {
+        SetDirty();
         {
             unique_lock<mutex> lock(mMutexConnections);
             if (mnId == 0)
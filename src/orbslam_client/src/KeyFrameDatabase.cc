@@ -45,6 +45,15 @@ namespace ORB_SLAM2 {
         }
     }
 
+    void KeyFrameDatabase::add(long unsigned int nId, const DBoW2::BowVector &vBow, Cache *pCache) {
+        unique_lock<mutex> lock(mMutex);
+
+        LightKeyFrame tLKF(nId, pCache);
+
+        for (DBoW2::BowVector::const_iterator vit = vBow.begin(), vend = vBow.end(); vit != vend; vit++)
+            mvInvertedFile[vit->first].push_back(tLKF);
+    }
+
     void KeyFrameDatabase::erase(KeyFrame *pKF) {
         unique_lock<mutex> lock(mMutex);
         LightKeyFrame tLKF(pKF);
@@ -22,6 +22,7 @@
 #include "LoopClosing.h"
 #include "ORBmatcher.h"
 #include "Optimizer.h"
+#include "EpochManager.h"
 
 #include<mutex>
 
@@ -53,6 +54,8 @@ namespace ORB_SLAM2 {
 
             // Check if there are keyframes in the queue
             if ( CheckNewKeyFrames() ) {
+                EpochGuard guard;
+
                 // BoW conversion and insertion in Map
                 time_t start_t, end_t;
                 start_t = clock();
@@ -25,6 +25,7 @@
 #include "Converter.h"
 
 #include "Optimizer.h"
+#include "EpochManager.h"
 
 #include "ORBmatcher.h"
 
@@ -63,6 +64,8 @@ void LoopClosing::Run()
         // Check if there are keyframes in the queue
         if(CheckNewKeyFrames())
         {
+            EpochGuard guard;
+
             // Detect loop candidates and check covisibility consistency
             if(DetectLoop())
             {
@@ -723,6 +726,8 @@ void LoopClosing::ResetIfRequested()
 
 void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
 {
+    EpochGuard guard;
+
     cout << "Starting Global Bundle Adjustment" << endl;
 
     time_t start_t, end_t;
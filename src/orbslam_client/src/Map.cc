@@ -26,11 +26,15 @@ namespace ORB_SLAM2 {
 
     Map::Map() : mnMaxKFid(0) {
 
-        new thread(&ORB_SLAM2::Map::anlyzMapsize, this);
+    }
 
+    // a mappoint is charged to the first tile listing it
+    static TopoId chargedTile(MapPoint *pMP) {
+        return pMP->mpTopoIds.empty() ? 0 : *pMP->mpTopoIds.begin();
     }
 
     void Map::AddKeyFrame(KeyFrame *pKF) {
+        mMemory.setKeyFrame(pKF->mnId, pKF->mTopoId, pKF->MemoryBytes());
         unique_lock<mutex> lock(mMutexKFs);
         mspKeyFrames.insert(pKF);
         if (pKF->mnId > mnMaxKFid)
@@ -38,17 +42,20 @@ namespace ORB_SLAM2 {
     }
 
     void Map::AddMapPoint(MapPoint *pMP) {
+        mMemory.setMapPoint(pMP->mnId, chargedTile(pMP), pMP->MemoryBytes());
         unique_lock<mutex> lock(mMutexMPs);
         mspMapPoints.insert(pMP);
     }
 
     void Map::EraseMapPoint(MapPoint *pMP) {
+        mMemory.eraseMapPoint(pMP->mnId);
         unique_lock<mutex> lock(mMutexMPs);
         mspMapPoints.erase(pMP);
 
     }
 
     void Map::EraseKeyFrame(KeyFrame *pKF) {
+        mMemory.eraseKeyFrame(pKF->mnId);
         unique_lock<mutex> lock(mMutexKFs);
         //cout << "erase keyframe :" << pKF->mnFrameId << endl;
         pKF->dropMapPointMatches();
@@ -57,6 +64,7 @@ namespace ORB_SLAM2 {
     }
 
     void Map::transKeyframeToBack(KeyFrame *pKF ) {
+        mMemory.eraseKeyFrame(pKF->mnId);
         unique_lock<mutex> lock(mMutexKFs);
         mspKeyFrames.erase(pKF);
     }
@@ -136,23 +144,19 @@ namespace ORB_SLAM2 {
         mnMaxKFid = 0;
         mvpReferenceMapPoints.clear();
         mvpKeyFrameOrigins.clear();
+        mMemory.clear();
     }
 
     void Map::anlyzMapsize(){
 
-        ofstream f;
-
-        f.open("mymapsize.txt");
-        int t = 0;
-
-        while( 1 ) {
+        // the objects grow with their observations and connections after they entered the map
+        std::vector<KeyFrame *> vpKFs = GetAllKeyFrames();
+        for (size_t i = 0; i < vpKFs.size(); i++)
+            mMemory.updateKeyFrame(vpKFs[i]->mnId, vpKFs[i]->mTopoId, vpKFs[i]->MemoryBytes());
 
-            f << t <<" " << mspKeyFrames.size() << " " << mspMapPoints.size() << endl;
-            usleep(1000000);
-
-            t = t + 1;
-
-        }
+        std::vector<MapPoint *> vpMPs = GetAllMapPoints();
+        for (size_t i = 0; i < vpMPs.size(); i++)
+            mMemory.updateMapPoint(vpMPs[i]->mnId, chargedTile(vpMPs[i]), vpMPs[i]->MemoryBytes());
 
     }
 
@@ -0,0 +1,399 @@
+#include "MapJournal.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+namespace fs = boost::filesystem;
+
+namespace ORB_SLAM2 {
+
+    static const uint32_t JOURNAL_MAGIC = 0x4c57324d; // "M2WL"
+
+    MapJournal::MapJournal(const std::string &path) :
+            mPath(path), mFd(-1), mnSegment(0), mptWriter(nullptr), mbWriting(false), mbStop(false), mbFailed(false),
+            mnNextSeq(1), mnDurableSeq(0), mnSegmentBytes(0), mnRecords(0), mnFlushes(0), mnCheckpoints(0),
+            mnBytes(0), mFlushTime(0) {
+    }
+
+    MapJournal::~MapJournal() {
+
+        close();
+
+    }
+
+    std::string MapJournal::segmentPath(uint32_t segment) const {
+
+        char name[32];
+        snprintf(name, sizeof(name), "journal.%08u", segment);
+        return (fs::path(mPath) / name).string();
+
+    }
+
+    bool MapJournal::open() {
+
+        boost::system::error_code ec;
+        fs::create_directories(mPath, ec);
+
+        // first segment not covered by the tile store
+        uint32_t first = 0;
+        {
+            std::ifstream ifs((fs::path(mPath) / "checkpoint").string().c_str());
+            std::string key;
+            if (ifs >> key >> first && key != "segment")
+                first = 0;
+        }
+
+        uint32_t last = first;
+
+        if (fs::is_directory(mPath, ec)) {
+            for (fs::directory_iterator it(mPath, ec), end; it != end; it.increment(ec)) {
+
+                const std::string name = it->path().filename().string();
+                unsigned int segment;
+
+                if (name.size() != 16 || sscanf(name.c_str(), "journal.%08u", &segment) != 1)
+                    continue;
+
+                // left over by a checkpoint which stopped before its clean up
+                if (segment < first) {
+                    fs::remove(it->path(), ec);
+                    continue;
+                }
+
+                mvOldSegments.push_back(segment);
+                last = std::max(last, (uint32_t) segment + 1);
+            }
+        }
+
+        std::sort(mvOldSegments.begin(), mvOldSegments.end());
+
+        if (!openSegment(last)) {
+            cerr << "can not open the map journal " << mPath << endl;
+            return false;
+        }
+
+        mptWriter = new thread(&MapJournal::writerRun, this);
+
+        return true;
+
+    }
+
+    bool MapJournal::openSegment(uint32_t segment) {
+
+        int fd = ::open(segmentPath(segment).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+        if (fd < 0)
+            return false;
+
+        if (mFd >= 0)
+            ::close(mFd);
+
+        mFd = fd;
+        mnSegment = segment;
+        mnSegmentBytes = 0;
+
+        return true;
+
+    }
+
+    uint32_t MapJournal::checkOf(const RecordHeader &header, const char *payload) {
+
+        // FNV-1a over the header fields and the payload
+        uint32_t h = 2166136261u ^ header.kind;
+        h = (h * 16777619u) ^ (uint32_t) header.seq;
+        h = (h * 16777619u) ^ (uint32_t) (header.seq >> 32);
+        h = (h * 16777619u) ^ header.size;
+
+        for (uint32_t i = 0; i < header.size; i++)
+            h = (h ^ (unsigned char) payload[i]) * 16777619u;
+
+        return h;
+
+    }
+
+    uint64_t MapJournal::append(TileKind kind, std::string &payload) {
+
+        RecordHeader header;
+        header.magic = JOURNAL_MAGIC;
+        header.kind = kind;
+        header.size = payload.size();
+
+        std::string record;
+
+        unique_lock<mutex> lock(mMutexJournal);
+
+        if (mbFailed || !mptWriter) {
+            payload.clear();
+            return 0;
+        }
+
+        header.seq = mnNextSeq++;
+        header.check = checkOf(header, payload.data());
+
+        record.reserve(sizeof(header) + payload.size());
+        record.append((const char *) &header, sizeof(header));
+        record.append(payload);
+        payload.clear();
+
+        mPending.push_back(std::string());
+        mPending.back().swap(record);
+
+        mCondPending.notify_one();
+
+        return header.seq;
+
+    }
+
+    void MapJournal::writerRun() {
+
+        while (1) {
+
+            std::vector<std::string> batch;
+            uint64_t seq;
+            int fd;
+
+            {
+                unique_lock<mutex> lock(mMutexJournal);
+
+                while (mPending.empty() && !mbStop)
+                    mCondPending.wait(lock);
+
+                if (mPending.empty())
+                    break;
+
+                batch.swap(mPending);
+                seq = mnNextSeq - 1;
+                fd = mFd;
+                mbWriting = true;
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            // group commit, whatever was queued meanwhile goes in one write
+            std::string buf;
+            size_t size = 0;
+            for (size_t i = 0; i < batch.size(); i++)
+                size += batch[i].size();
+            buf.reserve(size);
+            for (size_t i = 0; i < batch.size(); i++)
+                buf.append(batch[i]);
+
+            bool bOK = true;
+            size_t done = 0;
+            while (bOK && done < buf.size()) {
+                ssize_t n = write(fd, buf.data() + done, buf.size() - done);
+                if (n > 0)
+                    done += n;
+                else
+                    bOK = false;
+            }
+
+            bOK = bOK && fdatasync(fd) == 0;
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            {
+                unique_lock<mutex> lock(mMutexJournal);
+
+                mbWriting = false;
+
+                if (bOK) {
+                    mnDurableSeq = seq;
+                    mnRecords += batch.size();
+                    mnBytes += buf.size();
+                    mnSegmentBytes += buf.size();
+                    mnFlushes++;
+                    mFlushTime += seconds;
+                } else if (!mbFailed) {
+                    cerr << "map journal write failed, the map is not journaled any more" << endl;
+                    mbFailed = true;
+                }
+            }
+
+            mCondDurable.notify_all();
+
+        }
+
+    }
+
+    bool MapJournal::flush() {
+
+        unique_lock<mutex> lock(mMutexJournal);
+
+        const uint64_t seq = mnNextSeq - 1;
+
+        while (mnDurableSeq < seq && !mbFailed && mptWriter)
+            mCondDurable.wait(lock);
+
+        return mnDurableSeq >= seq;
+
+    }
+
+    uint32_t MapJournal::rotate() {
+
+        unique_lock<mutex> lock(mMutexJournal);
+
+        // the writer keeps the old segment until what was queued before is written
+        while ((mbWriting || !mPending.empty()) && !mbFailed && mptWriter)
+            mCondDurable.wait(lock);
+
+        if (!openSegment(mnSegment + 1)) {
+            cerr << "can not open the map journal segment " << mnSegment + 1 << endl;
+            mbFailed = true;
+        }
+
+        return mnSegment;
+
+    }
+
+    bool MapJournal::checkpoint(uint32_t segment) {
+
+        const std::string path = (fs::path(mPath) / "checkpoint").string();
+
+        {
+            std::ofstream ofs((path + ".tmp").c_str(), ios::trunc);
+            ofs << "segment " << segment << endl;
+            ofs.flush();
+            if (!ofs.good())
+                return false;
+        }
+
+        int fd = ::open((path + ".tmp").c_str(), O_RDONLY);
+        if (fd >= 0) {
+            fsync(fd);
+            ::close(fd);
+        }
+
+        if (rename((path + ".tmp").c_str(), path.c_str()) != 0)
+            return false;
+
+        boost::system::error_code ec;
+
+        for (uint32_t s = mvOldSegments.empty() ? segment : std::min(mvOldSegments.front(), segment); s < segment; s++)
+            fs::remove(segmentPath(s), ec);
+
+        mvOldSegments.erase(std::remove_if(mvOldSegments.begin(), mvOldSegments.end(),
+                                           [segment](uint32_t s) { return s < segment; }), mvOldSegments.end());
+
+        unique_lock<mutex> lock(mMutexJournal);
+        mnCheckpoints++;
+
+        return true;
+
+    }
+
+    bool MapJournal::tornTail(const std::string &data, size_t offset, const RecordHeader &header, bool bFits) {
+
+        if (header.magic == JOURNAL_MAGIC && (!bFits || offset + sizeof(header) + header.size == data.size()))
+            return true;
+
+        for (size_t i = offset; i < data.size(); i++)
+            if (data[i] != 0)
+                return false;
+
+        return true;
+
+    }
+
+    bool MapJournal::replay(std::vector<JournalRecord> &records) {
+
+        for (size_t i = 0; i < mvOldSegments.size(); i++) {
+
+            std::ifstream ifs(segmentPath(mvOldSegments[i]).c_str(), ios::binary);
+            std::stringstream ss;
+            ss << ifs.rdbuf();
+            const std::string data = ss.str();
+
+            size_t offset = 0;
+
+            while (offset < data.size()) {
+
+                RecordHeader header;
+
+                // a crash in the middle of an append only tears the last record of its segment, the next
+                // segments were started after it
+                if (data.size() - offset < sizeof(header)) {
+                    cerr << "map journal segment " << mvOldSegments[i] << " ends with a torn record" << endl;
+                    break;
+                }
+
+                memcpy(&header, data.data() + offset, sizeof(header));
+
+                const bool bFits = header.magic == JOURNAL_MAGIC && data.size() - offset - sizeof(header) >= header.size;
+
+                if (!bFits || header.check != checkOf(header, data.data() + offset + sizeof(header))) {
+
+                    if (tornTail(data, offset, header, bFits)) {
+                        cerr << "map journal segment " << mvOldSegments[i] << " ends with a torn record" << endl;
+                        break;
+                    }
+
+                    cerr << "map journal segment " << mvOldSegments[i] << " is damaged at " << offset << endl;
+                    return false;
+                }
+
+                offset += sizeof(header);
+
+                JournalRecord record;
+                record.kind = header.kind;
+                record.seq = header.seq;
+                record.payload.assign(data, offset, header.size);
+                records.push_back(std::move(record));
+
+                offset += header.size;
+            }
+        }
+
+        return true;
+
+    }
+
+    uint64_t MapJournal::segmentBytes() {
+
+        unique_lock<mutex> lock(mMutexJournal);
+        return mnSegmentBytes;
+
+    }
+
+    void MapJournal::report() {
+
+        unique_lock<mutex> lock(mMutexJournal);
+
+        cout << "map journal: " << mnRecords << " records, " << mnBytes << " bytes in " << mnFlushes << " flushes, flush avg "
+             << (mnFlushes ? 1000.0 * mFlushTime / mnFlushes : 0.0) << " ms, " << mnCheckpoints << " checkpoints" << endl;
+
+    }
+
+    void MapJournal::close() {
+
+        if (mptWriter) {
+            {
+                unique_lock<mutex> lock(mMutexJournal);
+                mbStop = true;
+            }
+            mCondPending.notify_all();
+            mptWriter->join();
+            delete mptWriter;
+            mptWriter = nullptr;
+        }
+
+        mCondDurable.notify_all();
+
+        if (mFd >= 0) {
+            ::close(mFd);
+            mFd = -1;
+        }
+
+    }
+
+} //namespace ORB_SLAM
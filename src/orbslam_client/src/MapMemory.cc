@@ -0,0 +1,232 @@
+#include "MapMemory.h"
+
+#include <iostream>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ORB_SLAM2 {
+
+    MapMemory::MapMemory() : mnKeyFrameBytes(0), mnMapPointBytes(0), mbLogHeader(false) {
+    }
+
+    void MapMemory::set(std::map<long unsigned int, Account> &accounts, size_t &total, long unsigned int id, TopoId tId,
+                        size_t bytes, bool bInsert) {
+
+        std::map<long unsigned int, Account>::iterator mit = accounts.find(id);
+
+        if (mit == accounts.end()) {
+            if (!bInsert)
+                return;
+            mit = accounts.insert(make_pair(id, Account())).first;
+            mit->second.tId = tId;
+            mit->second.bytes = 0;
+        }
+
+        total = total - mit->second.bytes + bytes;
+
+        mTiles[mit->second.tId] -= mit->second.bytes;
+        if (mTiles[mit->second.tId] == 0)
+            mTiles.erase(mit->second.tId);
+
+        mTiles[tId] += bytes;
+
+        mit->second.tId = tId;
+        mit->second.bytes = bytes;
+
+    }
+
+    void MapMemory::erase(std::map<long unsigned int, Account> &accounts, size_t &total, long unsigned int id) {
+
+        std::map<long unsigned int, Account>::iterator mit = accounts.find(id);
+
+        if (mit == accounts.end())
+            return;
+
+        total -= mit->second.bytes;
+
+        mTiles[mit->second.tId] -= mit->second.bytes;
+        if (mTiles[mit->second.tId] == 0)
+            mTiles.erase(mit->second.tId);
+
+        accounts.erase(mit);
+
+    }
+
+    void MapMemory::setKeyFrame(long unsigned int id, TopoId tId, size_t bytes) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        set(mKeyFrames, mnKeyFrameBytes, id, tId, bytes, true);
+
+    }
+
+    void MapMemory::setMapPoint(long unsigned int id, TopoId tId, size_t bytes) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        set(mMapPoints, mnMapPointBytes, id, tId, bytes, true);
+
+    }
+
+    void MapMemory::updateKeyFrame(long unsigned int id, TopoId tId, size_t bytes) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        set(mKeyFrames, mnKeyFrameBytes, id, tId, bytes, false);
+
+    }
+
+    void MapMemory::updateMapPoint(long unsigned int id, TopoId tId, size_t bytes) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        set(mMapPoints, mnMapPointBytes, id, tId, bytes, false);
+
+    }
+
+    void MapMemory::eraseKeyFrame(long unsigned int id) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        erase(mKeyFrames, mnKeyFrameBytes, id);
+
+    }
+
+    void MapMemory::eraseMapPoint(long unsigned int id) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        erase(mMapPoints, mnMapPointBytes, id);
+
+    }
+
+    size_t MapMemory::keyFrameBytes(long unsigned int id) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        std::map<long unsigned int, Account>::iterator mit = mKeyFrames.find(id);
+        return mit != mKeyFrames.end() ? mit->second.bytes : 0;
+
+    }
+
+    size_t MapMemory::mapPointBytes(long unsigned int id) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        std::map<long unsigned int, Account>::iterator mit = mMapPoints.find(id);
+        return mit != mMapPoints.end() ? mit->second.bytes : 0;
+
+    }
+
+    size_t MapMemory::tileBytes(TopoId tId) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        std::map<TopoId, size_t>::iterator mit = mTiles.find(tId);
+        return mit != mTiles.end() ? mit->second : 0;
+
+    }
+
+    void MapMemory::getTileBytes(std::map<TopoId, size_t> &tiles) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        tiles = mTiles;
+
+    }
+
+    void MapMemory::setStructure(const std::string &name, size_t bytes) {
+
+        unique_lock<mutex> lock(mMutexMemory);
+        mStructures[name] = bytes;
+
+    }
+
+    MemoryStats MapMemory::stats() {
+
+        MemoryStats stats;
+
+        {
+            unique_lock<mutex> lock(mMutexMemory);
+
+            stats.nKeyFrames = mKeyFrames.size();
+            stats.nMapPoints = mMapPoints.size();
+            stats.keyFrameBytes = mnKeyFrameBytes;
+            stats.mapPointBytes = mnMapPointBytes;
+            stats.nTiles = mTiles.size();
+            stats.largestTileBytes = 0;
+            for (std::map<TopoId, size_t>::iterator mit = mTiles.begin(); mit != mTiles.end(); mit++)
+                stats.largestTileBytes = std::max(stats.largestTileBytes, mit->second);
+            stats.structures = mStructures;
+        }
+
+        stats.residentBytes = processResidentBytes();
+
+        return stats;
+
+    }
+
+    void MapMemory::clear() {
+
+        unique_lock<mutex> lock(mMutexMemory);
+
+        mKeyFrames.clear();
+        mMapPoints.clear();
+        mTiles.clear();
+        mnKeyFrameBytes = 0;
+        mnMapPointBytes = 0;
+
+    }
+
+    bool MapMemory::openLog(const std::string &path) {
+
+        mLog.open(path.c_str());
+
+        if (!mLog.is_open()) {
+            cerr << "can not open the memory log " << path << endl;
+            return false;
+        }
+
+        mbLogHeader = false;
+
+        return true;
+
+    }
+
+    void MapMemory::log(double t) {
+
+        if (!mLog.is_open())
+            return;
+
+        MemoryStats s = stats();
+
+        // the structures are named once they were measured, the first three columns are those of the
+        // former mymapsize.txt
+        if (!mbLogHeader) {
+            mLog << "# t keyframes mappoints keyframe_bytes mappoint_bytes tiles largest_tile_bytes";
+            for (std::map<std::string, size_t>::iterator mit = s.structures.begin(); mit != s.structures.end(); mit++)
+                mLog << " " << mit->first;
+            mLog << " resident_bytes" << endl;
+            mbLogHeader = true;
+        }
+
+        mLog << t << " " << s.nKeyFrames << " " << s.nMapPoints << " " << s.keyFrameBytes << " " << s.mapPointBytes
+             << " " << s.nTiles << " " << s.largestTileBytes;
+
+        for (std::map<std::string, size_t>::iterator mit = s.structures.begin(); mit != s.structures.end(); mit++)
+            mLog << " " << mit->second;
+
+        mLog << " " << s.residentBytes << endl;
+
+    }
+
+    size_t MapMemory::processResidentBytes() {
+
+        FILE *f = fopen("/proc/self/statm", "r");
+
+        if (!f)
+            return 0;
+
+        long unsigned int size = 0, resident = 0;
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+            resident = 0;
+
+        fclose(f);
+
+        return resident * sysconf(_SC_PAGESIZE);
+
+    }
+
+} //namespace ORB_SLAM
@@ -20,6 +20,8 @@
 
 #include "MapPoint.h"
 #include "ORBmatcher.h"
+#include "MapMemory.h"
+#include "TileArena.h"
 
 #include<mutex>
 
@@ -32,7 +34,8 @@ namespace ORB_SLAM2 {
             mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
             mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
             mnCorrectedReference(0), mnBAGlobalForKF(0), mnVisible(1), mnFound(1), mbBad(false),
-            mpReplaced(static_cast<LightMapPoint>(nullptr)), mfMinDistance(0), mfMaxDistance(0), mpCacher(pCacher) {
+            mpReplaced(static_cast<LightMapPoint>(nullptr)), mfMinDistance(0), mfMaxDistance(0), mpCacher(pCacher),
+            mnVersion(1) {
 
         Pos.copyTo(mWorldPos);
         LightKeyFrame tLKF(pRefKF);
@@ -53,7 +56,7 @@ namespace ORB_SLAM2 {
             mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
             mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
             mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<LightKeyFrame>(nullptr)), mnVisible(1),
-            mnFound(1), mbBad(false), mpReplaced(nullptr), mpCacher(pCacher) {
+            mnFound(1), mbBad(false), mpReplaced(nullptr), mpCacher(pCacher), mnVersion(1) {
 
         Pos.copyTo(mWorldPos);
 
@@ -79,6 +82,7 @@ namespace ORB_SLAM2 {
     }
 
     void MapPoint::SetWorldPos(const cv::Mat &Pos) {
+        SetDirty();
         //unique_lock<mutex> lock2(mGlobalMutex);
         unique_lock<mutex> lock(mMutexPos);
         Pos.copyTo(mWorldPos);
@@ -129,6 +133,8 @@ namespace ORB_SLAM2 {
                 mObservations[tLKF] = idx;
             }
 
+            SetDirty();
+
             if (pKF->mvuRight[idx] >= 0)
                 nObs += 2;
             else
@@ -162,6 +168,67 @@ namespace ORB_SLAM2 {
     }
 
 
+    void MapPoint::SetDirty() {
+        mnVersion++;
+    }
+
+    unsigned int MapPoint::GetVersion() {
+        return mnVersion;
+    }
+
+    bool MapPoint::IsDirty(TopoId tId) {
+        unique_lock<mutex> lock(mMutexVersion);
+        std::map<TopoId, unsigned int>::iterator mit = mStoredVersions.find(tId);
+        return mit == mStoredVersions.end() || mit->second != mnVersion;
+    }
+
+    void MapPoint::SetStored(TopoId tId, unsigned int nVersion) {
+        unique_lock<mutex> lock(mMutexVersion);
+        mStoredVersions[tId] = nVersion;
+    }
+
+    void MapPoint::RestoreTopoMap(TopoId tId) {
+        mpCacher->mTopoMap->restoreMapPoint(mnId, tId);
+        if (mpRefKF.mnId > 0)
+            mpCacher->mTopoMap->mpRefKf[mnId] = mpRefKF.mnId;
+    }
+
+    void *MapPoint::operator new(size_t size) {
+        return TileArena::allocate(size);
+    }
+
+    void MapPoint::operator delete(void *p) {
+        TileArena::release(p);
+    }
+
+    size_t MapPoint::MemoryBytes() {
+
+        size_t bytes = TileArena::objectBytes(sizeof(MapPoint)) + heapBytes(mpTopoIds) + heapBytes(mPosGBA);
+
+        {
+            unique_lock<mutex> lock(mMutexPos);
+            bytes += heapBytes(mWorldPos) + heapBytes(mNormalVector);
+        }
+
+        {
+            unique_lock<mutex> lock(mMutexFeatures);
+            bytes += heapBytes(mDescriptor);
+        }
+
+        {
+            unique_lock<mutex> lock(mMutexObservations);
+            bytes += heapBytes(mObservations) + heapBytes(mObsLoopKP);
+        }
+
+        {
+            unique_lock<mutex> lock(mMutexVersion);
+            bytes += heapBytes(mStoredVersions);
+        }
+
+        return bytes;
+
+    }
+
     void MapPoint::EraseObservation(KeyFrame *pKF) {
         bool bBad = false;
         {
@@ -177,6 +244,8 @@ namespace ORB_SLAM2 {
                 mObservations.erase(tLKF);
                 mObsLoopKP.erase( tLKF.mnId );
 
+                SetDirty();
+
                 if (mpRefKF == tLKF){
                     mpRefKF = mObservations.begin()->first;
                     mpCacher->mTopoMap->mpRefKf[mnId ] = mObservations.begin()->first.mnId;
@@ -239,6 +308,7 @@ namespace ORB_SLAM2 {
     }
 
     void MapPoint::SetBadFlag() {
+        SetDirty();
         std::map<KeyFrame *, size_t> obs;
         obs = GetObservations();
         {
@@ -278,6 +348,7 @@ namespace ORB_SLAM2 {
             nvisible = mnVisible;
             mpReplaced = pMP;
         }
+        SetDirty();
         {
             unique_lock<mutex> lock(mMutexFound);
             nfound = mnFound;
@@ -384,6 +455,8 @@ namespace ORB_SLAM2 {
 
         {
             unique_lock<mutex> lock(mMutexFeatures);
+            if (mDescriptor.empty() || ORBmatcher::DescriptorDistance(mDescriptor, vDescriptors[BestIdx]) != 0)
+                SetDirty();
             mDescriptor = vDescriptors[BestIdx].clone();
 
         }
@@ -454,9 +527,12 @@ namespace ORB_SLAM2 {
 
         {
             unique_lock<mutex> lock3(mMutexPos);
+            cv::Mat normalVector = normal / n;
+            if (mfMaxDistance != dist * levelScaleFactor || mNormalVector.empty() || cv::norm(mNormalVector, normalVector) > 0)
+                SetDirty();
             mfMaxDistance = dist * levelScaleFactor;
             mfMinDistance = mfMaxDistance / pRefKF->mvScaleFactors[nLevels - 1];
-            mNormalVector = normal / n;
+            mNormalVector = normalVector;
         }
     }
 
@@ -0,0 +1,322 @@
+#include "MapSnapshot.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace ORB_SLAM2 {
+
+    static const uint32_t SNAPSHOT_MAGIC = 0x4e53324d; // "M2SN"
+
+    // 2: the TopoIds are Morton codes of the 3D tile cells
+    static const uint16_t SNAPSHOT_VERSION = 2;
+
+    MapSnapshot::MapSnapshot() : mFd(-1), mEnd(0), mpMapped(nullptr), mSize(0), mIndexOffset(0), mIndexSize(0) {
+
+        mInfo.format = 0;
+        mInfo.nKFNextId = 0;
+        mInfo.nMPNextId = 0;
+        mInfo.currentTopoId = 0;
+
+    }
+
+    MapSnapshot::~MapSnapshot() {
+
+        close();
+
+    }
+
+    uint32_t MapSnapshot::checkOf(const SnapshotHeader &header, const char *directory, size_t size) {
+
+        SnapshotHeader h = header;
+        h.check = 0;
+
+        // FNV-1a over the header and the directory
+        uint32_t check = 2166136261u;
+
+        const unsigned char *p = (const unsigned char *) &h;
+        for (size_t i = 0; i < sizeof(h); i++)
+            check = (check ^ p[i]) * 16777619u;
+
+        p = (const unsigned char *) directory;
+        for (size_t i = 0; i < size; i++)
+            check = (check ^ p[i]) * 16777619u;
+
+        return check;
+
+    }
+
+    bool MapSnapshot::create(const std::string &path) {
+
+        close();
+
+        mPath = path;
+        mFd = ::open((path + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (mFd < 0) {
+            cerr << "can not create the map snapshot " << path << endl;
+            return false;
+        }
+
+        // the header is written last, once the offsets are known
+        mEnd = sizeof(SnapshotHeader);
+        mvEntries.clear();
+
+        return true;
+
+    }
+
+    bool MapSnapshot::writeBlock(const std::string &block, uint64_t &offset) {
+
+        offset = mEnd;
+
+        size_t done = 0;
+        while (done < block.size()) {
+            ssize_t n = pwrite(mFd, block.data() + done, block.size() - done, mEnd + done);
+            if (n <= 0)
+                return false;
+            done += n;
+        }
+
+        mEnd += block.size();
+
+        return true;
+
+    }
+
+    bool MapSnapshot::addTile(const TileBlocks &tile) {
+
+        if (mFd < 0)
+            return false;
+
+        for (int k = 0; k < 2; k++) {
+
+            const std::string &data = k == 0 ? tile.kfData : tile.mpData;
+            const std::string &pose = k == 0 ? tile.kfPose : tile.mpPose;
+
+            if (data.empty())
+                continue;
+
+            SnapshotEntry entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.topoId = tile.tId;
+            entry.kind = k == 0 ? TILE_KEYFRAMES : TILE_MAPPOINTS;
+            entry.dataSize = data.size();
+            entry.poseSize = pose.size();
+
+            if (!writeBlock(data, entry.dataOffset) || !writeBlock(pose, entry.poseOffset)) {
+                cerr << "can not write tile " << tile.tId << " to the map snapshot " << mPath << endl;
+                return false;
+            }
+
+            mvEntries.push_back(entry);
+        }
+
+        return true;
+
+    }
+
+    bool MapSnapshot::finish(const SnapshotInfo &info, const std::string &index) {
+
+        if (mFd < 0)
+            return false;
+
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = SNAPSHOT_MAGIC;
+        header.version = SNAPSHOT_VERSION;
+        header.format = info.format;
+        header.tiles = mvEntries.size();
+        header.kfNextId = info.nKFNextId;
+        header.mpNextId = info.nMPNextId;
+        header.topoId = info.currentTopoId;
+        header.indexSize = index.size();
+
+        std::string directory((const char *) mvEntries.data(), mvEntries.size() * sizeof(SnapshotEntry));
+
+        bool bOK = writeBlock(index, header.indexOffset) && writeBlock(directory, header.directoryOffset);
+
+        header.check = checkOf(header, directory.data(), directory.size());
+
+        bOK = bOK && pwrite(mFd, &header, sizeof(header), 0) == (ssize_t) sizeof(header);
+        bOK = bOK && fsync(mFd) == 0;
+
+        ::close(mFd);
+        mFd = -1;
+
+        // a snapshot which was not written entirely never replaces the previous one
+        if (!bOK || rename((mPath + ".tmp").c_str(), mPath.c_str()) != 0) {
+            cerr << "can not write the map snapshot " << mPath << endl;
+            unlink((mPath + ".tmp").c_str());
+            return false;
+        }
+
+        mInfo = info;
+        mvEntries.clear();
+
+        return true;
+
+    }
+
+    bool MapSnapshot::open(const std::string &path) {
+
+        close();
+
+        mPath = path;
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            cerr << "can not open the map snapshot " << path << endl;
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < sizeof(SnapshotHeader)) {
+            cerr << "the map snapshot " << path << " is truncated" << endl;
+            ::close(fd);
+            return false;
+        }
+
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (p == MAP_FAILED) {
+            cerr << "can not map the map snapshot " << path << endl;
+            return false;
+        }
+
+        mpMapped = (char *) p;
+        mSize = st.st_size;
+
+        SnapshotHeader header;
+        memcpy(&header, mpMapped, sizeof(header));
+
+        const uint64_t directorySize = (uint64_t) header.tiles * sizeof(SnapshotEntry);
+
+        // the tiles of an older snapshot are addressed by another TopoId scheme
+        if (header.magic == SNAPSHOT_MAGIC && header.version != SNAPSHOT_VERSION) {
+            cerr << "the map snapshot " << path << " has version " << header.version << ", " << SNAPSHOT_VERSION << " is needed" << endl;
+            close();
+            return false;
+        }
+
+        if (header.magic != SNAPSHOT_MAGIC ||
+            header.directoryOffset > mSize || directorySize > mSize - header.directoryOffset ||
+            header.indexOffset > mSize || header.indexSize > mSize - header.indexOffset ||
+            header.check != checkOf(header, mpMapped + header.directoryOffset, directorySize)) {
+            cerr << "the map snapshot " << path << " is damaged" << endl;
+            close();
+            return false;
+        }
+
+        mInfo.format = header.format;
+        mInfo.nKFNextId = header.kfNextId;
+        mInfo.nMPNextId = header.mpNextId;
+        mInfo.currentTopoId = header.topoId;
+
+        mIndexOffset = header.indexOffset;
+        mIndexSize = header.indexSize;
+
+        for (uint32_t i = 0; i < header.tiles; i++) {
+
+            SnapshotEntry entry;
+            memcpy(&entry, mpMapped + header.directoryOffset + i * sizeof(SnapshotEntry), sizeof(entry));
+
+            if (entry.dataOffset + entry.dataSize > mSize || entry.poseOffset + entry.poseSize > mSize) {
+                cerr << "the map snapshot " << path << " is damaged" << endl;
+                close();
+                return false;
+            }
+
+            mDirectory[TileKey(entry.kind, entry.topoId)] = entry;
+        }
+
+        // the tile sections are read in any order, the index has just been read
+        madvise(mpMapped, mSize, MADV_RANDOM);
+
+        return true;
+
+    }
+
+    const char *MapSnapshot::indexData() const {
+
+        return mpMapped ? mpMapped + mIndexOffset : nullptr;
+
+    }
+
+    size_t MapSnapshot::indexSize() const {
+
+        return mpMapped ? mIndexSize : 0;
+
+    }
+
+    bool MapSnapshot::hasTile(TopoId tId) const {
+
+        return mDirectory.count(TileKey(TILE_KEYFRAMES, tId)) > 0 || mDirectory.count(TileKey(TILE_MAPPOINTS, tId)) > 0;
+
+    }
+
+    bool MapSnapshot::getTile(TileKind kind, TopoId tId, std::string &data, std::string &pose) const {
+
+        std::map<TileKey, SnapshotEntry>::const_iterator mit = mDirectory.find(TileKey(kind, tId));
+
+        if (mit == mDirectory.end() || !mpMapped)
+            return false;
+
+        data.assign(mpMapped + mit->second.dataOffset, mit->second.dataSize);
+        pose.assign(mpMapped + mit->second.poseOffset, mit->second.poseSize);
+
+        return data.size() > 0;
+
+    }
+
+    bool MapSnapshot::getAllPoses(TileKind kind, std::map<TopoId, std::string> &poses) const {
+
+        if (!mpMapped)
+            return false;
+
+        for (std::map<TileKey, SnapshotEntry>::const_iterator mit = mDirectory.begin(); mit != mDirectory.end(); mit++) {
+            if (mit->first.first == (uint32_t) kind)
+                poses[mit->first.second].assign(mpMapped + mit->second.poseOffset, mit->second.poseSize);
+        }
+
+        return true;
+
+    }
+
+    void MapSnapshot::getTileIds(std::set<TopoId> &tIds) const {
+
+        for (std::map<TileKey, SnapshotEntry>::const_iterator mit = mDirectory.begin(); mit != mDirectory.end(); mit++)
+            tIds.insert(mit->first.second);
+
+    }
+
+    void MapSnapshot::close() {
+
+        if (mFd >= 0) {
+            ::close(mFd);
+            unlink((mPath + ".tmp").c_str());
+            mFd = -1;
+        }
+
+        if (mpMapped) {
+            munmap(mpMapped, mSize);
+            mpMapped = nullptr;
+        }
+
+        mSize = 0;
+        mIndexOffset = 0;
+        mIndexSize = 0;
+        mDirectory.clear();
+        mvEntries.clear();
+
+    }
+
+} //namespace ORB_SLAM
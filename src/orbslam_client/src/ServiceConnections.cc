@@ -0,0 +1,113 @@
+#include "ServiceConnections.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace ORB_SLAM2 {
+
+    ServiceConnections::ServiceConnections(double waitTimeout) : mWaitTimeout(waitTimeout) {
+    }
+
+    ServiceConnections::~ServiceConnections() {
+
+        shutdown();
+
+    }
+
+    void ServiceConnections::release(const std::string &name, Lease &lease) {
+
+        unique_lock<mutex> lock(mMutexConnections);
+        mIdle[name].push_back(lease.client);
+
+    }
+
+    void ServiceConnections::record(const std::string &name, const Lease &lease, bool bOK, double seconds) {
+
+        unique_lock<mutex> lock(mMutexConnections);
+
+        std::map<std::string, ServiceConnectionStats>::iterator mit = mStats.find(name);
+
+        if (mit == mStats.end()) {
+            ServiceConnectionStats stats = {0, 0, 0, 0, 0, 0, 0};
+            mit = mStats.insert(make_pair(name, stats)).first;
+        }
+
+        ServiceConnectionStats &stats = mit->second;
+
+        stats.nCalls++;
+
+        if (!bOK)
+            stats.nFailures++;
+
+        if (lease.bFresh) {
+            stats.nConnects++;
+            stats.setupTime += seconds;
+        } else {
+            stats.nReused++;
+            stats.reusedTime += seconds;
+        }
+
+    }
+
+    void ServiceConnections::recordReconnect(const std::string &name) {
+
+        unique_lock<mutex> lock(mMutexConnections);
+        mStats[name].nReconnects++;
+
+    }
+
+    ServiceConnectionStats ServiceConnections::getStats(const std::string &name) {
+
+        unique_lock<mutex> lock(mMutexConnections);
+
+        std::map<std::string, ServiceConnectionStats>::iterator mit = mStats.find(name);
+
+        if (mit == mStats.end()) {
+            ServiceConnectionStats stats = {0, 0, 0, 0, 0, 0, 0};
+            return stats;
+        }
+
+        return mit->second;
+
+    }
+
+    void ServiceConnections::report() {
+
+        std::map<std::string, ServiceConnectionStats> stats;
+        std::map<std::string, size_t> idle;
+
+        {
+            unique_lock<mutex> lock(mMutexConnections);
+            stats = mStats;
+            for (std::map<std::string, std::vector<ros::ServiceClient> >::iterator mit = mIdle.begin(); mit != mIdle.end(); mit++)
+                idle[mit->first] = mit->second.size();
+        }
+
+        for (std::map<std::string, ServiceConnectionStats>::iterator mit = stats.begin(); mit != stats.end(); mit++) {
+
+            const ServiceConnectionStats &s = mit->second;
+
+            cout << mit->first << ": " << s.nCalls << " calls, " << s.nConnects << " connects ("
+                 << s.nReconnects << " reconnects, " << idle[mit->first] << " open), " << s.nReused << " reused, "
+                 << s.nFailures << " failed, first call avg "
+                 << (s.nConnects ? 1000.0 * s.setupTime / s.nConnects : 0.0) << " ms, reused call avg "
+                 << (s.nReused ? 1000.0 * s.reusedTime / s.nReused : 0.0) << " ms" << endl;
+        }
+
+    }
+
+    void ServiceConnections::shutdown() {
+
+        unique_lock<mutex> lock(mMutexConnections);
+
+        for (std::map<std::string, std::vector<ros::ServiceClient> >::iterator mit = mIdle.begin(); mit != mIdle.end(); mit++) {
+            for (size_t i = 0; i < mit->second.size(); i++)
+                mit->second[i].shutdown();
+        }
+
+        mIdle.clear();
+
+    }
+
+} //namespace ORB_SLAM
@@ -22,9 +22,12 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "TileStore.h"
+#include "MapJournal.h"
 #include <thread>
 #include <pangolin/pangolin.h>
 #include <iomanip>
+#include <sstream>
 
 namespace ORB_SLAM2 {
 
@@ -60,14 +63,182 @@ namespace ORB_SLAM2 {
 //        Lmax = 1;
 //        Lmin = 1;
 
+        // tiles of Lmax, split down to Lmin where the map is dense
+        if (!fsSettings["Cache.TileMaxSize"].empty())
+            Lmax = std::max((int) fsSettings["Cache.TileMaxSize"], 1);
+
+        if (!fsSettings["Cache.TileMinSize"].empty())
+            Lmin = std::min(std::max((int) fsSettings["Cache.TileMinSize"], 1), Lmax);
+
         mpCacher = new Cache( maxArea, Lmax, Lmin );
 
+        // payload format of the tiles swapped with the server: 0 boost text archive, 1 binary tile
+        if (!fsSettings["Cache.TileFormat"].empty())
+            mpCacher->mTileFormat = (int) fsSettings["Cache.TileFormat"] == 1 ? TILE_FORMAT_BINARY : TILE_FORMAT_ARCHIVE;
+
+        // write-behind eviction: I/O worker threads (0 uploads on the cache thread) and the queue bound
+        if (!fsSettings["Cache.IOWorkers"].empty())
+            mpCacher->mnIOWorkers = std::max((int) fsSettings["Cache.IOWorkers"], 0);
+
+        if (!fsSettings["Cache.EvictQueueSize"].empty())
+            mpCacher->mnMaxEvictQueue = std::max((int) fsSettings["Cache.EvictQueueSize"], 1);
+
+        if (!fsSettings["Cache.EvictBatch"].empty())
+            mpCacher->mnEvictBatch = std::max((int) fsSettings["Cache.EvictBatch"], 1);
+
+        if (!fsSettings["Cache.PrefetchHorizon"].empty())
+            mpCacher->mfPrefetchHorizon = std::max((float) fsSettings["Cache.PrefetchHorizon"], 0.f);
+
+        if (!fsSettings["Cache.PrefetchMaxTiles"].empty())
+            mpCacher->mnMaxPrefetchTiles = std::max((int) fsSettings["Cache.PrefetchMaxTiles"], 0);
+
+        // tile compression: 0 none, 1 zlib, 2 bzip2, binary tiles only
+        if (!fsSettings["Cache.HotTileCodec"].empty())
+            mpCacher->mHotTileCodec = std::min(std::max((int) fsSettings["Cache.HotTileCodec"], 0), (int) TILE_CODEC_BZIP2);
+
+        if (!fsSettings["Cache.ColdTileCodec"].empty())
+            mpCacher->mColdTileCodec = std::min(std::max((int) fsSettings["Cache.ColdTileCodec"], 0), (int) TILE_CODEC_BZIP2);
+
+        if (!fsSettings["Cache.HotTileRange"].empty())
+            mpCacher->mfHotTileRange = std::max((float) fsSettings["Cache.HotTileRange"], 0.f);
+
+        // levels of tiles above and below the camera kept in cache
+        if (!fsSettings["Cache.TileVerticalRadius"].empty())
+            mpCacher->mTopoMap->setVerticalRadius(std::max((int) fsSettings["Cache.TileVerticalRadius"], 0));
+
+        // resident tiles within a byte budget instead of the fixed window, 0 keeps the window
+        if (!fsSettings["Cache.MemoryBudget"].empty())
+            mpCacher->mnMemoryBudget = std::max((int) fsSettings["Cache.MemoryBudget"], 0);
+
+        if (!fsSettings["Cache.GuaranteedTiles"].empty())
+            mpCacher->mnGuaranteedTiles = std::max((int) fsSettings["Cache.GuaranteedTiles"], 0);
+
+        // a tile is split when it holds more keyframes or more MB than this, 0 disables the test
+        if (!fsSettings["Cache.TileSplitKeyFrames"].empty())
+            mpCacher->mnTileSplitKeyFrames = std::max((int) fsSettings["Cache.TileSplitKeyFrames"], 0);
+
+        if (!fsSettings["Cache.TileSplitSize"].empty())
+            mpCacher->mnTileSplitSize = std::max((int) fsSettings["Cache.TileSplitSize"], 0);
+
+        // time series of the byte accounts of the map, an interval of 0 disables it
+        if (!fsSettings["Cache.MemoryLog"].empty())
+            mpCacher->mMemoryLogPath = (string) fsSettings["Cache.MemoryLog"];
+
+        if (!fsSettings["Cache.MemoryLogInterval"].empty())
+            mpCacher->mfMemoryLogInterval = std::max((float) fsSettings["Cache.MemoryLogInterval"], 0.f);
+
+        if (!fsSettings["Cache.MmapThreshold"].empty())
+            mpCacher->mnMmapThreshold = std::max((int) fsSettings["Cache.MmapThreshold"], 0);
+
+        if (!fsSettings["Cache.ReclaimEvicted"].empty())
+            mpCacher->mbReclaimEvicted = (int) fsSettings["Cache.ReclaimEvicted"] != 0;
+
+        if (!fsSettings["Cache.RelocRadius"].empty())
+            mpCacher->mfRelocRadius = std::max((float) fsSettings["Cache.RelocRadius"], 0.f);
+
+        if (!fsSettings["Cache.PoseDeltaTranslation"].empty())
+            mpCacher->mfPoseDeltaTranslation = std::max((float) fsSettings["Cache.PoseDeltaTranslation"], 0.f);
+
+        if (!fsSettings["Cache.PoseDeltaRotation"].empty())
+            mpCacher->mfPoseDeltaRotation = std::max((float) fsSettings["Cache.PoseDeltaRotation"], 0.f);
+
+        if (!fsSettings["Cache.PoseBatch"].empty())
+            mpCacher->mnPoseBatch = std::max((int) fsSettings["Cache.PoseBatch"], 1);
+
+        // tile storage backend: 0 orbslam_server, 1 local memory mapped file
+        if (!fsSettings["Cache.Storage"].empty() && (int) fsSettings["Cache.Storage"] == 1) {
+            string storePath = "tilestore";
+            if (!fsSettings["Cache.StoragePath"].empty())
+                storePath = (string) fsSettings["Cache.StoragePath"];
+            bool bReset = fsSettings["Cache.StorageReset"].empty() || (int) fsSettings["Cache.StorageReset"] != 0;
+
+            MappedTileStore *pStore = new MappedTileStore(storePath, bReset);
+            if (pStore->isOpen()) {
+                delete mpCacher->mpTileStore;
+                mpCacher->mpTileStore = pStore;
+            } else {
+                cerr << "Falling back to the orbslam_server tile storage" << endl;
+                delete pStore;
+            }
+        }
+
+        // orbslam_server shards, each started in the namespace ShardNamespace + index ("shard0", "shard1", ...)
+        if ((fsSettings["Cache.Storage"].empty() || (int) fsSettings["Cache.Storage"] == 0) &&
+            !fsSettings["Cache.Shards"].empty() && (int) fsSettings["Cache.Shards"] > 1) {
+            string shardNamespace = "shard";
+            if (!fsSettings["Cache.ShardNamespace"].empty())
+                shardNamespace = (string) fsSettings["Cache.ShardNamespace"];
+            TopoId range = 0;
+            if (!fsSettings["Cache.ShardRange"].empty())
+                range = (TopoId) std::max((double) fsSettings["Cache.ShardRange"], 0.0);
+
+            vector<TileStore *> vpShards;
+            for (int s = 0; s < (int) fsSettings["Cache.Shards"]; s++) {
+                stringstream ns;
+                ns << shardNamespace << s << "/";
+                vpShards.push_back(new RosTileStore(mpCacher->mpConnections, ns.str()));
+            }
+
+            delete mpCacher->mpTileStore;
+            mpCacher->mpTileStore = new ShardedTileStore(vpShards, range);
+        }
+
+        // write-ahead journal of the map, off unless a path is given
+        bool bRecover = fsSettings["Cache.JournalRecover"].empty() || (int) fsSettings["Cache.JournalRecover"] != 0;
+
+        if (!fsSettings["Cache.JournalInterval"].empty())
+            mpCacher->mfJournalInterval = std::max((float) fsSettings["Cache.JournalInterval"], 0.f);
+
+        if (!fsSettings["Cache.JournalCheckpointSize"].empty())
+            mpCacher->mnJournalCheckpointSize = std::max((int) fsSettings["Cache.JournalCheckpointSize"], 1);
+
+        if (!fsSettings["Cache.JournalPath"].empty()) {
+            MapJournal *pJournal = new MapJournal((string) fsSettings["Cache.JournalPath"]);
+            if (pJournal->open()) {
+                mpCacher->mpJournal = pJournal;
+            } else {
+                cerr << "Running without the map journal" << endl;
+                delete pJournal;
+            }
+        }
+
+        cout << "Tile storage: " << mpCacher->mpTileStore->name() << endl;
+        cout << "Tile format: " << (mpCacher->mTileFormat == TILE_FORMAT_BINARY ? "binary" : "archive") << endl;
+        cout << "I/O workers: " << mpCacher->mnIOWorkers << ", eviction queue: " << mpCacher->mnMaxEvictQueue << endl;
+        cout << "Prefetch horizon: " << mpCacher->mfPrefetchHorizon << "s, max tiles: " << mpCacher->mnMaxPrefetchTiles << endl;
+        cout << "Tile codec: hot " << (int) mpCacher->mHotTileCodec << ", cold " << (int) mpCacher->mColdTileCodec
+             << " beyond " << mpCacher->mfHotTileRange << endl;
+        if (mpCacher->mnMemoryBudget > 0)
+            cout << "Tile memory budget: " << mpCacher->mnMemoryBudget << "MB, guaranteed radius "
+                 << mpCacher->mnGuaranteedTiles << " tiles" << endl;
+        if (Lmin < Lmax && (mpCacher->mnTileSplitKeyFrames > 0 || mpCacher->mnTileSplitSize > 0))
+            cout << "Tile size: " << Lmax << " down to " << Lmin << ", split over " << mpCacher->mnTileSplitKeyFrames
+                 << " keyframes or " << mpCacher->mnTileSplitSize << "MB" << endl;
+        if (mpCacher->mfMemoryLogInterval > 0 && !mpCacher->mMemoryLogPath.empty())
+            cout << "Memory log: " << mpCacher->mMemoryLogPath << " every " << mpCacher->mfMemoryLogInterval << "s" << endl;
+        if (mpCacher->mnMmapThreshold > 0)
+            cout << "Malloc: payloads of " << mpCacher->mnMmapThreshold << " bytes and more mapped apart" << endl;
+        if (mpCacher->mbReclaimEvicted) {
+            cout << "Evicted keyframes and mappoints are freed" << endl;
+            if (mpCacher->mnMemoryBudget <= 0)
+                cerr << "Cache.ReclaimEvicted without Cache.MemoryBudget, the tiles around the camera are not guaranteed" << endl;
+        }
+        if (mpCacher->mfRelocRadius > 0)
+            cout << "Relocalization: tiles within " << mpCacher->mfRelocRadius << " of the last pose brought in" << endl;
+        if (mpCacher->mpJournal)
+            cout << "Map journal: every " << mpCacher->mfJournalInterval << "s, checkpoint at "
+                 << mpCacher->mnJournalCheckpointSize << "MB" << endl;
+
         mpCacher->loadORBVocabulary(strVocFile);
 
         mpCacher->createKeyFrameDatabase();
 
         mpCacher->createMap();
 
+        // the map left by a run which did not shut down cleanly
+        if (mpCacher->mpJournal && bRecover)
+            mpCacher->RecoverMap();
+
 
         //Create Drawers. These are used by the Viewer
         mpFrameDrawer = new FrameDrawer(mpCacher->getMpMap());
@@ -259,6 +430,11 @@ namespace ORB_SLAM2 {
 
         mpCacher->outputKeyframePose();
 
+        // the cache thread drains the evictions, checkpoints the journal and reports on its way out
+        mpCacher->RequestFinish();
+        while (!mpCacher->isFinished())
+            usleep(100000);
+
         mpViewer->RequestFinish();
 
         while( !mpViewer->isFinished() ) {
@@ -291,7 +467,9 @@ namespace ORB_SLAM2 {
 
         // For each frame we have a reference keyframe (lRit), the timestamp (lT) and a flag
         // which is true when tracking failed (lbL).
-        list<ORB_SLAM2::KeyFrame *>::iterator lRit = mpTracker->mlpReferences.begin();
+        int nSkipped = 0;
+        bool bStoredPoses = false;
+        list<ORB_SLAM2::LightKeyFrame>::iterator lRit = mpTracker->mlpReferences.begin();
         list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
         list<bool>::iterator lbL = mpTracker->mlbLost.begin();
         for (list<cv::Mat>::iterator lit = mpTracker->mlRelativeFramePoses.begin(),
@@ -299,17 +477,14 @@ namespace ORB_SLAM2 {
             if (*lbL)
                 continue;
 
-            KeyFrame *pKF = *lRit;
+            cv::Mat Trw = ReferencePose(*lRit, bStoredPoses);
 
-            cv::Mat Trw = cv::Mat::eye(4, 4, CV_32F);
-
-            // If the reference keyframe was culled, traverse the spanning tree to get a suitable keyframe.
-            while (pKF->isBad()) {
-                Trw = Trw * pKF->mTcp;
-                pKF = pKF->GetParent();
+            if (Trw.empty()) {
+                nSkipped++;
+                continue;
             }
 
-            Trw = Trw * pKF->GetPose() * Two;
+            Trw = Trw * Two;
 
             cv::Mat Tcw = (*lit) * Trw;
             cv::Mat Rwc = Tcw.rowRange(0, 3).colRange(0, 3).t();
@@ -321,10 +496,44 @@ namespace ORB_SLAM2 {
               << twc.at<float>(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
         }
         f.close();
+        if (nSkipped > 0)
+            cout << nSkipped << " frames skipped, their reference keyframe has no pose" << endl;
         cout << endl << "trajectory saved!" << endl;
     }
 
 
+    cv::Mat System::ReferencePose(const LightKeyFrame &ref, bool &bStoredPoses) {
+
+        KeyFrame *pKF = ref.getKeyFrame();
+        long unsigned int nId = ref.mnId;
+
+        cv::Mat Trw = cv::Mat::eye(4, 4, CV_32F);
+
+        // If the reference keyframe was culled, traverse the spanning tree to get a suitable keyframe.
+        while (pKF && pKF->isBad()) {
+            Trw = Trw * pKF->mTcp;
+            nId = pKF->GetParentId();
+            pKF = pKF->GetParent();
+        }
+
+        if (pKF)
+            return Trw * pKF->GetPose();
+
+        // its tile was evicted, the pose it was written back with is the one in the store
+        if (!bStoredPoses) {
+            mpCacher->getAllKeyFramePose();
+            bStoredPoses = true;
+        }
+
+        cv::Mat Tkw = nId > 0 ? mpCacher->getStoredKeyFramePose(nId) : cv::Mat();
+
+        if (Tkw.empty())
+            return cv::Mat();
+
+        return Trw * Tkw;
+
+    }
+
     void System::SaveKeyFrameTrajectoryTUM(const string &filename) {
         cout << endl << "Saving keyframe trajectory to " << filename << " ..." << endl;
 
@@ -387,21 +596,20 @@ namespace ORB_SLAM2 {
 
         // For each frame we have a reference keyframe (lRit), the timestamp (lT) and a flag
         // which is true when tracking failed (lbL).
-        list<ORB_SLAM2::KeyFrame *>::iterator lRit = mpTracker->mlpReferences.begin();
+        int nSkipped = 0;
+        bool bStoredPoses = false;
+        list<ORB_SLAM2::LightKeyFrame>::iterator lRit = mpTracker->mlpReferences.begin();
         list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
         for (list<cv::Mat>::iterator lit = mpTracker->mlRelativeFramePoses.begin(), lend = mpTracker->mlRelativeFramePoses.end();
              lit != lend; lit++, lRit++, lT++) {
-            ORB_SLAM2::KeyFrame *pKF = *lRit;
-
-            cv::Mat Trw = cv::Mat::eye(4, 4, CV_32F);
+            cv::Mat Trw = ReferencePose(*lRit, bStoredPoses);
 
-            while (pKF->isBad()) {
-                //  cout << "bad parent" << endl;
-                Trw = Trw * pKF->mTcp;
-                pKF = pKF->GetParent();
+            if (Trw.empty()) {
+                nSkipped++;
+                continue;
             }
 
-            Trw = Trw * pKF->GetPose() * Two;
+            Trw = Trw * Two;
 
             cv::Mat Tcw = (*lit) * Trw;
             cv::Mat Rwc = Tcw.rowRange(0, 3).colRange(0, 3).t();
@@ -415,6 +623,8 @@ namespace ORB_SLAM2 {
               << endl;
         }
         f.close();
+        if (nSkipped > 0)
+            cout << nSkipped << " frames skipped, their reference keyframe has no pose" << endl;
         cout << endl << "trajectory saved!" << endl;
     }
 
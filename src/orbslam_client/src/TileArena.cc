@@ -0,0 +1,248 @@
+#include "TileArena.h"
+
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <new>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+namespace ORB_SLAM2 {
+
+    namespace {
+
+        // at least CHUNK_OBJECTS objects a chunk
+        const size_t CHUNK_BYTES = 64 * 1024;
+        const size_t CHUNK_OBJECTS = 8;
+
+        // in front of each object, the chunk it is in. keeps the objects 16 bytes aligned
+        const size_t HEADER_BYTES = 16;
+
+        struct Arena;
+
+        struct Chunk {
+            char *base;
+            size_t bytes;
+            // an object with its header
+            size_t slotSize;
+            Arena *arena;
+            // the freed objects, linked through their first word
+            void *free;
+            // the slots past it were never handed out
+            size_t next;
+            size_t live;
+            size_t capacity;
+        };
+
+        // the chunks of one tile and one object size, under their own lock
+        struct Arena {
+            std::mutex mutex;
+            // the chunks with room
+            std::vector<Chunk *> open;
+        };
+
+        typedef std::pair<TopoId, size_t> ArenaKey;
+
+        struct Arenas {
+            std::mutex mutex;
+            // kept to the end, an arena is a few words and its tile may come back
+            std::map<ArenaKey, Arena *> arenas;
+        };
+
+        Arenas &arenas() {
+            static Arenas *pArenas = new Arenas();
+            return *pArenas;
+        }
+
+        std::atomic<long unsigned int> gChunks(0);
+        std::atomic<size_t> gMappedBytes(0);
+        std::atomic<size_t> gLiveBytes(0);
+
+        std::atomic<TopoId> gDefaultTile(0);
+
+        thread_local TopoId tlTile = 0;
+        thread_local bool tlScoped = false;
+
+        // the arenas the thread allocated in, found again without the lock of the registry
+        thread_local std::map<ArenaKey, Arena *> tlArenas;
+
+        Arena *arenaOf(TopoId tId, size_t slotSize) {
+
+            const ArenaKey key(tId, slotSize);
+
+            std::map<ArenaKey, Arena *>::iterator mit = tlArenas.find(key);
+
+            if (mit != tlArenas.end())
+                return mit->second;
+
+            Arena *pArena;
+
+            {
+                Arenas &a = arenas();
+                unique_lock<mutex> lock(a.mutex);
+
+                Arena *&p = a.arenas[key];
+                if (!p)
+                    p = new Arena();
+                pArena = p;
+            }
+
+            tlArenas[key] = pArena;
+
+            return pArena;
+
+        }
+
+        void closeChunk(Arena *arena, Chunk *chunk) {
+
+            std::vector<Chunk *> &open = arena->open;
+
+            for (size_t i = 0; i < open.size(); i++) {
+                if (open[i] == chunk) {
+                    open[i] = open.back();
+                    open.pop_back();
+                    break;
+                }
+            }
+
+        }
+
+    }
+
+    size_t TileArena::objectBytes(size_t size) {
+
+        return HEADER_BYTES + ((std::max(size, sizeof(void *)) + 15) & ~(size_t) 15);
+
+    }
+
+    void *TileArena::allocate(size_t size) {
+
+        const size_t slotSize = objectBytes(size);
+
+        const TopoId tId = tlScoped ? tlTile : gDefaultTile.load(std::memory_order_relaxed);
+
+        Arena *arena = arenaOf(tId, slotSize);
+
+        unique_lock<mutex> lock(arena->mutex);
+
+        if (arena->open.empty()) {
+
+            const size_t page = sysconf(_SC_PAGESIZE);
+            const size_t bytes = (std::max(CHUNK_BYTES, CHUNK_OBJECTS * slotSize) + page - 1) / page * page;
+
+            void *base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (base == MAP_FAILED)
+                throw std::bad_alloc();
+
+            Chunk *chunk = new Chunk();
+            chunk->base = (char *) base;
+            chunk->bytes = bytes;
+            chunk->slotSize = slotSize;
+            chunk->arena = arena;
+            chunk->free = nullptr;
+            chunk->next = 0;
+            chunk->live = 0;
+            chunk->capacity = bytes / slotSize;
+
+            gChunks.fetch_add(1, std::memory_order_relaxed);
+            gMappedBytes.fetch_add(bytes, std::memory_order_relaxed);
+
+            arena->open.push_back(chunk);
+        }
+
+        Chunk *chunk = arena->open.back();
+
+        void *p;
+        if (chunk->free) {
+            p = chunk->free;
+            chunk->free = *(void **) p;
+        } else {
+            // the header of a slot is written once, it stays while the slot is on the free list
+            char *slot = chunk->base + chunk->next * slotSize;
+            *(Chunk **) slot = chunk;
+            p = slot + HEADER_BYTES;
+            chunk->next++;
+        }
+
+        chunk->live++;
+        gLiveBytes.fetch_add(slotSize, std::memory_order_relaxed);
+
+        if (chunk->live == chunk->capacity)
+            closeChunk(arena, chunk);
+
+        return p;
+
+    }
+
+    void TileArena::release(void *p) {
+
+        if (!p)
+            return;
+
+        Chunk *chunk = *(Chunk **) ((char *) p - HEADER_BYTES);
+        Arena *arena = chunk->arena;
+
+        {
+            unique_lock<mutex> lock(arena->mutex);
+
+            // a full chunk has room again
+            if (chunk->live == chunk->capacity)
+                arena->open.push_back(chunk);
+
+            *(void **) p = chunk->free;
+            chunk->free = p;
+
+            chunk->live--;
+            gLiveBytes.fetch_sub(chunk->slotSize, std::memory_order_relaxed);
+
+            if (chunk->live > 0)
+                return;
+
+            closeChunk(arena, chunk);
+        }
+
+        // out of the open list, no other thread can reach it
+        gChunks.fetch_sub(1, std::memory_order_relaxed);
+        gMappedBytes.fetch_sub(chunk->bytes, std::memory_order_relaxed);
+        munmap(chunk->base, chunk->bytes);
+        delete chunk;
+
+    }
+
+    void TileArena::setDefaultTile(TopoId tId) {
+
+        gDefaultTile.store(tId, std::memory_order_relaxed);
+
+    }
+
+    TileArenaStats TileArena::stats() {
+
+        TileArenaStats stats;
+        stats.nChunks = gChunks.load(std::memory_order_relaxed);
+        stats.mappedBytes = gMappedBytes.load(std::memory_order_relaxed);
+        stats.liveBytes = gLiveBytes.load(std::memory_order_relaxed);
+
+        return stats;
+
+    }
+
+    TileArenaScope::TileArenaScope(TopoId tId) : mPrevious(tlTile), mbPrevious(tlScoped) {
+
+        tlTile = tId;
+        tlScoped = true;
+
+    }
+
+    TileArenaScope::~TileArenaScope() {
+
+        tlTile = mPrevious;
+        tlScoped = mbPrevious;
+
+    }
+
+} //namespace ORB_SLAM
@@ -0,0 +1,1070 @@
+#include "TileCodec.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "LightKeyFrame.h"
+#include "LightMapPoint.h"
+#include "TopoMap.h"
+#include "TileArena.h"
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/copy.hpp>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the tile wire format is little-endian, blocks are copied without byte swapping"
+#endif
+
+using namespace std;
+
+namespace io = boost::iostreams;
+
+namespace ORB_SLAM2 {
+
+    // lower bounds of a record, the ids and the timestamp or first frame leading it
+    static const size_t MIN_KEYFRAME_RECORD = 2 * sizeof(uint64_t) + sizeof(double);
+    static const size_t MIN_MAPPOINT_RECORD = sizeof(uint64_t) + 2 * sizeof(int64_t);
+
+    // append-only writer over the output payload
+    class TileWriter {
+    public:
+        TileWriter(std::string &out) : mOut(out) {}
+
+        void putBlock(const void *p, size_t n) {
+            if (n > 0)
+                mOut.append((const char *) p, n);
+        }
+
+        template<typename T>
+        void put(const T v) {
+            putBlock(&v, sizeof(T));
+        }
+
+        void putId(long unsigned int id) {
+            put<uint64_t>(id);
+        }
+
+        void putBool(bool b) {
+            put<uint8_t>(b ? 1 : 0);
+        }
+
+        void putMat(const cv::Mat &m) {
+            put<int32_t>(m.rows);
+            put<int32_t>(m.cols);
+            put<int32_t>(m.type());
+            if (m.empty())
+                return;
+            if (m.isContinuous()) {
+                putBlock(m.data, m.total() * m.elemSize());
+            } else {
+                const size_t rowSize = m.cols * m.elemSize();
+                for (int i = 0; i < m.rows; i++)
+                    putBlock(m.ptr(i), rowSize);
+            }
+        }
+
+        void putFloats(const std::vector<float> &v) {
+            put<uint32_t>(v.size());
+            putBlock(v.data(), v.size() * sizeof(float));
+        }
+
+        void putKeyPoints(const std::vector<cv::KeyPoint> &v) {
+            put<uint32_t>(v.size());
+            putBlock(v.data(), v.size() * sizeof(cv::KeyPoint));
+        }
+
+        size_t size() const {
+            return mOut.size();
+        }
+
+        std::string &mOut;
+    };
+
+    // bounds checked reader over the received payload, throws std::out_of_range on truncated data
+    class TileReader {
+    public:
+        TileReader(const char *data, size_t size) : mPtr(data), mEnd(data + size) {}
+
+        size_t remaining() const {
+            return (size_t) (mEnd - mPtr);
+        }
+
+        const char *take(size_t n) {
+            if (remaining() < n)
+                throw std::out_of_range("truncated tile");
+            const char *p = mPtr;
+            mPtr += n;
+            return p;
+        }
+
+        void getBlock(void *dst, size_t n) {
+            if (n > 0)
+                memcpy(dst, take(n), n);
+        }
+
+        template<typename T>
+        T get() {
+            T v;
+            getBlock(&v, sizeof(T));
+            return v;
+        }
+
+        long unsigned int getId() {
+            return (long unsigned int) get<uint64_t>();
+        }
+
+        bool getBool() {
+            return get<uint8_t>() != 0;
+        }
+
+        // the element count is checked against the remaining bytes before anything is allocated
+        uint32_t getCount(size_t elemSize) {
+            uint32_t n = get<uint32_t>();
+            if (elemSize > 0 && (size_t) n > remaining() / elemSize)
+                throw std::out_of_range("bad element count in tile");
+            return n;
+        }
+
+        void getMat(cv::Mat &m) {
+            int32_t rows = get<int32_t>();
+            int32_t cols = get<int32_t>();
+            int32_t type = get<int32_t>();
+            if (rows <= 0 || cols <= 0) {
+                m.release();
+                return;
+            }
+            const size_t bytes = (size_t) rows * cols * CV_ELEM_SIZE(type);
+            if (bytes > remaining())
+                throw std::out_of_range("truncated mat in tile");
+            m.create(rows, cols, type);
+            getBlock(m.data, bytes);
+        }
+
+        void getFloats(std::vector<float> &v) {
+            v.resize(getCount(sizeof(float)));
+            getBlock(v.data(), v.size() * sizeof(float));
+        }
+
+        void getKeyPoints(std::vector<cv::KeyPoint> &v) {
+            v.resize(getCount(sizeof(cv::KeyPoint)));
+            getBlock(v.data(), v.size() * sizeof(cv::KeyPoint));
+        }
+
+    private:
+        const char *mPtr;
+        const char *mEnd;
+    };
+
+    static_assert(sizeof(cv::KeyPoint) == 7 * 4, "cv::KeyPoint is copied as a raw block of 7 32-bit fields");
+
+    static void writeHeader(TileWriter &w, TileKind kind, TopoId tId) {
+        w.put<uint32_t>(TileCodec::MAGIC);
+        w.put<uint16_t>(TileCodec::VERSION);
+        w.put<uint8_t>(kind);
+        w.put<uint8_t>(0);
+        w.put<uint32_t>(0);
+        w.put<uint64_t>(tId);
+        w.put<uint32_t>(0);
+    }
+
+    // patch the record count and the payload size once the records are written
+    static void finishHeader(std::string &out, size_t headerPos, uint32_t count) {
+        uint32_t size = (uint32_t) (out.size() - headerPos - TileCodec::HEADER_SIZE);
+        memcpy(&out[headerPos + 8], &count, sizeof(count));
+        memcpy(&out[headerPos + 20], &size, sizeof(size));
+    }
+
+    bool TileCodec::isTile(const char *data, size_t size) {
+
+        if (size < HEADER_SIZE)
+            return false;
+
+        uint32_t magic;
+        memcpy(&magic, data, sizeof(magic));
+        return magic == MAGIC;
+    }
+
+    bool TileCodec::readHeader(const char *data, size_t size, TileHeader &header) {
+
+        if (!isTile(data, size))
+            return false;
+
+        TileReader r(data, size);
+        header.magic = r.get<uint32_t>();
+        header.version = r.get<uint16_t>();
+        header.kind = r.get<uint8_t>();
+        header.codec = r.get<uint8_t>();
+        header.count = r.get<uint32_t>();
+        header.topoId = r.get<uint64_t>();
+        header.size = r.get<uint32_t>();
+
+        if (header.version > VERSION) {
+            cout << "unsupported tile version " << header.version << endl;
+            return false;
+        }
+
+        if (header.codec > TILE_CODEC_BZIP2) {
+            cout << "unsupported tile codec " << (int) header.codec << endl;
+            return false;
+        }
+
+        return header.size <= size - HEADER_SIZE;
+    }
+
+    uint8_t TileCodec::codecOf(const std::string &buf) {
+
+        TileHeader header;
+        if (!readHeader(buf.data(), buf.size(), header))
+            return TILE_CODEC_NONE;
+
+        return header.codec;
+    }
+
+    bool TileCodec::compress(std::string &tile, uint8_t codec) {
+
+        TileHeader header;
+        if (codec == TILE_CODEC_NONE || !readHeader(tile.data(), tile.size(), header) || header.codec != TILE_CODEC_NONE)
+            return false;
+
+        std::string packed;
+        packed.reserve(HEADER_SIZE + sizeof(uint32_t) + header.size / 2);
+        packed.append(tile, 0, HEADER_SIZE);
+
+        const uint32_t rawSize = header.size;
+        packed.append((const char *) &rawSize, sizeof(rawSize));
+
+        try {
+            io::filtering_ostream os;
+
+            if (codec == TILE_CODEC_ZLIB) {
+                os.push(io::zlib_compressor(io::zlib_params(io::zlib::best_speed)));
+            } else if (codec == TILE_CODEC_BZIP2) {
+                os.push(io::bzip2_compressor());
+            } else {
+                cout << "unsupported tile codec " << (int) codec << endl;
+                return false;
+            }
+
+            os.push(io::back_inserter(packed));
+            os.write(tile.data() + HEADER_SIZE, header.size);
+
+            // closing the chain flushes the end of the compressed stream
+            os.reset();
+        } catch (const std::exception &e) {
+            cout << "error in compressing tile " << header.topoId << " : " << e.what() << endl;
+            return false;
+        }
+
+        if (packed.size() >= tile.size())
+            return false;
+
+        const uint32_t size = (uint32_t) (packed.size() - HEADER_SIZE);
+        packed[7] = (char) codec;
+        memcpy(&packed[20], &size, sizeof(size));
+
+        tile.swap(packed);
+
+        return true;
+    }
+
+    bool TileCodec::decompress(const char *data, size_t size, std::string &out) {
+
+        TileHeader header;
+        if (!readHeader(data, size, header))
+            return false;
+
+        if (header.codec == TILE_CODEC_NONE) {
+            out.assign(data, HEADER_SIZE + header.size);
+            return true;
+        }
+
+        if (header.size < sizeof(uint32_t))
+            return false;
+
+        uint32_t rawSize;
+        memcpy(&rawSize, data + HEADER_SIZE, sizeof(rawSize));
+
+        out.clear();
+        out.reserve(HEADER_SIZE + rawSize);
+        out.append(data, HEADER_SIZE);
+
+        try {
+            io::filtering_istream is;
+
+            if (header.codec == TILE_CODEC_ZLIB)
+                is.push(io::zlib_decompressor());
+            else
+                is.push(io::bzip2_decompressor());
+
+            is.push(io::array_source(data + HEADER_SIZE + sizeof(uint32_t), header.size - sizeof(uint32_t)));
+
+            io::copy(is, io::back_inserter(out));
+        } catch (const std::exception &e) {
+            cout << "error in decompressing tile " << header.topoId << " : " << e.what() << endl;
+            return false;
+        }
+
+        if (out.size() != HEADER_SIZE + rawSize) {
+            cout << "tile " << header.topoId << " decompressed to " << out.size() - HEADER_SIZE << " bytes instead of " << rawSize << endl;
+            return false;
+        }
+
+        out[7] = (char) TILE_CODEC_NONE;
+        memcpy(&out[20], &rawSize, sizeof(rawSize));
+
+        return true;
+    }
+
+    // read the header of a tile of the given kind, a compressed body is inflated into raw and data points there
+    static bool openTile(const char *&data, size_t &size, TileKind kind, TileHeader &header, std::string &raw) {
+
+        if (!TileCodec::readHeader(data, size, header) || header.kind != kind)
+            return false;
+
+        if (header.codec == TILE_CODEC_NONE)
+            return true;
+
+        if (!TileCodec::decompress(data, size, raw))
+            return false;
+
+        data = raw.data();
+        size = raw.size();
+
+        return TileCodec::readHeader(data, size, header);
+    }
+
+    void TileCodec::writeKeyFrame(TileWriter &w, KeyFrame *pKF) {
+
+        w.putId(pKF->mnId);
+        w.putId(pKF->mnFrameId);
+        w.put<double>(pKF->mTimeStamp);
+        w.put<int32_t>(pKF->mnGridCols);
+        w.put<int32_t>(pKF->mnGridRows);
+        w.put<float>(pKF->mfGridElementWidthInv);
+        w.put<float>(pKF->mfGridElementHeightInv);
+        w.putId(pKF->mnTrackReferenceForFrame);
+        w.putId(pKF->mnFuseTargetForKF);
+        w.putId(pKF->mnBALocalForKF);
+        w.putId(pKF->mnBAFixedForKF);
+        w.putId(pKF->mnLoopQuery);
+        w.put<int32_t>(pKF->mnLoopWords);
+        w.put<float>(pKF->mLoopScore);
+        w.putId(pKF->mnRelocQuery);
+        w.put<int32_t>(pKF->mnRelocWords);
+        w.put<float>(pKF->mRelocScore);
+        w.putMat(pKF->mTcwGBA);
+        w.putMat(pKF->mTcwBefGBA);
+        w.putId(pKF->mnBAGlobalForKF);
+
+        const float calib[9] = {pKF->fx, pKF->fy, pKF->cx, pKF->cy, pKF->invfx, pKF->invfy,
+                                pKF->mbf, pKF->mb, pKF->mThDepth};
+        w.putBlock(calib, sizeof(calib));
+        w.put<int32_t>(pKF->N);
+
+        w.putKeyPoints(pKF->mvKeys);
+        w.putKeyPoints(pKF->mvKeysUn);
+        w.putFloats(pKF->mvuRight);
+        w.putFloats(pKF->mvDepth);
+        w.putMat(pKF->mDescriptors);
+
+        w.put<uint32_t>(pKF->mBowVec.size());
+        for (DBoW2::BowVector::const_iterator mit = pKF->mBowVec.begin(); mit != pKF->mBowVec.end(); mit++) {
+            w.put<uint32_t>(mit->first);
+            w.put<double>(mit->second);
+        }
+
+        w.put<uint32_t>(pKF->mFeatVec.size());
+        for (DBoW2::FeatureVector::const_iterator mit = pKF->mFeatVec.begin(); mit != pKF->mFeatVec.end(); mit++) {
+            w.put<uint32_t>(mit->first);
+            w.put<uint32_t>(mit->second.size());
+            w.putBlock(mit->second.data(), mit->second.size() * sizeof(unsigned int));
+        }
+
+        w.putMat(pKF->mTcp);
+        w.put<int32_t>(pKF->mnScaleLevels);
+        w.put<float>(pKF->mfScaleFactor);
+        w.put<float>(pKF->mfLogScaleFactor);
+        w.putFloats(pKF->mvScaleFactors);
+        w.putFloats(pKF->mvLevelSigma2);
+        w.putFloats(pKF->mvInvLevelSigma2);
+
+        const int32_t bounds[4] = {pKF->mnMinX, pKF->mnMinY, pKF->mnMaxX, pKF->mnMaxY};
+        w.putBlock(bounds, sizeof(bounds));
+        w.putMat(pKF->mK);
+
+        w.putMat(pKF->Tcw);
+        w.putMat(pKF->Twc);
+        w.putMat(pKF->Ow);
+        w.putMat(pKF->Cw);
+
+        w.put<uint32_t>(pKF->mvpMapPoints.size());
+        for (size_t i = 0; i < pKF->mvpMapPoints.size(); i++)
+            w.putId(pKF->mvpMapPoints[i].mnMapPointId);
+
+        // grid cells hold keypoint indices, N always fits in 32 bits
+        w.put<uint32_t>(pKF->mGrid.size());
+        for (size_t i = 0; i < pKF->mGrid.size(); i++) {
+            w.put<uint32_t>(pKF->mGrid[i].size());
+            for (size_t j = 0; j < pKF->mGrid[i].size(); j++) {
+                const std::vector<size_t> &cell = pKF->mGrid[i][j];
+                w.put<uint32_t>(cell.size());
+                for (size_t k = 0; k < cell.size(); k++)
+                    w.put<uint32_t>(cell[k]);
+            }
+        }
+
+        w.put<uint32_t>(pKF->mConnectedKeyFrameWeights.size());
+        for (std::map<LightKeyFrame, int>::const_iterator mit = pKF->mConnectedKeyFrameWeights.begin();
+             mit != pKF->mConnectedKeyFrameWeights.end(); mit++) {
+            w.putId(mit->first.mnId);
+            w.put<int32_t>(mit->second);
+        }
+
+        w.put<uint32_t>(pKF->mvpOrderedConnectedKeyFrames.size());
+        for (size_t i = 0; i < pKF->mvpOrderedConnectedKeyFrames.size(); i++)
+            w.putId(pKF->mvpOrderedConnectedKeyFrames[i].mnId);
+
+        w.put<uint32_t>(pKF->mvOrderedWeights.size());
+        w.putBlock(pKF->mvOrderedWeights.data(), pKF->mvOrderedWeights.size() * sizeof(int));
+
+        w.putBool(pKF->mbFirstConnection);
+        w.putId(pKF->mpParent.mnId);
+
+        w.put<uint32_t>(pKF->mspChildrens.size());
+        for (std::set<LightKeyFrame>::const_iterator mit = pKF->mspChildrens.begin(); mit != pKF->mspChildrens.end(); mit++)
+            w.putId(mit->mnId);
+
+        w.put<uint32_t>(pKF->mspLoopEdges.size());
+        for (std::set<LightKeyFrame>::const_iterator mit = pKF->mspLoopEdges.begin(); mit != pKF->mspLoopEdges.end(); mit++)
+            w.putId(mit->mnId);
+
+        w.putBool(pKF->mbNotErase);
+        w.putBool(pKF->mbToBeErased);
+        w.putBool(pKF->mbBad);
+        w.put<float>(pKF->mHalfBaseline);
+        w.putId(pKF->mTopoId);
+    }
+
+    void TileCodec::readKeyFrame(TileReader &r, KeyFrame *pKF, Cache *pCacher) {
+
+        pKF->mpCacher = pCacher;
+
+        pKF->mnId = r.getId();
+        pKF->mnFrameId = r.getId();
+        pKF->mTimeStamp = r.get<double>();
+        pKF->mnGridCols = r.get<int32_t>();
+        pKF->mnGridRows = r.get<int32_t>();
+        pKF->mfGridElementWidthInv = r.get<float>();
+        pKF->mfGridElementHeightInv = r.get<float>();
+        pKF->mnTrackReferenceForFrame = r.getId();
+        pKF->mnFuseTargetForKF = r.getId();
+        pKF->mnBALocalForKF = r.getId();
+        pKF->mnBAFixedForKF = r.getId();
+        pKF->mnLoopQuery = r.getId();
+        pKF->mnLoopWords = r.get<int32_t>();
+        pKF->mLoopScore = r.get<float>();
+        pKF->mnRelocQuery = r.getId();
+        pKF->mnRelocWords = r.get<int32_t>();
+        pKF->mRelocScore = r.get<float>();
+        r.getMat(pKF->mTcwGBA);
+        r.getMat(pKF->mTcwBefGBA);
+        pKF->mnBAGlobalForKF = r.getId();
+
+        float calib[9];
+        r.getBlock(calib, sizeof(calib));
+        pKF->fx = calib[0]; pKF->fy = calib[1]; pKF->cx = calib[2]; pKF->cy = calib[3];
+        pKF->invfx = calib[4]; pKF->invfy = calib[5];
+        pKF->mbf = calib[6]; pKF->mb = calib[7]; pKF->mThDepth = calib[8];
+        pKF->N = r.get<int32_t>();
+
+        r.getKeyPoints(pKF->mvKeys);
+        r.getKeyPoints(pKF->mvKeysUn);
+        r.getFloats(pKF->mvuRight);
+        r.getFloats(pKF->mvDepth);
+        r.getMat(pKF->mDescriptors);
+
+        pKF->mBowVec.clear();
+        uint32_t nWords = r.getCount(sizeof(uint32_t) + sizeof(double));
+        for (uint32_t i = 0; i < nWords; i++) {
+            DBoW2::WordId wid = r.get<uint32_t>();
+            DBoW2::WordValue wv = r.get<double>();
+            pKF->mBowVec.insert(pKF->mBowVec.end(), make_pair(wid, wv));
+        }
+
+        pKF->mFeatVec.clear();
+        uint32_t nNodes = r.getCount(2 * sizeof(uint32_t));
+        for (uint32_t i = 0; i < nNodes; i++) {
+            DBoW2::NodeId nid = r.get<uint32_t>();
+            std::vector<unsigned int> &feats = pKF->mFeatVec[nid];
+            feats.resize(r.getCount(sizeof(unsigned int)));
+            r.getBlock(feats.data(), feats.size() * sizeof(unsigned int));
+        }
+
+        r.getMat(pKF->mTcp);
+        pKF->mnScaleLevels = r.get<int32_t>();
+        pKF->mfScaleFactor = r.get<float>();
+        pKF->mfLogScaleFactor = r.get<float>();
+        r.getFloats(pKF->mvScaleFactors);
+        r.getFloats(pKF->mvLevelSigma2);
+        r.getFloats(pKF->mvInvLevelSigma2);
+
+        int32_t bounds[4];
+        r.getBlock(bounds, sizeof(bounds));
+        pKF->mnMinX = bounds[0]; pKF->mnMinY = bounds[1]; pKF->mnMaxX = bounds[2]; pKF->mnMaxY = bounds[3];
+        r.getMat(pKF->mK);
+
+        r.getMat(pKF->Tcw);
+        r.getMat(pKF->Twc);
+        r.getMat(pKF->Ow);
+        r.getMat(pKF->Cw);
+
+        pKF->mvpMapPoints.resize(r.getCount(sizeof(uint64_t)));
+        for (size_t i = 0; i < pKF->mvpMapPoints.size(); i++)
+            pKF->mvpMapPoints[i] = LightMapPoint(r.getId(), pCacher);
+
+        pKF->mGrid.resize(r.getCount(sizeof(uint32_t)));
+        for (size_t i = 0; i < pKF->mGrid.size(); i++) {
+            pKF->mGrid[i].resize(r.getCount(sizeof(uint32_t)));
+            for (size_t j = 0; j < pKF->mGrid[i].size(); j++) {
+                std::vector<size_t> &cell = pKF->mGrid[i][j];
+                cell.resize(r.getCount(sizeof(uint32_t)));
+                for (size_t k = 0; k < cell.size(); k++)
+                    cell[k] = r.get<uint32_t>();
+            }
+        }
+
+        pKF->mConnectedKeyFrameWeights.clear();
+        uint32_t nConnected = r.getCount(sizeof(uint64_t) + sizeof(int32_t));
+        for (uint32_t i = 0; i < nConnected; i++) {
+            LightKeyFrame tLKF(r.getId(), pCacher);
+            pKF->mConnectedKeyFrameWeights.insert(pKF->mConnectedKeyFrameWeights.end(),
+                                                  make_pair(tLKF, (int) r.get<int32_t>()));
+        }
+
+        pKF->mvpOrderedConnectedKeyFrames.resize(r.getCount(sizeof(uint64_t)));
+        for (size_t i = 0; i < pKF->mvpOrderedConnectedKeyFrames.size(); i++)
+            pKF->mvpOrderedConnectedKeyFrames[i] = LightKeyFrame(r.getId(), pCacher);
+
+        pKF->mvOrderedWeights.resize(r.getCount(sizeof(int)));
+        r.getBlock(pKF->mvOrderedWeights.data(), pKF->mvOrderedWeights.size() * sizeof(int));
+
+        pKF->mbFirstConnection = r.getBool();
+        pKF->mpParent = LightKeyFrame(r.getId(), pCacher);
+
+        pKF->mspChildrens.clear();
+        uint32_t nChilds = r.getCount(sizeof(uint64_t));
+        for (uint32_t i = 0; i < nChilds; i++)
+            pKF->mspChildrens.insert(pKF->mspChildrens.end(), LightKeyFrame(r.getId(), pCacher));
+
+        pKF->mspLoopEdges.clear();
+        uint32_t nLoops = r.getCount(sizeof(uint64_t));
+        for (uint32_t i = 0; i < nLoops; i++)
+            pKF->mspLoopEdges.insert(pKF->mspLoopEdges.end(), LightKeyFrame(r.getId(), pCacher));
+
+        pKF->mbNotErase = r.getBool();
+        pKF->mbToBeErased = r.getBool();
+        pKF->mbBad = r.getBool();
+        pKF->mHalfBaseline = r.get<float>();
+        pKF->mTopoId = r.getId();
+    }
+
+    void TileCodec::writeMapPoint(TileWriter &w, MapPoint *pMP) {
+
+        w.putId(pMP->mnId);
+        w.put<int64_t>(pMP->mnFirstKFid);
+        w.put<int64_t>(pMP->mnFirstFrame);
+        w.put<int32_t>(pMP->nObs);
+        w.put<float>(pMP->mTrackProjX);
+        w.put<float>(pMP->mTrackProjY);
+        w.put<float>(pMP->mTrackProjXR);
+        w.putBool(pMP->mbTrackInView);
+        w.put<int32_t>(pMP->mnTrackScaleLevel);
+        w.put<float>(pMP->mTrackViewCos);
+        w.putId(pMP->mnTrackReferenceForFrame);
+        w.putId(pMP->mnLastFrameSeen);
+        w.putId(pMP->mnBALocalForKF);
+        w.putId(pMP->mnFuseCandidateForKF);
+        w.putId(pMP->mnLoopPointForKF);
+        w.putId(pMP->mnCorrectedByKF);
+        w.putId(pMP->mnCorrectedReference);
+        w.putMat(pMP->mPosGBA);
+        w.putId(pMP->mnBAGlobalForKF);
+        w.putMat(pMP->mWorldPos);
+
+        w.put<uint32_t>(pMP->mObservations.size());
+        for (std::map<LightKeyFrame, size_t>::const_iterator mit = pMP->mObservations.begin();
+             mit != pMP->mObservations.end(); mit++) {
+            w.putId(mit->first.mnId);
+            w.put<uint32_t>(mit->second);
+        }
+
+        w.put<uint32_t>(pMP->mObsLoopKP.size());
+        for (std::map<long unsigned int, LoopKeyPoint>::const_iterator mit = pMP->mObsLoopKP.begin();
+             mit != pMP->mObsLoopKP.end(); mit++) {
+            const float kp[4] = {mit->second.ptx, mit->second.pty, mit->second.ptur, mit->second.octaveSigm};
+            w.putId(mit->first);
+            w.putBlock(kp, sizeof(kp));
+        }
+
+        w.putMat(pMP->mNormalVector);
+        w.putMat(pMP->mDescriptor);
+        w.putId(pMP->mpRefKF.mnId);
+        w.put<int32_t>(pMP->mnVisible);
+        w.put<int32_t>(pMP->mnFound);
+        w.putBool(pMP->mbBad);
+        w.putId(pMP->mpReplaced.mnMapPointId);
+        w.put<float>(pMP->mfMinDistance);
+        w.put<float>(pMP->mfMaxDistance);
+    }
+
+    void TileCodec::readMapPoint(TileReader &r, MapPoint *pMP, Cache *pCacher) {
+
+        pMP->mpCacher = pCacher;
+
+        pMP->mnId = r.getId();
+        pMP->mnFirstKFid = (long int) r.get<int64_t>();
+        pMP->mnFirstFrame = (long int) r.get<int64_t>();
+        pMP->nObs = r.get<int32_t>();
+        pMP->mTrackProjX = r.get<float>();
+        pMP->mTrackProjY = r.get<float>();
+        pMP->mTrackProjXR = r.get<float>();
+        pMP->mbTrackInView = r.getBool();
+        pMP->mnTrackScaleLevel = r.get<int32_t>();
+        pMP->mTrackViewCos = r.get<float>();
+        pMP->mnTrackReferenceForFrame = r.getId();
+        pMP->mnLastFrameSeen = r.getId();
+        pMP->mnBALocalForKF = r.getId();
+        pMP->mnFuseCandidateForKF = r.getId();
+        pMP->mnLoopPointForKF = r.getId();
+        pMP->mnCorrectedByKF = r.getId();
+        pMP->mnCorrectedReference = r.getId();
+        r.getMat(pMP->mPosGBA);
+        pMP->mnBAGlobalForKF = r.getId();
+        r.getMat(pMP->mWorldPos);
+
+        pMP->mObservations.clear();
+        uint32_t nObs = r.getCount(sizeof(uint64_t) + sizeof(uint32_t));
+        for (uint32_t i = 0; i < nObs; i++) {
+            LightKeyFrame tLKF(r.getId(), pCacher);
+            pMP->mObservations.insert(pMP->mObservations.end(), make_pair(tLKF, (size_t) r.get<uint32_t>()));
+        }
+
+        pMP->mObsLoopKP.clear();
+        uint32_t nLoopKP = r.getCount(sizeof(uint64_t) + 4 * sizeof(float));
+        for (uint32_t i = 0; i < nLoopKP; i++) {
+            long unsigned int kfId = r.getId();
+            float kp[4];
+            r.getBlock(kp, sizeof(kp));
+            pMP->mObsLoopKP.insert(pMP->mObsLoopKP.end(), make_pair(kfId, LoopKeyPoint(kp[0], kp[1], kp[2], kp[3])));
+        }
+
+        r.getMat(pMP->mNormalVector);
+        r.getMat(pMP->mDescriptor);
+        pMP->mpRefKF = LightKeyFrame(r.getId(), pCacher);
+        pMP->mnVisible = r.get<int32_t>();
+        pMP->mnFound = r.get<int32_t>();
+        pMP->mbBad = r.getBool();
+        pMP->mpReplaced = LightMapPoint(r.getId(), pCacher);
+        pMP->mfMinDistance = r.get<float>();
+        pMP->mfMaxDistance = r.get<float>();
+    }
+
+    void TileCodec::encodeKeyFrames(TopoId tId, const std::vector<KeyFrame *> &pKFs, std::string &out) {
+
+        // keypoints, descriptors, depth and grid take roughly 160 bytes per feature
+        size_t estimate = HEADER_SIZE;
+        for (size_t i = 0; i < pKFs.size(); i++)
+            if (pKFs[i])
+                estimate += pKFs[i]->N * 160 + 4096;
+
+        out.clear();
+        out.reserve(estimate);
+
+        TileWriter w(out);
+        writeHeader(w, TILE_KEYFRAMES, tId);
+
+        uint32_t count = 0;
+        for (size_t i = 0; i < pKFs.size(); i++) {
+            if (pKFs[i]) {
+                writeKeyFrame(w, pKFs[i]);
+                count++;
+            }
+        }
+
+        finishHeader(out, 0, count);
+    }
+
+    bool TileCodec::decodeKeyFrames(const char *data, size_t size, Cache *pCacher, std::vector<KeyFrame *> &pKFs) {
+
+        TileHeader header;
+        std::string raw;
+        if (!openTile(data, size, TILE_KEYFRAMES, header, raw))
+            return false;
+
+        TileReader r(data + HEADER_SIZE, header.size);
+
+        // the count comes off the wire, it must fit in the payload before anything is allocated for it
+        if ((size_t) header.count > header.size / MIN_KEYFRAME_RECORD) {
+            cout << "error in decoding keyframe tile " << header.topoId << " : bad count " << header.count << endl;
+            return false;
+        }
+
+        std::vector<KeyFrame *> decoded;
+        decoded.reserve(header.count);
+
+        TileArenaScope scope(header.topoId);
+
+        for (uint32_t i = 0; i < header.count; i++) {
+            KeyFrame *tKF = new KeyFrame();
+            decoded.push_back(tKF);
+            try {
+                readKeyFrame(r, tKF, pCacher);
+            } catch (const std::exception &e) {
+                cout << "error in decoding keyframe tile " << header.topoId << " : " << e.what() << endl;
+                // nothing of a broken tile is handed out
+                for (size_t j = 0; j < decoded.size(); j++)
+                    delete decoded[j];
+                return false;
+            }
+        }
+
+        pKFs.insert(pKFs.end(), decoded.begin(), decoded.end());
+
+        return true;
+    }
+
+    void TileCodec::encodeMapPoints(TopoId tId, const std::vector<MapPoint *> &pMPs, std::string &out) {
+
+        out.clear();
+        out.reserve(HEADER_SIZE + pMPs.size() * 512);
+
+        TileWriter w(out);
+        writeHeader(w, TILE_MAPPOINTS, tId);
+
+        uint32_t count = 0;
+        for (size_t i = 0; i < pMPs.size(); i++) {
+            if (pMPs[i]) {
+                writeMapPoint(w, pMPs[i]);
+                count++;
+            }
+        }
+
+        finishHeader(out, 0, count);
+    }
+
+    bool TileCodec::decodeMapPoints(const char *data, size_t size, Cache *pCacher, std::vector<MapPoint *> &pMPs) {
+
+        TileHeader header;
+        std::string raw;
+        if (!openTile(data, size, TILE_MAPPOINTS, header, raw))
+            return false;
+
+        TileReader r(data + HEADER_SIZE, header.size);
+
+        // the count comes off the wire, it must fit in the payload before anything is allocated for it
+        if ((size_t) header.count > header.size / MIN_MAPPOINT_RECORD) {
+            cout << "error in decoding mappoint tile " << header.topoId << " : bad count " << header.count << endl;
+            return false;
+        }
+
+        std::vector<MapPoint *> decoded;
+        decoded.reserve(header.count);
+
+        TileArenaScope scope(header.topoId);
+
+        for (uint32_t i = 0; i < header.count; i++) {
+            MapPoint *tMP = new MapPoint();
+            decoded.push_back(tMP);
+            try {
+                readMapPoint(r, tMP, pCacher);
+            } catch (const std::exception &e) {
+                cout << "error in decoding mappoint tile " << header.topoId << " : " << e.what() << endl;
+                // nothing of a broken tile is handed out
+                for (size_t j = 0; j < decoded.size(); j++)
+                    delete decoded[j];
+                return false;
+            }
+        }
+
+        pMPs.insert(pMPs.end(), decoded.begin(), decoded.end());
+
+        return true;
+    }
+
+    void TileCodec::encodeKeyFramePoses(TopoId tId, const KeyFramePoseMap &poses, std::string &out) {
+
+        out.clear();
+        out.reserve(HEADER_SIZE + poses.size() * (sizeof(uint64_t) + 12 + 16 * sizeof(float)));
+
+        TileWriter w(out);
+        writeHeader(w, TILE_KEYFRAME_POSES, tId);
+
+        for (KeyFramePoseMap::const_iterator mit = poses.begin(); mit != poses.end(); mit++) {
+            w.putId(mit->first);
+            w.putMat(mit->second);
+        }
+
+        finishHeader(out, 0, poses.size());
+    }
+
+    bool TileCodec::decodeKeyFramePoses(const char *data, size_t size, KeyFramePoseMap &poses) {
+
+        TileHeader header;
+        std::string raw;
+        if (!openTile(data, size, TILE_KEYFRAME_POSES, header, raw))
+            return false;
+
+        TileReader r(data + HEADER_SIZE, header.size);
+
+        try {
+            for (uint32_t i = 0; i < header.count; i++) {
+                long unsigned int id = r.getId();
+                r.getMat(poses[id]);
+            }
+        } catch (const std::exception &e) {
+            cout << "error in decoding keyframe poses of tile " << header.topoId << " : " << e.what() << endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void TileCodec::encodeMapPointPoses(TopoId tId, const MapPointPoseMap &poses, std::string &out) {
+
+        out.clear();
+        out.reserve(HEADER_SIZE + poses.size() * 128);
+
+        TileWriter w(out);
+        writeHeader(w, TILE_MAPPOINT_POSES, tId);
+
+        for (MapPointPoseMap::const_iterator mit = poses.begin(); mit != poses.end(); mit++) {
+            w.putId(mit->first);
+            w.putMat(mit->second.first);
+
+            const std::vector<std::pair<long unsigned int, LoopKeyPoint> > &obs = mit->second.second;
+            w.put<uint32_t>(obs.size());
+            for (size_t i = 0; i < obs.size(); i++) {
+                const float kp[4] = {obs[i].second.ptx, obs[i].second.pty, obs[i].second.ptur, obs[i].second.octaveSigm};
+                w.putId(obs[i].first);
+                w.putBlock(kp, sizeof(kp));
+            }
+        }
+
+        finishHeader(out, 0, poses.size());
+    }
+
+    bool TileCodec::decodeMapPointPoses(const char *data, size_t size, MapPointPoseMap &poses) {
+
+        TileHeader header;
+        std::string raw;
+        if (!openTile(data, size, TILE_MAPPOINT_POSES, header, raw))
+            return false;
+
+        TileReader r(data + HEADER_SIZE, header.size);
+
+        try {
+            for (uint32_t i = 0; i < header.count; i++) {
+                long unsigned int id = r.getId();
+                std::pair<cv::Mat, std::vector<std::pair<long unsigned int, LoopKeyPoint> > > &entry = poses[id];
+                r.getMat(entry.first);
+
+                uint32_t nObs = r.getCount(sizeof(uint64_t) + 4 * sizeof(float));
+                entry.second.clear();
+                entry.second.reserve(nObs);
+                for (uint32_t j = 0; j < nObs; j++) {
+                    long unsigned int kfId = r.getId();
+                    float kp[4];
+                    r.getBlock(kp, sizeof(kp));
+                    entry.second.push_back(make_pair(kfId, LoopKeyPoint(kp[0], kp[1], kp[2], kp[3])));
+                }
+            }
+        } catch (const std::exception &e) {
+            cout << "error in decoding mappoint poses of tile " << header.topoId << " : " << e.what() << endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void TileCodec::encodeTopoIndex(TopoMap *pTopo, std::string &out) {
+
+        out.clear();
+        out.reserve(HEADER_SIZE + pTopo->KF2TopoId.size() * 512);
+
+        TileWriter w(out);
+        writeHeader(w, TILE_TOPO_INDEX, 0);
+
+        // the tiles of the keyframes, mpTopoKFs is rebuilt from it
+        w.put<uint64_t>(pTopo->KF2TopoId.size());
+        for (std::map<long unsigned int, TopoId>::const_iterator mit = pTopo->KF2TopoId.begin(); mit != pTopo->KF2TopoId.end(); mit++) {
+            w.putId(mit->first);
+            w.put<uint64_t>(mit->second);
+        }
+
+        {
+            unique_lock<mutex> lock(pTopo->mpTopoMpsMutex);
+
+            w.put<uint64_t>(pTopo->mpTopoMps.size());
+            for (std::map<TopoId, std::set<long unsigned int> >::const_iterator mit = pTopo->mpTopoMps.begin(); mit != pTopo->mpTopoMps.end(); mit++) {
+                w.put<uint64_t>(mit->first);
+                w.put<uint32_t>(mit->second.size());
+                for (std::set<long unsigned int>::const_iterator sit = mit->second.begin(); sit != mit->second.end(); sit++)
+                    w.putId(*sit);
+            }
+        }
+
+        w.put<uint64_t>(pTopo->KFgraph.size());
+        for (std::map<long unsigned int, std::vector<pair<long unsigned int, int> > >::const_iterator mit = pTopo->KFgraph.begin(); mit != pTopo->KFgraph.end(); mit++) {
+            w.putId(mit->first);
+            w.put<uint32_t>(mit->second.size());
+            for (size_t i = 0; i < mit->second.size(); i++) {
+                w.putId(mit->second[i].first);
+                w.put<int32_t>(mit->second[i].second);
+            }
+        }
+
+        // the spanning tree, mpKFchilds is rebuilt from it
+        w.put<uint64_t>(pTopo->KFParent.size());
+        for (std::map<long unsigned int, long unsigned int>::const_iterator mit = pTopo->KFParent.begin(); mit != pTopo->KFParent.end(); mit++) {
+            w.putId(mit->first);
+            w.putId(mit->second);
+        }
+
+        w.put<uint64_t>(pTopo->KFLoopEdges.size());
+        for (std::map<long unsigned int, set<long unsigned int> >::const_iterator mit = pTopo->KFLoopEdges.begin(); mit != pTopo->KFLoopEdges.end(); mit++) {
+            w.putId(mit->first);
+            w.put<uint32_t>(mit->second.size());
+            for (std::set<long unsigned int>::const_iterator sit = mit->second.begin(); sit != mit->second.end(); sit++)
+                w.putId(*sit);
+        }
+
+        w.put<uint64_t>(pTopo->DBowMap.size());
+        for (std::map<long unsigned int, DBoW2::BowVector>::const_iterator mit = pTopo->DBowMap.begin(); mit != pTopo->DBowMap.end(); mit++) {
+            w.putId(mit->first);
+            w.put<uint32_t>(mit->second.size());
+            for (DBoW2::BowVector::const_iterator vit = mit->second.begin(); vit != mit->second.end(); vit++) {
+                w.put<uint32_t>(vit->first);
+                w.put<double>(vit->second);
+            }
+        }
+
+        w.put<uint64_t>(pTopo->mpRefKf.size());
+        for (std::map<long unsigned int, long unsigned int>::const_iterator mit = pTopo->mpRefKf.begin(); mit != pTopo->mpRefKf.end(); mit++) {
+            w.putId(mit->first);
+            w.putId(mit->second);
+        }
+
+        finishHeader(out, 0, 0);
+    }
+
+    bool TileCodec::decodeTopoIndex(const char *data, size_t size, TopoMap *pTopo) {
+
+        TileHeader header;
+        std::string raw;
+        if (!openTile(data, size, TILE_TOPO_INDEX, header, raw))
+            return false;
+
+        TileReader r(data + HEADER_SIZE, header.size);
+
+        std::map<long unsigned int, TopoId> kf2TopoId;
+        std::map<TopoId, std::set<long unsigned int> > topoKFs;
+        std::map<TopoId, std::set<long unsigned int> > topoMps;
+        std::map<long unsigned int, std::vector<pair<long unsigned int, int> > > graph;
+        std::map<long unsigned int, long unsigned int> parents;
+        std::map<long unsigned int, std::set<long unsigned int> > childs;
+        std::map<long unsigned int, set<long unsigned int> > loopEdges;
+        std::map<long unsigned int, DBoW2::BowVector> bows;
+        std::map<long unsigned int, long unsigned int> refKfs;
+
+        try {
+            uint64_t n = r.get<uint64_t>();
+            for (uint64_t i = 0; i < n; i++) {
+                long unsigned int kf = r.getId();
+                TopoId tId = r.get<uint64_t>();
+                kf2TopoId[kf] = tId;
+                topoKFs[tId].insert(kf);
+            }
+
+            n = r.get<uint64_t>();
+            for (uint64_t i = 0; i < n; i++) {
+                std::set<long unsigned int> &mps = topoMps[r.get<uint64_t>()];
+                uint32_t m = r.getCount(sizeof(uint64_t));
+                for (uint32_t j = 0; j < m; j++)
+                    mps.insert(mps.end(), r.getId());
+            }
+
+            n = r.get<uint64_t>();
+            for (uint64_t i = 0; i < n; i++) {
+                std::vector<pair<long unsigned int, int> > &edges = graph[r.getId()];
+                uint32_t m = r.getCount(sizeof(uint64_t) + sizeof(int32_t));
+                edges.reserve(m);
+                for (uint32_t j = 0; j < m; j++) {
+                    long unsigned int kf = r.getId();
+                    edges.push_back(make_pair(kf, (int) r.get<int32_t>()));
+                }
+            }
+
+            n = r.get<uint64_t>();
+            for (uint64_t i = 0; i < n; i++) {
+                long unsigned int child = r.getId();
+                long unsigned int parent = r.getId();
+                parents[child] = parent;
+                childs[parent].insert(child);
+            }
+
+            n = r.get<uint64_t>();
+            for (uint64_t i = 0; i < n; i++) {
+                std::set<long unsigned int> &edges = loopEdges[r.getId()];
+                uint32_t m = r.getCount(sizeof(uint64_t));
+                for (uint32_t j = 0; j < m; j++)
+                    edges.insert(r.getId());
+            }
+
+            n = r.get<uint64_t>();
+            for (uint64_t i = 0; i < n; i++) {
+                DBoW2::BowVector &bow = bows[r.getId()];
+                uint32_t m = r.getCount(sizeof(uint32_t) + sizeof(double));
+                for (uint32_t j = 0; j < m; j++) {
+                    DBoW2::WordId word = r.get<uint32_t>();
+                    bow.insert(bow.end(), make_pair(word, (DBoW2::WordValue) r.get<double>()));
+                }
+            }
+
+            n = r.get<uint64_t>();
+            for (uint64_t i = 0; i < n; i++) {
+                long unsigned int mp = r.getId();
+                refKfs[mp] = r.getId();
+            }
+        } catch (const std::exception &e) {
+            cout << "error in decoding the topo index : " << e.what() << endl;
+            return false;
+        }
+
+        pTopo->KF2TopoId.swap(kf2TopoId);
+        pTopo->mpTopoKFs.swap(topoKFs);
+        {
+            unique_lock<mutex> lock(pTopo->mpTopoMpsMutex);
+            pTopo->mpTopoMps.swap(topoMps);
+        }
+        pTopo->KFgraph.swap(graph);
+        pTopo->KFParent.swap(parents);
+        pTopo->mpKFchilds.swap(childs);
+        pTopo->KFLoopEdges.swap(loopEdges);
+        pTopo->DBowMap.swap(bows);
+        pTopo->mpRefKf.swap(refKfs);
+
+        // the split cells are not stored, the deeper tiles in use bring them back
+        for (std::map<long unsigned int, TopoId>::const_iterator mit = pTopo->KF2TopoId.begin(); mit != pTopo->KF2TopoId.end(); mit++)
+            pTopo->noteTileId(mit->second);
+        for (std::map<TopoId, std::set<long unsigned int> >::const_iterator mit = pTopo->mpTopoMps.begin(); mit != pTopo->mpTopoMps.end(); mit++)
+            if (!mit->second.empty())
+                pTopo->noteTileId(mit->first);
+
+        return true;
+    }
+
+}
@@ -0,0 +1,981 @@
+#include "TileStore.h"
+#include "ServiceConnections.h"
+#include "MapSnapshot.h"
+#include "sstream"
+#include "ros/ros.h"
+#include "orbslam_server/orbslam_save.h"
+#include "orbslam_server/orbslam_get.h"
+#include "orbslam_server/orbslam_pose_save.h"
+#include "orbslam_server/orbslam_pose_get.h"
+#include "orbslam_server/orbslam_batch_save.h"
+#include "orbslam_server/orbslam_batch_get.h"
+#include "orbslam_server/orbslam_pose_batch.h"
+#include "orbslam_server/orbslam_tile_query.h"
+#include "boost/archive/text_oarchive.hpp"
+#include "boost/archive/text_iarchive.hpp"
+#include "boost/serialization/vector.hpp"
+#include "boost/serialization/map.hpp"
+#include "boost/serialization/string.hpp"
+#include "boost/serialization/utility.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace ORB_SLAM2 {
+
+    bool TileStore::updatePoses(const std::map<TopoId, std::string> &kfPoses, const std::map<TopoId, std::string> &mpPoses) {
+
+        bool bOK = true;
+
+        if (!kfPoses.empty())
+            bOK = updateAllPoses(TILE_KEYFRAMES, kfPoses) && bOK;
+
+        if (!mpPoses.empty())
+            bOK = updateAllPoses(TILE_MAPPOINTS, mpPoses) && bOK;
+
+        return bOK;
+
+    }
+
+    bool TileStore::saveTiles(const std::vector<TileBlocks> &tiles) {
+
+        bool bOK = true;
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+
+            if (tiles[i].kfData.size() > 0)
+                bOK = saveTile(TILE_KEYFRAMES, tiles[i].tId, tiles[i].kfData, tiles[i].kfPose) && bOK;
+
+            if (tiles[i].mpData.size() > 0)
+                bOK = saveTile(TILE_MAPPOINTS, tiles[i].tId, tiles[i].mpData, tiles[i].mpPose) && bOK;
+        }
+
+        return bOK;
+
+    }
+
+    bool TileStore::getTiles(std::vector<TileBlocks> &tiles) {
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+
+            if (!getTile(TILE_KEYFRAMES, tiles[i].tId, tiles[i].kfData, tiles[i].kfPose)) {
+                tiles[i].kfData.clear();
+                tiles[i].kfPose.clear();
+            }
+
+            if (!getTile(TILE_MAPPOINTS, tiles[i].tId, tiles[i].mpData, tiles[i].mpPose)) {
+                tiles[i].mpData.clear();
+                tiles[i].mpPose.clear();
+            }
+        }
+
+        return true;
+
+    }
+
+    bool RosTileStore::saveTile(TileKind kind, TopoId tId, const std::string &data, const std::string &pose) {
+
+        const char *service = kind == TILE_KEYFRAMES ? "saveTopoKeyFrame" : "saveTopoMapPoint";
+        orbslam_server::orbslam_save srv;
+
+        srv.request.ID = tId;
+        // the payloads are uint8[] fields, stored as BYTEA
+        srv.request.DATA.assign(data.begin(), data.end());
+        srv.request.POSE.assign(pose.begin(), pose.end());
+
+        if (!mpConnections->call(mNamespace + service, srv)) {
+            cout << "Failed to call service save tile " << tId << endl;
+            return false;
+        }
+
+        return true;
+
+    }
+
+    bool RosTileStore::getTile(TileKind kind, TopoId tId, std::string &data, std::string &pose) {
+
+        const char *service = kind == TILE_KEYFRAMES ? "getTopoKeyFrame" : "getTopoMapPoint";
+        orbslam_server::orbslam_get srv;
+
+        srv.request.ID = tId;
+
+        if (!mpConnections->call(mNamespace + service, srv))
+            return false;
+
+        data.assign(srv.response.DATA.begin(), srv.response.DATA.end());
+        pose.assign(srv.response.POSE.begin(), srv.response.POSE.end());
+
+        return data.size() > 0;
+
+    }
+
+    bool RosTileStore::getAllPoses(TileKind kind, std::map<TopoId, std::string> &poses) {
+
+        const char *service = kind == TILE_KEYFRAMES ? "getAllKeyFramePose" : "getAllTopoMapPointPose";
+        orbslam_server::orbslam_pose_get srv;
+
+        if (!mpConnections->call(mNamespace + service, srv))
+            return false;
+
+        std::stringstream sPose(std::string(srv.response.POSE.begin(), srv.response.POSE.end()));
+        boost::archive::text_iarchive iPose(sPose);
+
+        // the server answers a map for the keyframes and a list for the mappoints
+        if (kind == TILE_KEYFRAMES) {
+            iPose >> poses;
+        } else {
+            vector<pair<long unsigned int, std::string> > vPoses;
+            iPose >> vPoses;
+            for (size_t i = 0; i < vPoses.size(); i++)
+                poses[vPoses[i].first].swap(vPoses[i].second);
+        }
+
+        return true;
+
+    }
+
+    bool RosTileStore::updateAllPoses(TileKind kind, const std::map<TopoId, std::string> &poses) {
+
+        std::ostringstream os;
+        boost::archive::text_oarchive oa(os);
+
+        if (kind == TILE_KEYFRAMES) {
+            oa << poses;
+        } else {
+            vector<pair<long unsigned int, std::string> > vPoses(poses.begin(), poses.end());
+            oa << vPoses;
+        }
+
+        const char *service = kind == TILE_KEYFRAMES ? "updateAllKeyFramePose" : "updateAllTopoMapPointPose";
+        orbslam_server::orbslam_pose_save srv;
+
+        const std::string sPose = os.str();
+        srv.request.POSE.assign(sPose.begin(), sPose.end());
+
+        if (!mpConnections->call(mNamespace + service, srv)) {
+            ROS_INFO("update all pose error");
+            return false;
+        }
+
+        return true;
+
+    }
+
+    bool RosTileStore::updatePoses(const std::map<TopoId, std::string> &kfPoses, const std::map<TopoId, std::string> &mpPoses) {
+
+        if (kfPoses.empty() && mpPoses.empty())
+            return true;
+
+        orbslam_server::orbslam_pose_batch srv;
+
+        srv.request.KF_POSE.resize(kfPoses.size());
+        srv.request.MP_POSE.resize(mpPoses.size());
+
+        size_t i = 0;
+        for (std::map<TopoId, std::string>::const_iterator mit = kfPoses.begin(); mit != kfPoses.end(); mit++, i++) {
+            srv.request.KF_IDS.push_back(mit->first);
+            srv.request.KF_POSE[i].BYTES.assign(mit->second.begin(), mit->second.end());
+        }
+
+        i = 0;
+        for (std::map<TopoId, std::string>::const_iterator mit = mpPoses.begin(); mit != mpPoses.end(); mit++, i++) {
+            srv.request.MP_IDS.push_back(mit->first);
+            srv.request.MP_POSE[i].BYTES.assign(mit->second.begin(), mit->second.end());
+        }
+
+        if (!mpConnections->call(mNamespace + "updateTopoPoses", srv)) {
+            ROS_INFO("update topo poses error");
+            return false;
+        }
+
+        return true;
+
+    }
+
+    bool RosTileStore::saveTiles(const std::vector<TileBlocks> &tiles) {
+
+        if (tiles.empty())
+            return true;
+
+        orbslam_server::orbslam_batch_save srv;
+
+        srv.request.KF_POSE.resize(tiles.size());
+        srv.request.KF_DATA.resize(tiles.size());
+        srv.request.MP_POSE.resize(tiles.size());
+        srv.request.MP_DATA.resize(tiles.size());
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+            srv.request.IDS.push_back(tiles[i].tId);
+            srv.request.KF_POSE[i].BYTES.assign(tiles[i].kfPose.begin(), tiles[i].kfPose.end());
+            srv.request.KF_DATA[i].BYTES.assign(tiles[i].kfData.begin(), tiles[i].kfData.end());
+            srv.request.MP_POSE[i].BYTES.assign(tiles[i].mpPose.begin(), tiles[i].mpPose.end());
+            srv.request.MP_DATA[i].BYTES.assign(tiles[i].mpData.begin(), tiles[i].mpData.end());
+        }
+
+        // one box per tile when any is known, NaN for the others
+        for (size_t i = 0; i < tiles.size(); i++) {
+            if (tiles[i].extent.size() == 6) {
+                srv.request.EXTENTS.assign(6 * tiles.size(), std::numeric_limits<double>::quiet_NaN());
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < tiles.size() && !srv.request.EXTENTS.empty(); i++) {
+            if (tiles[i].extent.size() == 6)
+                std::copy(tiles[i].extent.begin(), tiles[i].extent.end(), srv.request.EXTENTS.begin() + 6 * i);
+        }
+
+        if (!mpConnections->call(mNamespace + "saveTopoTiles", srv)) {
+            cout << "Failed to call service save tiles, size " << tiles.size() << endl;
+            return false;
+        }
+
+        return true;
+
+    }
+
+    bool RosTileStore::getTiles(std::vector<TileBlocks> &tiles) {
+
+        if (tiles.empty())
+            return true;
+
+        orbslam_server::orbslam_batch_get srv;
+
+        for (size_t i = 0; i < tiles.size(); i++)
+            srv.request.IDS.push_back(tiles[i].tId);
+
+        if (!mpConnections->call(mNamespace + "getTopoTiles", srv) || srv.response.KF_DATA.size() != tiles.size() || srv.response.KF_POSE.size() != tiles.size() ||
+            srv.response.MP_DATA.size() != tiles.size() || srv.response.MP_POSE.size() != tiles.size())
+            return false;
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+            tiles[i].kfPose.assign(srv.response.KF_POSE[i].BYTES.begin(), srv.response.KF_POSE[i].BYTES.end());
+            tiles[i].kfData.assign(srv.response.KF_DATA[i].BYTES.begin(), srv.response.KF_DATA[i].BYTES.end());
+            tiles[i].mpPose.assign(srv.response.MP_POSE[i].BYTES.begin(), srv.response.MP_POSE[i].BYTES.end());
+            tiles[i].mpData.assign(srv.response.MP_DATA[i].BYTES.begin(), srv.response.MP_DATA[i].BYTES.end());
+        }
+
+        return true;
+
+    }
+
+    bool RosTileStore::queryTiles(const TileQuery &query, std::vector<TileBlocks> &tiles) {
+
+        orbslam_server::orbslam_tile_query srv;
+
+        srv.request.BOX = query.box;
+        srv.request.CENTER.assign(query.center, query.center + 3);
+        srv.request.RADIUS = query.radius;
+        srv.request.MAX_TILES = query.maxTiles;
+        srv.request.EXCLUDE.assign(query.exclude.begin(), query.exclude.end());
+
+        if (!mpConnections->call(mNamespace + "queryTopoTiles", srv))
+            return false;
+
+        const size_t m = srv.response.IDS.size();
+
+        if (srv.response.KF_DATA.size() != m || srv.response.KF_POSE.size() != m ||
+            srv.response.MP_DATA.size() != m || srv.response.MP_POSE.size() != m)
+            return false;
+
+        tiles.resize(m);
+
+        for (size_t i = 0; i < m; i++) {
+            tiles[i].tId = srv.response.IDS[i];
+            tiles[i].distance = i < srv.response.DISTANCES.size() ? srv.response.DISTANCES[i] : 0;
+            tiles[i].kfPose.assign(srv.response.KF_POSE[i].BYTES.begin(), srv.response.KF_POSE[i].BYTES.end());
+            tiles[i].kfData.assign(srv.response.KF_DATA[i].BYTES.begin(), srv.response.KF_DATA[i].BYTES.end());
+            tiles[i].mpPose.assign(srv.response.MP_POSE[i].BYTES.begin(), srv.response.MP_POSE[i].BYTES.end());
+            tiles[i].mpData.assign(srv.response.MP_DATA[i].BYTES.begin(), srv.response.MP_DATA[i].BYTES.end());
+        }
+
+        return true;
+
+    }
+
+    // the data file grows by whole chunks, the mapping is replaced when it does
+    static const uint64_t STORE_CHUNK = 64ull << 20;
+
+    // the records carry the checks of their blocks since "MID2", the older index files are not read
+    static const uint32_t INDEX_CHECK = 0x3244494d; // "MID2"
+
+    MappedTileStore::MappedTileStore(const std::string &path, bool bReset) :
+            mPath(path), mDataFd(-1), mIndexFd(-1), mpMapped(nullptr), mCapacity(0), mEnd(0) {
+
+        int flags = O_RDWR | O_CREAT | (bReset ? O_TRUNC : 0);
+
+        mDataFd = open((path + ".dat").c_str(), flags, 0644);
+        mIndexFd = open((path + ".idx").c_str(), flags | O_APPEND, 0644);
+
+        if (!isOpen()) {
+            cerr << "can not open the tile store " << path << endl;
+            return;
+        }
+
+        struct stat st;
+        fstat(mDataFd, &st);
+
+        // the blocks are checked through the mapping
+        if (!reserve(st.st_size)) {
+            cerr << "can not map the tile store " << path << endl;
+            close(mDataFd);
+            mDataFd = -1;
+            return;
+        }
+
+        if (!replayIndex())
+            cerr << "tile store index " << path << " is damaged, the tail is ignored" << endl;
+
+    }
+
+    MappedTileStore::~MappedTileStore() {
+
+        if (mpMapped)
+            munmap(mpMapped, mCapacity);
+
+        if (mDataFd >= 0)
+            close(mDataFd);
+
+        if (mIndexFd >= 0)
+            close(mIndexFd);
+
+    }
+
+    uint32_t MappedTileStore::checkOf(const IndexEntry &entry) {
+
+        uint64_t h = entry.topoId ^ (entry.dataOffset << 7) ^ (entry.poseOffset << 13) ^
+                     ((uint64_t) entry.dataSize << 29) ^ ((uint64_t) entry.poseSize << 3) ^ entry.kind ^
+                     ((uint64_t) entry.dataCheck << 17) ^ entry.poseCheck;
+
+        return (uint32_t) (h ^ (h >> 32)) ^ INDEX_CHECK;
+
+    }
+
+    uint32_t MappedTileStore::checkOf(const char *block, size_t size) {
+
+        // FNV-1a
+        uint32_t h = 2166136261u;
+
+        for (size_t i = 0; i < size; i++)
+            h = (h ^ (unsigned char) block[i]) * 16777619u;
+
+        return h;
+
+    }
+
+    bool MappedTileStore::replayIndex() {
+
+        mIndex.clear();
+        mEnd = 0;
+
+        struct stat st;
+        if (fstat(mIndexFd, &st) != 0)
+            return false;
+
+        const size_t n = st.st_size / sizeof(IndexEntry);
+
+        for (size_t i = 0; i < n; i++) {
+
+            IndexEntry entry;
+
+            if (pread(mIndexFd, &entry, sizeof(entry), i * sizeof(entry)) != (ssize_t) sizeof(entry))
+                return false;
+
+            // the data file is grown by whole chunks, so only the checks of the blocks tell a record written
+            // while its blocks did not reach the disk. it ends the log
+            if (entry.check != checkOf(entry) ||
+                entry.dataOffset + entry.dataSize > mCapacity || entry.poseOffset + entry.poseSize > mCapacity ||
+                entry.dataCheck != checkOf(mpMapped + entry.dataOffset, entry.dataSize) ||
+                entry.poseCheck != checkOf(mpMapped + entry.poseOffset, entry.poseSize)) {
+                // the records appended from now on must not follow it
+                if (ftruncate(mIndexFd, i * sizeof(IndexEntry)) != 0)
+                    cerr << "can not cut the tile store index " << mPath << endl;
+                return false;
+            }
+
+            mIndex[TileKey(entry.kind, entry.topoId)] = entry;
+
+            mEnd = std::max(mEnd, std::max(entry.dataOffset + entry.dataSize, entry.poseOffset + entry.poseSize));
+        }
+
+        if (st.st_size % sizeof(IndexEntry) != 0) {
+            if (ftruncate(mIndexFd, n * sizeof(IndexEntry)) != 0)
+                cerr << "can not cut the tile store index " << mPath << endl;
+            return false;
+        }
+
+        return true;
+
+    }
+
+    bool MappedTileStore::reserve(uint64_t size) {
+
+        if (mpMapped && size <= mCapacity)
+            return true;
+
+        uint64_t capacity = std::max(mCapacity, STORE_CHUNK);
+        while (capacity < size)
+            capacity *= 2;
+
+        if (ftruncate(mDataFd, capacity) != 0)
+            return false;
+
+        if (mpMapped)
+            munmap(mpMapped, mCapacity);
+
+        void *p = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, mDataFd, 0);
+
+        if (p == MAP_FAILED) {
+            mpMapped = nullptr;
+            mCapacity = 0;
+            return false;
+        }
+
+        mpMapped = (char *) p;
+        mCapacity = capacity;
+
+        return true;
+
+    }
+
+    bool MappedTileStore::append(const std::string &block, uint64_t &offset) {
+
+        if (!reserve(mEnd + block.size()))
+            return false;
+
+        offset = mEnd;
+        memcpy(mpMapped + offset, block.data(), block.size());
+        mEnd += block.size();
+
+        return true;
+
+    }
+
+    bool MappedTileStore::sync(uint64_t offset, uint64_t size) {
+
+        if (size == 0)
+            return true;
+
+        // msync takes a page aligned address
+        const uint64_t page = sysconf(_SC_PAGESIZE);
+        const uint64_t begin = offset / page * page;
+
+        return msync(mpMapped + begin, offset + size - begin, MS_SYNC) == 0;
+
+    }
+
+    bool MappedTileStore::appendIndex(const IndexEntry &entry) {
+
+        return write(mIndexFd, &entry, sizeof(entry)) == (ssize_t) sizeof(entry);
+
+    }
+
+    bool MappedTileStore::saveTile(TileKind kind, TopoId tId, const std::string &data, const std::string &pose) {
+
+        unique_lock<mutex> lock(mMutexStore);
+
+        if (!isOpen())
+            return false;
+
+        IndexEntry entry;
+        entry.topoId = tId;
+        entry.kind = kind;
+        entry.dataSize = data.size();
+        entry.poseSize = pose.size();
+        entry.dataCheck = checkOf(data.data(), data.size());
+        entry.poseCheck = checkOf(pose.data(), pose.size());
+
+        if (!append(data, entry.dataOffset) || !append(pose, entry.poseOffset)) {
+            cerr << "tile store " << mPath << " is full" << endl;
+            return false;
+        }
+
+        // the pose block follows the data block
+        if (!sync(entry.dataOffset, data.size() + pose.size())) {
+            cerr << "can not sync the tile store " << mPath << endl;
+            return false;
+        }
+
+        entry.check = checkOf(entry);
+
+        if (!appendIndex(entry))
+            return false;
+
+        mIndex[TileKey(kind, tId)] = entry;
+
+        return true;
+
+    }
+
+    bool MappedTileStore::getTile(TileKind kind, TopoId tId, std::string &data, std::string &pose) {
+
+        unique_lock<mutex> lock(mMutexStore);
+
+        std::map<TileKey, IndexEntry>::iterator mit = mIndex.find(TileKey(kind, tId));
+
+        if (mit == mIndex.end() || !mpMapped)
+            return false;
+
+        // pages not touched since the tile was written are faulted in here
+        data.assign(mpMapped + mit->second.dataOffset, mit->second.dataSize);
+        pose.assign(mpMapped + mit->second.poseOffset, mit->second.poseSize);
+
+        return data.size() > 0;
+
+    }
+
+    bool MappedTileStore::getAllPoses(TileKind kind, std::map<TopoId, std::string> &poses) {
+
+        unique_lock<mutex> lock(mMutexStore);
+
+        if (!mpMapped)
+            return false;
+
+        for (std::map<TileKey, IndexEntry>::iterator mit = mIndex.begin(); mit != mIndex.end(); mit++) {
+            if (mit->first.first == (uint32_t) kind)
+                poses[mit->first.second].assign(mpMapped + mit->second.poseOffset, mit->second.poseSize);
+        }
+
+        return true;
+
+    }
+
+    bool MappedTileStore::updateAllPoses(TileKind kind, const std::map<TopoId, std::string> &poses) {
+
+        unique_lock<mutex> lock(mMutexStore);
+
+        if (!isOpen())
+            return false;
+
+        for (std::map<TopoId, std::string>::const_iterator mit = poses.begin(); mit != poses.end(); mit++) {
+
+            // like the server, only tiles which were saved get their poses replaced
+            std::map<TileKey, IndexEntry>::iterator eit = mIndex.find(TileKey(kind, mit->first));
+
+            if (eit == mIndex.end())
+                continue;
+
+            IndexEntry entry = eit->second;
+            entry.poseSize = mit->second.size();
+            entry.poseCheck = checkOf(mit->second.data(), mit->second.size());
+
+            if (!append(mit->second, entry.poseOffset) || !sync(entry.poseOffset, entry.poseSize))
+                return false;
+
+            entry.check = checkOf(entry);
+
+            if (!appendIndex(entry))
+                return false;
+
+            eit->second = entry;
+        }
+
+        return true;
+
+    }
+
+    SnapshotTileStore::SnapshotTileStore(TileStore *pStore, MapSnapshot *pSnapshot) :
+            mpStore(pStore), mpSnapshot(pSnapshot) {
+    }
+
+    SnapshotTileStore::~SnapshotTileStore() {
+
+        delete mpSnapshot;
+        delete mpStore;
+
+    }
+
+    std::string SnapshotTileStore::name() const {
+
+        return mpStore->name() + " over snapshot " + mpSnapshot->path();
+
+    }
+
+    bool SnapshotTileStore::inSnapshot(TileKind kind, TopoId tId) {
+
+        unique_lock<mutex> lock(mMutexSuperseded);
+        return mpSnapshot->hasTile(tId) && mSuperseded.count(TileKey(kind, tId)) == 0;
+
+    }
+
+    void SnapshotTileStore::supersede(TileKind kind, TopoId tId) {
+
+        unique_lock<mutex> lock(mMutexSuperseded);
+        mSuperseded.insert(TileKey(kind, tId));
+
+    }
+
+    bool SnapshotTileStore::saveTile(TileKind kind, TopoId tId, const std::string &data, const std::string &pose) {
+
+        if (!mpStore->saveTile(kind, tId, data, pose))
+            return false;
+
+        supersede(kind, tId);
+
+        return true;
+
+    }
+
+    bool SnapshotTileStore::getTile(TileKind kind, TopoId tId, std::string &data, std::string &pose) {
+
+        if (inSnapshot(kind, tId)) {
+            // a kind the snapshot does not hold was empty when it was saved
+            if (!mpSnapshot->getTile(kind, tId, data, pose)) {
+                data.clear();
+                pose.clear();
+                return false;
+            }
+            return true;
+        }
+
+        return mpStore->getTile(kind, tId, data, pose);
+
+    }
+
+    bool SnapshotTileStore::getAllPoses(TileKind kind, std::map<TopoId, std::string> &poses) {
+
+        std::map<TopoId, std::string> stored;
+
+        if (!mpStore->getAllPoses(kind, stored))
+            return false;
+
+        mpSnapshot->getAllPoses(kind, poses);
+
+        for (std::map<TopoId, std::string>::iterator mit = poses.begin(); mit != poses.end(); ) {
+            if (!inSnapshot(kind, mit->first))
+                poses.erase(mit++);
+            else
+                mit++;
+        }
+
+        for (std::map<TopoId, std::string>::iterator mit = stored.begin(); mit != stored.end(); mit++)
+            poses[mit->first].swap(mit->second);
+
+        return true;
+
+    }
+
+    bool SnapshotTileStore::movePoses(TileKind kind, const std::map<TopoId, std::string> &poses, std::map<TopoId, std::string> &rest) {
+
+        bool bOK = true;
+
+        for (std::map<TopoId, std::string>::const_iterator mit = poses.begin(); mit != poses.end(); mit++) {
+
+            if (!inSnapshot(kind, mit->first)) {
+                rest.insert(*mit);
+                continue;
+            }
+
+            std::string data, pose;
+
+            // like the other stores, only tiles which were saved get their poses replaced
+            if (!mpSnapshot->getTile(kind, mit->first, data, pose))
+                continue;
+
+            bOK = saveTile(kind, mit->first, data, mit->second) && bOK;
+        }
+
+        return bOK;
+
+    }
+
+    bool SnapshotTileStore::updateAllPoses(TileKind kind, const std::map<TopoId, std::string> &poses) {
+
+        std::map<TopoId, std::string> rest;
+
+        bool bOK = movePoses(kind, poses, rest);
+
+        if (!rest.empty())
+            bOK = mpStore->updateAllPoses(kind, rest) && bOK;
+
+        return bOK;
+
+    }
+
+    bool SnapshotTileStore::updatePoses(const std::map<TopoId, std::string> &kfPoses, const std::map<TopoId, std::string> &mpPoses) {
+
+        std::map<TopoId, std::string> kfRest, mpRest;
+
+        bool bOK = movePoses(TILE_KEYFRAMES, kfPoses, kfRest);
+        bOK = movePoses(TILE_MAPPOINTS, mpPoses, mpRest) && bOK;
+
+        return mpStore->updatePoses(kfRest, mpRest) && bOK;
+
+    }
+
+    bool SnapshotTileStore::saveTiles(const std::vector<TileBlocks> &tiles) {
+
+        if (!mpStore->saveTiles(tiles))
+            return false;
+
+        // an empty payload is not stored, the snapshot copy is out of date all the same
+        for (size_t i = 0; i < tiles.size(); i++) {
+            supersede(TILE_KEYFRAMES, tiles[i].tId);
+            supersede(TILE_MAPPOINTS, tiles[i].tId);
+        }
+
+        return true;
+
+    }
+
+    bool SnapshotTileStore::queryTiles(const TileQuery &query, std::vector<TileBlocks> &tiles) {
+
+        return mpStore->queryTiles(query, tiles);
+
+    }
+
+    bool SnapshotTileStore::getTiles(std::vector<TileBlocks> &tiles) {
+
+        std::vector<TileBlocks> stored;
+        std::vector<size_t> vIndex;
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+
+            const bool bKF = inSnapshot(TILE_KEYFRAMES, tiles[i].tId);
+            const bool bMP = inSnapshot(TILE_MAPPOINTS, tiles[i].tId);
+
+            if (bKF && !mpSnapshot->getTile(TILE_KEYFRAMES, tiles[i].tId, tiles[i].kfData, tiles[i].kfPose)) {
+                tiles[i].kfData.clear();
+                tiles[i].kfPose.clear();
+            }
+
+            if (bMP && !mpSnapshot->getTile(TILE_MAPPOINTS, tiles[i].tId, tiles[i].mpData, tiles[i].mpPose)) {
+                tiles[i].mpData.clear();
+                tiles[i].mpPose.clear();
+            }
+
+            if (!bKF || !bMP) {
+                stored.push_back(TileBlocks());
+                stored.back().tId = tiles[i].tId;
+                vIndex.push_back(i);
+            }
+        }
+
+        // the tiles written since the load go to the store in one batch
+        if (!stored.empty() && !mpStore->getTiles(stored))
+            return false;
+
+        for (size_t j = 0; j < stored.size(); j++) {
+
+            TileBlocks &tile = tiles[vIndex[j]];
+
+            if (!inSnapshot(TILE_KEYFRAMES, tile.tId)) {
+                tile.kfData.swap(stored[j].kfData);
+                tile.kfPose.swap(stored[j].kfPose);
+            }
+
+            if (!inSnapshot(TILE_MAPPOINTS, tile.tId)) {
+                tile.mpData.swap(stored[j].mpData);
+                tile.mpPose.swap(stored[j].mpPose);
+            }
+        }
+
+        return true;
+
+    }
+
+    ShardedTileStore::ShardedTileStore(const std::vector<TileStore *> &vpShards, TopoId range) :
+            mvpShards(vpShards), mRange(range) {
+    }
+
+    ShardedTileStore::~ShardedTileStore() {
+
+        for (size_t s = 0; s < mvpShards.size(); s++)
+            delete mvpShards[s];
+
+    }
+
+    size_t ShardedTileStore::shardOf(TopoId tId) const {
+
+        if (mRange > 0)
+            return (tId / mRange) % mvpShards.size();
+
+        // neighbouring tiles differ in a few low bits of each coordinate, mix them before the modulo
+        uint64_t h = tId;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        h = h ^ (h >> 31);
+
+        return h % mvpShards.size();
+
+    }
+
+    std::string ShardedTileStore::name() const {
+
+        std::ostringstream os;
+        os << mvpShards.size() << " shards (" << (mRange > 0 ? "range" : "hash") << ")";
+        for (size_t s = 0; s < mvpShards.size(); s++)
+            os << (s ? ", " : ": ") << mvpShards[s]->name();
+
+        return os.str();
+
+    }
+
+    bool ShardedTileStore::forShards(const std::vector<char> &bUsed, const std::function<bool(size_t)> &job) {
+
+        std::vector<size_t> vShards;
+        for (size_t s = 0; s < bUsed.size(); s++)
+            if (bUsed[s])
+                vShards.push_back(s);
+
+        if (vShards.size() == 1)
+            return job(vShards[0]);
+
+        std::vector<char> vbOK(vShards.size(), 0);
+        std::vector<std::thread> vThreads;
+
+        for (size_t i = 0; i < vShards.size(); i++)
+            vThreads.push_back(std::thread([&job, &vShards, &vbOK, i]() { vbOK[i] = job(vShards[i]); }));
+
+        for (size_t i = 0; i < vThreads.size(); i++)
+            vThreads[i].join();
+
+        return std::find(vbOK.begin(), vbOK.end(), 0) == vbOK.end();
+
+    }
+
+    bool ShardedTileStore::saveTile(TileKind kind, TopoId tId, const std::string &data, const std::string &pose) {
+
+        return mvpShards[shardOf(tId)]->saveTile(kind, tId, data, pose);
+
+    }
+
+    bool ShardedTileStore::getTile(TileKind kind, TopoId tId, std::string &data, std::string &pose) {
+
+        return mvpShards[shardOf(tId)]->getTile(kind, tId, data, pose);
+
+    }
+
+    bool ShardedTileStore::getAllPoses(TileKind kind, std::map<TopoId, std::string> &poses) {
+
+        std::vector<std::map<TopoId, std::string> > vPoses(mvpShards.size());
+
+        bool bOK = forShards(std::vector<char>(mvpShards.size(), 1), [&](size_t s) {
+            return mvpShards[s]->getAllPoses(kind, vPoses[s]);
+        });
+
+        for (size_t s = 0; s < vPoses.size(); s++)
+            poses.insert(vPoses[s].begin(), vPoses[s].end());
+
+        return bOK;
+
+    }
+
+    bool ShardedTileStore::updateAllPoses(TileKind kind, const std::map<TopoId, std::string> &poses) {
+
+        std::vector<std::map<TopoId, std::string> > vPoses(mvpShards.size());
+        std::vector<char> bUsed(mvpShards.size(), 0);
+
+        for (std::map<TopoId, std::string>::const_iterator mit = poses.begin(); mit != poses.end(); mit++) {
+            const size_t s = shardOf(mit->first);
+            vPoses[s].insert(*mit);
+            bUsed[s] = 1;
+        }
+
+        return forShards(bUsed, [&](size_t s) { return mvpShards[s]->updateAllPoses(kind, vPoses[s]); });
+
+    }
+
+    bool ShardedTileStore::updatePoses(const std::map<TopoId, std::string> &kfPoses, const std::map<TopoId, std::string> &mpPoses) {
+
+        std::vector<std::map<TopoId, std::string> > vKFPoses(mvpShards.size()), vMPPoses(mvpShards.size());
+        std::vector<char> bUsed(mvpShards.size(), 0);
+
+        for (std::map<TopoId, std::string>::const_iterator mit = kfPoses.begin(); mit != kfPoses.end(); mit++) {
+            const size_t s = shardOf(mit->first);
+            vKFPoses[s].insert(*mit);
+            bUsed[s] = 1;
+        }
+
+        for (std::map<TopoId, std::string>::const_iterator mit = mpPoses.begin(); mit != mpPoses.end(); mit++) {
+            const size_t s = shardOf(mit->first);
+            vMPPoses[s].insert(*mit);
+            bUsed[s] = 1;
+        }
+
+        return forShards(bUsed, [&](size_t s) { return mvpShards[s]->updatePoses(vKFPoses[s], vMPPoses[s]); });
+
+    }
+
+    bool ShardedTileStore::saveTiles(const std::vector<TileBlocks> &tiles) {
+
+        std::vector<std::vector<TileBlocks> > vTiles(mvpShards.size());
+        std::vector<char> bUsed(mvpShards.size(), 0);
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+            const size_t s = shardOf(tiles[i].tId);
+            vTiles[s].push_back(tiles[i]);
+            bUsed[s] = 1;
+        }
+
+        return forShards(bUsed, [&](size_t s) { return mvpShards[s]->saveTiles(vTiles[s]); });
+
+    }
+
+    bool ShardedTileStore::getTiles(std::vector<TileBlocks> &tiles) {
+
+        std::vector<std::vector<TileBlocks> > vTiles(mvpShards.size());
+        std::vector<std::vector<size_t> > vIndex(mvpShards.size());
+        std::vector<char> bUsed(mvpShards.size(), 0);
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+            const size_t s = shardOf(tiles[i].tId);
+            TileBlocks tile;
+            tile.tId = tiles[i].tId;
+            vTiles[s].push_back(tile);
+            vIndex[s].push_back(i);
+            bUsed[s] = 1;
+        }
+
+        if (!forShards(bUsed, [&](size_t s) { return mvpShards[s]->getTiles(vTiles[s]); }))
+            return false;
+
+        for (size_t s = 0; s < vTiles.size(); s++) {
+            for (size_t j = 0; j < vTiles[s].size(); j++) {
+                TileBlocks &tile = tiles[vIndex[s][j]];
+                tile.kfPose.swap(vTiles[s][j].kfPose);
+                tile.kfData.swap(vTiles[s][j].kfData);
+                tile.mpPose.swap(vTiles[s][j].mpPose);
+                tile.mpData.swap(vTiles[s][j].mpData);
+            }
+        }
+
+        return true;
+
+    }
+
+    bool ShardedTileStore::queryTiles(const TileQuery &query, std::vector<TileBlocks> &tiles) {
+
+        std::vector<std::vector<TileBlocks> > vTiles(mvpShards.size());
+
+        // each shard answers its own nearest maxTiles, the merge keeps the nearest of them
+        if (!forShards(std::vector<char>(mvpShards.size(), 1),
+                       [&](size_t s) { return mvpShards[s]->queryTiles(query, vTiles[s]); }))
+            return false;
+
+        tiles.clear();
+
+        for (size_t s = 0; s < vTiles.size(); s++)
+            for (size_t j = 0; j < vTiles[s].size(); j++)
+                tiles.push_back(std::move(vTiles[s][j]));
+
+        std::stable_sort(tiles.begin(), tiles.end(),
+                         [](const TileBlocks &a, const TileBlocks &b) { return a.distance < b.distance; });
+
+        if (query.maxTiles > 0 && tiles.size() > query.maxTiles)
+            tiles.resize(query.maxTiles);
+
+        return true;
+
+    }
+
+} //namespace ORB_SLAM
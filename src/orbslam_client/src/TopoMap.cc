@@ -3,19 +3,57 @@
 //
 
 #include "TopoMap.h"
+#include "MapMemory.h"
 #include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <stdint.h>
 using namespace std;
 
 namespace ORB_SLAM2 {
 
-    ToPoIdGenetator::ToPoIdGenetator(int MaxArea, int Lmin, int Lmax ): mMaxArea( MaxArea ), mLmin( Lmin ), mLmax( Lmax ) {
+    // bits of each axis in a TopoId, the level of the cell is in the bits above
+    static const int MORTON_BITS = 20;
+    static const int LEVEL_SHIFT = 3 * MORTON_BITS;
+    static const uint64_t CELL_MASK = ( 1ull << LEVEL_SHIFT ) - 1;
 
-        int tmp = ( MaxArea / Lmax ) * 2;
-        codebits = 0;
-        while( tmp > 0 ) {
-            tmp = tmp / 2;
-            codebits ++ ;
-        }
+    // insert two zero bits after each of the low 20 bits
+    static uint64_t spreadBits( uint64_t v ) {
+
+        v &= ( 1ull << MORTON_BITS ) - 1;
+        v = ( v | v << 32 ) & 0x1f00000000ffffull;
+        v = ( v | v << 16 ) & 0x1f0000ff0000ffull;
+        v = ( v | v << 8 ) & 0x100f00f00f00f00full;
+        v = ( v | v << 4 ) & 0x10c30c30c30c30c3ull;
+        v = ( v | v << 2 ) & 0x1249249249249249ull;
+
+        return v;
+
+    }
+
+    static uint64_t compactBits( uint64_t v ) {
+
+        v &= 0x1249249249249249ull;
+        v = ( v ^ ( v >> 2 ) ) & 0x10c30c30c30c30c3ull;
+        v = ( v ^ ( v >> 4 ) ) & 0x100f00f00f00f00full;
+        v = ( v ^ ( v >> 8 ) ) & 0x1f0000ff0000ffull;
+        v = ( v ^ ( v >> 16 ) ) & 0x1f00000000ffffull;
+        v = ( v ^ ( v >> 32 ) ) & ( ( 1ull << MORTON_BITS ) - 1 );
+
+        return v;
+
+    }
+
+    ToPoIdGenetator::ToPoIdGenetator(int MaxArea, int Lmin, int Lmax ): mVerticalRadius( 1 ), mMaxArea( MaxArea ), mLmin( Lmin ), mLmax( Lmax ) {
+
+        // each level halves the cells, down to Lmin
+        mnMaxLevel = 0;
+        while( Lmin > 0 && mnMaxLevel < 15 && ( Lmax >> ( mnMaxLevel + 1 ) ) >= Lmin )
+            mnMaxLevel++;
+
+        if( ( ( 2 * (long) MaxArea ) / Lmax + 2 ) << mnMaxLevel >= ( 1l << MORTON_BITS ) )
+            cerr << "MaxArea " << MaxArea << " spans more tiles than a TopoId addresses" << endl;
 
     }
 
@@ -23,11 +61,22 @@ namespace ORB_SLAM2 {
 
         TopoId ans = 0;
 
-        long unsigned int x = (long unsigned int) (( mMaxArea + p3d.x )/ mLmax + 1 );
-        long unsigned int y = (long unsigned int) (( mMaxArea + p3d.y )/ mLmax + 1 );
-        long unsigned int z = (long unsigned int) (( mMaxArea + p3d.z )/ mLmax + 1 );
+        unique_lock<mutex> lock( mMutexSplit );
+
+        // descend while the cell is split
+        for( int level = 0; level <= mnMaxLevel; level++ ) {
+
+            const double size = (double) mLmax / ( 1 << level );
+
+            long unsigned int x = (long unsigned int) (( mMaxArea + p3d.x )/ size + 1 );
+            long unsigned int y = (long unsigned int) (( mMaxArea + p3d.y )/ size + 1 );
+            long unsigned int z = (long unsigned int) (( mMaxArea + p3d.z )/ size + 1 );
 
-        ans =  this->generateId( x, y, z );
+            ans = this->generateId( level, x, y, z );
+
+            if( mSplit.count( ans ) == 0 )
+                break;
+        }
 
 //        cout << "KeyFrame x : " << p3d.x << " y : " << p3d.y << " z : " << p3d.z << " the code is " << ans <<  endl;
 
@@ -37,31 +86,155 @@ namespace ORB_SLAM2 {
 
     TopoId ToPoIdGenetator::generateId( long unsigned int x, long unsigned int y, long unsigned int z ){
 
-        long unsigned int id = ( x << codebits ) + z;
+        return generateId( 0, x, y, z );
+
+    }
+
+    TopoId ToPoIdGenetator::generateId( int level, long unsigned int x, long unsigned int y, long unsigned int z ){
 
-        return id;
+        return ( (uint64_t) level << LEVEL_SHIFT ) | spreadBits( x ) | ( spreadBits( y ) << 1 ) | ( spreadBits( z ) << 2 );
+
+    }
+
+    void ToPoIdGenetator::decodeId( TopoId tId, long unsigned int &x, long unsigned int &y, long unsigned int &z ){
+
+        x = compactBits( tId & CELL_MASK );
+        y = compactBits( ( tId & CELL_MASK ) >> 1 );
+        z = compactBits( ( tId & CELL_MASK ) >> 2 );
+
+    }
+
+    int ToPoIdGenetator::levelOf( TopoId tId ) {
+
+        return (int) ( tId >> LEVEL_SHIFT );
+
+    }
+
+    TopoId ToPoIdGenetator::parentOf( TopoId tId ) {
+
+        const int level = levelOf( tId );
+
+        if( level == 0 )
+            return tId;
+
+        long unsigned int x, y, z;
+        decodeId( tId, x, y, z );
+
+        return generateId( level - 1, ( x - 1 ) / 2 + 1, ( y - 1 ) / 2 + 1, ( z - 1 ) / 2 + 1 );
+
+    }
+
+    std::vector<TopoId> ToPoIdGenetator::childrenOf( TopoId tId ) {
+
+        std::vector<TopoId> children;
+
+        const int level = levelOf( tId );
+
+        if( level >= mnMaxLevel )
+            return children;
+
+        long unsigned int x, y, z;
+        decodeId( tId, x, y, z );
+
+        for( int b = 0; b < 8; b++ )
+            children.push_back( generateId( level + 1, 2 * x - 1 + ( b & 1 ), 2 * y - 1 + ( ( b >> 1 ) & 1 ), 2 * z - 1 + ( ( b >> 2 ) & 1 ) ) );
+
+        return children;
+
+    }
+
+    void ToPoIdGenetator::setSplit( TopoId tId, bool bSplit ) {
+
+        unique_lock<mutex> lock( mMutexSplit );
+
+        if( bSplit )
+            mSplit.insert( tId );
+        else
+            mSplit.erase( tId );
+
+    }
+
+    bool ToPoIdGenetator::isSplit( TopoId tId ) {
+
+        unique_lock<mutex> lock( mMutexSplit );
+
+        return mSplit.count( tId ) > 0;
+
+    }
+
+    void ToPoIdGenetator::noteTile( TopoId tId ) {
+
+        unique_lock<mutex> lock( mMutexSplit );
+
+        while( levelOf( tId ) > 0 ) {
+            tId = parentOf( tId );
+            mSplit.insert( tId );
+        }
+
+    }
+
+    void ToPoIdGenetator::addLeaves( TopoId tId, std::set<TopoId> &leaves ) {
+
+        if( mSplit.count( tId ) == 0 ) {
+            leaves.insert( tId );
+            return;
+        }
+
+        std::vector<TopoId> children = childrenOf( tId );
+        for( size_t i = 0; i < children.size(); i++ )
+            addLeaves( children[i], leaves );
 
     }
 
     // this is the algorithm of keep what topomap in cache
-    std::set< TopoId > ToPoIdGenetator::generateOctIds( TopoId tId ) {
+    std::set< TopoId > ToPoIdGenetator::generateOctIds( TopoId tId, int radius ) {
 
-        long unsigned int x = ( tId >> codebits );
-        long unsigned int y = 0;
-        long unsigned int z = ( tId % ( 1 << codebits ) ) ;
+        // the window is counted in cells of the first level, whatever the level of tId
+        const int level = levelOf( tId );
+
+        long unsigned int x, y, z;
+        decodeId( tId, x, y, z );
+
+        x = ( ( x - 1 ) >> level ) + 1;
+        y = ( ( y - 1 ) >> level ) + 1;
+        z = ( ( z - 1 ) >> level ) + 1;
+
+        const int vertical = std::min( radius, mVerticalRadius );
 
         std::set<TopoId > OctIds;
 
-        for( int i = -5; i <= 5; i++ ) {
-            for( int j = -5; j <= 5; j++ ) {
-                TopoId tmp = this->generateId( x + i, y , z + j );
-                OctIds.insert( tmp );
+        unique_lock<mutex> lock( mMutexSplit );
+
+        for( int i = -radius; i <= radius; i++ ) {
+            for( int k = -vertical; k <= vertical; k++ ) {
+                for( int j = -radius; j <= radius; j++ ) {
+                    TopoId tmp = this->generateId( x + i, y + k, z + j );
+                    addLeaves( tmp, OctIds );
+                }
             }
         }
 
         return OctIds;
     }
 
+    int ToPoIdGenetator::tileDistance( TopoId a, TopoId b ) {
+
+        long unsigned int ax, ay, az, bx, by, bz;
+        decodeId( a, ax, ay, az );
+        decodeId( b, bx, by, bz );
+
+        // between the centres of the cells, in cells of the first level
+        const double sa = 1.0 / ( 1 << levelOf( a ) );
+        const double sb = 1.0 / ( 1 << levelOf( b ) );
+
+        double dx = ( ax - 0.5 ) * sa - ( bx - 0.5 ) * sb;
+        double dy = ( ay - 0.5 ) * sa - ( by - 0.5 ) * sb;
+        double dz = ( az - 0.5 ) * sa - ( bz - 0.5 ) * sb;
+
+        return (int) std::floor( std::max( std::fabs( dx ), std::max( std::fabs( dy ), std::fabs( dz ) ) ) + 0.5 );
+
+    }
+
     TopoMap::TopoMap(Cache *pCache, int MaxArea, int Lmin, int Lmax) {
 
         this->mpCache = pCache;
@@ -107,6 +280,9 @@ namespace ORB_SLAM2 {
 
             mpTopoKFs[topoKFid].insert(pkf->mnId);
 
+            markTopoIdDirty(oldtopoKFid);
+            markTopoIdDirty(topoKFid);
+
             pkf->mTopoId = topoKFid;
 
         }
@@ -120,6 +296,8 @@ namespace ORB_SLAM2 {
 
         mpTopoKFs[mtpId].erase(pkf->mnId);
 
+        markTopoIdDirty(mtpId);
+
         if( KF2TopoId.find( pkf->mnId) != KF2TopoId.end() )
             KF2TopoId.erase( pkf->mnId );
 
@@ -154,7 +332,8 @@ namespace ORB_SLAM2 {
     void TopoMap::addMapPoint(MapPoint * mp, TopoId tid) {
 
         unique_lock<mutex> lock( mpTopoMpsMutex );
-        mpTopoMps[ tid ].insert( mp->mnId );
+        if( mpTopoMps[ tid ].insert( mp->mnId ).second )
+            markTopoIdDirty( tid );
 
     }
 
@@ -163,8 +342,10 @@ namespace ORB_SLAM2 {
         unique_lock<mutex> lock( mpTopoMpsMutex );
         for ( std::map< TopoId, std::set<long unsigned int > >::iterator mit = mpTopoMps.begin();
                 mit != mpTopoMps.end(); mit ++ ) {
-            if( (*mit).second.count( mpid ) > 0 )
+            if( (*mit).second.count( mpid ) > 0 ) {
                 (*mit).second.erase( mpid );
+                markTopoIdDirty( (*mit).first );
+            }
         }
 
     }
@@ -185,6 +366,92 @@ namespace ORB_SLAM2 {
 
     }
 
+    void TopoMap::restoreKeyFrame( long unsigned int kf, TopoId tpId ) {
+
+        // a keyframe journaled in another tile than the stored one has moved
+        std::map<long unsigned int, TopoId>::iterator mit = KF2TopoId.find( kf );
+        if( mit != KF2TopoId.end() && (*mit).second != tpId )
+            mpTopoKFs[ (*mit).second ].erase( kf );
+
+        mpTopoKFs[ tpId ].insert( kf );
+        KF2TopoId[ kf ] = tpId;
+
+        mTopoIdGen->noteTile( tpId );
+
+    }
+
+    void TopoMap::restoreMapPoint( long unsigned int mpid, TopoId tpId ) {
+
+        unique_lock<mutex> lock( mpTopoMpsMutex );
+        mpTopoMps[ tpId ].insert( mpid );
+
+    }
+
+    int TopoMap::getTileLevel( TopoId tpId ) {
+
+        return mTopoIdGen->levelOf( tpId );
+
+    }
+
+    int TopoMap::getMaxTileLevel() {
+
+        return mTopoIdGen->maxLevel();
+
+    }
+
+    TopoId TopoMap::getParentTile( TopoId tpId ) {
+
+        return mTopoIdGen->parentOf( tpId );
+
+    }
+
+    std::vector<TopoId> TopoMap::getChildTiles( TopoId tpId ) {
+
+        return mTopoIdGen->childrenOf( tpId );
+
+    }
+
+    bool TopoMap::isTileSplit( TopoId tpId ) {
+
+        return mTopoIdGen->isSplit( tpId );
+
+    }
+
+    void TopoMap::setTileSplit( TopoId tpId, bool bSplit ) {
+
+        mTopoIdGen->setSplit( tpId, bSplit );
+
+    }
+
+    void TopoMap::noteTileId( TopoId tpId ) {
+
+        mTopoIdGen->noteTile( tpId );
+
+    }
+
+    void TopoMap::eraseMapPointFromTile( long unsigned int mpid, TopoId tpId ) {
+
+        unique_lock<mutex> lock( mpTopoMpsMutex );
+        std::map< TopoId, std::set<long unsigned int > >::iterator mit = mpTopoMps.find( tpId );
+        if( mit != mpTopoMps.end() && (*mit).second.erase( mpid ) > 0 )
+            markTopoIdDirty( tpId );
+
+    }
+
+    void TopoMap::markTopoIdDirty( TopoId tpId ) {
+
+        unique_lock<mutex> lock( mDirtyTopoIdsMutex );
+        mDirtyTopoIds.insert( tpId );
+
+    }
+
+    bool TopoMap::takeTopoIdDirty( TopoId tpId ) {
+
+        unique_lock<mutex> lock( mDirtyTopoIdsMutex );
+        return mDirtyTopoIds.erase( tpId ) > 0;
+
+    }
+
     //this is the strategy of the keep the TopoMap in the cache
     //this stategy associated with the code
     std::set<TopoId> TopoMap::getTopoMapsNeedInCache( TopoId tpId ){
@@ -193,6 +460,24 @@ namespace ORB_SLAM2 {
 
     }
 
+    std::set<TopoId> TopoMap::getTopoMapsInRange( TopoId tpId, int radius ){
+
+        return mTopoIdGen->generateOctIds( tpId, radius );
+
+    }
+
+    int TopoMap::getTileDistance( TopoId a, TopoId b ){
+
+        return mTopoIdGen->tileDistance( a, b );
+
+    }
+
+    void TopoMap::setVerticalRadius( int radius ){
+
+        mTopoIdGen->mVerticalRadius = radius;
+
+    }
+
     // add or update the edge from kf1 to kf2 on the weight in the graph
 
     void TopoMap::addKeyFrameObservations( long unsigned int kf1, long unsigned int kf2, const int weight ){
@@ -289,6 +574,9 @@ namespace ORB_SLAM2 {
 
         std::map<long unsigned int, std::vector< pair <long unsigned int, int > > >::iterator kfiter = this->KFgraph.find( kf );
 
+        if( kfiter == KFgraph.end() )
+            return tCovisibleKFs;
+
         for(std::vector<pair <long unsigned int, int > >::iterator mit = kfiter->second.begin() ; mit != kfiter->second.end(); mit ++  ) {
 
             tCovisibleKFs.push_back( (*mit).first );
@@ -466,6 +754,45 @@ namespace ORB_SLAM2 {
         return tloop;
     }
 
+    // heap bytes of a map of matrices, of vectors or of bow vectors, with the values
+    template<class K, class V>
+    static size_t deepBytes( const std::map<K, V> &m ) {
+
+        size_t bytes = heapBytes( m );
+        for( typename std::map<K, V>::const_iterator mit = m.begin(); mit != m.end(); mit++ )
+            bytes += heapBytes( (*mit).second );
+        return bytes;
+
+    }
+
+    void TopoMap::memoryBytes( std::map<std::string, size_t> &structures ) {
+
+        structures["DBowMap"] = deepBytes( DBowMap );
+
+        structures["KFgraph"] = deepBytes( KFgraph );
+
+        structures["mpKfPose"] = deepBytes( mpKfPose ) + deepBytes( mpKfPoseStored ) + deepBytes( mpKfTcwGBA ) +
+                                 deepBytes( mpKfTcwBefGBA );
+
+        structures["mpMpPose"] = deepBytes( mpMpPose ) + deepBytes( mpMpPoseStored );
+
+        structures["mpMpObservations"] = deepBytes( mpMpObservations );
+
+        // the tiles, the spanning tree and the bookkeeping of the corrections
+        size_t index = heapBytes( KF2TopoId ) + heapBytes( KFParent ) + heapBytes( mpRefKf ) +
+                       heapBytes( mpKfBAGlobalForKF ) + heapBytes( mpMpBAGlobalForKF );
+
+        index += deepBytes( mpTopoKFs ) + deepBytes( KFLoopEdges ) + deepBytes( mpKFchilds );
+
+        {
+            unique_lock<mutex> lock( mpTopoMpsMutex );
+            index += deepBytes( mpTopoMps );
+        }
+
+        structures["TopoMap index"] = index;
+
+    }
+
     void TopoMap::updateAllPose(){
 
 //        for( std::map<long unsigned int, cv::Mat>::iterator mit = mpKfPose.begin();
@@ -32,6 +32,7 @@
 
 #include"Optimizer.h"
 #include"PnPsolver.h"
+#include"EpochManager.h"
 
 #include<iostream>
 
@@ -45,7 +46,7 @@ namespace ORB_SLAM2
 
 Tracking::Tracking(System *pSys, Cache* pCacher, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, const string &strSettingPath, const int sensor):
     mState(NO_IMAGES_YET), mSensor(sensor), mbOnlyTracking(false), mbVO(false), mpCacher( pCacher) , mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys),
-    mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mnLastRelocFrameId(0)
+    mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mnLastRelocFrameId(0), mbNeighbourhoodLoaded(false)
 {
     // Load camera parameters from settings file
 
@@ -278,6 +279,19 @@ void Tracking::Track()
         usleep( 3000 );
     }
 
+    // lost: the relocalization candidates may be in tiles evicted around the last pose, they are brought in
+    // once, before the map is locked for the frame
+    if(mState==LOST && !mbNeighbourhoodLoaded && mpCacher->mfRelocRadius > 0)
+    {
+        mpCacher->LoadNeighbourhood(mpCacher->getCameraCenter(), mpCacher->mfRelocRadius);
+        mbNeighbourhoodLoaded = true;
+    }
+    else if(mState==OK)
+        mbNeighbourhoodLoaded = false;
+
+    // the keyframes and mappoints got from the cache are not freed before the frame is tracked
+    EpochGuard guard;
+
     if(mState==NO_IMAGES_YET)
     {
         mState = NOT_INITIALIZED;
@@ -447,6 +461,9 @@ void Tracking::Track()
             else
                 mVelocity = cv::Mat();
 
+            // the cache predicts the tiles needed next from the motion model
+            mpCacher->updateMotion(mCurrentFrame.mTcw, mVelocity, mCurrentFrame.mTimeStamp);
+
             mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
 
             // Clean VO matches
@@ -509,7 +526,7 @@ void Tracking::Track()
     {
         cv::Mat Tcr = mCurrentFrame.mTcw*mCurrentFrame.mpReferenceKF->GetPoseInverse();
         mlRelativeFramePoses.push_back(Tcr);
-        mlpReferences.push_back(mpReferenceKF);
+        mlpReferences.push_back(LightKeyFrame(mpReferenceKF));
         mlFrameTimes.push_back(mCurrentFrame.mTimeStamp);
         mlbLost.push_back(mState==LOST);
     }
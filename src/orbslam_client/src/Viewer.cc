@@ -20,6 +20,7 @@
 
 #include "Viewer.h"
 #include <pangolin/pangolin.h>
+#include "EpochManager.h"
 
 #include <mutex>
 
@@ -129,14 +130,19 @@ void Viewer::Run()
 
         d_cam.Activate(s_cam);
         glClearColor(1.0f,1.0f,1.0f,1.0f);
-        mpMapDrawer->DrawCurrentCamera(Twc);
-        if(menuShowKeyFrames || menuShowGraph)
-            mpMapDrawer->DrawKeyFrames(menuShowKeyFrames,menuShowGraph);
-        if(menuShowPoints)
-            mpMapDrawer->DrawMapPoints();
-
-        if(menuTopoMapline)
-            mpMapDrawer->DrawTopoMapline( mMaxArea, mLmax, mLmin );
+        {
+            // the keyframes and mappoints drawn are not freed meanwhile
+            EpochGuard guard;
+
+            mpMapDrawer->DrawCurrentCamera(Twc);
+            if(menuShowKeyFrames || menuShowGraph)
+                mpMapDrawer->DrawKeyFrames(menuShowKeyFrames,menuShowGraph);
+            if(menuShowPoints)
+                mpMapDrawer->DrawMapPoints();
+
+            if(menuTopoMapline)
+                mpMapDrawer->DrawTopoMapline( mMaxArea, mLmax, mLmin );
+        }
 
         pangolin::FinishFrame();
 
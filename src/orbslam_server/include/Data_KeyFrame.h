@@ -29,7 +29,7 @@ public:
 
     }
 
-    Data_KeyFrame(long unsigned int kfid ,std::string pose, std::string  data) {
+    Data_KeyFrame(long unsigned int kfid ,const std::vector<unsigned char> &pose, const std::vector<unsigned char> &data) {
 
         kfid_ = kfid;
         Data_KeyFrame::pose_ = pose;
@@ -57,19 +57,19 @@ public:
     }
 
 
-    const string &getData_() const {
+    const std::vector<unsigned char> &getData_() const {
         return data_;
     }
 
-    void setData_(const string &data_) {
+    void setData_(const std::vector<unsigned char> &data_) {
         Data_KeyFrame::data_ = data_;
     }
 
-    const string &getPose_() const {
+    const std::vector<unsigned char> &getPose_() const {
         return pose_;
     }
 
-    void setPose_(const string &pose_) {
+    void setPose_(const std::vector<unsigned char> &pose_) {
         Data_KeyFrame::pose_ = pose_;
     }
 
@@ -79,11 +79,16 @@ private:
 #pragma db id auto
     unsigned long id_;
 
+    // unique index, the logical id is the upsert and lookup key
+#pragma db unique
     long unsigned int kfid_;
 
-    std::string pose_;
+    // raw bytes, BYTEA columns
+#pragma db type("BYTEA")
+    std::vector<unsigned char> pose_;
 
-    std::string data_;
+#pragma db type("BYTEA")
+    std::vector<unsigned char> data_;
 
 };
 
@@ -31,7 +31,7 @@ public:
 
     }
 
-    Data_TopoMapPoint(long unsigned int Topoid ,std::string pose, std::string data) {
+    Data_TopoMapPoint(long unsigned int Topoid ,const std::vector<unsigned char> &pose, const std::vector<unsigned char> &data) {
 
         topoId_ = Topoid;
         Data_TopoMapPoint::pose_ = pose;
@@ -60,18 +60,18 @@ public:
         Data_TopoMapPoint::topoId_ = topoId_;
     }
 
-    void setData_(const std::string &data_) {
+    void setData_(const std::vector<unsigned char> &data_) {
         Data_TopoMapPoint::data_ = data_;
     }
-    std::string getData_() const {
+    const std::vector<unsigned char> &getData_() const {
         return data_;
     }
 
-    const string &getPose_() const {
+    const std::vector<unsigned char> &getPose_() const {
         return pose_;
     }
 
-    void setPose_(const string &pose_) {
+    void setPose_(const std::vector<unsigned char> &pose_) {
         Data_TopoMapPoint::pose_ = pose_;
     }
 
@@ -81,11 +81,16 @@ private:
 #pragma db id auto
     unsigned long id_;
 
+    // unique index, the logical id is the upsert and lookup key
+#pragma db unique
     long unsigned int topoId_;
 
-    std::string pose_;
+    // raw bytes, BYTEA columns
+#pragma db type("BYTEA")
+    std::vector<unsigned char> pose_;
 
-    std::string data_;
+#pragma db type("BYTEA")
+    std::vector<unsigned char> data_;
 
 };
 
@@ -0,0 +1,54 @@
+#ifndef PROJECT_PGSTATEMENTS_H
+#define PROJECT_PGSTATEMENTS_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+/*
+ * Prepared statements on the logical ids of the data tables (topoId, kfid, mpid), which carry a unique
+ * index since sql/001_unique_logical_ids.sql. Writes are native upserts (INSERT ... ON CONFLICT, PostgreSQL
+ * 9.5 or later) instead of a query followed by update or persist.
+ *
+ * All the functions run on the connection of the current odb transaction and must be called inside one.
+ * They throw odb::pgsql::database_exception on a database error.
+ *
+ * pose and data are BYTEA columns, exchanged in the binary protocol format without escaping.
+ */
+
+typedef std::vector<unsigned char> PgBlob;
+
+enum PgTable {
+    PG_KEYFRAME = 0,
+    PG_MAPPOINT = 1,
+    PG_TOPO_KEYFRAME = 2,
+    PG_TOPO_MAPPOINT = 3
+};
+
+// insert or replace the row with the logical id, returns the row id
+unsigned long pgUpsertById(PgTable table, unsigned long id, const PgBlob &pose, const PgBlob &data);
+
+// false when there is no row with the logical id
+bool pgSelectById(PgTable table, unsigned long id, PgBlob &pose, PgBlob &data);
+
+// replace the pose of an existing row, false when there is none
+bool pgUpdatePoseById(PgTable table, unsigned long id, const PgBlob &pose);
+
+/*
+ * Spatial extents of the tile tables (PG_TOPO_KEYFRAME, PG_TOPO_MAPPOINT), a PostGIS column added by
+ * sql/003_tile_extents.sql. A box is min x, y, z then max x, y, z. The statements are prepared the first
+ * time they are used, a database without the column only fails these calls.
+ */
+
+// whether the extent columns exist
+bool pgHasTileExtents();
+
+// set the extent of an existing row, false when there is none
+bool pgUpdateExtentById(PgTable table, unsigned long id, const double *extent);
+
+// the tiles of both tables whose extent intersects box and lies within radius of center (radius <= 0: any
+// distance), with their distance to center, nearest first. limit 0 returns them all
+void pgSelectTilesNear(const double *box, const double *center, double radius, unsigned int limit,
+                       std::vector<std::pair<unsigned long, double> > &tiles);
+
+#endif //PROJECT_PGSTATEMENTS_H
@@ -0,0 +1,54 @@
+#ifndef PROJECT_SERVICESTATS_H
+#define PROJECT_SERVICESTATS_H
+
+#include <string>
+#include <map>
+#include <mutex>
+
+#include "ros/ros.h"
+#include "ros/callback_queue.h"
+
+/*
+ * Per service latency of orbslam_server. The queue stamps every callback when it is added, ServiceTimer
+ * (the first statement of each handler) reads that stamp on the worker thread to get the time the request
+ * waited for a worker, and measures the handler itself.
+ */
+
+class TimedCallbackQueue : public ros::CallbackQueue {
+
+public:
+
+    virtual void addCallback(const ros::CallbackInterfacePtr &callback, uint64_t owner_id = 0);
+
+};
+
+class ServiceTimer {
+
+public:
+
+    ServiceTimer(const char *service);
+
+    ~ServiceTimer();
+
+private:
+
+    const char *mService;
+
+    double mQueued;
+
+    ros::WallTime mStart;
+
+};
+
+struct ServiceLatency {
+    unsigned long calls;
+    double queueSum;
+    double queueMax;
+    double serviceSum;
+    double serviceMax;
+};
+
+// log the latencies gathered since the last report, then start over
+void reportServiceStats();
+
+#endif //PROJECT_SERVICESTATS_H
@@ -0,0 +1,90 @@
+#ifndef PROJECT_TILECACHE_H
+#define PROJECT_TILECACHE_H
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <utility>
+
+#include "PgStatements.h"
+
+/*
+ * TileCache keeps the payloads of the tiles read or written lately (PG_TOPO_KEYFRAME, PG_TOPO_MAPPOINT rows),
+ * so a tile the client asks again within seconds is answered without a query. It is write through: the
+ * handlers write the database first and update the cache once their transaction committed.
+ *
+ * The entries are kept in LRU order within a byte budget. A worker which missed reads the row and fills
+ * the entry with the ticket taken before its transaction, the fill is dropped when a write or an
+ * invalidation happened meanwhile, so a row read before a concurrent write never hides that write.
+ */
+
+class TileCache {
+
+public:
+
+    TileCache();
+
+    // 0 disables the cache
+    void setBudget(size_t nBytes);
+
+    // copy the payloads out, false on a miss
+    bool get(PgTable table, unsigned long id, PgBlob &pose, PgBlob &data);
+
+    // taken before reading the database on a miss
+    unsigned long ticket();
+
+    // store what was read with ticket, unless a write happened since
+    void fill(PgTable table, unsigned long id, const PgBlob &pose, const PgBlob &data, unsigned long ticket);
+
+    // after the write of the row was committed
+    void put(PgTable table, unsigned long id, const PgBlob &pose, const PgBlob &data);
+
+    // after the pose of the row was updated, the data stays cached
+    void updatePose(PgTable table, unsigned long id, const PgBlob &pose);
+
+    // before a write whose result is not known yet
+    void invalidate(PgTable table, unsigned long id);
+
+    // log the counters gathered since the last report, then start over
+    void report();
+
+private:
+
+    typedef std::pair<int, unsigned long> TileKey;
+
+    struct Entry {
+        PgBlob pose;
+        PgBlob data;
+        std::list<TileKey>::iterator lru;
+    };
+
+    void insert(const TileKey &key, const PgBlob &pose, const PgBlob &data);
+
+    void erase(std::map<TileKey, Entry>::iterator mit);
+
+    void evict();
+
+    static size_t sizeOf(const Entry &entry) { return entry.pose.size() + entry.data.size(); }
+
+    std::mutex mMutexCache;
+
+    size_t mnBudget;
+    size_t mnBytes;
+
+    // bumped by every write, a fill with an older ticket is dropped
+    unsigned long mnWrites;
+
+    std::map<TileKey, Entry> mEntries;
+
+    // most recently used first
+    std::list<TileKey> mLru;
+
+    // statistics
+    unsigned long mnHits;
+    unsigned long mnMisses;
+    unsigned long mnEvictions;
+    unsigned long mnStaleFills;
+
+};
+
+#endif //PROJECT_TILECACHE_H
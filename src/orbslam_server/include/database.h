@@ -24,6 +24,7 @@
 #  include <odb/sqlite/database.hxx>
 #elif defined(DATABASE_PGSQL)
 #  include <odb/pgsql/database.hxx>
+#  include <odb/pgsql/connection-factory.hxx>
 #elif defined(DATABASE_ORACLE)
 #  include <odb/oracle/database.hxx>
 #elif defined(DATABASE_MSSQL)
@@ -32,8 +33,9 @@
 #  error unknown database; did you forget to define the DATABASE_* macros?
 #endif
 
+// maxConnections bounds the connection pool (pgsql), 0 leaves it unbounded
 inline std::auto_ptr<odb::database>
-create_database (int& argc, char* argv[])
+create_database (int& argc, char* argv[], std::size_t maxConnections = 0)
 {
   using namespace std;
   using namespace odb::core;
@@ -81,7 +83,9 @@ create_database (int& argc, char* argv[])
     c->execute ("PRAGMA foreign_keys=ON");
   }
 #elif defined(DATABASE_PGSQL)
-  auto_ptr<database> db (new odb::pgsql::database (argc, argv));
+  auto_ptr<odb::pgsql::connection_factory> f (
+    new odb::pgsql::connection_pool_factory (maxConnections, maxConnections > 0 ? maxConnections : 1));
+  auto_ptr<database> db (new odb::pgsql::database (argc, argv, false, "", f));
 #elif defined(DATABASE_ORACLE)
   auto_ptr<database> db (new odb::oracle::database (argc, argv));
 #elif defined(DATABASE_MSSQL)
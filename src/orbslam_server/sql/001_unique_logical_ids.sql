@@ -0,0 +1,36 @@
+/* Unique indexes on the logical ids of the data tables, needed by the upsert
+ * (INSERT ... ON CONFLICT) write path of orbslam_server. PostgreSQL 9.5 or later.
+ *
+ * Databases created from the ODB schemas before the indexes existed may hold
+ * several rows for one logical id, only the most recent row (highest id) is kept.
+ *
+ *   psql -U m2slam_usr -h 127.0.0.1 -d m2slam_db < 001_unique_logical_ids.sql
+ */
+
+BEGIN;
+
+DELETE FROM "Data_TopoKeyFrame" a USING "Data_TopoKeyFrame" b
+  WHERE a."topoId" = b."topoId" AND a."id" < b."id";
+
+DELETE FROM "Data_TopoMapPoint" a USING "Data_TopoMapPoint" b
+  WHERE a."topoId" = b."topoId" AND a."id" < b."id";
+
+DELETE FROM "Data_KeyFrame" a USING "Data_KeyFrame" b
+  WHERE a."kfid" = b."kfid" AND a."id" < b."id";
+
+DELETE FROM "Data_MapPoint" a USING "Data_MapPoint" b
+  WHERE a."mpid" = b."mpid" AND a."id" < b."id";
+
+CREATE UNIQUE INDEX IF NOT EXISTS "Data_TopoKeyFrame_topoId_i"
+  ON "Data_TopoKeyFrame" ("topoId");
+
+CREATE UNIQUE INDEX IF NOT EXISTS "Data_TopoMapPoint_topoId_i"
+  ON "Data_TopoMapPoint" ("topoId");
+
+CREATE UNIQUE INDEX IF NOT EXISTS "Data_KeyFrame_kfid_i"
+  ON "Data_KeyFrame" ("kfid");
+
+CREATE UNIQUE INDEX IF NOT EXISTS "Data_MapPoint_mpid_i"
+  ON "Data_MapPoint" ("mpid");
+
+COMMIT;
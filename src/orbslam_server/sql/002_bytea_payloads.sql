@@ -0,0 +1,26 @@
+/* pose and data become BYTEA columns, the services exchange them as uint8[] and
+ * binary tile payloads are stored as they are. The TEXT rows written so far hold
+ * ASCII archives, their bytes are kept unchanged.
+ *
+ *   psql -U m2slam_usr -h 127.0.0.1 -d m2slam_db < 002_bytea_payloads.sql
+ */
+
+BEGIN;
+
+ALTER TABLE "Data_TopoKeyFrame"
+  ALTER COLUMN "pose" TYPE BYTEA USING convert_to("pose", 'UTF8'),
+  ALTER COLUMN "data" TYPE BYTEA USING convert_to("data", 'UTF8');
+
+ALTER TABLE "Data_TopoMapPoint"
+  ALTER COLUMN "pose" TYPE BYTEA USING convert_to("pose", 'UTF8'),
+  ALTER COLUMN "data" TYPE BYTEA USING convert_to("data", 'UTF8');
+
+ALTER TABLE "Data_KeyFrame"
+  ALTER COLUMN "pose" TYPE BYTEA USING convert_to("pose", 'UTF8'),
+  ALTER COLUMN "data" TYPE BYTEA USING convert_to("data", 'UTF8');
+
+ALTER TABLE "Data_MapPoint"
+  ALTER COLUMN "pose" TYPE BYTEA USING convert_to("pose", 'UTF8'),
+  ALTER COLUMN "data" TYPE BYTEA USING convert_to("data", 'UTF8');
+
+COMMIT;
@@ -0,0 +1,25 @@
+/* Spatial extent of the tile rows, the bounding box of the keyframe centres and
+ * mappoint positions of the tile, written by saveTopoTiles. It is stored as the
+ * 3D segment between the min and max corners, whose n-D box is the extent, and
+ * indexed for the n-D operators (&&&, <<->>) of queryTopoTiles. PostGIS 2.2 or later.
+ *
+ * Rows written before the column existed have no extent and are only found by topoId.
+ *
+ *   psql -U m2slam_usr -h 127.0.0.1 -d m2slam_db < 003_tile_extents.sql
+ */
+
+BEGIN;
+
+CREATE EXTENSION IF NOT EXISTS postgis;
+
+ALTER TABLE "Data_TopoKeyFrame" ADD COLUMN "extent" geometry(LINESTRINGZ);
+
+ALTER TABLE "Data_TopoMapPoint" ADD COLUMN "extent" geometry(LINESTRINGZ);
+
+CREATE INDEX IF NOT EXISTS "Data_TopoKeyFrame_extent_i"
+  ON "Data_TopoKeyFrame" USING GIST ("extent" gist_geometry_ops_nd);
+
+CREATE INDEX IF NOT EXISTS "Data_TopoMapPoint_extent_i"
+  ON "Data_TopoMapPoint" USING GIST ("extent" gist_geometry_ops_nd);
+
+COMMIT;
@@ -0,0 +1,329 @@
+#include "PgStatements.h"
+
+#include <set>
+#include <utility>
+#include <mutex>
+#include <sstream>
+#include <cstdlib>
+
+#include <odb/pgsql/database.hxx>
+#include <odb/pgsql/connection.hxx>
+#include <odb/pgsql/transaction.hxx>
+#include <odb/pgsql/exceptions.hxx>
+
+#include <libpq-fe.h>
+
+using namespace std;
+
+namespace {
+
+    struct PgTableInfo {
+        const char *table;
+        const char *key;
+    };
+
+    const PgTableInfo pgTables[] = {
+            {"Data_KeyFrame",     "kfid"},
+            {"Data_MapPoint",     "mpid"},
+            {"Data_TopoKeyFrame", "topoId"},
+            {"Data_TopoMapPoint", "topoId"}
+    };
+
+    const int pgTableCount = sizeof(pgTables) / sizeof(pgTables[0]);
+
+    // statements are prepared once per connection
+    std::mutex mutexPrepared;
+    std::set<PGconn *> preparedConns;
+
+    // each statement prepared on a connection, a prepare failing halfway leaves the first ones on it
+    std::set<std::pair<PGconn *, std::string> > preparedStatements;
+
+    std::string statementName(const char *op, int table) {
+        std::ostringstream os;
+        os << "m2_" << op << "_" << table;
+        return os.str();
+    }
+
+    void throwError(PGconn *h, PGresult *r) {
+        std::string state;
+        std::string message = PQerrorMessage(h);
+        if (r) {
+            const char *s = PQresultErrorField(r, PG_DIAG_SQLSTATE);
+            if (s) state = s;
+            message = PQresultErrorMessage(r);
+            PQclear(r);
+        }
+        throw odb::pgsql::database_exception(state, message);
+    }
+
+    // called with mutexPrepared held, a statement already on the connection is not prepared again
+    void prepare(PGconn *h, const std::string &name, const std::string &sql, int nParams) {
+        if (preparedStatements.find(make_pair(h, name)) != preparedStatements.end())
+            return;
+        PGresult *r = PQprepare(h, name.c_str(), sql.c_str(), nParams, nullptr);
+        if (!r || PQresultStatus(r) != PGRES_COMMAND_OK)
+            throwError(h, r);
+        PQclear(r);
+        preparedStatements.insert(make_pair(h, name));
+    }
+
+    PGconn *currentHandle() {
+
+        PGconn *h = odb::pgsql::transaction::current().connection().handle();
+
+        unique_lock<mutex> lock(mutexPrepared);
+
+        if (preparedConns.find(h) != preparedConns.end())
+            return h;
+
+        for (int i = 0; i < pgTableCount; i++) {
+
+            std::string t = std::string("\"") + pgTables[i].table + "\"";
+            std::string k = std::string("\"") + pgTables[i].key + "\"";
+
+            prepare(h, statementName("upsert", i),
+                    "INSERT INTO " + t + " (" + k + ", \"pose\", \"data\") VALUES ($1, $2, $3) "
+                    "ON CONFLICT (" + k + ") DO UPDATE SET \"pose\" = EXCLUDED.\"pose\", \"data\" = EXCLUDED.\"data\" "
+                    "RETURNING \"id\"", 3);
+
+            prepare(h, statementName("select", i),
+                    "SELECT \"pose\", \"data\" FROM " + t + " WHERE " + k + " = $1", 1);
+
+            prepare(h, statementName("pose", i),
+                    "UPDATE " + t + " SET \"pose\" = $2 WHERE " + k + " = $1", 2);
+        }
+
+        preparedConns.insert(h);
+
+        return h;
+
+    }
+
+    std::set<PGconn *> spatialConns;
+
+    // the spatial statements need PostGIS and the extent columns, they are prepared apart
+    PGconn *spatialHandle() {
+
+        PGconn *h = currentHandle();
+
+        unique_lock<mutex> lock(mutexPrepared);
+
+        if (spatialConns.find(h) != spatialConns.end())
+            return h;
+
+        for (int i = PG_TOPO_KEYFRAME; i <= PG_TOPO_MAPPOINT; i++) {
+
+            std::string t = std::string("\"") + pgTables[i].table + "\"";
+            std::string k = std::string("\"") + pgTables[i].key + "\"";
+
+            // the segment between the corners, its n-D box is the extent
+            prepare(h, statementName("extent", i),
+                    "UPDATE " + t + " SET \"extent\" = ST_MakeLine(ST_MakePoint($2::float8, $3::float8, $4::float8), "
+                    "ST_MakePoint($5::float8, $6::float8, $7::float8)) WHERE " + k + " = $1", 7);
+        }
+
+        // distance from the center to the box of the tile, 0 inside
+        prepare(h, "m2_near",
+                "WITH q AS (SELECT ST_MakeLine(ST_MakePoint($1::float8, $2::float8, $3::float8), "
+                "ST_MakePoint($4::float8, $5::float8, $6::float8)) AS box), "
+                "t AS (SELECT \"topoId\", \"extent\"::box3d AS b FROM \"Data_TopoKeyFrame\", q WHERE \"extent\" &&& q.box "
+                "UNION ALL SELECT \"topoId\", \"extent\"::box3d AS b FROM \"Data_TopoMapPoint\", q WHERE \"extent\" &&& q.box), "
+                "d AS (SELECT \"topoId\", sqrt("
+                "power(GREATEST(ST_XMin(b) - $7::float8, 0, $7::float8 - ST_XMax(b)), 2) + "
+                "power(GREATEST(ST_YMin(b) - $8::float8, 0, $8::float8 - ST_YMax(b)), 2) + "
+                "power(GREATEST(ST_ZMin(b) - $9::float8, 0, $9::float8 - ST_ZMax(b)), 2)) AS dist FROM t) "
+                "SELECT \"topoId\", MIN(dist) AS dist FROM d WHERE $10::float8 <= 0 OR dist <= $10::float8 "
+                "GROUP BY \"topoId\" ORDER BY dist, \"topoId\" LIMIT $11::bigint", 11);
+
+        spatialConns.insert(h);
+
+        return h;
+
+    }
+
+    // every parameter in text format, a null value is SQL NULL
+    PGresult *execText(PGconn *h, const std::string &name, int nParams, const char *const *values, ExecStatusType expected) {
+
+        PGresult *r = PQexecPrepared(h, name.c_str(), nParams, values, nullptr, nullptr, 0);
+
+        if (!r || PQresultStatus(r) != expected)
+            throwError(h, r);
+
+        return r;
+
+    }
+
+    std::string textOf(double v) {
+        std::ostringstream os;
+        os.precision(17);
+        os << v;
+        return os.str();
+    }
+
+    // the ids are unsigned 64 bits (a split tile has its level in the top bits), the BIGINT columns keep their
+    // bits as a signed value, as ODB does
+    std::string idText(unsigned long id) {
+        return std::to_string((long long) id);
+    }
+
+    unsigned long idOf(const char *text) {
+        return (unsigned long) strtoll(text, nullptr, 10);
+    }
+
+    // the first parameter (the logical id) is text, the blobs are binary
+    const char *blobData(const PgBlob &blob) {
+        static const char empty = 0;
+        return blob.empty() ? &empty : (const char *) &blob[0];
+    }
+
+    PGresult *execPrepared(PGconn *h, const std::string &name, int nParams, const char *const *values,
+                           const int *lengths, int resultFormat, ExecStatusType expected) {
+
+        const int formats[3] = {0, 1, 1};
+
+        PGresult *r = PQexecPrepared(h, name.c_str(), nParams, values, lengths, formats, resultFormat);
+
+        if (!r || PQresultStatus(r) != expected)
+            throwError(h, r);
+
+        return r;
+
+    }
+
+}
+
+unsigned long pgUpsertById(PgTable table, unsigned long id, const PgBlob &pose, const PgBlob &data) {
+
+    PGconn *h = currentHandle();
+
+    std::string sid = idText(id);
+    const char *values[3] = {sid.c_str(), blobData(pose), blobData(data)};
+    int lengths[3] = {(int) sid.size(), (int) pose.size(), (int) data.size()};
+
+    PGresult *r = execPrepared(h, statementName("upsert", table), 3, values, lengths, 0, PGRES_TUPLES_OK);
+
+    unsigned long rowId = PQntuples(r) > 0 ? strtoul(PQgetvalue(r, 0, 0), nullptr, 10) : 0;
+
+    PQclear(r);
+
+    return rowId;
+
+}
+
+bool pgSelectById(PgTable table, unsigned long id, PgBlob &pose, PgBlob &data) {
+
+    PGconn *h = currentHandle();
+
+    std::string sid = idText(id);
+    const char *values[1] = {sid.c_str()};
+    int lengths[1] = {(int) sid.size()};
+
+    PGresult *r = execPrepared(h, statementName("select", table), 1, values, lengths, 1, PGRES_TUPLES_OK);
+
+    bool bFound = PQntuples(r) > 0;
+
+    if (bFound) {
+        const unsigned char *p = (const unsigned char *) PQgetvalue(r, 0, 0);
+        pose.assign(p, p + PQgetlength(r, 0, 0));
+        const unsigned char *d = (const unsigned char *) PQgetvalue(r, 0, 1);
+        data.assign(d, d + PQgetlength(r, 0, 1));
+    }
+
+    PQclear(r);
+
+    return bFound;
+
+}
+
+bool pgUpdatePoseById(PgTable table, unsigned long id, const PgBlob &pose) {
+
+    PGconn *h = currentHandle();
+
+    std::string sid = idText(id);
+    const char *values[2] = {sid.c_str(), blobData(pose)};
+    int lengths[2] = {(int) sid.size(), (int) pose.size()};
+
+    PGresult *r = execPrepared(h, statementName("pose", table), 2, values, lengths, 0, PGRES_COMMAND_OK);
+
+    bool bUpdated = atoi(PQcmdTuples(r)) > 0;
+
+    PQclear(r);
+
+    return bUpdated;
+
+}
+
+bool pgHasTileExtents() {
+
+    PGconn *h = odb::pgsql::transaction::current().connection().handle();
+
+    PGresult *r = PQexec(h, "SELECT 1 FROM information_schema.columns WHERE table_name = 'Data_TopoKeyFrame' "
+                            "AND column_name = 'extent'");
+
+    if (!r || PQresultStatus(r) != PGRES_TUPLES_OK)
+        throwError(h, r);
+
+    bool bFound = PQntuples(r) > 0;
+
+    PQclear(r);
+
+    return bFound;
+
+}
+
+bool pgUpdateExtentById(PgTable table, unsigned long id, const double *extent) {
+
+    PGconn *h = spatialHandle();
+
+    std::string params[7];
+    params[0] = idText(id);
+    for (int i = 0; i < 6; i++)
+        params[i + 1] = textOf(extent[i]);
+
+    const char *values[7];
+    for (int i = 0; i < 7; i++)
+        values[i] = params[i].c_str();
+
+    PGresult *r = execText(h, statementName("extent", table), 7, values, PGRES_COMMAND_OK);
+
+    bool bUpdated = atoi(PQcmdTuples(r)) > 0;
+
+    PQclear(r);
+
+    return bUpdated;
+
+}
+
+void pgSelectTilesNear(const double *box, const double *center, double radius, unsigned int limit,
+                       std::vector<std::pair<unsigned long, double> > &tiles) {
+
+    PGconn *h = spatialHandle();
+
+    std::string params[11];
+    for (int i = 0; i < 6; i++)
+        params[i] = textOf(box[i]);
+    for (int i = 0; i < 3; i++)
+        params[i + 6] = textOf(center[i]);
+    params[9] = textOf(radius);
+    params[10] = std::to_string(limit);
+
+    const char *values[11];
+    for (int i = 0; i < 11; i++)
+        values[i] = params[i].c_str();
+
+    // LIMIT NULL is no limit
+    if (limit == 0)
+        values[10] = nullptr;
+
+    PGresult *r = execText(h, "m2_near", 11, values, PGRES_TUPLES_OK);
+
+    const int n = PQntuples(r);
+
+    tiles.reserve(tiles.size() + n);
+
+    for (int i = 0; i < n; i++)
+        tiles.push_back(std::make_pair(idOf(PQgetvalue(r, i, 0)), strtod(PQgetvalue(r, i, 1), nullptr)));
+
+    PQclear(r);
+
+}
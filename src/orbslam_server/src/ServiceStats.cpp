@@ -0,0 +1,101 @@
+#include "ServiceStats.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+    // forwards to the wrapped callback, with the time it entered the queue
+    class TimedCallback : public ros::CallbackInterface {
+
+    public:
+
+        TimedCallback(const ros::CallbackInterfacePtr &callback) :
+                mCallback(callback), mQueued(ros::WallTime::now()) {}
+
+        virtual CallResult call();
+
+        virtual bool ready() { return mCallback->ready(); }
+
+    private:
+
+        ros::CallbackInterfacePtr mCallback;
+
+        ros::WallTime mQueued;
+
+    };
+
+    // queueing time of the callback running on this worker, negative outside of a TimedCallback
+    __thread double currentQueued = -1;
+
+    std::mutex mutexStats;
+    std::map<std::string, ServiceLatency> serviceStats;
+
+    ros::CallbackInterface::CallResult TimedCallback::call() {
+
+        currentQueued = (ros::WallTime::now() - mQueued).toSec();
+
+        CallResult result = mCallback->call();
+
+        currentQueued = -1;
+
+        return result;
+
+    }
+
+}
+
+void TimedCallbackQueue::addCallback(const ros::CallbackInterfacePtr &callback, uint64_t owner_id) {
+
+    ros::CallbackQueue::addCallback(ros::CallbackInterfacePtr(new TimedCallback(callback)), owner_id);
+
+}
+
+ServiceTimer::ServiceTimer(const char *service) :
+        mService(service), mQueued(std::max(currentQueued, 0.0)), mStart(ros::WallTime::now()) {
+}
+
+ServiceTimer::~ServiceTimer() {
+
+    double service = (ros::WallTime::now() - mStart).toSec();
+
+    unique_lock<mutex> lock(mutexStats);
+
+    std::map<std::string, ServiceLatency>::iterator mit = serviceStats.find(mService);
+
+    if (mit == serviceStats.end()) {
+        ServiceLatency latency = {0, 0, 0, 0, 0};
+        mit = serviceStats.insert(make_pair(std::string(mService), latency)).first;
+    }
+
+    ServiceLatency &latency = mit->second;
+
+    latency.calls++;
+    latency.queueSum += mQueued;
+    latency.queueMax = std::max(latency.queueMax, mQueued);
+    latency.serviceSum += service;
+    latency.serviceMax = std::max(latency.serviceMax, service);
+
+}
+
+void reportServiceStats() {
+
+    std::map<std::string, ServiceLatency> stats;
+
+    {
+        unique_lock<mutex> lock(mutexStats);
+        stats.swap(serviceStats);
+    }
+
+    for (std::map<std::string, ServiceLatency>::iterator mit = stats.begin(); mit != stats.end(); mit++) {
+
+        const ServiceLatency &l = mit->second;
+
+        ROS_INFO("%s: %lu calls, queue avg %.2f ms max %.2f ms, service avg %.2f ms max %.2f ms",
+                 mit->first.c_str(), l.calls,
+                 1000.0 * l.queueSum / l.calls, 1000.0 * l.queueMax,
+                 1000.0 * l.serviceSum / l.calls, 1000.0 * l.serviceMax);
+    }
+
+}
@@ -0,0 +1,182 @@
+#include "TileCache.h"
+
+#include "ros/ros.h"
+
+using namespace std;
+
+TileCache::TileCache() :
+        mnBudget(0), mnBytes(0), mnWrites(0), mnHits(0), mnMisses(0), mnEvictions(0), mnStaleFills(0) {
+}
+
+void TileCache::setBudget(size_t nBytes) {
+
+    unique_lock<mutex> lock(mMutexCache);
+
+    mnBudget = nBytes;
+
+    evict();
+
+}
+
+bool TileCache::get(PgTable table, unsigned long id, PgBlob &pose, PgBlob &data) {
+
+    unique_lock<mutex> lock(mMutexCache);
+
+    if (mnBudget == 0)
+        return false;
+
+    std::map<TileKey, Entry>::iterator mit = mEntries.find(TileKey(table, id));
+
+    if (mit == mEntries.end()) {
+        mnMisses++;
+        return false;
+    }
+
+    mLru.splice(mLru.begin(), mLru, mit->second.lru);
+
+    pose = mit->second.pose;
+    data = mit->second.data;
+
+    mnHits++;
+
+    return true;
+
+}
+
+unsigned long TileCache::ticket() {
+
+    unique_lock<mutex> lock(mMutexCache);
+
+    return mnWrites;
+
+}
+
+void TileCache::fill(PgTable table, unsigned long id, const PgBlob &pose, const PgBlob &data, unsigned long ticket) {
+
+    unique_lock<mutex> lock(mMutexCache);
+
+    // an unknown tile is not cached, it is stored soon after
+    if (mnBudget == 0 || data.empty())
+        return;
+
+    if (ticket != mnWrites) {
+        mnStaleFills++;
+        return;
+    }
+
+    insert(TileKey(table, id), pose, data);
+
+}
+
+void TileCache::put(PgTable table, unsigned long id, const PgBlob &pose, const PgBlob &data) {
+
+    unique_lock<mutex> lock(mMutexCache);
+
+    mnWrites++;
+
+    if (mnBudget == 0)
+        return;
+
+    insert(TileKey(table, id), pose, data);
+
+}
+
+void TileCache::updatePose(PgTable table, unsigned long id, const PgBlob &pose) {
+
+    unique_lock<mutex> lock(mMutexCache);
+
+    mnWrites++;
+
+    std::map<TileKey, Entry>::iterator mit = mEntries.find(TileKey(table, id));
+
+    if (mit == mEntries.end())
+        return;
+
+    mnBytes = mnBytes - mit->second.pose.size() + pose.size();
+    mit->second.pose = pose;
+
+    evict();
+
+}
+
+void TileCache::invalidate(PgTable table, unsigned long id) {
+
+    unique_lock<mutex> lock(mMutexCache);
+
+    mnWrites++;
+
+    std::map<TileKey, Entry>::iterator mit = mEntries.find(TileKey(table, id));
+
+    if (mit != mEntries.end())
+        erase(mit);
+
+}
+
+void TileCache::insert(const TileKey &key, const PgBlob &pose, const PgBlob &data) {
+
+    std::map<TileKey, Entry>::iterator mit = mEntries.find(key);
+
+    if (mit != mEntries.end())
+        erase(mit);
+
+    // a tile larger than the whole budget would only flush the others
+    if (pose.size() + data.size() > mnBudget)
+        return;
+
+    Entry &entry = mEntries[key];
+    entry.pose = pose;
+    entry.data = data;
+
+    mLru.push_front(key);
+    entry.lru = mLru.begin();
+
+    mnBytes += sizeOf(entry);
+
+    evict();
+
+}
+
+void TileCache::erase(std::map<TileKey, Entry>::iterator mit) {
+
+    mnBytes -= sizeOf(mit->second);
+    mLru.erase(mit->second.lru);
+    mEntries.erase(mit);
+
+}
+
+void TileCache::evict() {
+
+    while (mnBytes > mnBudget && !mLru.empty()) {
+        erase(mEntries.find(mLru.back()));
+        mnEvictions++;
+    }
+
+}
+
+void TileCache::report() {
+
+    unsigned long nHits, nMisses, nEvictions, nStaleFills, nEntries;
+    size_t nBytes, nBudget;
+
+    {
+        unique_lock<mutex> lock(mMutexCache);
+
+        if (mnBudget == 0)
+            return;
+
+        nHits = mnHits;
+        nMisses = mnMisses;
+        nEvictions = mnEvictions;
+        nStaleFills = mnStaleFills;
+        nEntries = mEntries.size();
+        nBytes = mnBytes;
+        nBudget = mnBudget;
+
+        mnHits = mnMisses = mnEvictions = mnStaleFills = 0;
+    }
+
+    ROS_INFO("tile cache: %lu hits, %lu misses (%.1f%% hit), %lu evictions, %lu stale fills, %lu entries, %.1f of %.1f MB",
+             nHits, nMisses, nHits + nMisses ? 100.0 * nHits / (nHits + nMisses) : 0.0, nEvictions, nStaleFills,
+             nEntries, nBytes / 1048576.0, nBudget / 1048576.0);
+
+}
@@ -4,6 +4,9 @@
 #include <memory>   // std::auto_ptr
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <set>
 
 #include <odb/database.hxx>
 #include <odb/transaction.hxx>
@@ -16,8 +19,15 @@
 #include "orbslam_server/orbslam_muilt_get.h"
 #include "orbslam_server/orbslam_pose_get.h"
 #include "orbslam_server/orbslam_pose_save.h"
+#include "orbslam_server/orbslam_batch_save.h"
+#include "orbslam_server/orbslam_batch_get.h"
+#include "orbslam_server/orbslam_pose_batch.h"
+#include "orbslam_server/orbslam_tile_query.h"
 
 #include "database.h" // create_database
+#include "PgStatements.h"
+#include "ServiceStats.h"
+#include "TileCache.h"
 
 #include "person.h"
 #include "person_odb.h"
@@ -48,42 +58,37 @@ using namespace odb::core;
 
 auto_ptr<database> db;
 
-bool saveOneMapPoint(orbslam_server::orbslam_save::Request &req,
-                     orbslam_server::orbslam_save::Response &res) {
+// the tile tables carry the extent columns of sql/003_tile_extents.sql
+bool bTileExtents = false;
 
-    unsigned long usr_id;
+// payloads of the tiles read or written lately
+TileCache tileCache;
 
-    std::string ss = req.DATA;
+// read one tile row missed by the tile cache and cache it, inside the transaction of the caller
+void loadTopoTile(PgTable table, unsigned long id, PgBlob &pose, PgBlob &data) {
 
-    std::string pose = req.POSE;
+    const unsigned long ticket = tileCache.ticket();
 
-    unsigned long id = req.ID;
+    pgSelectById(table, id, pose, data);
 
-    {
-        typedef odb::query<Data_MapPoint> query;
-        typedef odb::result<Data_MapPoint> result;
+    tileCache.fill(table, id, pose, data, ticket);
 
-        {
-            transaction t(db->begin());
-            result r(db->query<Data_MapPoint>(query::mpid == id));
-            if (r.size() > 0) {
-                for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                    Data_MapPoint *tmp = mit->getData_MapPoint();
-                    tmp->setData_(ss);
-                    tmp->setPose_(pose);
-                    db->update(tmp);
-                    usr_id = tmp->getId_();
-                }
-            } else {
-                Data_MapPoint tmp(id, pose, ss);
-                usr_id = db->persist(tmp);
-            }
-            t.commit();
-        }
+}
 
-    }
+bool saveOneMapPoint(orbslam_server::orbslam_save::Request &req,
+                     orbslam_server::orbslam_save::Response &res) {
 
-    res.ID = usr_id;
+    ServiceTimer timer("saveOneMapPoint");
+
+    try {
+        transaction t(db->begin());
+        res.ID = pgUpsertById(PG_MAPPOINT, req.ID, req.POSE, req.DATA);
+        t.commit();
+    }
+    catch (const odb::exception &e) {
+        cerr << e.what() << endl;
+        return false;
+    }
 
     ROS_INFO("MapPoint ID : %d saved! ", (int) res.ID);
 
@@ -93,27 +98,17 @@ bool saveOneMapPoint(orbslam_server::orbslam_save::Request &req,
 
 bool getOneMapPoint(orbslam_server::orbslam_get::Request &req,
                     orbslam_server::orbslam_get::Response &res) {
-    std::string ss = "";
-    res.DATA = ss;
-    std::string pose = "";
-    res.POSE = pose;
 
-    try {
+    ServiceTimer timer("getOneMapPoint");
 
-        typedef odb::query<Data_MapPoint> query;
-        typedef odb::result<Data_MapPoint> result;
+    res.DATA.clear();
 
-        {
-            transaction t(db->begin());
+    res.POSE.clear();
 
-            result r(db->query<Data_MapPoint>(query::mpid == req.ID));
-            for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                res.DATA = mit->getData_();
-                res.POSE = mit->getPose_();
-                break;
-            }
-            t.commit();
-        }
+    try {
+        transaction t(db->begin());
+        pgSelectById(PG_MAPPOINT, req.ID, res.POSE, res.DATA);
+        t.commit();
     }
     catch (const odb::exception &e) {
         cerr << e.what() << endl;
@@ -126,42 +121,23 @@ bool getOneMapPoint(orbslam_server::orbslam_get::Request &req,
 
 
 bool saveTopoMapPoint(orbslam_server::orbslam_save::Request &req,
-                     orbslam_server::orbslam_save::Response &res) {
-
-    unsigned long usr_id;
-
-    std::string ss = req.DATA;
-
-    std::string pose = req.POSE;
-
-    unsigned long id = req.ID;
+                      orbslam_server::orbslam_save::Response &res) {
 
-    {
-        typedef odb::query<Data_TopoMapPoint> query;
-        typedef odb::result<Data_TopoMapPoint> result;
+    ServiceTimer timer("saveTopoMapPoint");
 
-        {
-            transaction t(db->begin());
-            result r(db->query<Data_TopoMapPoint>(query::topoId == id));
-            if (r.size() > 0) {
-                for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                    Data_TopoMapPoint *tmp = mit->getData_TopoMapPoint();
-                    tmp->setData_(ss);
-                    tmp->setPose_(pose);
-                    db->update(tmp);
-                    usr_id = tmp->getId_();
-                    break;
-                }
-            } else {
-                Data_TopoMapPoint tmp(id,pose, ss);
-                usr_id = db->persist(tmp);
-            }
-            t.commit();
-        }
+    tileCache.invalidate(PG_TOPO_MAPPOINT, req.ID);
 
+    try {
+        transaction t(db->begin());
+        res.ID = pgUpsertById(PG_TOPO_MAPPOINT, req.ID, req.POSE, req.DATA);
+        t.commit();
+    }
+    catch (const odb::exception &e) {
+        cerr << e.what() << endl;
+        return false;
     }
 
-    res.ID = usr_id;
+    tileCache.put(PG_TOPO_MAPPOINT, req.ID, req.POSE, req.DATA);
 
     ROS_INFO("TopoMapPoint ID : %d saved! ", (int) res.ID);
 
@@ -170,37 +146,79 @@ bool saveTopoMapPoint(orbslam_server::orbslam_save::Request &req,
 }
 
 bool getTopoMapPoint(orbslam_server::orbslam_get::Request &req,
-                    orbslam_server::orbslam_get::Response &res) {
+                     orbslam_server::orbslam_get::Response &res) {
+
+    ServiceTimer timer("getTopoMapPoint");
 
     ROS_INFO("getTopoMapPoint function");
 
-    std::string ss = "";
+    res.DATA.clear();
 
-    std::string pose = "";
+    res.POSE.clear();
+
+    // a cached tile skips the database
+    if (tileCache.get(PG_TOPO_MAPPOINT, req.ID, res.POSE, res.DATA))
+        return true;
+
+    try {
+        transaction t(db->begin());
+        loadTopoTile(PG_TOPO_MAPPOINT, req.ID, res.POSE, res.DATA);
+        t.commit();
+    }
+    catch (const odb::exception &e) {
+        cerr << e.what() << endl;
+        return false;
+    }
+
+    return true;
+
+}
+
+
+bool saveTopoKeyFrame(orbslam_server::orbslam_save::Request &req,
+                      orbslam_server::orbslam_save::Response &res) {
 
-    res.DATA = ss;
+    ServiceTimer timer("saveTopoKeyFrame");
 
-    res.POSE = pose;
+    tileCache.invalidate(PG_TOPO_KEYFRAME, req.ID);
 
     try {
+        transaction t(db->begin());
+        res.ID = pgUpsertById(PG_TOPO_KEYFRAME, req.ID, req.POSE, req.DATA);
+        t.commit();
+    }
+    catch (const odb::exception &e) {
+        cerr << e.what() << endl;
+        return false;
+    }
 
-        typedef odb::query<Data_TopoMapPoint> query;
-        typedef odb::result<Data_TopoMapPoint> result;
+    tileCache.put(PG_TOPO_KEYFRAME, req.ID, req.POSE, req.DATA);
 
-        {
-            transaction t(db->begin());
-            result r(db->query<Data_TopoMapPoint>(query::topoId == req.ID));
-            if (r.size() > 0) {
-
-                for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                    res.DATA = mit->getData_();
-                    res.POSE = mit->getPose_();
-                    break;
-                }
-            }
+    ROS_INFO("Data_TopoKeyFrame ID : %d saved! ", (int) res.ID);
 
-            t.commit();
-        }
+    return true;
+
+}
+
+bool getTopoKeyFrame(orbslam_server::orbslam_get::Request &req,
+                     orbslam_server::orbslam_get::Response &res) {
+
+    ServiceTimer timer("getTopoKeyFrame");
+
+    ROS_INFO("GetData_TopoKeyFrame function");
+
+    res.DATA.clear();
+
+    res.POSE.clear();
+
+    // a cached tile skips the database
+    if (tileCache.get(PG_TOPO_KEYFRAME, req.ID, res.POSE, res.DATA))
+        return true;
+
+    try {
+        transaction t(db->begin());
+        loadTopoTile(PG_TOPO_KEYFRAME, req.ID, res.POSE, res.DATA);
+        t.commit();
     }
     catch (const odb::exception &e) {
         cerr << e.what() << endl;
@@ -211,83 +229,114 @@ bool getTopoMapPoint(orbslam_server::orbslam_get::Request &req,
 
 }
 
+// store one tile inside the transaction of the caller, empty payloads are skipped. extent is the
+// bounding box of the tile (min x y z, max x y z), null or NaN when the client did not send it
+void storeTopoTile(unsigned long id, const PgBlob &kfPose, const PgBlob &kfData,
+                   const PgBlob &mpPose, const PgBlob &mpData, const double *extent) {
 
-bool saveTopoKeyFrame(orbslam_server::orbslam_save::Request &req,
-                      orbslam_server::orbslam_save::Response &res) {
+    const bool bExtent = bTileExtents && extent && !std::isnan(extent[0]);
+
+    // the cache is refilled by the caller once the transaction committed
+    if (kfData.size() > 0) {
+        tileCache.invalidate(PG_TOPO_KEYFRAME, id);
+        pgUpsertById(PG_TOPO_KEYFRAME, id, kfPose, kfData);
+        if (bExtent)
+            pgUpdateExtentById(PG_TOPO_KEYFRAME, id, extent);
+    }
 
-    unsigned long usr_id;
+    if (mpData.size() > 0) {
+        tileCache.invalidate(PG_TOPO_MAPPOINT, id);
+        pgUpsertById(PG_TOPO_MAPPOINT, id, mpPose, mpData);
+        if (bExtent)
+            pgUpdateExtentById(PG_TOPO_MAPPOINT, id, extent);
+    }
 
-    std::string ss = req.DATA;
+}
 
-    std::string pose = req.POSE;
+bool saveTopoTiles(orbslam_server::orbslam_batch_save::Request &req,
+                   orbslam_server::orbslam_batch_save::Response &res) {
 
-    unsigned long id = req.ID;
+    ServiceTimer timer("saveTopoTiles");
 
-    {
-        typedef odb::query<Data_TopoKeyFrame> query;
-        typedef odb::result<Data_TopoKeyFrame> result;
+    const size_t n = req.IDS.size();
 
-        {
-            transaction t(db->begin());
-            result r(db->query<Data_TopoKeyFrame>(query::topoId == id));
-            if (r.size() > 0) {
-                for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                    Data_TopoKeyFrame *tmp = mit->getData_TopoKeyFrame();
-                    tmp->setData_(ss);
-                    tmp->setPose_(pose);
-                    db->update(tmp);
-                    usr_id = tmp->getId_();
-                    break;
-                }
-            } else {
-                Data_TopoKeyFrame tmp(id,pose, ss);
-                usr_id = db->persist(tmp);
-            }
-            t.commit();
-        }
+    if (req.KF_POSE.size() != n || req.KF_DATA.size() != n || req.MP_POSE.size() != n || req.MP_DATA.size() != n ||
+        (req.EXTENTS.size() != 0 && req.EXTENTS.size() != 6 * n)) {
+        ROS_INFO("saveTopoTiles: malformed request");
+        return false;
+    }
 
+    try {
+        // the whole batch is one transaction
+        transaction t(db->begin());
+
+        for (size_t i = 0; i < n; i++)
+            storeTopoTile(req.IDS[i], req.KF_POSE[i].BYTES, req.KF_DATA[i].BYTES, req.MP_POSE[i].BYTES, req.MP_DATA[i].BYTES,
+                          req.EXTENTS.empty() ? nullptr : &req.EXTENTS[6 * i]);
+
+        t.commit();
+    }
+    catch (const odb::exception &e) {
+        cerr << e.what() << endl;
+        return false;
+    }
+
+    // write through, the client is the only writer of its tiles
+    for (size_t i = 0; i < n; i++) {
+        if (req.KF_DATA[i].BYTES.size() > 0)
+            tileCache.put(PG_TOPO_KEYFRAME, req.IDS[i], req.KF_POSE[i].BYTES, req.KF_DATA[i].BYTES);
+        if (req.MP_DATA[i].BYTES.size() > 0)
+            tileCache.put(PG_TOPO_MAPPOINT, req.IDS[i], req.MP_POSE[i].BYTES, req.MP_DATA[i].BYTES);
     }
 
-    res.ID = usr_id;
+    res.ID = n;
 
-    ROS_INFO("Data_TopoKeyFrame ID : %d saved! ", (int) res.ID);
+    ROS_INFO("TopoTiles saved: %d", (int) n);
 
     return true;
 
 }
 
-bool getTopoKeyFrame(orbslam_server::orbslam_get::Request &req,
-                     orbslam_server::orbslam_get::Response &res) {
+bool getTopoTiles(orbslam_server::orbslam_batch_get::Request &req,
+                  orbslam_server::orbslam_batch_get::Response &res) {
 
-    ROS_INFO("GetData_TopoKeyFrame function");
+    ServiceTimer timer("getTopoTiles");
 
-    std::string ss = "";
+    const size_t n = req.IDS.size();
 
-    std::string pose = "";
+    // unknown tiles are answered with empty payloads
+    res.KF_POSE.resize(n);
+    res.KF_DATA.resize(n);
+    res.MP_POSE.resize(n);
+    res.MP_DATA.resize(n);
 
-    res.DATA = ss;
+    // the tiles in cache are answered without a transaction
+    std::vector<size_t> vKFMissed, vMPMissed;
 
-    res.POSE = pose;
+    for (size_t i = 0; i < n; i++) {
+        if (!tileCache.get(PG_TOPO_KEYFRAME, req.IDS[i], res.KF_POSE[i].BYTES, res.KF_DATA[i].BYTES))
+            vKFMissed.push_back(i);
+        if (!tileCache.get(PG_TOPO_MAPPOINT, req.IDS[i], res.MP_POSE[i].BYTES, res.MP_DATA[i].BYTES))
+            vMPMissed.push_back(i);
+    }
 
-    try {
+    if (vKFMissed.empty() && vMPMissed.empty())
+        return true;
 
-        typedef odb::query<Data_TopoKeyFrame> query;
-        typedef odb::result<Data_TopoKeyFrame> result;
+    try {
+        transaction t(db->begin());
 
-        {
-            transaction t(db->begin());
-            result r(db->query<Data_TopoKeyFrame>(query::topoId == req.ID));
-            if (r.size() > 0) {
-
-                for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                    res.DATA = mit->getData_();
-                    res.POSE = mit->getPose_();
-                    break;
-                }
-            }
+        for (size_t j = 0; j < vKFMissed.size(); j++) {
+            const size_t i = vKFMissed[j];
+            loadTopoTile(PG_TOPO_KEYFRAME, req.IDS[i], res.KF_POSE[i].BYTES, res.KF_DATA[i].BYTES);
+        }
 
-            t.commit();
+        for (size_t j = 0; j < vMPMissed.size(); j++) {
+            const size_t i = vMPMissed[j];
+            loadTopoTile(PG_TOPO_MAPPOINT, req.IDS[i], res.MP_POSE[i].BYTES, res.MP_DATA[i].BYTES);
         }
+
+        t.commit();
     }
     catch (const odb::exception &e) {
         cerr << e.what() << endl;
@@ -298,72 +347,149 @@ bool getTopoKeyFrame(orbslam_server::orbslam_get::Request &req,
 
 }
 
-bool saveOneKeyFrame(orbslam_server::orbslam_save::Request &req,
-                     orbslam_server::orbslam_save::Response &res) {
+bool queryTopoTiles(orbslam_server::orbslam_tile_query::Request &req,
+                    orbslam_server::orbslam_tile_query::Response &res) {
 
-    unsigned long usr_id;
+    ServiceTimer timer("queryTopoTiles");
 
-    std::string ss = req.DATA;
+    if (!bTileExtents) {
+        ROS_INFO("queryTopoTiles: the tile tables have no extent, run sql/003_tile_extents.sql");
+        return false;
+    }
 
-    std::string pose = req.POSE;
+    if (req.CENTER.size() != 3 || (req.BOX.size() != 0 && req.BOX.size() != 6) || (req.BOX.empty() && req.RADIUS <= 0)) {
+        ROS_INFO("queryTopoTiles: malformed request");
+        return false;
+    }
 
-    unsigned long id = req.ID;
+    // a radius query is a box query on the cube around the center
+    double box[6];
+    for (int i = 0; i < 3; i++) {
+        box[i] = req.BOX.empty() ? req.CENTER[i] - req.RADIUS : req.BOX[i];
+        box[i + 3] = req.BOX.empty() ? req.CENTER[i] + req.RADIUS : req.BOX[i + 3];
+    }
 
-    {
-        typedef odb::query<Data_KeyFrame> query;
-        typedef odb::result<Data_KeyFrame> result;
+    std::set<unsigned long> exclude(req.EXCLUDE.begin(), req.EXCLUDE.end());
 
-        {
-            transaction t(db->begin());
-            result r(db->query<Data_KeyFrame>(query::kfid == id));
-            if (r.size() > 0) {
-                for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                    Data_KeyFrame *tkf = mit->getData_KeyFrame();
-                    tkf->setData_(ss);
-                    tkf->setPose_(pose);
-                    db->update(tkf);
-                    usr_id = tkf->getId_();
-                }
-            } else {
-                Data_KeyFrame tkf(id, pose, ss);
-                usr_id = db->persist(tkf);
-            }
-            t.commit();
+    std::vector<std::pair<unsigned long, double> > tiles;
+
+    try {
+        transaction t(db->begin());
+
+        pgSelectTilesNear(box, &req.CENTER[0], req.RADIUS, req.MAX_TILES, tiles);
+
+        const size_t n = tiles.size();
+
+        res.KF_POSE.resize(n);
+        res.KF_DATA.resize(n);
+        res.MP_POSE.resize(n);
+        res.MP_DATA.resize(n);
+
+        for (size_t i = 0; i < n; i++) {
+
+            res.IDS.push_back(tiles[i].first);
+            res.DISTANCES.push_back(tiles[i].second);
+
+            // the client holds these already, only their ids and distances are sent
+            if (exclude.count(tiles[i].first))
+                continue;
+
+            if (!tileCache.get(PG_TOPO_KEYFRAME, tiles[i].first, res.KF_POSE[i].BYTES, res.KF_DATA[i].BYTES))
+                loadTopoTile(PG_TOPO_KEYFRAME, tiles[i].first, res.KF_POSE[i].BYTES, res.KF_DATA[i].BYTES);
+            if (!tileCache.get(PG_TOPO_MAPPOINT, tiles[i].first, res.MP_POSE[i].BYTES, res.MP_DATA[i].BYTES))
+                loadTopoTile(PG_TOPO_MAPPOINT, tiles[i].first, res.MP_POSE[i].BYTES, res.MP_DATA[i].BYTES);
         }
 
+        t.commit();
+    }
+    catch (const odb::exception &e) {
+        cerr << e.what() << endl;
+        return false;
+    }
+
+    ROS_INFO("queryTopoTiles: %d tiles", (int) tiles.size());
+
+    return true;
+
+}
+
+bool updateTopoPoses(orbslam_server::orbslam_pose_batch::Request &req,
+                     orbslam_server::orbslam_pose_batch::Response &res) {
+
+    ServiceTimer timer("updateTopoPoses");
+
+    if (req.KF_POSE.size() != req.KF_IDS.size() || req.MP_POSE.size() != req.MP_IDS.size()) {
+        ROS_INFO("updateTopoPoses: malformed request");
+        return false;
     }
 
-    res.ID = usr_id;
+    int nUpdated = 0;
 
-    ROS_INFO("KeyFrame ID : %d saved!", (int) res.ID);
+    try {
+        // the client sends the changed tiles in batches, one transaction each
+        transaction t(db->begin());
+
+        for (size_t i = 0; i < req.KF_IDS.size(); i++)
+            nUpdated += pgUpdatePoseById(PG_TOPO_KEYFRAME, req.KF_IDS[i], req.KF_POSE[i].BYTES);
+
+        for (size_t i = 0; i < req.MP_IDS.size(); i++)
+            nUpdated += pgUpdatePoseById(PG_TOPO_MAPPOINT, req.MP_IDS[i], req.MP_POSE[i].BYTES);
+
+        t.commit();
+    }
+    catch (const odb::exception &e) {
+        cerr << e.what() << endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < req.KF_IDS.size(); i++)
+        tileCache.updatePose(PG_TOPO_KEYFRAME, req.KF_IDS[i], req.KF_POSE[i].BYTES);
+
+    for (size_t i = 0; i < req.MP_IDS.size(); i++)
+        tileCache.updatePose(PG_TOPO_MAPPOINT, req.MP_IDS[i], req.MP_POSE[i].BYTES);
+
+    res.ID = nUpdated;
+
+    ROS_INFO("Update TopoPoses kf tiles: %d mp tiles: %d", (int) req.KF_IDS.size(), (int) req.MP_IDS.size());
 
     return true;
+
 }
 
-bool getOneKeyFrame(orbslam_server::orbslam_get::Request &req,
-                    orbslam_server::orbslam_get::Response &res) {
+bool saveOneKeyFrame(orbslam_server::orbslam_save::Request &req,
+                     orbslam_server::orbslam_save::Response &res) {
 
-    std::string ss = "";
-    res.DATA = ss;
-    std::string pose = "";
-    res.POSE = pose;
+    ServiceTimer timer("saveOneKeyFrame");
 
     try {
+        transaction t(db->begin());
+        res.ID = pgUpsertById(PG_KEYFRAME, req.ID, req.POSE, req.DATA);
+        t.commit();
+    }
+    catch (const odb::exception &e) {
+        cerr << e.what() << endl;
+        return false;
+    }
 
-        typedef odb::query<Data_KeyFrame> query;
-        typedef odb::result<Data_KeyFrame> result;
+    ROS_INFO("KeyFrame ID : %d saved! ", (int) res.ID);
 
-        {
-            transaction t(db->begin());
+    return true;
 
-            result r(db->query<Data_KeyFrame>(query::kfid == req.ID));
-            for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                res.DATA = mit->getData_();
-                res.POSE = mit->getPose_();
-                break;
-            }
-            t.commit();
-        }
+}
+
+bool getOneKeyFrame(orbslam_server::orbslam_get::Request &req,
+                    orbslam_server::orbslam_get::Response &res) {
+
+    ServiceTimer timer("getOneKeyFrame");
+
+    res.DATA.clear();
+
+    res.POSE.clear();
+
+    try {
+        transaction t(db->begin());
+        pgSelectById(PG_KEYFRAME, req.ID, res.POSE, res.DATA);
+        t.commit();
     }
     catch (const odb::exception &e) {
         cerr << e.what() << endl;
@@ -377,6 +503,8 @@ bool getOneKeyFrame(orbslam_server::orbslam_get::Request &req,
 bool getAllKeyFramePose( orbslam_server::orbslam_pose_get::Request &req,
                          orbslam_server::orbslam_pose_get::Response &res ) {
 
+    ServiceTimer timer("getAllKeyFramePose");
+
     std::map< long unsigned int, std::string > ans_pose;
 
     try {
@@ -389,7 +517,7 @@ bool getAllKeyFramePose( orbslam_server::orbslam_pose_get::Request &req,
 
             result r(db->query<Data_TopoKeyFrame>(query::topoId.is_not_null() ));
             for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                ans_pose [ mit->getTopoId_() ] =  mit->getPose_()  ;
+                ans_pose [ mit->getTopoId_() ].assign( mit->getPose_().begin(), mit->getPose_().end() );
             }
 
             t.commit();
@@ -406,7 +534,9 @@ bool getAllKeyFramePose( orbslam_server::orbslam_pose_get::Request &req,
 
     aoa << ans_pose ;
 
-    res.POSE = aos.str();
+    const std::string sPose = aos.str();
+
+    res.POSE.assign(sPose.begin(), sPose.end());
 
     ROS_INFO( "Get all keyFrame pose " );
 
@@ -417,11 +547,13 @@ bool getAllKeyFramePose( orbslam_server::orbslam_pose_get::Request &req,
 bool updateAllKeyFramePose( orbslam_server::orbslam_pose_save::Request &req,
                             orbslam_server::orbslam_pose_save::Response &res ) {
 
+    ServiceTimer timer("updateAllKeyFramePose");
+
     std::map<long unsigned int, std::string > kf_pose;
 
     kf_pose.clear();
 
-    std::stringstream is(req.POSE);
+    std::stringstream is(std::string(req.POSE.begin(), req.POSE.end()));
 
     boost::archive::text_iarchive ia(is);
 
@@ -429,28 +561,19 @@ bool updateAllKeyFramePose( orbslam_server::orbslam_pose_save::Request &req,
 
     try {
 
-        typedef odb::query<Data_TopoKeyFrame> query;
-        typedef odb::result<Data_TopoKeyFrame> result;
-
-        {
-            transaction t(db->begin());
-            for( std::map<long unsigned int, string>::iterator mit = kf_pose.begin(); mit != kf_pose.end(); mit ++ ) {
-                result r(db->query<Data_TopoKeyFrame>(query::topoId == (*mit).first ));
-                for (result::iterator mmit(r.begin()); mmit != r.end(); ++mmit) {
-                    Data_TopoKeyFrame *tmp = mmit->getData_TopoKeyFrame();
-                    tmp->setPose_( (*mit).second);
-                    db->update(tmp);
-                    break;
-                }
-            }
-            t.commit();
-        }
+        transaction t(db->begin());
+        for( std::map<long unsigned int, string>::iterator mit = kf_pose.begin(); mit != kf_pose.end(); mit ++ )
+            pgUpdatePoseById(PG_TOPO_KEYFRAME, (*mit).first, PgBlob((*mit).second.begin(), (*mit).second.end()));
+        t.commit();
     }
     catch (const odb::exception &e) {
         cerr << e.what() << endl;
         return false;
     }
 
+    for( std::map<long unsigned int, string>::iterator mit = kf_pose.begin(); mit != kf_pose.end(); mit ++ )
+        tileCache.updatePose(PG_TOPO_KEYFRAME, (*mit).first, PgBlob((*mit).second.begin(), (*mit).second.end()));
+
     ROS_INFO( "Update All KeyFrame pose size: %d", (int) kf_pose.size() );
     return true;
 
@@ -459,6 +582,8 @@ bool updateAllKeyFramePose( orbslam_server::orbslam_pose_save::Request &req,
 bool getAllTopoMapPointPose( orbslam_server::orbslam_pose_get::Request &req,
                          orbslam_server::orbslam_pose_get::Response &res ) {
 
+    ServiceTimer timer("getAllTopoMapPointPose");
+
     vector< pair<long unsigned int, std::string > > ans_pose;
 
     try {
@@ -471,7 +596,7 @@ bool getAllTopoMapPointPose( orbslam_server::orbslam_pose_get::Request &req,
 
             result r(db->query<Data_TopoMapPoint>(query::topoId.is_not_null() ));
             for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                ans_pose.push_back( make_pair( mit->getTopoId_(), mit->getPose_() ) ) ;
+                ans_pose.push_back( make_pair( mit->getTopoId_(), std::string( mit->getPose_().begin(), mit->getPose_().end() ) ) ) ;
             }
 
             t.commit();
@@ -487,7 +612,9 @@ bool getAllTopoMapPointPose( orbslam_server::orbslam_pose_get::Request &req,
     boost::archive::text_oarchive aoa(aos);
 
     aoa << ans_pose ;
-    res.POSE = aos.str();
+    const std::string sPose = aos.str();
+
+    res.POSE.assign(sPose.begin(), sPose.end());
     ROS_INFO( "Get all Topo MapPoints " );
 
     return true;
@@ -497,11 +624,13 @@ bool getAllTopoMapPointPose( orbslam_server::orbslam_pose_get::Request &req,
 bool updateAllTopoMapPointPose( orbslam_server::orbslam_pose_save::Request &req,
                             orbslam_server::orbslam_pose_save::Response &res ) {
 
+    ServiceTimer timer("updateAllTopoMapPointPose");
+
     vector< pair<long unsigned int, std::string > > kf_pose;
 
     kf_pose.clear();
 
-    std::stringstream is(req.POSE);
+    std::stringstream is(std::string(req.POSE.begin(), req.POSE.end()));
 
     boost::archive::text_iarchive ia(is);
 
@@ -509,29 +638,19 @@ bool updateAllTopoMapPointPose( orbslam_server::orbslam_pose_save::Request &req,
 
     try {
 
-        typedef odb::query<Data_TopoMapPoint> query;
-        typedef odb::result<Data_TopoMapPoint> result;
-
-        {
-            transaction t(db->begin());
-
-            for( int i = 0; i < kf_pose.size(); i ++ ) {
-                result r(db->query<Data_TopoMapPoint>(query::topoId == kf_pose[i].first ));
-                for (result::iterator mit(r.begin()); mit != r.end(); ++mit) {
-                    Data_TopoMapPoint *tmp = mit->getData_TopoMapPoint();
-                    tmp->setPose_( kf_pose[i].second);
-                    db->update(tmp);
-                    break;
-                }
-            }
-            t.commit();
-        }
+        transaction t(db->begin());
+        for( int i = 0; i < kf_pose.size(); i ++ )
+            pgUpdatePoseById(PG_TOPO_MAPPOINT, kf_pose[i].first, PgBlob(kf_pose[i].second.begin(), kf_pose[i].second.end()));
+        t.commit();
     }
     catch (const odb::exception &e) {
         cerr << e.what() << endl;
         return false;
     }
 
+    for( int i = 0; i < kf_pose.size(); i ++ )
+        tileCache.updatePose(PG_TOPO_MAPPOINT, kf_pose[i].first, PgBlob(kf_pose[i].second.begin(), kf_pose[i].second.end()));
+
     ROS_INFO( "Update All Topo MapPoint pose size: %d", (int) kf_pose.size() );
 
     return true;
@@ -826,19 +945,60 @@ bool updateAllTopoMapPointPose( orbslam_server::orbslam_pose_save::Request &req,
 //
 //}
 
+void reportStats() {
+
+    reportServiceStats();
+
+    tileCache.report();
+
+}
+
 int main(int argc, char *argv[]) {
 
     try {
 
+        ros::init(argc, argv, "save_test_server");
+
+        // requests are served by a pool of workers, each transaction takes its own pooled connection
+        ros::NodeHandle pn("~");
+        int nThreads = 4;
+        double statsPeriod = 10.0;
+        int tileCacheMB = 256;
+        pn.param("threads", nThreads, nThreads);
+        pn.param("stats_period", statsPeriod, statsPeriod);
+        pn.param("tile_cache_mb", tileCacheMB, tileCacheMB);
+        nThreads = std::max(nThreads, 1);
+
+        tileCache.setBudget((size_t) std::max(tileCacheMB, 0) * 1024 * 1024);
+
+        // a shard started in its own namespace may use its own database
+        std::string dbName = "odb_test";
+        std::string dbHost = "127.0.0.1";
+        pn.param("database", dbName, dbName);
+        pn.param("host", dbHost, dbHost);
+
         int db_argc = 9;
         char *db_argv[] = {(char *) "pgsql", (char *) "--user", (char *) "odb_test", (char *) "--database",
-                           (char *) "odb_test", (char *) "--host", (char *) "127.0.0.1", (char *) "--password",
+                           (char *) dbName.c_str(), (char *) "--host", (char *) dbHost.c_str(), (char *) "--password",
                            (char *) "odb_test"};
-        db = (create_database(db_argc, db_argv));
+        db = (create_database(db_argc, db_argv, nThreads));
 
-        ros::init(argc, argv, "save_test_server");
+        try {
+            transaction t(db->begin());
+            bTileExtents = pgHasTileExtents();
+            t.commit();
+        }
+        catch (const odb::exception &e) {
+            cerr << e.what() << endl;
+        }
+
+        if (!bTileExtents)
+            ROS_INFO("The tile tables have no extent, queryTopoTiles is disabled until sql/003_tile_extents.sql is run.");
+
+        TimedCallbackQueue queue;
 
         ros::NodeHandle n;
+        n.setCallbackQueue(&queue);
 
         ros::ServiceServer saveOneKeyFrameService = n.advertiseService("saveOneKeyFrame", saveOneKeyFrame);
         ros::ServiceServer getOneKeyFrameService = n.advertiseService("getOneKeyFrame", getOneKeyFrame);
@@ -855,15 +1015,29 @@ int main(int argc, char *argv[]) {
         ros::ServiceServer saveTopoKeyFrameService = n.advertiseService("saveTopoKeyFrame", saveTopoKeyFrame);
         ros::ServiceServer getTopoKeyFrameService = n.advertiseService("getTopoKeyFrame", getTopoKeyFrame);
 
+        ros::ServiceServer saveTopoTilesService = n.advertiseService("saveTopoTiles", saveTopoTiles);
+        ros::ServiceServer getTopoTilesService = n.advertiseService("getTopoTiles", getTopoTiles);
+
         ros::ServiceServer getAllKeyFramePoseService = n.advertiseService("getAllKeyFramePose", getAllKeyFramePose );
         ros::ServiceServer updateAllKeyFramePoseService = n.advertiseService("updateAllKeyFramePose", updateAllKeyFramePose );
         ros::ServiceServer getAllTopoMapPointPoseService = n.advertiseService("getAllTopoMapPointPose", getAllTopoMapPointPose );
         ros::ServiceServer updateAllTopoMapPointPoseService = n.advertiseService("updateAllTopoMapPointPose", updateAllTopoMapPointPose );
+        ros::ServiceServer updateTopoPosesService = n.advertiseService("updateTopoPoses", updateTopoPoses );
+        ros::ServiceServer queryTopoTilesService = n.advertiseService("queryTopoTiles", queryTopoTiles );
+
+
+        ros::WallTimer statsTimer;
+        if (statsPeriod > 0)
+            statsTimer = n.createWallTimer(ros::WallDuration(statsPeriod),
+                                           boost::bind(&reportStats));
 
+        ROS_INFO("Ready to save OrbSlam and muilt to server in %s, %d workers, tile cache %d MB.",
+                 ros::this_node::getNamespace().c_str(), nThreads, std::max(tileCacheMB, 0));
 
-        ROS_INFO("Ready to save OrbSlam and muilt to server.");
+        ros::AsyncSpinner spinner(nThreads, &queue);
+        spinner.start();
 
-        ros::spin();
+        ros::waitForShutdown();
 
         return 0;
     }